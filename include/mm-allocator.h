@@ -12,6 +12,7 @@ G_BEGIN_DECLS
  * MMAllocator
  * Currently, just wraps OrtAllocator.
  * You need to directly call Alloc() or Free() from allocator.
+ * Allocated blocks count in memory usage of the context.
  */
 typedef struct _MMAllocator MMAllocator;
 
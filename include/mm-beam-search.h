@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-value-ops.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMBeamSearchError
+{
+  MM_BEAM_SEARCH_ERROR_DONE = 1,
+  MM_BEAM_SEARCH_ERROR_SHAPE,
+} MMBeamSearchError;
+
+#define MM_BEAM_SEARCH_ERROR mm_beam_search_error_quark ()
+
+/*
+ * MMBeamSearch
+ * Beam search decoder. Tracks beam scores, parent beams and sequences, and
+ * reorders past-state values along the beam axis in place after each step
+ * (See mm_value_gather()). Rows of beams which keep their parent are not
+ * copied, and a parent chosen by several beams is copied once.
+ */
+typedef struct _MMBeamSearch MMBeamSearch;
+
+/*
+ * eos_token_id finishes a beam, and can be -1 to disable.
+ * Finished sequences are scored by sum of log probabilities divided by
+ * length ^ length_penalty.
+ */
+MMBeamSearch *mm_beam_search_new (guint beam_width, guint max_length,
+                                  int64_t eos_token_id, float length_penalty);
+void mm_beam_search_ref (MMBeamSearch *search);
+void mm_beam_search_unref (MMBeamSearch *search);
+/*
+ * Registers value to be reordered along axis after each step.
+ * Dimension of axis should be beam_width.
+ */
+void mm_beam_search_add_state (MMBeamSearch *search, MMValue *value,
+                               size_t axis);
+void mm_beam_search_remove_state (MMBeamSearch *search, MMValue *value);
+/*
+ * Advances search with logits of shape [beam_width, vocab_size].
+ * Log-softmax is applied to each row. Registered states are reordered.
+ */
+gboolean mm_beam_search_step (MMBeamSearch *search, const float *logits,
+                              size_t vocab_size, GError **error);
+/* Reorders value along axis by parents of the last step. */
+gboolean mm_beam_search_reorder (MMBeamSearch *search, MMValue *value,
+                                 size_t axis, GError **error);
+/* Tokens selected by the last step, one for each beam. */
+const int64_t *mm_beam_search_get_tokens (MMBeamSearch *search);
+/* Parent beams of the last step, one for each beam. */
+const int64_t *mm_beam_search_get_parents (MMBeamSearch *search);
+/* Sums of log probabilities of beams. */
+const float *mm_beam_search_get_scores (MMBeamSearch *search);
+/* Returns TRUE if no beam can be better than finished sequences. */
+gboolean mm_beam_search_is_done (MMBeamSearch *search);
+/*
+ * Returns the best finished sequence, including eos_token_id, or NULL if no
+ * sequence is finished. Every beam is finished when max_length is reached.
+ */
+const int64_t *mm_beam_search_get_best (MMBeamSearch *search, size_t *length,
+                                        float *score);
+
+G_END_DECLS
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glib.h>
+#include <onnxruntime_c_api.h>
+
+#include "mm-context.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMBufferError
+{
+  MM_BUFFER_ERROR_ALLOCATION = 1,
+  MM_BUFFER_ERROR_SIZE,
+} MMBufferError;
+
+#define MM_BUFFER_ERROR mm_buffer_error_quark ()
+
+/*
+ * MMBuffer
+ * Reference counted block of tensor data. Tensors created with
+ * mm_buffer_new_tensor() point into the block and hold a reference until
+ * they are released, so the block outlives every tensor using it.
+ * Used by MMValue to share data between values (See mm_value_assign()).
+ */
+typedef struct _MMBuffer MMBuffer;
+
+/*
+ * Allocates size bytes with allocator, or the default allocator of context
+ * if allocator is NULL. Data is not initialized.
+ */
+MMBuffer *mm_buffer_new (MMContext *context, OrtAllocator *allocator,
+                         size_t size, GError **error);
+void mm_buffer_ref (MMBuffer *buffer);
+void mm_buffer_unref (MMBuffer *buffer);
+gpointer mm_buffer_get_data (MMBuffer *buffer);
+size_t mm_buffer_get_size (MMBuffer *buffer);
+/*
+ * Returns TRUE if buffer has more than refs references, that is, if a
+ * caller holding refs references would change data seen by others by
+ * writing it.
+ */
+gboolean mm_buffer_is_shared (MMBuffer *buffer, guint refs);
+/*
+ * Creates tensor of shape dim pointing into buffer. The tensor holds a
+ * reference of buffer until it is released.
+ */
+OrtValue *mm_buffer_new_tensor (MMBuffer *buffer, const int64_t *dim,
+                                size_t ndim, ONNXTensorElementDataType dtype,
+                                GError **error);
+
+G_END_DECLS
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <gio/gio.h>
 #include <glib.h>
 #include <onnxruntime_c_api.h>
 
@@ -13,15 +14,49 @@ G_BEGIN_DECLS
 typedef struct _MMContext MMContext;
 #define MM_ORT_ERROR mm_ort_quark ()
 
+typedef enum _MMContextError
+{
+  MM_CONTEXT_ERROR_BUDGET = 1,
+  MM_CONTEXT_ERROR_ENV,
+} MMContextError;
+
+#define MM_CONTEXT_ERROR mm_context_error_quark ()
+
+/* What mm_context_admit_memory() does when work does not fit the budget. */
+typedef enum _MMMemoryPolicy
+{
+  /* Fails with MM_CONTEXT_ERROR_BUDGET */
+  MM_MEMORY_POLICY_REJECT,
+  /* Waits until enough memory is released */
+  MM_MEMORY_POLICY_WAIT,
+} MMMemoryPolicy;
+
+/*
+ * Called when memory usage would exceed the budget. Should free cached data
+ * of about size bytes, and return the number of bytes freed.
+ */
+typedef size_t (*MMMemoryEvictFunc) (size_t size, gpointer user_data);
+
 struct _MMContext
 {
   const OrtApi *api;
   OrtEnv *env;
-  /* default allocator */
+  /* default allocator, whose allocations count in memory usage */
   OrtAllocator *allocator;
 };
 
 MMContext *mm_context_new (GError **error);
+/*
+ * Creates context whose sessions share global intra-op and inter-op thread
+ * pools instead of creating their own, so models running concurrently do
+ * not oversubscribe cores. 0 means ORT default.
+ * ORT has one environment per process, so this fails with
+ * MM_CONTEXT_ERROR_ENV while contexts without global thread pools exist,
+ * and thread counts are ignored while other contexts with them exist.
+ */
+MMContext *mm_context_new_with_global_thread_pools (int intra_op_threads,
+                                                    int inter_op_threads,
+                                                    GError **error);
 void mm_context_ref (MMContext *context);
 void mm_context_unref (MMContext *context);
 /*
@@ -38,5 +73,57 @@ void mm_context_set_error (MMContext *context, GError **err,
  * Returned value should be freed with g_strfreev().
  */
 GStrv mm_context_get_available_execution_provider (MMContext *context);
+/* Returns TRUE if context is created with global thread pools. */
+gboolean mm_context_has_global_thread_pools (MMContext *context);
+
+/*
+ * Memory accounting
+ * Memory usage counts blocks of context->allocator and MMAllocator, which
+ * hold tensors of MMValue, sessions of MMModel (estimated by model file
+ * size), and memory charged by caches and admitted work.
+ * If budget is not 0, allocations of MMValue and MMModel fail with
+ * MM_CONTEXT_ERROR_BUDGET when they do not fit, after evict functions are
+ * called. budget = 0 disables the budget.
+ */
+void mm_context_set_memory_budget (MMContext *context, size_t budget,
+                                   MMMemoryPolicy policy);
+size_t mm_context_get_memory_budget (MMContext *context);
+size_t mm_context_get_memory_usage (MMContext *context);
+/* Returns TRUE if size more bytes fit the budget. Nothing is charged. */
+gboolean mm_context_check_memory (MMContext *context, size_t size,
+                                  GError **error);
+/* Charges size bytes if they fit the budget. */
+gboolean mm_context_reserve_memory (MMContext *context, size_t size,
+                                    GError **error);
+/* Charges size bytes already allocated, even if they exceed the budget. */
+void mm_context_charge_memory (MMContext *context, size_t size);
+/* Releases bytes charged by the functions above. */
+void mm_context_release_memory (MMContext *context, size_t size);
+/*
+ * Admission control for new work. Charges size bytes, projected with
+ * mm_model_get_projected_size() for example, until the work is done and
+ * mm_context_release_memory() is called. If they do not fit, the work is
+ * rejected or waits, depending on the memory policy. A waiting call fails
+ * with G_IO_ERROR_CANCELLED when cancellable is cancelled.
+ */
+gboolean mm_context_admit_memory (MMContext *context, size_t size,
+                                  GCancellable *cancellable, GError **error);
+/*
+ * Registers func of a cache, called with no lock held when memory usage
+ * would exceed the budget. Returns id for
+ * mm_context_remove_memory_evict_func().
+ */
+guint mm_context_add_memory_evict_func (MMContext *context,
+                                        MMMemoryEvictFunc func,
+                                        gpointer user_data);
+void mm_context_remove_memory_evict_func (MMContext *context, guint id);
+/*
+ * Returns OrtAllocator which forwards to allocator, and counts its blocks in
+ * memory usage of context. Free it with mm_context_unwrap_allocator() after
+ * every block is freed. allocator is not freed.
+ */
+OrtAllocator *mm_context_wrap_allocator (MMContext *context,
+                                         OrtAllocator *allocator);
+void mm_context_unwrap_allocator (MMContext *context, OrtAllocator *allocator);
 
 G_END_DECLS
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glib.h>
+#include <onnxruntime_c_api.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Element type conversion between tensor buffers.
+ * Supported conversions are FLOAT <-> FLOAT16, FLOAT <-> BFLOAT16 and
+ * INT32 <-> INT64, and copying between the same types.
+ * SIMD kernels (F16C, AVX2, AVX-512) are selected at runtime according to
+ * the CPU, with scalar fallbacks.
+ */
+
+/* Returns TRUE if mm_convert() can convert src_dtype to dst_dtype. */
+gboolean mm_convert_is_supported (ONNXTensorElementDataType dst_dtype,
+                                  ONNXTensorElementDataType src_dtype);
+/*
+ * Converts count elements of src to dst.
+ * Floating point values are rounded to nearest even, and INT64 values are
+ * truncated to INT32.
+ * Returns FALSE if the conversion is not supported.
+ */
+gboolean mm_convert (gpointer dst, ONNXTensorElementDataType dst_dtype,
+                     gconstpointer src, ONNXTensorElementDataType src_dtype,
+                     size_t count);
+
+G_END_DECLS
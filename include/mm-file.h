@@ -1,5 +1,6 @@
 #pragma once
 
+#include <gio/gio.h>
 #include <glib.h>
 
 #include "mm-value.h"
@@ -9,6 +10,8 @@ G_BEGIN_DECLS
 typedef enum _MMFileError
 {
   MM_FILE_ERROR_VERSION = 1,
+  MM_FILE_ERROR_INVALID,
+  MM_FILE_ERROR_UNSUPPORTED,
 } MMFileError;
 
 #define MM_FILE_ERROR mm_file_error_quark ()
@@ -28,11 +31,58 @@ void mm_file_add_value (MMFile *file, MMValue *value);
 void mm_file_remove_value (MMFile *file, MMValue *value);
 /* Writes holding data to path given at mm_file_new() */
 gboolean mm_file_write (MMFile *file, GError **error);
+/*
+ * Copies holding data into a buffer, and writes and syncs it to path given
+ * at mm_file_new() in a worker thread. Values can be changed as soon as
+ * this function returns. The buffer is reused by the next call.
+ * progress is called from the worker thread, and can be NULL.
+ * If cancelled, the file at path is kept as it was.
+ * Call mm_file_write_finish() in callback to get the result.
+ */
+void mm_file_write_async (MMFile *file, GCancellable *cancellable,
+                          GFileProgressCallback progress,
+                          gpointer progress_data,
+                          GAsyncReadyCallback callback, gpointer user_data);
+gboolean mm_file_write_finish (MMFile *file, GAsyncResult *result,
+                               GError **error);
+/*
+ * Appends a checkpoint of values as a delta record, instead of rewriting
+ * the file. For each value, rows of axis from the first one marked as
+ * changed since the last checkpoint (See mm_value_get_dirty_row()) are
+ * written, so the cost is proportional to new rows. Values of other
+ * changed shapes are written whole, and unchanged values are skipped. Rows
+ * removed since the last checkpoint are removed, also when no element is
+ * left. Checkpoints mark rows of values clean.
+ * The file is rewritten with mm_file_write() if nothing is written by this
+ * MMFile yet, or deltas are larger than the base.
+ * Quantized values are not supported.
+ */
+gboolean mm_file_append (MMFile *file, size_t axis, GError **error);
+/*
+ * Folds delta records into the base by reading the latest state into
+ * values and writing them again.
+ */
+gboolean mm_file_compact (MMFile *file, GError **error);
 /*
  * Reads data from path given at mm_file_new().
  * You should add data (for example, MMValue) before call this function.
  * Only necessary data will be loaded, and other data will be discarded.
+ * Quantized data stays quantized (See mm_value_quantize()).
+ * Delta records of mm_file_append() are applied in order, allocating each
+ * value once.
  */
 gboolean mm_file_read (MMFile *file, GError **error);
+/*
+ * Maps the file read-only and creates OrtValues pointing directly into the
+ * mapping, so the pages are shared by every user of the same file.
+ * names and values are set to input names and values of saved MMValues
+ * (values without input name, and quantized values are skipped).
+ * names should be freed with g_strfreev(), and values with
+ * g_ptr_array_unref().
+ * Mapping is kept until file is freed, so keep file alive while values
+ * are used. Delta records are ignored, so call mm_file_compact() first.
+ */
+gboolean mm_file_map (MMFile *file, MMContext *context, GStrv *names,
+                      GPtrArray **values, GError **error);
 
 G_END_DECLS
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-model.h"
+#include "mm-value.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMGraphError
+{
+  MM_GRAPH_ERROR_NOT_FOUND = 1,
+  MM_GRAPH_ERROR_CYCLE,
+  MM_GRAPH_ERROR_INPUT,
+} MMGraphError;
+
+#define MM_GRAPH_ERROR mm_graph_error_quark ()
+
+/*
+ * MMGraph
+ * Runs models as nodes of a directed acyclic graph. Nodes whose inputs are
+ * ready run concurrently on a worker pool, and intermediate values are
+ * released as soon as their last consumer finishes.
+ * To share intra-op threads between concurrently running nodes, create
+ * models with mm_context_new_with_global_thread_pools().
+ */
+typedef struct _MMGraph MMGraph;
+
+/* If max_threads is 0, number of processors is used. */
+MMGraph *mm_graph_new (guint max_threads, GError **error);
+void mm_graph_ref (MMGraph *graph);
+void mm_graph_unref (MMGraph *graph);
+/* Adds model as a node, and returns index of the node. */
+guint mm_graph_add_node (MMGraph *graph, MMModel *model);
+/* Binds output output_name of node src to input input_name of node dst. */
+gboolean mm_graph_connect (MMGraph *graph, guint src, const char *output_name,
+                           guint dst, const char *input_name, GError **error);
+/*
+ * Runs graph. inputs is array of MMValue, and each value is fed to every
+ * unconnected input with the same input_name.
+ * Returns outputs which are not connected to any node, as array of MMValue.
+ * Returned array should be freed with g_ptr_array_unref().
+ * Can be called from multiple threads.
+ */
+GPtrArray *mm_graph_run (MMGraph *graph, GPtrArray *inputs, GError **error);
+/*
+ * Same as mm_graph_run(), but every node runs with run options of
+ * run_context, so the deadline or cancellable stops running nodes, and
+ * nodes which have not started fail without running.
+ */
+GPtrArray *mm_graph_run_with_context (MMGraph *graph, GPtrArray *inputs,
+                                      MMRunContext *run_context,
+                                      GError **error);
+
+G_END_DECLS
@@ -41,13 +41,45 @@ void mm_model_io_unref (MMModelIO *model_io);
 /*
  * Set dynamic dimension. hash_table should be (str, int64_t)
  * This function calls mm_model_io_update() internally.
+ * Dimensions with buckets are rounded up to the bucket, and the rest is
+ * padded (See mm_value_set_valid_dimension()).
  */
 gboolean mm_model_io_set_dimension (MMModelIO *model_io,
                                     GHashTable *hash_table, GError **error);
+/*
+ * Set buckets for the dimension named dim_name, so that only a few distinct
+ * shapes reach ORT and its allocation plans can be reused.
+ * buckets should be sorted in ascending order. Dimensions larger than the
+ * last bucket are not rounded. length = 0 removes buckets.
+ * mm_model_run() slices outputs with the dimension back to the value
+ * before padding, whether buckets are set on inputs or outputs.
+ */
+void mm_model_io_set_buckets (MMModelIO *model_io, const char *dim_name,
+                              const int64_t *buckets, size_t length);
 /* Update values according to MMValue array. */
 void mm_model_io_update (MMModelIO *model_io);
+/*
+ * Gives values whose data is shared (See mm_value_assign()) their own
+ * tensors without copying data, so a run writing outputs does not change
+ * other values. Called by mm_model_run() for outputs.
+ */
+gboolean mm_model_io_unshare (MMModelIO *model_io, GError **error);
+/*
+ * Returns (char *, int64_t *) values of dimensions with buckets given to the
+ * last mm_model_io_set_dimension(), before padding. NULL if no dimension
+ * was padded. Returned hash table is owned by model_io.
+ */
+GHashTable *mm_model_io_get_valid_dimension (MMModelIO *model_io);
 /* Update internal MMValue array according to values */
 gboolean mm_model_io_update_info (MMModelIO *model_io, GError **error);
+/*
+ * Same as mm_model_io_update_info(), but values are also sliced back to
+ * valid_dimension, for example that of inputs (See
+ * mm_model_io_get_valid_dimension()). valid_dimension can be NULL.
+ */
+gboolean mm_model_io_update_info_with_dimension (MMModelIO *model_io,
+                                                 GHashTable *valid_dimension,
+                                                 GError **error);
 
 #define mm_model_input_new(value_array)                                       \
   (MMModelInput *)mm_model_io_new (value_array, TRUE)
@@ -57,10 +89,15 @@ gboolean mm_model_io_update_info (MMModelIO *model_io, GError **error);
   mm_model_io_unref ((MMModelIO *)model_input)
 #define mm_model_input_set_dimension(model_input, hash_table, error)          \
   mm_model_io_set_dimension ((MMModelIO *)model_input, hash_table, error)
+#define mm_model_input_set_buckets(model_input, dim_name, buckets, length)    \
+  mm_model_io_set_buckets ((MMModelIO *)model_input, dim_name, buckets,       \
+                           length)
 #define mm_model_input_update(model_input)                                    \
   mm_model_io_update ((MMModelIO *)model_input)
 #define mm_model_input_update_info(model_input, error)                        \
   mm_model_io_update_info ((MMModelIO *)model_input, error)
+#define mm_model_input_get_valid_dimension(model_input)                       \
+  mm_model_io_get_valid_dimension ((MMModelIO *)model_input)
 
 #define mm_model_output_new(value_array)                                      \
   (MMModelOutput *)mm_model_io_new (value_array, FALSE)
@@ -70,9 +107,18 @@ gboolean mm_model_io_update_info (MMModelIO *model_io, GError **error);
   mm_model_io_unref ((MMModelIO *)model_output)
 #define mm_model_output_set_dimension(model_output, hash_table, error)        \
   mm_model_io_set_dimension ((MMModelIO *)model_output, hash_table, error)
+#define mm_model_output_set_buckets(model_output, dim_name, buckets, length)  \
+  mm_model_io_set_buckets ((MMModelIO *)model_output, dim_name, buckets,      \
+                           length)
 #define mm_model_output_update(model_output)                                  \
   mm_model_io_update ((MMModelIO *)model_output)
 #define mm_model_output_update_info(model_output, error)                      \
   mm_model_io_update_info ((MMModelIO *)model_output, error)
+#define mm_model_output_update_info_with_dimension(model_output,              \
+                                                   valid_dimension, error)    \
+  mm_model_io_update_info_with_dimension ((MMModelIO *)model_output,          \
+                                          valid_dimension, error)
+#define mm_model_output_unshare(model_output, error)                          \
+  mm_model_io_unshare ((MMModelIO *)model_output, error)
 
 G_END_DECLS
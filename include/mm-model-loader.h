@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-model-options.h"
+#include "mm-model.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMModelLoaderError
+{
+  MM_MODEL_LOADER_ERROR_NOT_FOUND = 1,
+  MM_MODEL_LOADER_ERROR_EXISTS,
+} MMModelLoaderError;
+
+#define MM_MODEL_LOADER_ERROR mm_model_loader_error_quark ()
+
+typedef enum _MMModelLoadPhase
+{
+  /* Waiting for a free worker */
+  MM_MODEL_LOAD_PHASE_QUEUED,
+  /* Session is being created */
+  MM_MODEL_LOAD_PHASE_LOADING,
+  /* Model can be used */
+  MM_MODEL_LOAD_PHASE_READY,
+  /* Loading failed, error is kept in the loader */
+  MM_MODEL_LOAD_PHASE_FAILED,
+} MMModelLoadPhase;
+
+/*
+ * MMModelLoader
+ * Loads independent models concurrently on a bounded worker pool.
+ * Each model is identified by id, and callers can wait for each model
+ * separately, so the first model can be used while others are loading.
+ */
+typedef struct _MMModelLoader MMModelLoader;
+
+/*
+ * Called from worker threads whenever a phase of model changes.
+ * Do not call mm_model_loader_unref() from this function.
+ */
+typedef void (*MMModelLoaderPhaseFunc) (MMModelLoader *loader, const char *id,
+                                        MMModelLoadPhase phase,
+                                        gpointer user_data);
+
+/* If max_threads is 0, number of processors is used. */
+MMModelLoader *mm_model_loader_new (guint max_threads, GError **error);
+void mm_model_loader_ref (MMModelLoader *loader);
+/* Waits for models being loaded. Queued models are discarded. */
+void mm_model_loader_unref (MMModelLoader *loader);
+/* Should be called before mm_model_loader_add(). */
+void mm_model_loader_set_phase_func (MMModelLoader *loader,
+                                     MMModelLoaderPhaseFunc func,
+                                     gpointer user_data);
+/*
+ * Queues model for loading. id should be unique in loader, unless loading
+ * it failed, in which case it is queued again.
+ */
+gboolean mm_model_loader_add (MMModelLoader *loader, const char *id,
+                              MMModelOptions *options, const char *file_path,
+                              GError **error);
+/* Returns current phase of model. id should be added. */
+MMModelLoadPhase mm_model_loader_get_phase (MMModelLoader *loader,
+                                            const char *id);
+/*
+ * Returns model if it is ready, NULL otherwise. Does not block.
+ * Returned model should be freed with mm_model_unref().
+ */
+MMModel *mm_model_loader_get (MMModelLoader *loader, const char *id);
+/*
+ * Blocks until model is ready or loading fails.
+ * Returned model should be freed with mm_model_unref().
+ */
+MMModel *mm_model_loader_wait (MMModelLoader *loader, const char *id,
+                               GError **error);
+/* Blocks until all added models are loaded. Returns the first error. */
+gboolean mm_model_loader_wait_all (MMModelLoader *loader, GError **error);
+
+G_END_DECLS
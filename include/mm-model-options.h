@@ -14,6 +14,9 @@ G_BEGIN_DECLS
  * Thus, you should call context->api->* to interact with options.
  */
 typedef struct _MMModelOptions MMModelOptions;
+typedef struct _MMSessionTuning MMSessionTuning;
+/* Declared in mm-file.h */
+typedef struct _MMFile MMFile;
 
 struct _MMModelOptions
 {
@@ -22,11 +25,88 @@ struct _MMModelOptions
   OrtRunOptions *run_options;
 };
 
+/*
+ * Session options chosen by tuning (See mm-tuner.h). Thread counts of 0 are
+ * chosen by ORT.
+ */
+struct _MMSessionTuning
+{
+  int intra_op_threads;
+  int inter_op_threads;
+  ExecutionMode execution_mode;
+  GraphOptimizationLevel optimization_level;
+  gboolean memory_pattern;
+  gboolean cpu_arena;
+  /* Idle threads spin instead of sleeping */
+  gboolean allow_spinning;
+};
+
 MMModelOptions *mm_model_options_new (MMContext *context, GError **error);
+/*
+ * Copies model_options with a clone of session options, so options of the
+ * copy can be changed separately. Providers and external initializers are
+ * shared with model_options.
+ */
+MMModelOptions *mm_model_options_copy (MMModelOptions *model_options,
+                                       GError **error);
 void mm_model_options_ref (MMModelOptions *model_options);
 void mm_model_options_unref (MMModelOptions *model_options);
 gboolean mm_model_options_append_provider (MMModelOptions *model_options,
                                            MMProvider *provider,
                                            GError **error);
+/*
+ * Makes mm_model_new() load the model with the fastest available provider
+ * (See mm_provider_select_model()). shapes is array of GHashTable * like
+ * mm_model_warmup(), and can be empty for models without symbolic
+ * dimensions. NULL turns selection off. No provider should be appended to
+ * model_options, and copies of model_options do not select providers.
+ */
+void mm_model_options_set_auto_provider (MMModelOptions *model_options,
+                                         GPtrArray *shapes);
+/* Returns shapes set by mm_model_options_set_auto_provider(), or NULL. */
+GPtrArray *mm_model_options_get_auto_provider (MMModelOptions *model_options);
+/*
+ * Supplies initializers from MMFile (see mm_file_map()). Values are matched
+ * with initializers by input name, and their data stays in the file-backed
+ * mapping, so every session and process using the file shares the pages.
+ * Pre-packing is disabled, because it would make private copies of weights.
+ * file is kept alive while model_options is alive.
+ */
+gboolean mm_model_options_add_external_initializers (
+    MMModelOptions *model_options, MMFile *file, GError **error);
+/*
+ * Runs intra-op threads on processors of NUMA node, one thread for each
+ * processor (See mm-numa.h). Does nothing if context has global thread
+ * pools, because they are shared by every session.
+ */
+gboolean mm_model_options_set_numa_node (MMModelOptions *model_options,
+                                         guint node, GError **error);
+/*
+ * Applies tuning to session options. Thread counts and spinning are ignored
+ * if context has global thread pools.
+ */
+gboolean mm_model_options_apply_tuning (MMModelOptions *model_options,
+                                        const MMSessionTuning *tuning,
+                                        GError **error);
+/*
+ * Loads tuning from group of the key file at path, and applies it.
+ * group NULL is "session". See mm_session_tuning_load() for keys.
+ */
+gboolean mm_model_options_load_profile (MMModelOptions *model_options,
+                                        const char *path, const char *group,
+                                        GError **error);
+
+/* Sets options of mm_model_options_new(). */
+void mm_session_tuning_init (MMSessionTuning *tuning);
+/*
+ * Reads tuning from group of key_file. Keys are intra_op_threads,
+ * inter_op_threads, execution_mode (sequential or parallel),
+ * optimization_level (disable, basic, extended or all), memory_pattern,
+ * cpu_arena and allow_spinning. Missing keys are left unchanged.
+ */
+gboolean mm_session_tuning_load (MMSessionTuning *tuning, GKeyFile *key_file,
+                                 const char *group, GError **error);
+void mm_session_tuning_save (const MMSessionTuning *tuning,
+                             GKeyFile *key_file, const char *group);
 
 G_END_DECLS
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-model-options.h"
+#include "mm-model.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMModelRegistryError
+{
+  MM_MODEL_REGISTRY_ERROR_NOT_FOUND = 1,
+  MM_MODEL_REGISTRY_ERROR_EXISTS,
+  MM_MODEL_REGISTRY_ERROR_BUDGET,
+} MMModelRegistryError;
+
+#define MM_MODEL_REGISTRY_ERROR mm_model_registry_error_quark ()
+
+/*
+ * MMModelRegistry
+ * Maps model ids to files and options, and keeps the most recently used
+ * models loaded. Models are loaded on first use, and the least recently
+ * used ones are unloaded when their total size exceeds the budget, or when
+ * memory budget of their context is exceeded (See
+ * mm_context_set_memory_budget()). Models in use are pinned and never
+ * unloaded. Size of a model is the size of its file.
+ */
+typedef struct _MMModelRegistry MMModelRegistry;
+
+/* budget is total size of loaded models in bytes, and 0 means no limit. */
+MMModelRegistry *mm_model_registry_new (size_t budget, GError **error);
+void mm_model_registry_ref (MMModelRegistry *registry);
+/* Waits for models being prefetched. */
+void mm_model_registry_unref (MMModelRegistry *registry);
+/* Unloads models until loaded models fit budget. */
+void mm_model_registry_set_budget (MMModelRegistry *registry, size_t budget);
+/* Registers model. Nothing is loaded until it is used. */
+gboolean mm_model_registry_add (MMModelRegistry *registry, const char *id,
+                                MMModelOptions *options,
+                                const char *file_path, GError **error);
+/*
+ * Returns model, loading it if needed, and pins it until
+ * mm_model_registry_release(). Returned model is not ref'ed, and is valid
+ * while it is pinned. Fails with MM_MODEL_REGISTRY_ERROR_BUDGET if the model
+ * does not fit budget after unpinned models are unloaded.
+ * Can be called from multiple threads.
+ */
+MMModel *mm_model_registry_acquire (MMModelRegistry *registry, const char *id,
+                                    GError **error);
+/* Unpins model pinned by mm_model_registry_acquire(). */
+void mm_model_registry_release (MMModelRegistry *registry, const char *id);
+/*
+ * Loads model in a worker thread if it is not loaded, so a later
+ * mm_model_registry_acquire() does not wait. Failures are ignored.
+ */
+gboolean mm_model_registry_prefetch (MMModelRegistry *registry,
+                                     const char *id, GError **error);
+gboolean mm_model_registry_is_loaded (MMModelRegistry *registry,
+                                      const char *id);
+/* Returns total size of loaded models. */
+size_t mm_model_registry_get_loaded_size (MMModelRegistry *registry);
+
+G_END_DECLS
@@ -1,13 +1,22 @@
 #pragma once
 
+#include <gio/gio.h>
 #include <glib.h>
 #include <onnxruntime_c_api.h>
 
 #include "mm-model-io.h"
 #include "mm-model-options.h"
+#include "mm-run-context.h"
 
 G_BEGIN_DECLS
 
+typedef enum _MMModelError
+{
+  MM_MODEL_ERROR_SHAPE = 1,
+} MMModelError;
+
+#define MM_MODEL_ERROR mm_model_error_quark ()
+
 /*
  * MMModel
  * Holds OrtSession and other essential data.
@@ -27,10 +36,68 @@ struct _MMModel
 
 MMModel *mm_model_new (MMModelOptions *options, const char *file_path,
                        GError **error);
+/*
+ * Asynchronous version of mm_model_new(). Session is created in a worker
+ * thread, and callback is called in the thread-default main context.
+ * Call mm_model_new_finish() in callback to get the model.
+ */
+void mm_model_new_async (MMModelOptions *options, const char *file_path,
+                         GCancellable *cancellable,
+                         GAsyncReadyCallback callback, gpointer user_data);
+MMModel *mm_model_new_finish (GAsyncResult *result, GError **error);
 void mm_model_ref (MMModel *model);
 void mm_model_unref (MMModel *model);
 /* Run model. input and output should hold valid names and values. */
 gboolean mm_model_run (MMModel *model, MMModelInput *input,
                        MMModelOutput *output, GError **error);
+/*
+ * Same as mm_model_run(), but uses run options of run_context, so the run can
+ * be stopped by its deadline or cancellable without affecting other runs.
+ * If run_context is NULL, shared run options of model options are used.
+ */
+gboolean mm_model_run_with_context (MMModel *model, MMModelInput *input,
+                                    MMModelOutput *output,
+                                    MMRunContext *run_context, GError **error);
+/*
+ * Returns bytes of outputs for shape, which is (char *, int64_t *) like
+ * mm_model_io_set_dimension(). Outputs whose shape is not concrete count as
+ * 0. Useful as the size of mm_context_admit_memory() before a run.
+ */
+size_t mm_model_get_projected_size (MMModel *model, GHashTable *shape);
+
+/* Duration of warmup runs in microseconds. See mm_model_warmup(). */
+typedef struct _MMModelWarmupTiming
+{
+  /* First run with the shape */
+  gint64 cold;
+  /* Second run with the same shape */
+  gint64 warm;
+} MMModelWarmupTiming;
+
+/*
+ * Runs model with zero-filled inputs for each shape, so allocation
+ * planning, arena growth and kernel selection are done before the first
+ * real request. shapes is array of GHashTable * (char *, int64_t *), same as
+ * mm_model_io_set_dimension(), and should set every symbolic dimension of
+ * inputs. If parallel is TRUE, shapes are run concurrently.
+ * If timings is not NULL, it is set to GArray of MMModelWarmupTiming, in
+ * the order of shapes. It should be freed with g_array_unref().
+ */
+gboolean mm_model_warmup (MMModel *model, GPtrArray *shapes,
+                          gboolean parallel, GArray **timings,
+                          GError **error);
+/*
+ * Runs model iterations times with inputs of shape, after a run which is
+ * not measured, and returns durations of runs in microseconds as GArray of
+ * gint64. Floating point inputs are filled with the same pseudo random
+ * values in every call, and the others with zero.
+ * shape is the same as mm_model_warmup(). Returned array
+ * should be freed with g_array_unref(). If outputs is not NULL, it is set to
+ * array of MMValue * of outputs of the last run, which should be freed with
+ * g_ptr_array_unref(). Can be called from multiple threads.
+ */
+GArray *mm_model_benchmark (MMModel *model, GHashTable *shape,
+                            guint iterations, GPtrArray **outputs,
+                            GError **error);
 
 G_END_DECLS
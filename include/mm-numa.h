@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-model-options.h"
+#include "mm-model.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMNumaError
+{
+  MM_NUMA_ERROR_NODE = 1,
+  MM_NUMA_ERROR_AFFINITY,
+} MMNumaError;
+
+#define MM_NUMA_ERROR mm_numa_error_quark ()
+GQuark mm_numa_error_quark (void);
+
+/*
+ * NUMA topology of the host, read from /sys/devices/system/node on Linux.
+ * Other systems and hosts without the information have a single node with
+ * every processor, so code using these functions runs unchanged there.
+ * Nodes are numbered from 0 in the order of the system's node ids.
+ */
+guint mm_numa_get_node_count (void);
+/* Returns processors of node as GArray of guint. Free with g_array_unref() */
+GArray *mm_numa_get_node_cpus (guint node);
+/* Returns node of the processor running the calling thread. */
+guint mm_numa_get_current_node (void);
+/* Binds the calling thread to processors of node. */
+gboolean mm_numa_bind_thread (guint node, GError **error);
+
+/*
+ * MMModelReplicas
+ * One replica of a model for each NUMA node. Intra-op threads of each
+ * replica are pinned to processors of its node, and each replica is loaded
+ * by a thread bound to its node, so weights and arena are allocated in local
+ * memory by first touch. Requests are routed to the replica on the node of
+ * the calling thread.
+ */
+typedef struct _MMModelReplicas MMModelReplicas;
+
+/*
+ * Loads replicas of file_path. options is copied for each node (See
+ * mm_model_options_copy()). If context of options has global thread pools,
+ * threads are not pinned, but weights are still placed on each node.
+ */
+MMModelReplicas *mm_model_replicas_new (MMModelOptions *options,
+                                        const char *file_path, GError **error);
+void mm_model_replicas_ref (MMModelReplicas *replicas);
+void mm_model_replicas_unref (MMModelReplicas *replicas);
+guint mm_model_replicas_get_count (MMModelReplicas *replicas);
+/* Returns replica on node. Returned model is not ref'ed. */
+MMModel *mm_model_replicas_get_node (MMModelReplicas *replicas, guint node);
+/* Returns replica on node of the calling thread. Not ref'ed. */
+MMModel *mm_model_replicas_get (MMModelReplicas *replicas);
+
+G_END_DECLS
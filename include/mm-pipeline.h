@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-model.h"
+#include "mm-value.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMPipelineError
+{
+  MM_PIPELINE_ERROR_NOT_FOUND = 1,
+  MM_PIPELINE_ERROR_STATE,
+  MM_PIPELINE_ERROR_INPUT,
+} MMPipelineError;
+
+#define MM_PIPELINE_ERROR mm_pipeline_error_quark ()
+
+/*
+ * MMPipeline
+ * Chains models as stages. Outputs of a stage are bound to inputs of later
+ * stages as the same OrtValue, so nothing is copied between stages.
+ * Each stage runs on its own thread, and stages are connected with bounded
+ * queues, so stage k of a request overlaps stage k + 1 of the previous one.
+ */
+typedef struct _MMPipeline MMPipeline;
+/*
+ * MMPipelineRequest
+ * A request queued to MMPipeline.
+ */
+typedef struct _MMPipelineRequest MMPipelineRequest;
+
+/* queue_length is the number of requests which can wait for each stage. */
+MMPipeline *mm_pipeline_new (guint queue_length);
+void mm_pipeline_ref (MMPipeline *pipeline);
+/* Queued requests are completed before threads are stopped. */
+void mm_pipeline_unref (MMPipeline *pipeline);
+/* Appends model as the last stage, and returns index of the stage. */
+guint mm_pipeline_add_stage (MMPipeline *pipeline, MMModel *model);
+/*
+ * Binds output output_name of stage src to input input_name of stage dst.
+ * src should be smaller than dst.
+ */
+gboolean mm_pipeline_connect (MMPipeline *pipeline, guint src,
+                              const char *output_name, guint dst,
+                              const char *input_name, GError **error);
+/* Starts stage threads. Stages can not be changed after this. */
+gboolean mm_pipeline_start (MMPipeline *pipeline, GError **error);
+/*
+ * Queues request. inputs is array of MMValue, and each value is fed to
+ * every unconnected input with the same input_name.
+ * Values should not be changed until the request is completed.
+ * Blocks while the queue of the first stage is full.
+ */
+MMPipelineRequest *mm_pipeline_push (MMPipeline *pipeline, GPtrArray *inputs,
+                                     GError **error);
+/*
+ * Same as mm_pipeline_push(), but every stage runs with run options of
+ * run_context. A request whose deadline passes while it waits in a queue
+ * fails without running later stages. run_context is kept alive until the
+ * request is freed.
+ */
+MMPipelineRequest *mm_pipeline_push_with_context (MMPipeline *pipeline,
+                                                  GPtrArray *inputs,
+                                                  MMRunContext *run_context,
+                                                  GError **error);
+
+void mm_pipeline_request_ref (MMPipelineRequest *request);
+void mm_pipeline_request_unref (MMPipelineRequest *request);
+/*
+ * Blocks until request is completed, and returns outputs of the last stage
+ * as array of MMValue. Returned array should be freed with
+ * g_ptr_array_unref().
+ */
+GPtrArray *mm_pipeline_request_wait (MMPipelineRequest *request,
+                                     GError **error);
+
+G_END_DECLS
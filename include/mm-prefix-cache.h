@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-context.h"
+#include "mm-value.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMPrefixCacheError
+{
+  MM_PREFIX_CACHE_ERROR_EMPTY = 1,
+  MM_PREFIX_CACHE_ERROR_MISMATCH,
+  MM_PREFIX_CACHE_ERROR_QUANTIZED,
+  MM_PREFIX_CACHE_ERROR_BUDGET,
+} MMPrefixCacheError;
+
+#define MM_PREFIX_CACHE_ERROR mm_prefix_cache_error_quark ()
+
+/*
+ * MMPrefixCache
+ * Keeps state values (KV caches and so on) computed for token prefixes,
+ * such as a system prompt shared by every conversation, so prefill of a new
+ * conversation starts after the longest cached prefix. Entries are keyed by
+ * hash of tokens, and tokens are compared too. Entries share data with the
+ * values they are inserted from and assigned to (See mm_value_assign()), so
+ * data is stored once and copied only by a conversation writing it. The
+ * least recently used entries are evicted when their total size exceeds the
+ * budget. Data is charged to the context by the allocator of values, like
+ * other values, and when memory budget of the context is exceeded (See
+ * mm_context_set_memory_budget()), the least recently used entries holding
+ * data no other value shares are evicted. Evicting an entry never
+ * invalidates values sharing its data.
+ */
+typedef struct _MMPrefixCache MMPrefixCache;
+
+/* budget is total size of entries in bytes, and 0 means no limit. */
+MMPrefixCache *mm_prefix_cache_new (MMContext *context, size_t budget);
+void mm_prefix_cache_ref (MMPrefixCache *cache);
+void mm_prefix_cache_unref (MMPrefixCache *cache);
+/* Evicts entries until they fit budget. */
+void mm_prefix_cache_set_budget (MMPrefixCache *cache, size_t budget);
+/*
+ * Keeps shape and data of values as the state after tokens, sharing data.
+ * Values are matched by their order in mm_prefix_cache_lookup(). Does
+ * nothing if tokens are already cached. Fails with
+ * MM_PREFIX_CACHE_ERROR_BUDGET if the entry does not fit budget after other
+ * entries are evicted. Quantized values are not supported.
+ */
+gboolean mm_prefix_cache_insert (MMPrefixCache *cache, const int64_t *tokens,
+                                 size_t ntokens, GPtrArray *values,
+                                 GError **error);
+/*
+ * Finds the longest cached prefix of tokens, and assigns its values to
+ * values (See mm_value_assign()). matched is set to its number of tokens,
+ * or to 0 if nothing matches. Pass ntokens - 1 to keep a token to run when
+ * logits of the last token are needed.
+ * Can be called from multiple threads with different values.
+ */
+gboolean mm_prefix_cache_lookup (MMPrefixCache *cache, const int64_t *tokens,
+                                 size_t ntokens, GPtrArray *values,
+                                 size_t *matched, GError **error);
+/* Evicts every entry. */
+void mm_prefix_cache_clear (MMPrefixCache *cache);
+/* Returns total size of entries. */
+size_t mm_prefix_cache_get_size (MMPrefixCache *cache);
+
+G_END_DECLS
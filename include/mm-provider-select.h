@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-model-options.h"
+#include "mm-model.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Loads file_path with the fastest of CPU and each available provider (See
+ * mm_provider_is_available()). Each candidate is a copy of options with the
+ * provider appended, and is run by mm_model_benchmark() at shapes, which is
+ * array of GHashTable * like mm_model_warmup(). If shapes is empty, models
+ * are run with an empty shape, which fails with MM_MODEL_ERROR_SHAPE for
+ * models with symbolic dimensions. Candidates whose outputs differ from CPU
+ * outputs are rejected. Floating point outputs are compared with a
+ * tolerance, integer and bool outputs exactly, and outputs of other types
+ * reject the candidate. The choice is cached per SHA-256 of the model file
+ * in the user cache directory, and is made again when available providers
+ * change.
+ */
+MMModel *mm_provider_select_model (MMModelOptions *options,
+                                   const char *file_path, GPtrArray *shapes,
+                                   GError **error);
+
+G_END_DECLS
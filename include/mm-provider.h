@@ -7,6 +7,13 @@
 
 G_BEGIN_DECLS
 
+typedef enum _MMProviderError
+{
+  MM_PROVIDER_ERROR_UNAVAILABLE = 1,
+} MMProviderError;
+
+#define MM_PROVIDER_ERROR mm_provider_error_quark ()
+
 typedef enum _MMProviderName
 {
   MM_PROVIDER_NULL,
@@ -15,12 +22,21 @@ typedef enum _MMProviderName
   MM_PROVIDER_CANN,
   MM_PROVIDER_DNNL,
   MM_PROVIDER_ROCM,
+  /* Providers below take key/value options (See mm_provider_set_option()) */
+  MM_PROVIDER_XNNPACK,
+  MM_PROVIDER_OPEN_VINO,
   // MM_PROVIDER_NV_TENSOR_RT,
   // MM_PROVIDER_MI_GRAPH_X,
-  // MM_PROVIDER_OPEN_VINO,
 } MMProviderName;
 
+/*
+ * Returns MM_PROVIDER_NULL for CPUExecutionProvider and providers which are
+ * not supported.
+ */
 MMProviderName mm_provider_name_from_str (const char *name);
+const char *mm_provider_name_to_str (MMProviderName name);
+/* Returns TRUE if ORT of context is built with the provider. */
+gboolean mm_provider_is_available (MMContext *context, MMProviderName name);
 
 /*
  * MMProvider
@@ -41,12 +57,36 @@ struct _MMProvider
     OrtROCMProviderOptions *rocm;
     OrtMIGraphXProviderOptions *mi_graph_x;
     OrtOpenVINOProviderOptions *open_vino;
+    /* char * to char * for providers appended by name */
+    GHashTable *options;
   };
 };
 
+/* Fails with MM_PROVIDER_ERROR_UNAVAILABLE if provider is not available. */
 MMProvider *mm_provider_new (MMContext *context, MMProviderName name,
                              GError **error);
 void mm_provider_ref (MMProvider *provider);
 void mm_provider_unref (MMProvider *provider);
+/*
+ * Sets an option of a provider taking key/value options. Keys are those of
+ * the provider documentation. Options should be set before the provider is
+ * appended to model options.
+ */
+void mm_provider_set_option (MMProvider *provider, const char *key,
+                             const char *value);
+/*
+ * Threads of XNNPACK's own pool. Intra-op threads of the session run other
+ * operators, so setting both to the number of processors oversubscribes
+ * them; ORT suggests 1 intra-op thread without spinning for models running
+ * mostly on XNNPACK (See mm_model_options_apply_tuning()).
+ */
+void mm_provider_set_xnnpack_threads (MMProvider *provider, int threads);
+/* OpenVINO device, such as "CPU", "GPU" or "NPU". */
+void mm_provider_set_open_vino_device_type (MMProvider *provider,
+                                            const char *device_type);
+void mm_provider_set_open_vino_threads (MMProvider *provider, int threads);
+/* Directory where OpenVINO caches compiled models. */
+void mm_provider_set_open_vino_cache_dir (MMProvider *provider,
+                                          const char *cache_dir);
 
 G_END_DECLS
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glib.h>
+#include <onnxruntime_c_api.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Linear quantization of FLOAT tensors, same as ONNX QuantizeLinear:
+ * q = clamp(round(x / scale) + zero_point), x = (q - zero_point) * scale.
+ * Signed types are quantized symmetrically (zero_point is 0), and unsigned
+ * types asymmetrically. 4-bit data is packed two elements per byte, lower
+ * nibble first.
+ */
+
+typedef enum _MMQuantizeGranularity
+{
+  /* One scale for the whole tensor */
+  MM_QUANTIZE_PER_TENSOR,
+  /* One scale per index of axis */
+  MM_QUANTIZE_PER_CHANNEL,
+  /* One scale per block_size elements along the last axis */
+  MM_QUANTIZE_BLOCK,
+} MMQuantizeGranularity;
+
+typedef struct _MMQuantizeInfo MMQuantizeInfo;
+
+struct _MMQuantizeInfo
+{
+  /* INT8, UINT8, INT4 or UINT4 */
+  ONNXTensorElementDataType dtype;
+  MMQuantizeGranularity granularity;
+  /* Used by MM_QUANTIZE_PER_CHANNEL */
+  int64_t axis;
+  /* Used by MM_QUANTIZE_BLOCK */
+  int64_t block_size;
+};
+
+/*
+ * Returns the number of scales (and zero points) for a tensor of shape dim.
+ * Returns 0 if info can not be applied to the shape.
+ */
+size_t mm_quantize_get_scale_count (const MMQuantizeInfo *info,
+                                    const int64_t *dim, size_t ndim);
+/*
+ * Quantizes src of shape dim to dst, and sets scales and zero_points,
+ * which should have mm_quantize_get_scale_count() elements.
+ */
+gboolean mm_quantize (gpointer dst, const float *src, const int64_t *dim,
+                      size_t ndim, const MMQuantizeInfo *info, float *scales,
+                      guint8 *zero_points);
+/* Dequantizes src of shape dim to dst. */
+gboolean mm_dequantize (float *dst, gconstpointer src, const int64_t *dim,
+                        size_t ndim, const MMQuantizeInfo *info,
+                        const float *scales, const guint8 *zero_points);
+
+G_END_DECLS
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <onnxruntime_c_api.h>
+
+#include "mm-context.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMRunContextError
+{
+  MM_RUN_CONTEXT_ERROR_DEADLINE = 1,
+} MMRunContextError;
+
+#define MM_RUN_CONTEXT_ERROR mm_run_context_error_quark ()
+
+/*
+ * MMRunContext
+ * Per-call OrtRunOptions with a deadline, a GCancellable, a run tag and
+ * config entries. When the deadline passes or cancellable is cancelled,
+ * runs using the context are terminated mid-inference, and runs using other
+ * contexts are not affected.
+ * Runs fail with MM_RUN_CONTEXT_ERROR_DEADLINE or G_IO_ERROR_CANCELLED.
+ */
+typedef struct _MMRunContext MMRunContext;
+
+MMRunContext *mm_run_context_new (MMContext *context, GError **error);
+void mm_run_context_ref (MMRunContext *run_context);
+void mm_run_context_unref (MMRunContext *run_context);
+/*
+ * Sets deadline in monotonic time (See g_get_monotonic_time()).
+ * 0 means no deadline. Should not be changed while runs are in progress.
+ */
+void mm_run_context_set_deadline (MMRunContext *run_context, gint64 deadline);
+/* Sets deadline to timeout microseconds from now. */
+void mm_run_context_set_timeout (MMRunContext *run_context, gint64 timeout);
+gint64 mm_run_context_get_deadline (MMRunContext *run_context);
+/* Should not be changed while runs are in progress. */
+void mm_run_context_set_cancellable (MMRunContext *run_context,
+                                     GCancellable *cancellable);
+/* Sets tag shown in ORT logs of runs. */
+gboolean mm_run_context_set_tag (MMRunContext *run_context, const char *tag,
+                                 GError **error);
+/* Adds run config entry, for example "memory.enable_memory_arena_shrinkage" */
+gboolean mm_run_context_add_config_entry (MMRunContext *run_context,
+                                          const char *key, const char *value,
+                                          GError **error);
+/*
+ * Returns run options to pass to context->api->Run(), or NULL if the
+ * deadline has passed or cancellable is cancelled. The deadline and
+ * cancellable terminate runs until mm_run_context_end() is called.
+ * Can be called from multiple threads for concurrent runs.
+ */
+OrtRunOptions *mm_run_context_begin (MMRunContext *run_context,
+                                     GError **error);
+/*
+ * Ends a run started by mm_run_context_begin(). status is the result of
+ * context->api->Run(), and is freed. Returns FALSE if status is not NULL.
+ */
+gboolean mm_run_context_end (MMRunContext *run_context, OrtStatus *status,
+                             GError **error);
+
+G_END_DECLS
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-value.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMSnapshotError
+{
+  MM_SNAPSHOT_ERROR_EMPTY = 1,
+  MM_SNAPSHOT_ERROR_MISMATCH,
+  MM_SNAPSHOT_ERROR_QUANTIZED,
+  MM_SNAPSHOT_ERROR_INVALID,
+} MMSnapshotError;
+
+#define MM_SNAPSHOT_ERROR mm_snapshot_error_quark ()
+
+/*
+ * MMSnapshot
+ * State of a conversation, that is, state values (KV caches and so on) and
+ * token history. Captured data is shared with the values until either is
+ * written (See mm_value_assign()), so capture and restore copy nothing.
+ * Files are MMFile files holding the values and the token history, so
+ * data loaded from a file is shared on restore too.
+ */
+typedef struct _MMSnapshot MMSnapshot;
+
+MMSnapshot *mm_snapshot_new (void);
+void mm_snapshot_ref (MMSnapshot *snapshot);
+void mm_snapshot_unref (MMSnapshot *snapshot);
+/*
+ * Adds a state value. Values are matched by the order they are added, and
+ * in files by input or output names (See mm_file_read()).
+ */
+void mm_snapshot_add_value (MMSnapshot *snapshot, MMValue *value);
+void mm_snapshot_set_tokens (MMSnapshot *snapshot, const int64_t *tokens,
+                             size_t ntokens);
+const int64_t *mm_snapshot_get_tokens (MMSnapshot *snapshot, size_t *ntokens);
+/*
+ * Captures shape and data of every value, sharing data with the values.
+ * Quantized values are not supported.
+ */
+gboolean mm_snapshot_capture (MMSnapshot *snapshot, GError **error);
+/*
+ * Sets shapes and data of values to captured or loaded ones, sharing data.
+ * Nothing is changed if data types or ranks do not match.
+ */
+gboolean mm_snapshot_restore (MMSnapshot *snapshot, GError **error);
+/* Frees captured data, for example after mm_snapshot_save(). */
+void mm_snapshot_clear (MMSnapshot *snapshot);
+/* Writes captured data and tokens to path with MMFile. */
+gboolean mm_snapshot_save (MMSnapshot *snapshot, const gchar *path,
+                           GError **error);
+/*
+ * Reads path written by mm_snapshot_save() as captured data, and loads
+ * tokens. Data is read into tensors allocated with allocators of the
+ * values, and values are not changed until mm_snapshot_restore().
+ */
+gboolean mm_snapshot_load (MMSnapshot *snapshot, const gchar *path,
+                           GError **error);
+/* Returns time taken by the last mm_snapshot_restore() in microseconds. */
+gint64 mm_snapshot_get_restore_time (MMSnapshot *snapshot);
+
+G_END_DECLS
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-value-ops.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMSpeculativeError
+{
+  MM_SPECULATIVE_ERROR_SHAPE = 1,
+} MMSpeculativeError;
+
+#define MM_SPECULATIVE_ERROR mm_speculative_error_quark ()
+
+typedef enum _MMSpeculativeModel
+{
+  MM_SPECULATIVE_DRAFT,
+  MM_SPECULATIVE_TARGET,
+} MMSpeculativeModel;
+
+/*
+ * Runs a model with ntokens tokens appended to its sequence, and returns
+ * logits of shape [ntokens, vocab_size], which should be valid until the
+ * next call. Past states registered with mm_speculative_add_state() should
+ * hold the states for the next run when this returns.
+ */
+typedef const float *(*MMSpeculativeRunFunc) (const int64_t *tokens,
+                                              size_t ntokens,
+                                              size_t *vocab_size,
+                                              gpointer user_data,
+                                              GError **error);
+
+/*
+ * MMSpeculative
+ * Speculative decoding with a small draft model and a large target model.
+ * The draft proposes k tokens one by one, and the target checks them in one
+ * run over the window. The longest prefix matching greedy choices of the
+ * target is accepted, with the target's token after it, and past states of
+ * rejected tokens are cut off. Output is the same as greedy decoding with
+ * the target alone. k grows while every proposal is accepted, and shrinks
+ * when less than half is accepted.
+ */
+typedef struct _MMSpeculative MMSpeculative;
+
+MMSpeculative *mm_speculative_new (MMSpeculativeRunFunc draft_func,
+                                   gpointer draft_data,
+                                   MMSpeculativeRunFunc target_func,
+                                   gpointer target_data);
+void mm_speculative_ref (MMSpeculative *spec);
+void mm_speculative_unref (MMSpeculative *spec);
+/* Default is 256. */
+void mm_speculative_set_max_tokens (MMSpeculative *spec, guint max_tokens);
+/* Generation stops after eos_token_id. -1 disables it. */
+void mm_speculative_set_eos_token (MMSpeculative *spec, int64_t eos_token_id);
+/* Initial and largest k. Defaults are 4 and 8. */
+void mm_speculative_set_draft_length (MMSpeculative *spec, guint k,
+                                      guint max_k);
+/*
+ * Registers past state of model, such as a KV cache, whose axis is the
+ * sequence. It is cut along axis in place with mm_value_truncate() when
+ * tokens are rejected, so its data can be reused when it grows again.
+ */
+void mm_speculative_add_state (MMSpeculative *spec, MMSpeculativeModel model,
+                               MMValue *value, size_t axis);
+void mm_speculative_remove_state (MMSpeculative *spec, MMValue *value);
+/*
+ * Runs prompt through both models, and appends generated tokens to tokens,
+ * which is GArray of int64_t. Past states should be empty.
+ */
+gboolean mm_speculative_generate (MMSpeculative *spec, const int64_t *prompt,
+                                  size_t nprompt, GArray *tokens,
+                                  GError **error);
+/* Accepted draft tokens divided by proposed ones, over every generation. */
+double mm_speculative_get_acceptance_rate (MMSpeculative *spec);
+/* Current k. */
+guint mm_speculative_get_draft_length (MMSpeculative *spec);
+
+G_END_DECLS
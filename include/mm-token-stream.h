@@ -0,0 +1,82 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum _MMTokenStreamError
+{
+  MM_TOKEN_STREAM_ERROR_BUSY = 1,
+} MMTokenStreamError;
+
+#define MM_TOKEN_STREAM_ERROR mm_token_stream_error_quark ()
+
+/*
+ * Runs the model with token appended to the sequence, and returns logits of
+ * the next token, which should be valid until the next call. token is -1 for
+ * the first call, which should run the prompt. Called in the generation
+ * thread.
+ */
+typedef const float *(*MMTokenStreamStepFunc) (int64_t token,
+                                               size_t *vocab_size,
+                                               gpointer user_data,
+                                               GError **error);
+/* Called for each generated token. Returns FALSE to stop generation. */
+typedef gboolean (*MMTokenStreamTokenFunc) (int64_t token,
+                                            gpointer user_data);
+
+/*
+ * MMTokenStream
+ * Generates tokens in a worker thread, and hands them to a callback through
+ * a bounded queue. The callback, such as detokenization, runs while the
+ * model computes the next token, so it does not add to per-token latency
+ * unless it is slower than the model. Generation waits while the queue is
+ * full.
+ */
+typedef struct _MMTokenStream MMTokenStream;
+
+MMTokenStream *mm_token_stream_new (MMTokenStreamStepFunc step_func,
+                                    gpointer step_data);
+void mm_token_stream_ref (MMTokenStream *stream);
+void mm_token_stream_unref (MMTokenStream *stream);
+/* Default is 256. */
+void mm_token_stream_set_max_tokens (MMTokenStream *stream,
+                                     guint max_tokens);
+/* Generation stops after eos_token_id is delivered. -1 disables it. */
+void mm_token_stream_set_eos_token (MMTokenStream *stream,
+                                   int64_t eos_token_id);
+/*
+ * temperature 0 is greedy. top_k 0 and top_p 1 disable the filters.
+ * Default is greedy.
+ */
+void mm_token_stream_set_sampling (MMTokenStream *stream, float temperature,
+                                   guint top_k, float top_p);
+void mm_token_stream_set_seed (MMTokenStream *stream, guint32 seed);
+/* Tokens generated ahead of the callback. Default is 16. */
+void mm_token_stream_set_queue_size (MMTokenStream *stream, guint size);
+/* Stops generation after the current step. Can be called from any thread. */
+void mm_token_stream_stop (MMTokenStream *stream);
+/*
+ * Generates tokens, and calls token_func for each token in the calling
+ * thread. Returns when generation is finished or stopped, and every token is
+ * delivered. A stream runs one generation at a time.
+ */
+gboolean mm_token_stream_run (MMTokenStream *stream,
+                              MMTokenStreamTokenFunc token_func,
+                              gpointer user_data, GCancellable *cancellable,
+                              GError **error);
+/*
+ * Asynchronous version of mm_token_stream_run(). token_func and callback are
+ * called in the thread-default main context, and callback is called after
+ * every token is delivered.
+ */
+void mm_token_stream_run_async (MMTokenStream *stream,
+                                MMTokenStreamTokenFunc token_func,
+                                gpointer user_data, GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer callback_data);
+gboolean mm_token_stream_run_finish (MMTokenStream *stream,
+                                     GAsyncResult *result, GError **error);
+
+G_END_DECLS
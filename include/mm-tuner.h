@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-model-options.h"
+#include "mm-model.h"
+
+G_BEGIN_DECLS
+
+typedef enum _MMTunerObjective
+{
+  /* Lowest median time of a run */
+  MM_TUNER_OBJECTIVE_LATENCY,
+  /* Most runs per second from concurrent callers */
+  MM_TUNER_OBJECTIVE_THROUGHPUT,
+} MMTunerObjective;
+
+typedef struct _MMTunerResult
+{
+  MMSessionTuning tuning;
+  /* Microseconds per run, or 0 if the candidate failed */
+  double time;
+} MMTunerResult;
+
+/*
+ * MMTuner
+ * Loads a model with each candidate tuning, runs it with zero-filled inputs
+ * at representative shapes, and picks the best candidate for an objective.
+ * The best tuning can be saved as a profile (See mm_session_tuning_save()
+ * and mm_model_options_load_profile()).
+ */
+typedef struct _MMTuner MMTuner;
+
+/* Candidates are copies of options (See mm_model_options_copy()). */
+MMTuner *mm_tuner_new (MMModelOptions *options, const char *file_path);
+void mm_tuner_ref (MMTuner *tuner);
+void mm_tuner_unref (MMTuner *tuner);
+/*
+ * Adds shape to benchmark, which is GHashTable * (char *, int64_t *) same as
+ * mm_model_warmup(). Models without symbolic dimensions need no shape.
+ */
+void mm_tuner_add_shape (MMTuner *tuner, GHashTable *shape);
+void mm_tuner_add_candidate (MMTuner *tuner, const MMSessionTuning *tuning);
+/*
+ * Adds candidates with thread counts based on number of processors, both
+ * execution modes, spinning on and off, and memory pattern and CPU arena
+ * disabled. Used if no candidate is added.
+ */
+void mm_tuner_add_default_candidates (MMTuner *tuner);
+/* Measured runs for each shape. Default is 10. */
+void mm_tuner_set_iterations (MMTuner *tuner, guint iterations);
+/* Concurrent callers for MM_TUNER_OBJECTIVE_THROUGHPUT. Default is 2. */
+void mm_tuner_set_concurrency (MMTuner *tuner, guint concurrency);
+/*
+ * Benchmarks candidates and sets best. Candidates which fail are skipped,
+ * and the first error is returned if every candidate fails.
+ */
+gboolean mm_tuner_run (MMTuner *tuner, MMTunerObjective objective,
+                       MMSessionTuning *best, GError **error);
+/* Returns GArray of MMTunerResult of the last run, in order of candidates. */
+GArray *mm_tuner_get_results (MMTuner *tuner);
+
+G_END_DECLS
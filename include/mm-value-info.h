@@ -10,6 +10,9 @@ G_BEGIN_DECLS
 /*
  * MMValueInfo
  * Holds basic tensor information. See below.
+ * Names are interned (See g_intern_string()), so they can be compared as
+ * pointers and are never freed. Copies share dim_name, and own only dim,
+ * which is stored inline for small ranks.
  */
 typedef struct _MMValueInfo MMValueInfo;
 
@@ -17,16 +20,27 @@ struct _MMValueInfo
 {
   ONNXTensorElementDataType dtype;
   size_t ndim;
+  /* Concrete shape, can be modified */
   int64_t *dim;
-  /* string array, and element can be NULL */
-  char **dim_name;
-  char *name;
+  /* string array, and element can be NULL. Shared, never modified. */
+  const char *const *dim_name;
+  const char *name;
 };
 
 MMValueInfo *mm_value_info_new (MMContext *context,
                                 const OrtTensorTypeAndShapeInfo *tensor_info,
                                 const char *name, GError **error);
-/* Copies MMValueInfo with ref count = 1. (NOT ref) */
+/*
+ * Creates MMValueInfo of a concrete shape without dimension names, for
+ * values which are not fed to models (See MMSnapshot).
+ */
+MMValueInfo *mm_value_info_new_from_shape (ONNXTensorElementDataType dtype,
+                                           const int64_t *dim, size_t ndim,
+                                           const char *name);
+/*
+ * Copies MMValueInfo with ref count = 1. (NOT ref)
+ * Only dim is copied, so this allocates once for small ranks.
+ */
 MMValueInfo *mm_value_info_copy (MMValueInfo *value_info);
 void mm_value_info_ref (MMValueInfo *value_info);
 void mm_value_info_unref (MMValueInfo *value_info);
@@ -42,6 +56,13 @@ gboolean mm_value_info_set_dimension (MMValueInfo *value_info,
                                       GHashTable *hash_table);
 /* Returns element count. If the shape is not concrete, returns 0. */
 size_t mm_value_info_get_element_count (MMValueInfo *value_info);
+/*
+ * Returns size of one element of dtype in bytes.
+ * Returns 0 for types smaller than a byte (INT4, UINT4).
+ */
+size_t mm_value_info_get_dtype_size (ONNXTensorElementDataType dtype);
+/* Returns size of one element in bytes. See above. */
+size_t mm_value_info_get_element_size (MMValueInfo *value_info);
 /* Returns data size. If the shape is not concrete, returns 0. */
 size_t mm_value_info_get_data_size (MMValueInfo *value_info);
 
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mm-value.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Tensor operations on MMValue, working on value->info->dim.
+ * Results are written to dst, which is reallocated with mm_value_update()
+ * if its shape differs. dst should have the same data type and rank as the
+ * sources, and can be one of the sources.
+ * Data is moved with blocked memcpy, and large operations are split into
+ * threads.
+ */
+
+/* Copies [start, end) of axis. */
+gboolean mm_value_slice (MMValue *dst, MMValue *src, size_t axis,
+                         int64_t start, int64_t end, GError **error);
+/*
+ * Concatenates nsrcs values along axis. If dst is the first source, only
+ * the appended rows are marked as changed (See mm_value_get_dirty_row()).
+ */
+gboolean mm_value_concat (MMValue *dst, MMValue **srcs, size_t nsrcs,
+                          size_t axis, GError **error);
+/*
+ * Selects indices of axis, like index_select. If dst is src and nindices is
+ * the same as the dimension of axis, rows are reordered in place, and rows
+ * whose index does not change are not copied.
+ */
+gboolean mm_value_gather (MMValue *dst, MMValue *src, size_t axis,
+                          const int64_t *indices, size_t nindices,
+                          GError **error);
+/* Pads pads_begin[k] and pads_end[k] zeros before and after axis k. */
+gboolean mm_value_pad (MMValue *dst, MMValue *src, const int64_t *pads_begin,
+                       const int64_t *pads_end, GError **error);
+/* Permutes axes. Axis k of dst is axis perm[k] of src. */
+gboolean mm_value_transpose (MMValue *dst, MMValue *src, const size_t *perm,
+                             GError **error);
+
+G_END_DECLS
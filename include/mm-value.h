@@ -5,13 +5,28 @@
 
 #include "mm-allocator.h"
 #include "mm-context.h"
+#include "mm-quantize.h"
 #include "mm-value-info.h"
 
 G_BEGIN_DECLS
 
+typedef enum _MMValueError
+{
+  MM_VALUE_ERROR_DTYPE = 1,
+  MM_VALUE_ERROR_QUANTIZE,
+  MM_VALUE_ERROR_SHAPE,
+} MMValueError;
+
+#define MM_VALUE_ERROR mm_value_error_quark ()
+GQuark mm_value_error_quark (void);
+
 /*
  * MMValue
  * Wraps OrtValue and other essential data.
+ * Tensors allocated by MMValue point into a reference counted MMBuffer, so
+ * values can share data (See mm_value_assign()). Shared data is copied on
+ * the first write through mm_value_get_data() and the other setters, and
+ * reading it with mm_value_peek_data() never copies.
  */
 typedef struct _MMValue MMValue;
 
@@ -22,9 +37,9 @@ struct _MMValue
   MMAllocator *allocator;
   /* Can be NULL because of symbolic dimension mechanism in ONNXRuntime. */
   OrtValue *value;
-  /* name as an input, can be NULL */
+  /* name as an input, can be NULL. Interned like MMValueInfo names. */
   const gchar *input_name;
-  /* name as an output, can be NULL */
+  /* name as an output, can be NULL. Interned too. */
   const gchar *output_name;
 };
 
@@ -39,15 +54,130 @@ void mm_value_unref (MMValue *value);
  */
 gboolean mm_value_set_dimension (MMValue *value, GHashTable *hash_table,
                                  GError **error);
-/* Set value data. data should be already casted to value's data type. */
+/*
+ * Set value data. data should be already casted to value's data type.
+ * If valid dimension is set, data should have valid dimension, and padded
+ * region is filled with zero.
+ */
 gboolean mm_value_set_data (MMValue *value, gpointer data, GError **error);
-/* Returns pointer to the value's data obtained with GetTensorMutableData() */
+/*
+ * Same as mm_value_set_data(), but data is dtype and converted to value's
+ * data type while copying. See mm-convert.h for supported conversions.
+ */
+gboolean mm_value_set_data_from (MMValue *value, gconstpointer data,
+                                 ONNXTensorElementDataType dtype,
+                                 GError **error);
+/*
+ * Copies value data to data. If valid dimension is set, only valid region is
+ * copied, so data should have valid dimension.
+ */
+gboolean mm_value_copy_data (MMValue *value, gpointer data, GError **error);
+/* Same as mm_value_copy_data(), but converts value data to dtype. */
+gboolean mm_value_copy_data_to (MMValue *value, gpointer data,
+                                ONNXTensorElementDataType dtype,
+                                GError **error);
+/*
+ * Set valid dimension, which can be smaller than value->info->dim when the
+ * tensor is padded (See mm_model_io_set_buckets()).
+ * hash_table should be (char *, int64_t *), and NULL resets valid dimension.
+ * Valid dimension is reset by mm_value_set_dimension().
+ */
+void mm_value_set_valid_dimension (MMValue *value, GHashTable *hash_table);
+/* Returns valid dimension. Same as value->info->dim if not padded. */
+const int64_t *mm_value_get_valid_dimension (MMValue *value);
+/*
+ * Returns pointer to the value's data obtained with GetTensorMutableData()
+ * Data shared with other values is copied first.
+ */
 gpointer mm_value_get_data (MMValue *value, GError **error);
+/* Same as mm_value_get_data(), but data is only read and never copied. */
+gconstpointer mm_value_peek_data (MMValue *value, GError **error);
+/* Returns context of value. Returned context is not ref'ed. */
+MMContext *mm_value_get_context (MMValue *value);
 /* Update value->info according to value->value */
 gboolean mm_value_update_info (MMValue *value, GError **error);
 /* Update value->value according to value->info */
 gboolean mm_value_update (MMValue *value, GError **error);
+/*
+ * Like mm_value_update(), but keeps value->value if it already has the
+ * shape and data type of value->info and its data is not shared, and does
+ * not initialize data. Useful when data is overwritten right after.
+ * Data kept by mm_value_truncate() is reused if it is large enough.
+ */
+gboolean mm_value_reserve (MMValue *value, GError **error);
+/*
+ * Shrinks axis of value to its first length rows in place. Rows are moved
+ * within the data, which is kept at its size, so the value can grow back
+ * with mm_value_reserve() without allocation. Data is copied only if it is
+ * shared or allocated by ORT. Useful to roll back past states.
+ */
+gboolean mm_value_truncate (MMValue *value, size_t axis, int64_t length,
+                            GError **error);
+/*
+ * Returns the first row of axis which may have changed since
+ * mm_value_mark_clean(), or G_MAXINT64 if nothing changed. Writes through
+ * mm_value_get_data(), the setters, mm_value_update_info() and so on mark
+ * every row, and mm_value_truncate() only the rows after the kept ones.
+ * Marks are shared by every user of value, such as MMFile.
+ */
+int64_t mm_value_get_dirty_row (MMValue *value, size_t axis);
+/*
+ * Marks rows of axis from row as changed, in addition to earlier marks.
+ * Marks of another axis cover every row.
+ */
+void mm_value_mark_dirty (MMValue *value, size_t axis, int64_t row);
+/*
+ * Marks every row of axis as unchanged. Callers which know that rows are
+ * kept, for example past key values grown by a run, can mark clean and
+ * then mark dirty only the new rows.
+ */
+void mm_value_mark_clean (MMValue *value, size_t axis);
 /* Can be useful for attention layer...? See source code. */
 void mm_value_swap (MMValue *value);
+/*
+ * Sets shape, data and quantization of dst to those of src. Data is shared
+ * until either value is written. Data of tensors allocated by ORT, such as
+ * outputs not allocated before a run, is copied once instead.
+ * Data types before quantization and ranks should match.
+ */
+gboolean mm_value_assign (MMValue *dst, MMValue *src, GError **error);
+/*
+ * Returns new value with info, names and allocator of value, assigned with
+ * mm_value_assign(). Useful to fork conversation states and beams.
+ */
+MMValue *mm_value_clone (MMValue *value, GError **error);
+/* Returns TRUE if data of value is shared with other values. */
+gboolean mm_value_is_shared (MMValue *value);
+/*
+ * Quantizes FLOAT, FLOAT16 or BFLOAT16 value in place. value->value is
+ * replaced with a tensor of quantize_info->dtype, and value->info->dtype is
+ * changed to it. Scales and zero points are kept in value.
+ * Quantized value should be dequantized before it is fed to a model.
+ * mm_value_update() drops quantization and restores the data type.
+ */
+gboolean mm_value_quantize (MMValue *value,
+                            const MMQuantizeInfo *quantize_info,
+                            GError **error);
+/* Restores the data type before quantization. Does nothing if not quantized */
+gboolean mm_value_dequantize (MMValue *value, GError **error);
+/*
+ * Returns quantization info, or NULL if value is not quantized.
+ * dtype is set to the data type before quantization (or current data type if
+ * not quantized), and scales and zero_points to arrays with
+ * mm_quantize_get_scale_count() elements. Each of them can be NULL.
+ */
+const MMQuantizeInfo *mm_value_get_quantize_info (
+    MMValue *value, ONNXTensorElementDataType *dtype, const float **scales,
+    const guint8 **zero_points);
+/*
+ * Replaces value data with data already quantized with quantize_info,
+ * scales and zero_points. Current data type is kept as the type to
+ * dequantize to.
+ */
+gboolean mm_value_set_quantized_data (MMValue *value,
+                                      const MMQuantizeInfo *quantize_info,
+                                      gconstpointer data, const float *scales,
+                                      const guint8 *zero_points,
+                                      GError **error);
 
 G_END_DECLS
@@ -9,15 +9,49 @@
 #include "mm-context.h"
 /* OrtSession wrapper */
 #include "mm-model.h"
+/* Concurrent model loading */
+#include "mm-model-loader.h"
+/* Lazy model loading with LRU unloading */
+#include "mm-model-registry.h"
+/* NUMA topology and per-node model replicas */
+#include "mm-numa.h"
+/* Zero-copy multi-model pipeline */
+#include "mm-pipeline.h"
+/* Concurrent DAG of models */
+#include "mm-graph.h"
+/* Streaming token generation with sampling */
+#include "mm-token-stream.h"
+/* Speculative decoding with a draft model */
+#include "mm-speculative.h"
+/* Beam search decoding with in place state reordering */
+#include "mm-beam-search.h"
 /* Model input/output structure */
 #include "mm-model-io.h"
 /* OrtSessionOptions and OrtRunOptions wrapper */
 #include "mm-model-options.h"
+/* Session option tuning with persisted profiles */
+#include "mm-tuner.h"
+/* Per-call run options with deadline and cancellation */
+#include "mm-run-context.h"
 /* OrtValue wrapper */
 #include "mm-value.h"
+/* Reference counted tensor data shared by MMValue */
+#include "mm-buffer.h"
+/* Tensor operations on MMValue */
+#include "mm-value-ops.h"
 /* Basic tensor data for MMValue. */
 #include "mm-value-info.h"
+/* Element type conversion */
+#include "mm-convert.h"
+/* Linear quantization of tensors */
+#include "mm-quantize.h"
 /* Basic file IO for saving and loading Moduler-Model data */
 #include "mm-file.h"
+/* Conversation state snapshot and restore */
+#include "mm-snapshot.h"
+/* State of shared token prefixes across conversations */
+#include "mm-prefix-cache.h"
 /* Execution Provider wrapper */
 #include "mm-provider.h"
+/* Benchmark-driven execution provider selection */
+#include "mm-provider-select.h"
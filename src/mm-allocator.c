@@ -10,6 +10,8 @@ struct _MMRealAllocator
   MMContext *context;
   MMModel *model;
   OrtMemoryInfo *info;
+  /* Allocator of the session, wrapped by allocator */
+  OrtAllocator *session_allocator;
   gatomicrefcount ref_count;
 };
 
@@ -33,11 +35,13 @@ mm_allocator_new (MMContext *context, MMModel *model, const char *name,
     goto on_ort_error;
 
   status = context->api->CreateAllocator (model->session, allocator->info,
-                                          &allocator->allocator);
+                                          &allocator->session_allocator);
   if (status)
     goto on_ort_error;
 
   mm_context_ref (context);
+  allocator->allocator
+      = mm_context_wrap_allocator (context, allocator->session_allocator);
   mm_model_ref (model);
 
   allocator->context = context;
@@ -46,7 +50,8 @@ mm_allocator_new (MMContext *context, MMModel *model, const char *name,
 
   return (MMAllocator *)allocator;
 on_ort_error:
-  g_clear_pointer (&allocator->allocator, context->api->ReleaseAllocator);
+  g_clear_pointer (&allocator->session_allocator,
+                   context->api->ReleaseAllocator);
   g_clear_pointer (&allocator->info, context->api->ReleaseMemoryInfo);
   g_free (allocator);
   mm_context_set_error (context, error, status);
@@ -71,7 +76,8 @@ mm_allocator_unref (MMAllocator *allocator)
     return;
 
   context = rallocator->context;
-  context->api->ReleaseAllocator (rallocator->allocator);
+  mm_context_unwrap_allocator (context, rallocator->allocator);
+  context->api->ReleaseAllocator (rallocator->session_allocator);
   context->api->ReleaseMemoryInfo (rallocator->info);
   mm_model_unref (rallocator->model);
   mm_context_unref (rallocator->context);
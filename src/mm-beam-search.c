@@ -0,0 +1,434 @@
+#include "mm-beam-search.h"
+
+#include <math.h>
+#include <string.h>
+
+G_DEFINE_QUARK (mm-beam-search-error, mm_beam_search_error);
+
+typedef struct _MMBeamSearchState MMBeamSearchState;
+typedef struct _MMBeamSearchCandidate MMBeamSearchCandidate;
+
+struct _MMBeamSearchState
+{
+  MMValue *value;
+  size_t axis;
+};
+
+struct _MMBeamSearchCandidate
+{
+  float score;
+  int64_t token;
+  int64_t parent;
+};
+
+struct _MMBeamSearch
+{
+  guint beam_width;
+  guint max_length;
+  int64_t eos_token_id;
+  float length_penalty;
+  /* Number of steps */
+  size_t length;
+  /* beam_width x max_length tokens of alive beams */
+  int64_t *sequences;
+  int64_t *next_sequences;
+  float *scores;
+  int64_t *tokens;
+  int64_t *parents;
+  /* 2 * beam_width candidates for each beam */
+  MMBeamSearchCandidate *candidates;
+  /* beam_width x max_length tokens of finished sequences */
+  int64_t *finished;
+  size_t *finished_length;
+  float *finished_score;
+  guint nfinished;
+  /* MMBeamSearchState */
+  GArray *states;
+  gboolean done;
+  gatomicrefcount ref_count;
+};
+
+MMBeamSearch *
+mm_beam_search_new (guint beam_width, guint max_length, int64_t eos_token_id,
+                    float length_penalty)
+{
+  MMBeamSearch *search;
+
+  g_return_val_if_fail (beam_width > 0, NULL);
+  g_return_val_if_fail (max_length > 0, NULL);
+
+  search = g_new0 (MMBeamSearch, 1);
+  search->beam_width = beam_width;
+  search->max_length = max_length;
+  search->eos_token_id = eos_token_id;
+  search->length_penalty = length_penalty;
+  search->sequences = g_new0 (int64_t, (size_t)beam_width * max_length);
+  search->next_sequences = g_new0 (int64_t, (size_t)beam_width * max_length);
+  search->scores = g_new (float, beam_width);
+  search->tokens = g_new0 (int64_t, beam_width);
+  search->parents = g_new (int64_t, beam_width);
+  search->candidates
+      = g_new (MMBeamSearchCandidate, (size_t)beam_width * beam_width * 2);
+  search->finished = g_new0 (int64_t, (size_t)beam_width * max_length);
+  search->finished_length = g_new0 (size_t, beam_width);
+  search->finished_score = g_new0 (float, beam_width);
+  search->states = g_array_new (FALSE, FALSE, sizeof (MMBeamSearchState));
+  /* Only the first beam is alive, so that beams do not start the same. */
+  for (guint k = 0; k < beam_width; k++)
+    {
+      search->scores[k] = k == 0 ? 0.0f : -INFINITY;
+      search->parents[k] = k;
+    }
+  g_atomic_ref_count_init (&search->ref_count);
+  return search;
+}
+
+void
+mm_beam_search_ref (MMBeamSearch *search)
+{
+  g_return_if_fail (search);
+  g_atomic_ref_count_inc (&search->ref_count);
+}
+
+void
+mm_beam_search_unref (MMBeamSearch *search)
+{
+  g_return_if_fail (search);
+  if (!g_atomic_ref_count_dec (&search->ref_count))
+    return;
+
+  for (guint k = 0; k < search->states->len; k++)
+    mm_value_unref (
+        g_array_index (search->states, MMBeamSearchState, k).value);
+  g_array_unref (search->states);
+  g_free (search->finished_score);
+  g_free (search->finished_length);
+  g_free (search->finished);
+  g_free (search->candidates);
+  g_free (search->parents);
+  g_free (search->tokens);
+  g_free (search->scores);
+  g_free (search->next_sequences);
+  g_free (search->sequences);
+  g_free (search);
+}
+
+void
+mm_beam_search_add_state (MMBeamSearch *search, MMValue *value, size_t axis)
+{
+  MMBeamSearchState state;
+
+  g_return_if_fail (search);
+  g_return_if_fail (value);
+
+  mm_value_ref (value);
+  state.value = value;
+  state.axis = axis;
+  g_array_append_val (search->states, state);
+}
+
+void
+mm_beam_search_remove_state (MMBeamSearch *search, MMValue *value)
+{
+  g_return_if_fail (search);
+
+  for (guint k = 0; k < search->states->len; k++)
+    if (g_array_index (search->states, MMBeamSearchState, k).value == value)
+      {
+        g_array_remove_index (search->states, k);
+        mm_value_unref (value);
+        return;
+      }
+}
+
+gboolean
+mm_beam_search_reorder (MMBeamSearch *search, MMValue *value, size_t axis,
+                        GError **error)
+{
+  g_return_val_if_fail (search, FALSE);
+  g_return_val_if_fail (value, FALSE);
+
+  if (axis >= value->info->ndim
+      || value->info->dim[axis] != search->beam_width)
+    {
+      g_set_error (error, MM_BEAM_SEARCH_ERROR, MM_BEAM_SEARCH_ERROR_SHAPE,
+                   "Dimension of axis %zu of %s is not beam width %u", axis,
+                   value->info->name, search->beam_width);
+      return FALSE;
+    }
+  /* In place, rows of beams which keep their parent are not copied */
+  return mm_value_gather (value, value, axis, search->parents,
+                          search->beam_width, error);
+}
+
+/* Sift down for a min-heap of candidates ordered by score */
+static void
+mm_beam_search_sift (MMBeamSearchCandidate *heap, size_t n, size_t k)
+{
+  MMBeamSearchCandidate tmp;
+
+  for (;;)
+    {
+      size_t min = k;
+      size_t l = 2 * k + 1;
+      size_t r = l + 1;
+
+      if (l < n && heap[l].score < heap[min].score)
+        min = l;
+      if (r < n && heap[r].score < heap[min].score)
+        min = r;
+      if (min == k)
+        return;
+      tmp = heap[k];
+      heap[k] = heap[min];
+      heap[min] = tmp;
+      k = min;
+    }
+}
+
+/*
+ * Stores the top n tokens of logits into candidates with log-softmax
+ * added to score. Returns the number of candidates.
+ */
+static size_t
+mm_beam_search_top (MMBeamSearchCandidate *candidates, size_t n,
+                    const float *logits, size_t vocab_size, float score,
+                    int64_t parent)
+{
+  float max = -INFINITY;
+  float sum = 0.0f;
+  float lse;
+  size_t count = 0;
+
+  for (size_t k = 0; k < vocab_size; k++)
+    if (logits[k] > max)
+      max = logits[k];
+  for (size_t k = 0; k < vocab_size; k++)
+    sum += expf (logits[k] - max);
+  lse = max + logf (sum);
+
+  for (size_t k = 0; k < vocab_size; k++)
+    {
+      if (count < n)
+        {
+          candidates[count].score = logits[k];
+          candidates[count].token = k;
+          count++;
+          if (count == n)
+            for (size_t j = n / 2; j-- > 0;)
+              mm_beam_search_sift (candidates, n, j);
+        }
+      else if (logits[k] > candidates[0].score)
+        {
+          candidates[0].score = logits[k];
+          candidates[0].token = k;
+          mm_beam_search_sift (candidates, n, 0);
+        }
+    }
+  for (size_t k = 0; k < count; k++)
+    {
+      candidates[k].score = score + candidates[k].score - lse;
+      candidates[k].parent = parent;
+    }
+  return count;
+}
+
+static int
+mm_beam_search_compare (gconstpointer a, gconstpointer b)
+{
+  const MMBeamSearchCandidate *ca = a;
+  const MMBeamSearchCandidate *cb = b;
+
+  if (ca->score != cb->score)
+    return ca->score < cb->score ? 1 : -1;
+  if (ca->parent != cb->parent)
+    return ca->parent < cb->parent ? -1 : 1;
+  return ca->token < cb->token ? -1 : ca->token > cb->token;
+}
+
+static float
+mm_beam_search_normalize (MMBeamSearch *search, float score, size_t length)
+{
+  return score / powf ((float)length, search->length_penalty);
+}
+
+/* Adds a finished sequence of parent beam, followed by token if not -1. */
+static void
+mm_beam_search_finish (MMBeamSearch *search, int64_t parent, int64_t token,
+                       float score)
+{
+  size_t length = search->length + (token != -1);
+  float normalized = mm_beam_search_normalize (search, score, length);
+  guint slot;
+
+  if (search->nfinished < search->beam_width)
+    slot = search->nfinished++;
+  else
+    {
+      slot = 0;
+      for (guint k = 1; k < search->nfinished; k++)
+        if (search->finished_score[k] < search->finished_score[slot])
+          slot = k;
+      if (search->finished_score[slot] >= normalized)
+        return;
+    }
+
+  memcpy (search->finished + (size_t)slot * search->max_length,
+          search->sequences + (size_t)parent * search->max_length,
+          search->length * sizeof (int64_t));
+  if (token != -1)
+    search->finished[(size_t)slot * search->max_length + search->length]
+        = token;
+  search->finished_length[slot] = length;
+  search->finished_score[slot] = normalized;
+}
+
+gboolean
+mm_beam_search_step (MMBeamSearch *search, const float *logits,
+                     size_t vocab_size, GError **error)
+{
+  size_t ncandidates = 0;
+  size_t rank = 0;
+  guint nbeams = 0;
+  guint beam_width;
+  int64_t *tmp;
+
+  g_return_val_if_fail (search, FALSE);
+  g_return_val_if_fail (logits, FALSE);
+  g_return_val_if_fail (vocab_size > 0, FALSE);
+
+  if (search->done)
+    {
+      g_set_error (error, MM_BEAM_SEARCH_ERROR, MM_BEAM_SEARCH_ERROR_DONE,
+                   "Beam search is done");
+      return FALSE;
+    }
+
+  beam_width = search->beam_width;
+  /*
+   * 2 * beam_width candidates of each beam are enough, because at most
+   * beam_width of them are eos_token_id across all beams.
+   */
+  for (guint k = 0; k < beam_width; k++)
+    if (search->scores[k] != -INFINITY)
+      ncandidates += mm_beam_search_top (
+          search->candidates + ncandidates, 2 * (size_t)beam_width,
+          logits + (size_t)k * vocab_size, vocab_size, search->scores[k], k);
+  qsort (search->candidates, ncandidates, sizeof (MMBeamSearchCandidate),
+         mm_beam_search_compare);
+
+  for (; rank < ncandidates && nbeams < beam_width; rank++)
+    {
+      MMBeamSearchCandidate *c = search->candidates + rank;
+
+      if (c->token == search->eos_token_id)
+        {
+          /* Only candidates which could be selected as beams finish */
+          if (rank < beam_width)
+            mm_beam_search_finish (search, c->parent, c->token, c->score);
+          continue;
+        }
+      search->scores[nbeams] = c->score;
+      search->tokens[nbeams] = c->token;
+      search->parents[nbeams] = c->parent;
+      nbeams++;
+    }
+  /* Remaining beams are dead, which happens if vocabulary is small */
+  for (guint k = nbeams; k < beam_width; k++)
+    {
+      search->scores[k] = -INFINITY;
+      search->tokens[k] = 0;
+      search->parents[k] = k;
+    }
+
+  for (guint k = 0; k < beam_width; k++)
+    {
+      int64_t *dst = search->next_sequences + (size_t)k * search->max_length;
+
+      memcpy (dst,
+              search->sequences + search->parents[k] * search->max_length,
+              search->length * sizeof (int64_t));
+      dst[search->length] = search->tokens[k];
+    }
+  tmp = search->sequences;
+  search->sequences = search->next_sequences;
+  search->next_sequences = tmp;
+  search->length++;
+
+  if (nbeams == 0)
+    search->done = TRUE;
+  else if (search->length == search->max_length)
+    {
+      for (guint k = 0; k < nbeams; k++)
+        mm_beam_search_finish (search, k, -1, search->scores[k]);
+      search->done = TRUE;
+    }
+  else if (search->nfinished == beam_width)
+    {
+      /* Scores are sorted, so that the first beam is the best */
+      float best = mm_beam_search_normalize (search, search->scores[0],
+                                             search->length);
+      float worst = search->finished_score[0];
+
+      for (guint k = 1; k < search->nfinished; k++)
+        worst = MIN (worst, search->finished_score[k]);
+      search->done = worst >= best;
+    }
+
+  for (guint k = 0; k < search->states->len; k++)
+    {
+      MMBeamSearchState *state
+          = &g_array_index (search->states, MMBeamSearchState, k);
+
+      if (!mm_beam_search_reorder (search, state->value, state->axis, error))
+        return FALSE;
+    }
+  return TRUE;
+}
+
+const int64_t *
+mm_beam_search_get_tokens (MMBeamSearch *search)
+{
+  g_return_val_if_fail (search, NULL);
+  return search->tokens;
+}
+
+const int64_t *
+mm_beam_search_get_parents (MMBeamSearch *search)
+{
+  g_return_val_if_fail (search, NULL);
+  return search->parents;
+}
+
+const float *
+mm_beam_search_get_scores (MMBeamSearch *search)
+{
+  g_return_val_if_fail (search, NULL);
+  return search->scores;
+}
+
+gboolean
+mm_beam_search_is_done (MMBeamSearch *search)
+{
+  g_return_val_if_fail (search, TRUE);
+  return search->done;
+}
+
+const int64_t *
+mm_beam_search_get_best (MMBeamSearch *search, size_t *length, float *score)
+{
+  guint best = 0;
+
+  g_return_val_if_fail (search, NULL);
+
+  if (search->nfinished == 0)
+    return NULL;
+  for (guint k = 1; k < search->nfinished; k++)
+    if (search->finished_score[k] > search->finished_score[best])
+      best = k;
+  if (length)
+    *length = search->finished_length[best];
+  if (score)
+    *score = search->finished_score[best];
+  return search->finished + (size_t)best * search->max_length;
+}
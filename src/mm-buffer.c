@@ -0,0 +1,153 @@
+#include "mm-buffer.h"
+#include "mm-value-info.h"
+
+G_DEFINE_QUARK (mm-buffer-error, mm_buffer_error);
+
+struct _MMBuffer
+{
+  /*
+   * Given to ORT as the deleter of tensors, so releasing a tensor unrefs
+   * buffer. Should be the first member.
+   */
+  OrtAllocator deleter;
+  MMContext *context;
+  OrtAllocator *allocator;
+  gpointer data;
+  size_t size;
+  /* Not gatomicrefcount, because mm_buffer_is_shared() reads it */
+  gint ref_count;
+};
+
+static void *ORT_API_CALL
+mm_buffer_deleter_alloc (OrtAllocator *this_, size_t size)
+{
+  return NULL;
+}
+
+static void ORT_API_CALL
+mm_buffer_deleter_free (OrtAllocator *this_, void *p)
+{
+  mm_buffer_unref ((MMBuffer *)this_);
+}
+
+static const OrtMemoryInfo *ORT_API_CALL
+mm_buffer_deleter_info (const OrtAllocator *this_)
+{
+  const MMBuffer *buffer = (const MMBuffer *)this_;
+  return buffer->allocator->Info (buffer->allocator);
+}
+
+MMBuffer *
+mm_buffer_new (MMContext *context, OrtAllocator *allocator, size_t size,
+               GError **error)
+{
+  MMBuffer *buffer;
+  gpointer data;
+  g_return_val_if_fail (context, NULL);
+  g_return_val_if_fail (size > 0, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  if (allocator == NULL)
+    allocator = context->allocator;
+  if (!mm_context_check_memory (context, size, error))
+    return NULL;
+  data = allocator->Alloc (allocator, size);
+  if (data == NULL)
+    {
+      g_set_error (error, MM_BUFFER_ERROR, MM_BUFFER_ERROR_ALLOCATION,
+                   "Can not allocate %" G_GSIZE_FORMAT " bytes.", size);
+      return NULL;
+    }
+
+  buffer = g_new0 (MMBuffer, 1);
+  /* Members added by later API versions, such as Reserve, stay NULL. */
+  buffer->deleter.version = ORT_API_VERSION;
+  buffer->deleter.Alloc = mm_buffer_deleter_alloc;
+  buffer->deleter.Free = mm_buffer_deleter_free;
+  buffer->deleter.Info = mm_buffer_deleter_info;
+  mm_context_ref (context);
+  buffer->context = context;
+  buffer->allocator = allocator;
+  buffer->data = data;
+  buffer->size = size;
+  buffer->ref_count = 1;
+  return buffer;
+}
+
+void
+mm_buffer_ref (MMBuffer *buffer)
+{
+  g_return_if_fail (buffer);
+  g_atomic_int_inc (&buffer->ref_count);
+}
+
+void
+mm_buffer_unref (MMBuffer *buffer)
+{
+  g_return_if_fail (buffer);
+  if (!g_atomic_int_dec_and_test (&buffer->ref_count))
+    return;
+
+  buffer->allocator->Free (buffer->allocator, buffer->data);
+  mm_context_unref (buffer->context);
+  g_free (buffer);
+}
+
+gpointer
+mm_buffer_get_data (MMBuffer *buffer)
+{
+  g_return_val_if_fail (buffer, NULL);
+  return buffer->data;
+}
+
+size_t
+mm_buffer_get_size (MMBuffer *buffer)
+{
+  g_return_val_if_fail (buffer, 0);
+  return buffer->size;
+}
+
+gboolean
+mm_buffer_is_shared (MMBuffer *buffer, guint refs)
+{
+  g_return_val_if_fail (buffer, FALSE);
+  return (guint)g_atomic_int_get (&buffer->ref_count) > refs;
+}
+
+OrtValue *
+mm_buffer_new_tensor (MMBuffer *buffer, const int64_t *dim, size_t ndim,
+                      ONNXTensorElementDataType dtype, GError **error)
+{
+  const OrtApi *api;
+  OrtValue *tensor = NULL;
+  size_t size;
+  OrtStatus *status;
+  g_return_val_if_fail (buffer, NULL);
+  g_return_val_if_fail (dim || (ndim == 0), NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  size = mm_value_info_get_dtype_size (dtype);
+  for (size_t k = 0; k < ndim; k++)
+    size *= dim[k];
+  if ((size == 0) || (size > buffer->size))
+    {
+      g_set_error (error, MM_BUFFER_ERROR, MM_BUFFER_ERROR_SIZE,
+                   "Tensor of %" G_GSIZE_FORMAT " bytes does not fit buffer "
+                   "of %" G_GSIZE_FORMAT " bytes.",
+                   size, buffer->size);
+      return NULL;
+    }
+
+  /* The reference is released by ORT through the deleter. */
+  api = buffer->context->api;
+  mm_buffer_ref (buffer);
+  status = api->CreateTensorWithDataAndDeleterAsOrtValue (
+      &buffer->deleter, buffer->data, size, dim, ndim, dtype, &tensor);
+  if (status)
+    {
+      mm_buffer_unref (buffer);
+      mm_context_set_error (buffer->context, error, status);
+      return NULL;
+    }
+  return tensor;
+}
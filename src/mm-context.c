@@ -2,20 +2,115 @@
 #include "mm-context.h"
 
 typedef struct _MMRealContext MMRealContext;
+typedef struct _MMTrackedAllocator MMTrackedAllocator;
+typedef struct _MMMemoryEvictEntry MMMemoryEvictEntry;
 G_DEFINE_QUARK (mm-ort, mm_ort);
+G_DEFINE_QUARK (mm-context-error, mm_context_error);
 
 struct _MMRealContext
 {
   const OrtApi *api;
   OrtEnv *env;
+  /* Tracked wrapper of default_allocator */
   OrtAllocator *allocator;
   char **execution_providers;
   int execution_providers_length;
+  gboolean global_thread_pools;
+  OrtAllocator *default_allocator;
+  /* Memory accounting, protected by memory_mutex */
+  size_t memory_usage;
+  size_t memory_budget;
+  MMMemoryPolicy memory_policy;
+  GMutex memory_mutex;
+  GCond memory_cond;
+  /* Array of MMMemoryEvictEntry, protected by evict_mutex */
+  GArray *evict_entries;
+  guint evict_next_id;
+  GRecMutex evict_mutex;
   gatomicrefcount ref_count;
 };
 
-MMContext *
-mm_context_new (GError **error)
+/*
+ * OrtAllocator which counts allocated bytes in memory usage of context.
+ * Sizes are kept aside, because blocks can be in device memory.
+ */
+struct _MMTrackedAllocator
+{
+  OrtAllocator parent;
+  OrtAllocator *allocator;
+  MMRealContext *context;
+  /* Block to size */
+  GHashTable *sizes;
+  GMutex mutex;
+};
+
+struct _MMMemoryEvictEntry
+{
+  guint id;
+  MMMemoryEvictFunc func;
+  gpointer user_data;
+};
+
+static void *ORT_API_CALL
+mm_tracked_allocator_alloc (OrtAllocator *this_, size_t size)
+{
+  MMTrackedAllocator *tracked = (MMTrackedAllocator *)this_;
+  void *block;
+
+  block = tracked->allocator->Alloc (tracked->allocator, size);
+  if (block == NULL)
+    return NULL;
+  g_mutex_lock (&tracked->mutex);
+  g_hash_table_insert (tracked->sizes, block, GSIZE_TO_POINTER (size));
+  g_mutex_unlock (&tracked->mutex);
+  mm_context_charge_memory ((MMContext *)tracked->context, size);
+  return block;
+}
+
+static void ORT_API_CALL
+mm_tracked_allocator_free (OrtAllocator *this_, void *p)
+{
+  MMTrackedAllocator *tracked = (MMTrackedAllocator *)this_;
+  size_t size;
+
+  if (p == NULL)
+    return;
+  g_mutex_lock (&tracked->mutex);
+  size = GPOINTER_TO_SIZE (g_hash_table_lookup (tracked->sizes, p));
+  g_hash_table_remove (tracked->sizes, p);
+  g_mutex_unlock (&tracked->mutex);
+  mm_context_release_memory ((MMContext *)tracked->context, size);
+  tracked->allocator->Free (tracked->allocator, p);
+}
+
+static const OrtMemoryInfo *ORT_API_CALL
+mm_tracked_allocator_info (const OrtAllocator *this_)
+{
+  const MMTrackedAllocator *tracked = (const MMTrackedAllocator *)this_;
+  return tracked->allocator->Info (tracked->allocator);
+}
+
+/*
+ * ORT keeps one env per process, and CreateEnv*() returns the existing one
+ * ignoring threading options. So whether it has global thread pools is
+ * tracked here. Protected by mm_context_env_mutex.
+ */
+static GMutex mm_context_env_mutex;
+static guint mm_context_env_users;
+static gboolean mm_context_env_global_thread_pools;
+
+static void
+mm_context_release_env (const OrtApi *api, OrtEnv *env)
+{
+  g_mutex_lock (&mm_context_env_mutex);
+  api->ReleaseEnv (env);
+  mm_context_env_users--;
+  g_mutex_unlock (&mm_context_env_mutex);
+}
+
+static MMContext *
+mm_context_new_full (const OrtThreadingOptions *threading_options,
+                     GError **error)
 {
   MMRealContext *context;
   const OrtApiBase *base;
@@ -29,9 +124,30 @@ mm_context_new (GError **error)
 
   base = OrtGetApiBase ();
   api = base->GetApi (ORT_API_VERSION);
-  status = api->CreateEnv (ORT_LOGGING_LEVEL_FATAL, "ort", &env);
+  g_mutex_lock (&mm_context_env_mutex);
+  if (threading_options && (mm_context_env_users > 0)
+      && !mm_context_env_global_thread_pools)
+    {
+      g_mutex_unlock (&mm_context_env_mutex);
+      g_set_error (error, MM_CONTEXT_ERROR, MM_CONTEXT_ERROR_ENV,
+                   "ORT environment already exists without global thread "
+                   "pools.");
+      g_free (context);
+      return NULL;
+    }
+  if (threading_options)
+    status = api->CreateEnvWithGlobalThreadPools (
+        ORT_LOGGING_LEVEL_FATAL, "ort", threading_options, &env);
+  else
+    status = api->CreateEnv (ORT_LOGGING_LEVEL_FATAL, "ort", &env);
   if (status)
-    goto on_ort_error;
+    {
+      g_mutex_unlock (&mm_context_env_mutex);
+      goto on_ort_error;
+    }
+  if (mm_context_env_users++ == 0)
+    mm_context_env_global_thread_pools = threading_options != NULL;
+  g_mutex_unlock (&mm_context_env_mutex);
 
   status = api->GetAllocatorWithDefaultOptions (&allocator);
   if (status)
@@ -44,7 +160,19 @@ mm_context_new (GError **error)
 
   context->api = api;
   context->env = env;
-  context->allocator = allocator;
+  context->global_thread_pools = threading_options != NULL;
+  context->default_allocator = allocator;
+  context->memory_usage = 0;
+  context->memory_budget = 0;
+  context->memory_policy = MM_MEMORY_POLICY_REJECT;
+  g_mutex_init (&context->memory_mutex);
+  g_cond_init (&context->memory_cond);
+  context->evict_entries = g_array_new (FALSE, FALSE,
+                                        sizeof (MMMemoryEvictEntry));
+  context->evict_next_id = 1;
+  g_rec_mutex_init (&context->evict_mutex);
+  context->allocator
+      = mm_context_wrap_allocator ((MMContext *)context, allocator);
   g_atomic_ref_count_init (&context->ref_count);
 
   return (MMContext *)context;
@@ -53,11 +181,57 @@ on_ort_error:
                api->GetErrorMessage (status));
   api->ReleaseStatus (status);
   if (env)
-    api->ReleaseEnv (env);
+    mm_context_release_env (api, env);
   g_free (context);
   return NULL;
 }
 
+MMContext *
+mm_context_new (GError **error)
+{
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+  return mm_context_new_full (NULL, error);
+}
+
+MMContext *
+mm_context_new_with_global_thread_pools (int intra_op_threads,
+                                         int inter_op_threads, GError **error)
+{
+  const OrtApi *api;
+  OrtThreadingOptions *threading_options = NULL;
+  MMContext *context;
+  OrtStatus *status;
+  g_return_val_if_fail (intra_op_threads >= 0, NULL);
+  g_return_val_if_fail (inter_op_threads >= 0, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  api = OrtGetApiBase ()->GetApi (ORT_API_VERSION);
+  status = api->CreateThreadingOptions (&threading_options);
+  if (status)
+    goto on_ort_error;
+
+  status = api->SetGlobalIntraOpNumThreads (threading_options,
+                                            intra_op_threads);
+  if (status)
+    goto on_ort_error;
+
+  status = api->SetGlobalInterOpNumThreads (threading_options,
+                                            inter_op_threads);
+  if (status)
+    goto on_ort_error;
+
+  context = mm_context_new_full (threading_options, error);
+  api->ReleaseThreadingOptions (threading_options);
+  return context;
+on_ort_error:
+  g_set_error (error, MM_ORT_ERROR, api->GetErrorCode (status), "%s",
+               api->GetErrorMessage (status));
+  api->ReleaseStatus (status);
+  if (threading_options)
+    api->ReleaseThreadingOptions (threading_options);
+  return NULL;
+}
+
 void
 mm_context_ref (MMContext *context)
 {
@@ -77,7 +251,12 @@ mm_context_unref (MMContext *context)
       rcontext->api->ReleaseAvailableProviders (
           rcontext->execution_providers, rcontext->execution_providers_length)
       == NULL);
-  rcontext->api->ReleaseEnv (rcontext->env);
+  mm_context_release_env (rcontext->api, rcontext->env);
+  mm_context_unwrap_allocator (context, rcontext->allocator);
+  g_array_unref (rcontext->evict_entries);
+  g_rec_mutex_clear (&rcontext->evict_mutex);
+  g_cond_clear (&rcontext->memory_cond);
+  g_mutex_clear (&rcontext->memory_mutex);
   g_free (context);
 }
 
@@ -102,3 +281,273 @@ mm_context_get_available_execution_provider (MMContext *context)
     g_strv_builder_add (builder, rcontext->execution_providers[k]);
   return g_strv_builder_unref_to_strv (builder);
 }
+
+gboolean
+mm_context_has_global_thread_pools (MMContext *context)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  g_return_val_if_fail (rcontext, FALSE);
+  return rcontext->global_thread_pools;
+}
+
+OrtAllocator *
+mm_context_wrap_allocator (MMContext *context, OrtAllocator *allocator)
+{
+  MMTrackedAllocator *tracked;
+  g_return_val_if_fail (context, NULL);
+  g_return_val_if_fail (allocator, NULL);
+
+  /* Members added by later API versions, such as Reserve, stay NULL. */
+  tracked = g_new0 (MMTrackedAllocator, 1);
+  tracked->parent.version = ORT_API_VERSION;
+  tracked->parent.Alloc = mm_tracked_allocator_alloc;
+  tracked->parent.Free = mm_tracked_allocator_free;
+  tracked->parent.Info = mm_tracked_allocator_info;
+  tracked->allocator = allocator;
+  tracked->context = (MMRealContext *)context;
+  tracked->sizes = g_hash_table_new (NULL, NULL);
+  g_mutex_init (&tracked->mutex);
+  return (OrtAllocator *)tracked;
+}
+
+void
+mm_context_unwrap_allocator (MMContext *context, OrtAllocator *allocator)
+{
+  MMTrackedAllocator *tracked = (MMTrackedAllocator *)allocator;
+  g_return_if_fail (context);
+  g_return_if_fail (tracked);
+
+  g_hash_table_unref (tracked->sizes);
+  g_mutex_clear (&tracked->mutex);
+  g_free (tracked);
+}
+
+void
+mm_context_set_memory_budget (MMContext *context, size_t budget,
+                              MMMemoryPolicy policy)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  g_return_if_fail (rcontext);
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  rcontext->memory_budget = budget;
+  rcontext->memory_policy = policy;
+  g_cond_broadcast (&rcontext->memory_cond);
+  g_mutex_unlock (&rcontext->memory_mutex);
+}
+
+size_t
+mm_context_get_memory_budget (MMContext *context)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  size_t budget;
+  g_return_val_if_fail (rcontext, 0);
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  budget = rcontext->memory_budget;
+  g_mutex_unlock (&rcontext->memory_mutex);
+  return budget;
+}
+
+size_t
+mm_context_get_memory_usage (MMContext *context)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  size_t usage;
+  g_return_val_if_fail (rcontext, 0);
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  usage = rcontext->memory_usage;
+  g_mutex_unlock (&rcontext->memory_mutex);
+  return usage;
+}
+
+void
+mm_context_charge_memory (MMContext *context, size_t size)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  g_return_if_fail (rcontext);
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  rcontext->memory_usage += size;
+  g_mutex_unlock (&rcontext->memory_mutex);
+}
+
+void
+mm_context_release_memory (MMContext *context, size_t size)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  g_return_if_fail (rcontext);
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  g_warn_if_fail (rcontext->memory_usage >= size);
+  rcontext->memory_usage -= MIN (size, rcontext->memory_usage);
+  g_cond_broadcast (&rcontext->memory_cond);
+  g_mutex_unlock (&rcontext->memory_mutex);
+}
+
+guint
+mm_context_add_memory_evict_func (MMContext *context, MMMemoryEvictFunc func,
+                                  gpointer user_data)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  MMMemoryEvictEntry entry;
+  g_return_val_if_fail (rcontext, 0);
+  g_return_val_if_fail (func, 0);
+
+  g_rec_mutex_lock (&rcontext->evict_mutex);
+  entry.id = rcontext->evict_next_id++;
+  entry.func = func;
+  entry.user_data = user_data;
+  g_array_append_val (rcontext->evict_entries, entry);
+  g_rec_mutex_unlock (&rcontext->evict_mutex);
+  return entry.id;
+}
+
+void
+mm_context_remove_memory_evict_func (MMContext *context, guint id)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  g_return_if_fail (rcontext);
+
+  g_rec_mutex_lock (&rcontext->evict_mutex);
+  for (guint k = 0; k < rcontext->evict_entries->len; k++)
+    {
+      MMMemoryEvictEntry *entry
+          = &g_array_index (rcontext->evict_entries, MMMemoryEvictEntry, k);
+      if (entry->id != id)
+        continue;
+      g_array_remove_index (rcontext->evict_entries, k);
+      break;
+    }
+  g_rec_mutex_unlock (&rcontext->evict_mutex);
+}
+
+/* Calls evict functions until size bytes are freed. */
+static void
+mm_context_evict (MMRealContext *rcontext, size_t size)
+{
+  g_rec_mutex_lock (&rcontext->evict_mutex);
+  for (guint k = 0; (k < rcontext->evict_entries->len) && size; k++)
+    {
+      MMMemoryEvictEntry entry
+          = g_array_index (rcontext->evict_entries, MMMemoryEvictEntry, k);
+      size -= MIN (entry.func (size, entry.user_data), size);
+    }
+  g_rec_mutex_unlock (&rcontext->evict_mutex);
+}
+
+/*
+ * Returns TRUE if size bytes fit the budget, evicting caches if they do not.
+ * Called with memory_mutex held, which is released while evicting.
+ */
+static gboolean
+mm_context_fit_memory (MMRealContext *rcontext, size_t size)
+{
+  size_t budget = rcontext->memory_budget;
+  size_t deficit;
+
+  if ((budget == 0) || (rcontext->memory_usage + size <= budget))
+    return TRUE;
+  if (size > budget)
+    return FALSE;
+
+  /* Read under the mutex, as other threads change usage once unlocked */
+  deficit = rcontext->memory_usage + size - budget;
+  g_mutex_unlock (&rcontext->memory_mutex);
+  mm_context_evict (rcontext, deficit);
+  g_mutex_lock (&rcontext->memory_mutex);
+  budget = rcontext->memory_budget;
+  return (budget == 0) || (rcontext->memory_usage + size <= budget);
+}
+
+static void
+mm_context_set_budget_error (MMRealContext *rcontext, size_t size,
+                             GError **error)
+{
+  g_set_error (error, MM_CONTEXT_ERROR, MM_CONTEXT_ERROR_BUDGET,
+               "%" G_GSIZE_FORMAT " bytes do not fit memory budget (%"
+               G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes used).",
+               size, rcontext->memory_usage, rcontext->memory_budget);
+}
+
+gboolean
+mm_context_check_memory (MMContext *context, size_t size, GError **error)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  gboolean fit;
+  g_return_val_if_fail (rcontext, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  fit = mm_context_fit_memory (rcontext, size);
+  if (!fit)
+    mm_context_set_budget_error (rcontext, size, error);
+  g_mutex_unlock (&rcontext->memory_mutex);
+  return fit;
+}
+
+gboolean
+mm_context_reserve_memory (MMContext *context, size_t size, GError **error)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  gboolean fit;
+  g_return_val_if_fail (rcontext, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  fit = mm_context_fit_memory (rcontext, size);
+  if (fit)
+    rcontext->memory_usage += size;
+  else
+    mm_context_set_budget_error (rcontext, size, error);
+  g_mutex_unlock (&rcontext->memory_mutex);
+  return fit;
+}
+
+static void
+mm_context_memory_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+  MMRealContext *rcontext = user_data;
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  g_cond_broadcast (&rcontext->memory_cond);
+  g_mutex_unlock (&rcontext->memory_mutex);
+}
+
+gboolean
+mm_context_admit_memory (MMContext *context, size_t size,
+                         GCancellable *cancellable, GError **error)
+{
+  MMRealContext *rcontext = (MMRealContext *)context;
+  gulong cancelled_id = 0;
+  gboolean fit;
+  g_return_val_if_fail (rcontext, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (cancellable)
+    cancelled_id = g_cancellable_connect (
+        cancellable, G_CALLBACK (mm_context_memory_cancelled), rcontext,
+        NULL);
+
+  g_mutex_lock (&rcontext->memory_mutex);
+  for (;;)
+    {
+      fit = mm_context_fit_memory (rcontext, size);
+      if (fit || (rcontext->memory_policy != MM_MEMORY_POLICY_WAIT)
+          || (size > rcontext->memory_budget))
+        break;
+      if (cancellable && g_cancellable_is_cancelled (cancellable))
+        break;
+      g_cond_wait (&rcontext->memory_cond, &rcontext->memory_mutex);
+    }
+  if (fit)
+    rcontext->memory_usage += size;
+  else if (!g_cancellable_set_error_if_cancelled (cancellable, error))
+    mm_context_set_budget_error (rcontext, size, error);
+  g_mutex_unlock (&rcontext->memory_mutex);
+
+  if (cancelled_id)
+    g_cancellable_disconnect (cancellable, cancelled_id);
+  return fit;
+}
@@ -0,0 +1,405 @@
+#include "mm-convert.h"
+
+#include "mm-value-info.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MM_CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*MMConvertFunc) (gpointer dst, gconstpointer src, size_t count);
+
+typedef struct _MMConvertKernels MMConvertKernels;
+
+struct _MMConvertKernels
+{
+  MMConvertFunc float_to_half;
+  MMConvertFunc half_to_float;
+  MMConvertFunc float_to_bfloat;
+  MMConvertFunc bfloat_to_float;
+  MMConvertFunc int32_to_int64;
+  MMConvertFunc int64_to_int32;
+};
+
+static MMConvertKernels kernels;
+
+static guint16
+mm_convert_float_to_half_scalar (float value)
+{
+  guint32 x;
+  guint32 sign;
+  guint32 mantissa;
+  guint32 half;
+  guint32 rest;
+  guint32 middle;
+  guint shift;
+  gint exponent;
+
+  memcpy (&x, &value, sizeof (x));
+  sign = (x >> 16) & 0x8000;
+  mantissa = x & 0x7fffff;
+  exponent = (gint)((x >> 23) & 0xff);
+
+  /* Inf and NaN. NaN stays quiet NaN. */
+  if (exponent == 0xff)
+    return sign | 0x7c00 | (mantissa ? 0x200 | (mantissa >> 13) : 0);
+
+  exponent = exponent - 127 + 15;
+  if (exponent >= 0x1f)
+    return sign | 0x7c00;
+
+  if (exponent > 0)
+    {
+      shift = 13;
+      half = ((guint32)exponent << 10) | (mantissa >> 13);
+    }
+  else
+    {
+      /* Subnormal, or too small to be represented. */
+      if (exponent < -10)
+        return sign;
+      mantissa |= 0x800000;
+      shift = 14 - exponent;
+      half = mantissa >> shift;
+    }
+
+  /* Carry into the exponent is fine, and makes Inf on overflow. */
+  rest = mantissa & ((1u << shift) - 1);
+  middle = 1u << (shift - 1);
+  if ((rest > middle) || ((rest == middle) && (half & 1)))
+    half++;
+  return sign | half;
+}
+
+static float
+mm_convert_half_to_float_scalar (guint16 value)
+{
+  guint32 sign = (guint32)(value & 0x8000) << 16;
+  guint32 exponent = (value >> 10) & 0x1f;
+  guint32 mantissa = value & 0x3ff;
+  guint32 x;
+  float result;
+
+  if (exponent == 0x1f)
+    x = sign | 0x7f800000 | (mantissa << 13);
+  else if (exponent)
+    x = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  else if (mantissa == 0)
+    x = sign;
+  else
+    {
+      /* Subnormal half is normal float. */
+      exponent = 127 - 15 + 1;
+      while ((mantissa & 0x400) == 0)
+        {
+          mantissa <<= 1;
+          exponent--;
+        }
+      x = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+  memcpy (&result, &x, sizeof (result));
+  return result;
+}
+
+static guint16
+mm_convert_float_to_bfloat_scalar (float value)
+{
+  guint32 x;
+
+  memcpy (&x, &value, sizeof (x));
+  if ((x & 0x7fffffff) > 0x7f800000)
+    return (x >> 16) | 0x40;
+  return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+static void
+mm_convert_float_to_half_c (gpointer dst, gconstpointer src, size_t count)
+{
+  guint16 *d = dst;
+  const float *s = src;
+
+  for (size_t k = 0; k < count; k++)
+    d[k] = mm_convert_float_to_half_scalar (s[k]);
+}
+
+static void
+mm_convert_half_to_float_c (gpointer dst, gconstpointer src, size_t count)
+{
+  float *d = dst;
+  const guint16 *s = src;
+
+  for (size_t k = 0; k < count; k++)
+    d[k] = mm_convert_half_to_float_scalar (s[k]);
+}
+
+static void
+mm_convert_float_to_bfloat_c (gpointer dst, gconstpointer src, size_t count)
+{
+  guint16 *d = dst;
+  const float *s = src;
+
+  for (size_t k = 0; k < count; k++)
+    d[k] = mm_convert_float_to_bfloat_scalar (s[k]);
+}
+
+static void
+mm_convert_bfloat_to_float_c (gpointer dst, gconstpointer src, size_t count)
+{
+  guint32 *d = dst;
+  const guint16 *s = src;
+
+  for (size_t k = 0; k < count; k++)
+    d[k] = (guint32)s[k] << 16;
+}
+
+static void
+mm_convert_int32_to_int64_c (gpointer dst, gconstpointer src, size_t count)
+{
+  int64_t *d = dst;
+  const int32_t *s = src;
+
+  for (size_t k = 0; k < count; k++)
+    d[k] = s[k];
+}
+
+static void
+mm_convert_int64_to_int32_c (gpointer dst, gconstpointer src, size_t count)
+{
+  int32_t *d = dst;
+  const int64_t *s = src;
+
+  for (size_t k = 0; k < count; k++)
+    d[k] = (int32_t)s[k];
+}
+
+#ifdef MM_CONVERT_X86
+__attribute__ ((target ("avx,f16c"))) static void
+mm_convert_float_to_half_f16c (gpointer dst, gconstpointer src, size_t count)
+{
+  guint16 *d = dst;
+  const float *s = src;
+  size_t k = 0;
+
+  for (; k + 8 <= count; k += 8)
+    _mm_storeu_si128 ((__m128i *)(d + k),
+                      _mm256_cvtps_ph (_mm256_loadu_ps (s + k),
+                                       _MM_FROUND_TO_NEAREST_INT));
+  mm_convert_float_to_half_c (d + k, s + k, count - k);
+}
+
+__attribute__ ((target ("avx,f16c"))) static void
+mm_convert_half_to_float_f16c (gpointer dst, gconstpointer src, size_t count)
+{
+  float *d = dst;
+  const guint16 *s = src;
+  size_t k = 0;
+
+  for (; k + 8 <= count; k += 8)
+    _mm256_storeu_ps (d + k, _mm256_cvtph_ps (
+                                 _mm_loadu_si128 ((const __m128i *)(s + k))));
+  mm_convert_half_to_float_c (d + k, s + k, count - k);
+}
+
+__attribute__ ((target ("avx512f"))) static void
+mm_convert_float_to_half_avx512 (gpointer dst, gconstpointer src,
+                                 size_t count)
+{
+  guint16 *d = dst;
+  const float *s = src;
+  size_t k = 0;
+
+  for (; k + 16 <= count; k += 16)
+    _mm256_storeu_si256 (
+        (__m256i *)(d + k),
+        _mm512_cvtps_ph (_mm512_loadu_ps (s + k),
+                         _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  mm_convert_float_to_half_c (d + k, s + k, count - k);
+}
+
+__attribute__ ((target ("avx512f"))) static void
+mm_convert_half_to_float_avx512 (gpointer dst, gconstpointer src,
+                                 size_t count)
+{
+  float *d = dst;
+  const guint16 *s = src;
+  size_t k = 0;
+
+  for (; k + 16 <= count; k += 16)
+    _mm512_storeu_ps (d + k, _mm512_cvtph_ps (_mm256_loadu_si256 (
+                                 (const __m256i *)(s + k))));
+  mm_convert_half_to_float_c (d + k, s + k, count - k);
+}
+
+__attribute__ ((target ("avx2"))) static void
+mm_convert_float_to_bfloat_avx2 (gpointer dst, gconstpointer src,
+                                 size_t count)
+{
+  guint16 *d = dst;
+  const float *s = src;
+  const __m256i bias = _mm256_set1_epi32 (0x7fff);
+  const __m256i one = _mm256_set1_epi32 (1);
+  const __m256i quiet = _mm256_set1_epi32 (0x40);
+  size_t k = 0;
+
+  for (; k + 8 <= count; k += 8)
+    {
+      __m256 v = _mm256_loadu_ps (s + k);
+      __m256i x = _mm256_castps_si256 (v);
+      __m256i nan = _mm256_castps_si256 (_mm256_cmp_ps (v, v, _CMP_UNORD_Q));
+      __m256i lsb = _mm256_and_si256 (_mm256_srli_epi32 (x, 16), one);
+      __m256i rounded = _mm256_srli_epi32 (
+          _mm256_add_epi32 (_mm256_add_epi32 (x, bias), lsb), 16);
+      __m256i quieted = _mm256_or_si256 (_mm256_srli_epi32 (x, 16), quiet);
+      __m256i r = _mm256_blendv_epi8 (rounded, quieted, nan);
+
+      /* Packing works per 128-bit lane, so lanes are reordered after. */
+      r = _mm256_permute4x64_epi64 (_mm256_packus_epi32 (r, r), 0xd8);
+      _mm_storeu_si128 ((__m128i *)(d + k), _mm256_castsi256_si128 (r));
+    }
+  mm_convert_float_to_bfloat_c (d + k, s + k, count - k);
+}
+
+__attribute__ ((target ("avx2"))) static void
+mm_convert_bfloat_to_float_avx2 (gpointer dst, gconstpointer src,
+                                 size_t count)
+{
+  guint32 *d = dst;
+  const guint16 *s = src;
+  size_t k = 0;
+
+  for (; k + 8 <= count; k += 8)
+    {
+      __m256i x = _mm256_cvtepu16_epi32 (
+          _mm_loadu_si128 ((const __m128i *)(s + k)));
+      _mm256_storeu_si256 ((__m256i *)(d + k), _mm256_slli_epi32 (x, 16));
+    }
+  mm_convert_bfloat_to_float_c (d + k, s + k, count - k);
+}
+
+__attribute__ ((target ("avx2"))) static void
+mm_convert_int32_to_int64_avx2 (gpointer dst, gconstpointer src, size_t count)
+{
+  int64_t *d = dst;
+  const int32_t *s = src;
+  size_t k = 0;
+
+  for (; k + 4 <= count; k += 4)
+    _mm256_storeu_si256 ((__m256i *)(d + k),
+                         _mm256_cvtepi32_epi64 (
+                             _mm_loadu_si128 ((const __m128i *)(s + k))));
+  mm_convert_int32_to_int64_c (d + k, s + k, count - k);
+}
+
+__attribute__ ((target ("avx2"))) static void
+mm_convert_int64_to_int32_avx2 (gpointer dst, gconstpointer src, size_t count)
+{
+  int32_t *d = dst;
+  const int64_t *s = src;
+  const __m256i index = _mm256_setr_epi32 (0, 2, 4, 6, 1, 3, 5, 7);
+  size_t k = 0;
+
+  for (; k + 4 <= count; k += 4)
+    {
+      __m256i x = _mm256_loadu_si256 ((const __m256i *)(s + k));
+      x = _mm256_permutevar8x32_epi32 (x, index);
+      _mm_storeu_si128 ((__m128i *)(d + k), _mm256_castsi256_si128 (x));
+    }
+  mm_convert_int64_to_int32_c (d + k, s + k, count - k);
+}
+#endif
+
+static void
+mm_convert_init (void)
+{
+  static gsize initialized = 0;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  kernels.float_to_half = mm_convert_float_to_half_c;
+  kernels.half_to_float = mm_convert_half_to_float_c;
+  kernels.float_to_bfloat = mm_convert_float_to_bfloat_c;
+  kernels.bfloat_to_float = mm_convert_bfloat_to_float_c;
+  kernels.int32_to_int64 = mm_convert_int32_to_int64_c;
+  kernels.int64_to_int32 = mm_convert_int64_to_int32_c;
+
+#ifdef MM_CONVERT_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx") && __builtin_cpu_supports ("f16c"))
+    {
+      kernels.float_to_half = mm_convert_float_to_half_f16c;
+      kernels.half_to_float = mm_convert_half_to_float_f16c;
+    }
+  if (__builtin_cpu_supports ("avx512f"))
+    {
+      kernels.float_to_half = mm_convert_float_to_half_avx512;
+      kernels.half_to_float = mm_convert_half_to_float_avx512;
+    }
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      kernels.float_to_bfloat = mm_convert_float_to_bfloat_avx2;
+      kernels.bfloat_to_float = mm_convert_bfloat_to_float_avx2;
+      kernels.int32_to_int64 = mm_convert_int32_to_int64_avx2;
+      kernels.int64_to_int32 = mm_convert_int64_to_int32_avx2;
+    }
+#endif
+
+  g_once_init_leave (&initialized, 1);
+}
+
+static MMConvertFunc
+mm_convert_get_func (ONNXTensorElementDataType dst_dtype,
+                     ONNXTensorElementDataType src_dtype)
+{
+  mm_convert_init ();
+
+#define MM_CONVERT_CASE(dst, src, func)                                       \
+  if ((dst_dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_##dst)                      \
+      && (src_dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_##src))                  \
+    return kernels.func;
+
+  MM_CONVERT_CASE (FLOAT16, FLOAT, float_to_half);
+  MM_CONVERT_CASE (FLOAT, FLOAT16, half_to_float);
+  MM_CONVERT_CASE (BFLOAT16, FLOAT, float_to_bfloat);
+  MM_CONVERT_CASE (FLOAT, BFLOAT16, bfloat_to_float);
+  MM_CONVERT_CASE (INT64, INT32, int32_to_int64);
+  MM_CONVERT_CASE (INT32, INT64, int64_to_int32);
+#undef MM_CONVERT_CASE
+
+  return NULL;
+}
+
+gboolean
+mm_convert_is_supported (ONNXTensorElementDataType dst_dtype,
+                         ONNXTensorElementDataType src_dtype)
+{
+  if (dst_dtype == src_dtype)
+    return mm_value_info_get_dtype_size (dst_dtype) > 0;
+  return mm_convert_get_func (dst_dtype, src_dtype) != NULL;
+}
+
+gboolean
+mm_convert (gpointer dst, ONNXTensorElementDataType dst_dtype,
+            gconstpointer src, ONNXTensorElementDataType src_dtype,
+            size_t count)
+{
+  MMConvertFunc func;
+  g_return_val_if_fail (dst || (count == 0), FALSE);
+  g_return_val_if_fail (src || (count == 0), FALSE);
+
+  if (dst_dtype == src_dtype)
+    {
+      size_t size = mm_value_info_get_dtype_size (dst_dtype);
+      if (size == 0)
+        return FALSE;
+      memcpy (dst, src, count * size);
+      return TRUE;
+    }
+
+  func = mm_convert_get_func (dst_dtype, src_dtype);
+  if (func == NULL)
+    return FALSE;
+  func (dst, src, count);
+  return TRUE;
+}
@@ -1,5 +1,10 @@
 
+#include <errno.h>
 #include <gio/gio.h>
+#ifdef G_OS_UNIX
+#include <gio/gfiledescriptorbased.h>
+#include <unistd.h>
+#endif
 
 #include "mm-file.h"
 
@@ -12,9 +17,17 @@ typedef enum
 
 typedef enum
 {
-  MM_FILE_SUBVERSION_ALPHA
+  MM_FILE_SUBVERSION_ALPHA,
+  /* Adds dtype and aligns tensor data, so the file can be mapped. */
+  MM_FILE_SUBVERSION_BETA,
+  /* Adds quantization parameters. */
+  MM_FILE_SUBVERSION_GAMMA
 } MMFileSubversion;
 
+/* Alignment of tensor data from the beginning of the file. */
+#define MM_FILE_DATA_ALIGNMENT 64
+#define MM_FILE_ALIGN(x, a) (((x) + (a) - 1) & ~(size_t)((a) - 1))
+
 typedef struct _MMFileHeader
 {
   MMFileVersion version;
@@ -38,14 +51,96 @@ typedef struct _MMFileHeaderValueAlpha
   uint64_t data_offset;
 } MMFileHeaderValueAlpha;
 
+typedef struct _MMFileHeaderValueBeta
+{
+  uint64_t ndim;
+  uint64_t input_name_len;
+  uint64_t output_name_len;
+  uint64_t data_size;
+  uint64_t dim_offset;
+  uint64_t input_name_offset;
+  uint64_t output_name_offset;
+  uint64_t data_offset;
+  uint64_t dtype;
+} MMFileHeaderValueBeta;
+
+typedef struct _MMFileHeaderValueGamma
+{
+  uint64_t ndim;
+  uint64_t input_name_len;
+  uint64_t output_name_len;
+  uint64_t data_size;
+  uint64_t dim_offset;
+  uint64_t input_name_offset;
+  uint64_t output_name_offset;
+  uint64_t data_offset;
+  uint64_t dtype;
+  /* ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED if data is not quantized */
+  uint64_t dequantized_dtype;
+  uint64_t granularity;
+  int64_t axis;
+  int64_t block_size;
+  uint64_t nscales;
+  uint64_t scales_offset;
+  uint64_t zero_points_offset;
+} MMFileHeaderValueGamma;
+
 typedef struct _MMFileHeaderValueDataAlpha
 {
   uint64_t *dim;
   gchar *input_name;
   gchar *output_name;
   void *data;
+  /* Read only if data is quantized */
+  float *scales;
+  guint8 *zero_points;
 } MMFileHeaderValueDataAlpha;
 
+/* mm_file_write_async() reports progress and checks cancellation per chunk */
+#define MM_FILE_WRITE_CHUNK (4 << 20)
+
+/* Magic of records appended by mm_file_append() */
+#define MM_FILE_DELTA_MAGIC "MMDELTA\0"
+
+/*
+ * Appended after the base file, and followed by size bytes of
+ * MMFileDeltaValue, name, dim and data for each value.
+ */
+typedef struct _MMFileDeltaHeader
+{
+  char magic[8];
+  uint64_t nvalues;
+  uint64_t size;
+} MMFileDeltaHeader;
+
+/*
+ * Rows [start, dim[axis]) of axis of a value whose shape is now dim.
+ * Rows from start of the previous state are discarded, and start 0
+ * replaces the whole value. Data is laid out as a tensor with rows of
+ * axis limited to the appended ones.
+ */
+typedef struct _MMFileDeltaValue
+{
+  uint64_t name_len;
+  /* TRUE if name is output name */
+  uint64_t output;
+  uint64_t dtype;
+  uint64_t ndim;
+  uint64_t axis;
+  int64_t start;
+  uint64_t data_size;
+} MMFileDeltaValue;
+
+/*
+ * Shape of a value at the last checkpoint. Rows changed since then are
+ * tracked by the value (See mm_value_get_dirty_row()).
+ */
+typedef struct _MMFileCheckpoint
+{
+  size_t ndim;
+  int64_t dim[];
+} MMFileCheckpoint;
+
 /*
  * MMFile - utilities for saving Moduler Model stuff
  *
@@ -55,13 +150,33 @@ typedef struct _MMFileHeaderValueDataAlpha
  * File structure (with current version implementation):
  *  - version header (MMFileHeader)
  *  - version specific header (MMFileHeaderAlpha)
- *  - version specific variable length header (MMFileHeaderValueAlpha)
- *  - data
+ *  - version specific variable length header (MMFileHeaderValueGamma)
+ *  - dim, names, and scales and zero points of quantized values
+ *  - data, aligned to MM_FILE_DATA_ALIGNMENT from the beginning of the file
+ *  - delta records appended by mm_file_append() (MMFileDeltaHeader)
  */
 struct _MMFile
 {
   GFile *file;
   GPtrArray *value_array;
+  /* Kept while OrtValues created by mm_file_map() are alive */
+  GMappedFile *mapped_file;
+  /* MMFileCheckpoint of values in the file, keyed by MMValue */
+  GHashTable *checkpoints;
+  /* Axis of the last mm_file_append(), along which rows are marked */
+  size_t delta_axis;
+  /*
+   * Number of mm_file_write_async() in flight. Their checkpoints replace
+   * later ones, so rows are not marked clean meanwhile.
+   */
+  gint pending_writes;
+  /* Bytes of data in the base file, and in delta records */
+  guint64 base_size;
+  guint64 delta_size;
+  /* Buffer of the last mm_file_write_async(), reused by the next one */
+  GMutex mutex;
+  guint8 *spare_buffer;
+  size_t spare_size;
   gatomicrefcount ref_count;
 };
 
@@ -72,8 +187,18 @@ mm_file_new (const gchar *path)
 
   file = g_new (MMFile, 1);
   file->file = g_file_new_for_path (path);
+  file->mapped_file = NULL;
   file->value_array
       = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_value_unref);
+  file->checkpoints
+      = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  file->delta_axis = 0;
+  file->pending_writes = 0;
+  file->base_size = 0;
+  file->delta_size = 0;
+  g_mutex_init (&file->mutex);
+  file->spare_buffer = NULL;
+  file->spare_size = 0;
   g_atomic_ref_count_init (&file->ref_count);
   return file;
 }
@@ -92,7 +217,11 @@ mm_file_unref (MMFile *file)
   if (!g_atomic_ref_count_dec (&file->ref_count))
     return;
 
+  g_free (file->spare_buffer);
+  g_mutex_clear (&file->mutex);
+  g_hash_table_unref (file->checkpoints);
   g_ptr_array_unref (file->value_array);
+  g_clear_pointer (&file->mapped_file, g_mapped_file_unref);
   g_object_unref (file->file);
   g_free (file);
 }
@@ -118,56 +247,153 @@ mm_file_remove_value (MMFile *file, MMValue *value)
 
   if (!g_ptr_array_find (file->value_array, value, &idx))
     return;
+  g_hash_table_remove (file->checkpoints, value);
   g_ptr_array_remove_index (file->value_array, idx);
 }
 
-gboolean
-mm_file_write (MMFile *file, GError **error)
+/* Splits dim at axis into outer blocks of rows of row_size bytes. */
+static void
+mm_file_get_rows (const int64_t *dim, size_t ndim, size_t axis,
+                  size_t element_size, size_t *outer, size_t *row_size)
+{
+  *outer = 1;
+  *row_size = element_size;
+  for (size_t k = 0; k < ndim; k++)
+    {
+      if (k < axis)
+        *outer *= dim[k];
+      else if (k > axis)
+        *row_size *= dim[k];
+    }
+}
+
+/* Returns TRUE if shape is concrete, and has no elements. */
+static gboolean
+mm_file_is_empty (const int64_t *dim, size_t ndim)
+{
+  gboolean empty = FALSE;
+
+  for (size_t k = 0; k < ndim; k++)
+    {
+      if (dim[k] < 0)
+        return FALSE;
+      empty = empty || (dim[k] == 0);
+    }
+  return empty;
+}
+
+/* Remembers shape of value as written to the file */
+static MMFileCheckpoint *
+mm_file_checkpoint_new (MMValue *value)
+{
+  MMValueInfo *info = value->info;
+  MMFileCheckpoint *checkpoint;
+
+  checkpoint = g_malloc (sizeof (MMFileCheckpoint)
+                         + sizeof (int64_t) * info->ndim);
+  checkpoint->ndim = info->ndim;
+  memcpy (checkpoint->dim, info->dim, sizeof (int64_t) * info->ndim);
+  return checkpoint;
+}
+
+/* Remembers current shape of value, and marks its rows as written. */
+static void
+mm_file_set_checkpoint (MMFile *file, MMValue *value)
+{
+  g_hash_table_insert (file->checkpoints, value,
+                       mm_file_checkpoint_new (value));
+  if (g_atomic_int_get (&file->pending_writes) == 0)
+    mm_value_mark_clean (value, file->delta_axis);
+}
+
+/* Headers and data of values to write, as output vectors */
+typedef struct _MMFileImage
 {
-  GFileOutputStream *stream;
-  GArray *data = NULL;
   MMFileHeader header;
   MMFileHeaderAlpha header_alpha;
-  MMFileHeaderValueAlpha *header_value_alpha = NULL;
-  MMValue **valid_values = NULL;
+  MMFileHeaderValueGamma *header_value;
+  MMValue **values;
+  size_t nvalues;
+  /* GOutputVector pointing to headers and into values */
+  GArray *vectors;
+} MMFileImage;
+
+static void
+mm_file_image_clear (MMFileImage *image)
+{
+  g_free (image->values);
+  g_free (image->header_value);
+  g_clear_pointer (&image->vectors, g_array_unref);
+}
+
+static gboolean
+mm_file_image_init (MMFile *file, MMFileImage *image, GError **error)
+{
+  static const guint8 padding[MM_FILE_DATA_ALIGNMENT] = { 0 };
+  GArray *data;
+  MMFileHeaderValueGamma *header_value;
+  MMValue **valid_values;
   size_t valid_value_count = 0;
+  size_t base_offset;
   size_t offset = 0;
-  g_return_val_if_fail (file, FALSE);
-  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
-
-  stream = g_file_replace (
-      file->file, NULL, FALSE,
-      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL, error);
-  if (stream == NULL)
-    return FALSE;
 
   data = g_array_sized_new (FALSE, FALSE, sizeof (GOutputVector),
-                            3 + 4 * file->value_array->len);
+                            3 + 9 * file->value_array->len);
+  image->vectors = data;
 
-  header.version = MM_FILE_VERSION_ALPHA;
-  header.subversion = MM_FILE_SUBVERSION_ALPHA;
-  g_array_append_val (data, ((GOutputVector){ &header, sizeof (header) }));
-
-  header_alpha.nvalues = file->value_array->len;
+  image->header.version = MM_FILE_VERSION_ALPHA;
+  image->header.subversion = MM_FILE_SUBVERSION_GAMMA;
   g_array_append_val (
-      data, ((GOutputVector){ &header_alpha, sizeof (header_alpha) }));
+      data, ((GOutputVector){ &image->header, sizeof (image->header) }));
 
-  header_value_alpha = g_new (MMFileHeaderValueAlpha, file->value_array->len);
   valid_values = g_new (MMValue *, file->value_array->len);
+  image->values = valid_values;
   for (size_t k = 0; k < file->value_array->len; k++)
     {
-      size_t nelements;
       MMValue *v = file->value_array->pdata[k];
-      MMFileHeaderValueAlpha *hv = header_value_alpha + valid_value_count;
-
-      nelements = mm_value_info_get_element_count (v->info);
-      if (nelements == 0)
+      /* Empty values are kept without data, unlike symbolic shapes */
+      if ((mm_value_info_get_element_count (v->info) == 0)
+          && !mm_file_is_empty (v->info->dim, v->info->ndim))
         continue;
+      valid_values[valid_value_count++] = v;
+    }
+  image->nvalues = valid_value_count;
+
+  image->header_alpha.nvalues = valid_value_count;
+  g_array_append_val (data,
+                      ((GOutputVector){ &image->header_alpha,
+                                        sizeof (image->header_alpha) }));
+
+  /* Offsets are relative to the end of headers, but alignment is not. */
+  base_offset = sizeof (image->header) + sizeof (image->header_alpha)
+                + sizeof (MMFileHeaderValueGamma) * valid_value_count;
+  header_value = g_new0 (MMFileHeaderValueGamma, valid_value_count);
+  image->header_value = header_value;
+  for (size_t k = 0; k < valid_value_count; k++)
+    {
+      MMValue *v = valid_values[k];
+      MMFileHeaderValueGamma *hv = header_value + k;
+      const MMQuantizeInfo *quantize_info;
+      ONNXTensorElementDataType dequantized_dtype;
 
       hv->ndim = v->info->ndim;
       hv->input_name_len = v->input_name ? strlen (v->input_name) : 0;
       hv->output_name_len = v->output_name ? strlen (v->output_name) : 0;
       hv->data_size = mm_value_info_get_data_size (v->info);
+      hv->dtype = v->info->dtype;
+
+      hv->dequantized_dtype = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+      quantize_info
+          = mm_value_get_quantize_info (v, &dequantized_dtype, NULL, NULL);
+      if (quantize_info)
+        {
+          hv->dequantized_dtype = dequantized_dtype;
+          hv->granularity = quantize_info->granularity;
+          hv->axis = quantize_info->axis;
+          hv->block_size = quantize_info->block_size;
+          hv->nscales = mm_quantize_get_scale_count (
+              quantize_info, v->info->dim, v->info->ndim);
+        }
 
       hv->dim_offset = offset;
       offset += sizeof (int64_t) * hv->ndim;
@@ -175,14 +401,21 @@ mm_file_write (MMFile *file, GError **error)
       offset += hv->input_name_len + 1;
       hv->output_name_offset = offset;
       offset += hv->output_name_len + 1;
+      offset = MM_FILE_ALIGN (offset, sizeof (float));
+      hv->scales_offset = offset;
+      offset += sizeof (float) * hv->nscales;
+      hv->zero_points_offset = offset;
+      offset += sizeof (guint8) * hv->nscales;
+      offset = MM_FILE_ALIGN (base_offset + offset, MM_FILE_DATA_ALIGNMENT)
+               - base_offset;
       hv->data_offset = offset;
       offset += hv->data_size;
-
-      valid_values[valid_value_count++] = v;
+      /* keep dim of the next value aligned */
+      offset = MM_FILE_ALIGN (offset, sizeof (int64_t));
     }
 
-  g_array_append_val (data, ((GOutputVector){ header_value_alpha,
-                                              sizeof (MMFileHeaderValueAlpha)
+  g_array_append_val (data, ((GOutputVector){ header_value,
+                                              sizeof (MMFileHeaderValueGamma)
                                                   * valid_value_count }));
 
   for (size_t k = 0; k < valid_value_count; k++)
@@ -190,78 +423,633 @@ mm_file_write (MMFile *file, GError **error)
       GOutputVector vec_dim;
       GOutputVector vec_input_name;
       GOutputVector vec_output_name;
+      GOutputVector vec_scales_padding;
+      GOutputVector vec_scales;
+      GOutputVector vec_zero_points;
+      GOutputVector vec_padding;
       GOutputVector vec_data;
-      void *tensor_data;
+      GOutputVector vec_data_padding;
+      gconstpointer tensor_data;
+      const float *scales = NULL;
+      const guint8 *zero_points = NULL;
       MMValue *v = valid_values[k];
-      MMFileHeaderValueAlpha *hv = header_value_alpha + k;
+      MMFileHeaderValueGamma *hv = header_value + k;
+
+      mm_value_get_quantize_info (v, NULL, &scales, &zero_points);
 
       vec_dim.buffer = v->info->dim;
       vec_dim.size = sizeof (int64_t) * hv->ndim;
       vec_input_name.buffer = v->input_name;
       vec_input_name.size = hv->input_name_len + 1;
-      vec_output_name.buffer = v->input_name;
+      vec_output_name.buffer = v->output_name;
       vec_output_name.size = hv->output_name_len + 1;
-      tensor_data = mm_value_get_data (v, error);
+      vec_scales_padding.buffer = padding;
+      vec_scales_padding.size
+          = hv->scales_offset
+            - (hv->output_name_offset + hv->output_name_len + 1);
+      vec_scales.buffer = scales;
+      vec_scales.size = sizeof (float) * hv->nscales;
+      vec_zero_points.buffer = zero_points;
+      vec_zero_points.size = sizeof (guint8) * hv->nscales;
+      vec_padding.buffer = padding;
+      vec_padding.size = hv->data_offset
+                         - (hv->zero_points_offset + hv->nscales);
+      tensor_data = hv->data_size ? mm_value_peek_data (v, error) : padding;
       if (tensor_data == NULL)
-        goto on_error;
+        {
+          mm_file_image_clear (image);
+          return FALSE;
+        }
       vec_data.buffer = tensor_data;
-      vec_data.size = mm_value_info_get_data_size (v->info);
+      vec_data.size = hv->data_size;
+      vec_data_padding.buffer = padding;
+      vec_data_padding.size = MM_FILE_ALIGN (hv->data_size, sizeof (int64_t))
+                              - hv->data_size;
 
       g_array_append_val (data, vec_dim);
+      /* Missing names are still written as "", so offsets stay valid */
       if (v->input_name)
         g_array_append_val (data, vec_input_name);
+      else
+        g_array_append_val (data, ((GOutputVector){ padding, 1 }));
       if (v->output_name)
         g_array_append_val (data, vec_output_name);
+      else
+        g_array_append_val (data, ((GOutputVector){ padding, 1 }));
+      g_array_append_val (data, vec_scales_padding);
+      if (hv->nscales)
+        {
+          g_array_append_val (data, vec_scales);
+          g_array_append_val (data, vec_zero_points);
+        }
+      g_array_append_val (data, vec_padding);
       g_array_append_val (data, vec_data);
+      g_array_append_val (data, vec_data_padding);
     }
 
-  if (!g_output_stream_writev (G_OUTPUT_STREAM (stream),
-                               (GOutputVector *)data->data, data->len, NULL,
-                               NULL, error))
+  return TRUE;
+}
+
+/*
+ * Closes stream without replacing the destination. Unref'ing an open
+ * stream would close it and replace the destination with partial data.
+ */
+static void
+mm_file_abort_stream (GFileOutputStream *stream)
+{
+  GCancellable *cancellable = g_cancellable_new ();
+
+  g_cancellable_cancel (cancellable);
+  g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable, NULL);
+  g_object_unref (cancellable);
+  g_object_unref (stream);
+}
+
+gboolean
+mm_file_write (MMFile *file, GError **error)
+{
+  GFileOutputStream *stream;
+  MMFileImage image;
+  g_return_val_if_fail (file, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  stream = g_file_replace (
+      file->file, NULL, FALSE,
+      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL, error);
+  if (stream == NULL)
+    return FALSE;
+
+  if (!mm_file_image_init (file, &image, error))
     goto on_error;
 
-  g_free (valid_values);
-  g_free (header_value_alpha);
-  g_array_unref (data);
+  if (!g_output_stream_writev_all (G_OUTPUT_STREAM (stream),
+                                   (GOutputVector *)image.vectors->data,
+                                   image.vectors->len, NULL, NULL, error))
+    {
+      mm_file_image_clear (&image);
+      goto on_error;
+    }
+
+  /* Written values are the base of later mm_file_append() calls */
+  g_hash_table_remove_all (file->checkpoints);
+  file->base_size = 0;
+  file->delta_size = 0;
+  for (size_t k = 0; k < image.nvalues; k++)
+    {
+      mm_file_set_checkpoint (file, image.values[k]);
+      file->base_size += image.header_value[k].data_size;
+    }
+
+  mm_file_image_clear (&image);
   g_object_unref (stream);
   return TRUE;
 on_error:
-  g_free (valid_values);
-  g_free (header_value_alpha);
-  g_array_unref (data);
-  g_object_unref (stream);
+  mm_file_abort_stream (stream);
   return FALSE;
 }
 
+typedef struct _MMFileWriteData
+{
+  MMFile *file;
+  /* Copy of the whole file taken by mm_file_write_async() */
+  guint8 *buffer;
+  size_t size;
+  GFileProgressCallback progress;
+  gpointer progress_data;
+  /* Shapes of written values, applied by mm_file_write_finish() */
+  MMValue **values;
+  MMFileCheckpoint **checkpoints;
+  size_t nvalues;
+  guint64 base_size;
+  /* Rows marked before the write, marked again if it fails */
+  size_t axis;
+  int64_t *dirty_rows;
+} MMFileWriteData;
+
+static void
+mm_file_write_data_free (MMFileWriteData *data)
+{
+  MMFile *file = data->file;
+
+  /* Keeps the larger buffer for the next write */
+  g_mutex_lock (&file->mutex);
+  if (data->size > file->spare_size)
+    {
+      g_free (file->spare_buffer);
+      file->spare_buffer = g_steal_pointer (&data->buffer);
+      file->spare_size = data->size;
+    }
+  g_mutex_unlock (&file->mutex);
+  g_free (data->buffer);
+
+  for (size_t k = 0; k < data->nvalues; k++)
+    {
+      mm_value_unref (data->values[k]);
+      g_free (data->checkpoints[k]);
+    }
+  g_free (data->values);
+  g_free (data->checkpoints);
+  g_free (data->dirty_rows);
+  g_atomic_int_add (&file->pending_writes, -1);
+  mm_file_unref (file);
+  g_free (data);
+}
+
+static void
+mm_file_write_thread (GTask *task, gpointer source_object, gpointer task_data,
+                      GCancellable *cancellable)
+{
+  MMFileWriteData *data = task_data;
+  GFileOutputStream *stream;
+  GError *error = NULL;
+  size_t written = 0;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  stream = g_file_replace (
+      data->file->file, NULL, FALSE,
+      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, cancellable,
+      &error);
+  if (stream == NULL)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  while (written < data->size)
+    {
+      size_t size = MIN (data->size - written, MM_FILE_WRITE_CHUNK);
+
+      if (!g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+                                      data->buffer + written, size, NULL,
+                                      cancellable, &error))
+        goto on_error;
+      written += size;
+      if (data->progress)
+        data->progress (written, data->size, data->progress_data);
+    }
+
+  if (!g_output_stream_flush (G_OUTPUT_STREAM (stream), cancellable, &error))
+    goto on_error;
+#ifdef G_OS_UNIX
+  if (G_IS_FILE_DESCRIPTOR_BASED (stream)
+      && (fsync (g_file_descriptor_based_get_fd (
+              G_FILE_DESCRIPTOR_BASED (stream)))
+          != 0))
+    {
+      int errsv = errno;
+
+      g_set_error (&error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Failed to sync file: %s", g_strerror (errsv));
+      goto on_error;
+    }
+#endif
+  /* The destination is replaced here */
+  if (!g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable, &error))
+    goto on_error;
+
+  g_object_unref (stream);
+  g_task_return_boolean (task, TRUE);
+  return;
+on_error:
+  mm_file_abort_stream (stream);
+  g_task_return_error (task, error);
+}
+
+void
+mm_file_write_async (MMFile *file, GCancellable *cancellable,
+                     GFileProgressCallback progress, gpointer progress_data,
+                     GAsyncReadyCallback callback, gpointer user_data)
+{
+  GTask *task;
+  MMFileWriteData *data;
+  MMFileImage image;
+  GError *error = NULL;
+  guint8 *p;
+  g_return_if_fail (file);
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mm_file_write_async);
+  if (!mm_file_image_init (file, &image, &error))
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  mm_file_ref (file);
+  data = g_new0 (MMFileWriteData, 1);
+  data->file = file;
+  data->progress = progress;
+  data->progress_data = progress_data;
+  for (guint k = 0; k < image.vectors->len; k++)
+    data->size += g_array_index (image.vectors, GOutputVector, k).size;
+
+  /* Double buffering: reuses the buffer of the last finished write */
+  g_mutex_lock (&file->mutex);
+  if (file->spare_size >= data->size)
+    {
+      data->buffer = g_steal_pointer (&file->spare_buffer);
+      file->spare_size = 0;
+    }
+  g_mutex_unlock (&file->mutex);
+  if (data->buffer == NULL)
+    data->buffer = g_malloc (data->size);
+
+  /* Values can be changed right after this function returns */
+  p = data->buffer;
+  for (guint k = 0; k < image.vectors->len; k++)
+    {
+      GOutputVector *vec = &g_array_index (image.vectors, GOutputVector, k);
+
+      memcpy (p, vec->buffer, vec->size);
+      p += vec->size;
+    }
+
+  data->nvalues = image.nvalues;
+  data->values = g_new (MMValue *, image.nvalues);
+  data->checkpoints = g_new (MMFileCheckpoint *, image.nvalues);
+  data->axis = file->delta_axis;
+  data->dirty_rows = g_new (int64_t, image.nvalues);
+  for (size_t k = 0; k < image.nvalues; k++)
+    {
+      mm_value_ref (image.values[k]);
+      data->values[k] = image.values[k];
+      data->checkpoints[k] = mm_file_checkpoint_new (image.values[k]);
+      data->dirty_rows[k]
+          = mm_value_get_dirty_row (image.values[k], data->axis);
+      if (g_atomic_int_get (&file->pending_writes) == 0)
+        mm_value_mark_clean (image.values[k], data->axis);
+      data->base_size += image.header_value[k].data_size;
+    }
+  g_atomic_int_inc (&file->pending_writes);
+  mm_file_image_clear (&image);
+
+  g_task_set_task_data (task, data, (GDestroyNotify)mm_file_write_data_free);
+  g_task_run_in_thread (task, mm_file_write_thread);
+  g_object_unref (task);
+}
+
+gboolean
+mm_file_write_finish (MMFile *file, GAsyncResult *result, GError **error)
+{
+  MMFileWriteData *data;
+  g_return_val_if_fail (file, FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  data = g_task_get_task_data (G_TASK (result));
+  if (!g_task_propagate_boolean (G_TASK (result), error))
+    {
+      /* The file is kept, so rows changed before the write are not in it */
+      for (size_t k = 0; k < data->nvalues; k++)
+        mm_value_mark_dirty (data->values[k], data->axis,
+                             data->dirty_rows[k]);
+      return FALSE;
+    }
+
+  /* Appends made during the write went to the replaced file */
+  g_hash_table_remove_all (file->checkpoints);
+  file->base_size = data->base_size;
+  file->delta_size = 0;
+  for (size_t k = 0; k < data->nvalues; k++)
+    if (g_ptr_array_find (file->value_array, data->values[k], NULL))
+      g_hash_table_insert (file->checkpoints, data->values[k],
+                           g_steal_pointer (&data->checkpoints[k]));
+  return TRUE;
+}
+
+/*
+ * Returns row of axis from which value differs from checkpoint, which is
+ * the first row marked as changed, or the end of rows kept in both.
+ */
+static int64_t
+mm_file_get_delta_start (const MMFileCheckpoint *checkpoint, MMValue *value,
+                         size_t axis)
+{
+  MMValueInfo *info = value->info;
+
+  if ((checkpoint == NULL) || (checkpoint->ndim != info->ndim))
+    return 0;
+  if (info->ndim == 0)
+    return MIN (mm_value_get_dirty_row (value, axis), 1);
+  for (size_t k = 0; k < info->ndim; k++)
+    if ((k != axis) && (checkpoint->dim[k] != info->dim[k]))
+      return 0;
+
+  return MIN (MIN (checkpoint->dim[axis], info->dim[axis]),
+              mm_value_get_dirty_row (value, axis));
+}
+
+gboolean
+mm_file_append (MMFile *file, size_t axis, GError **error)
+{
+  GFileOutputStream *stream = NULL;
+  GArray *data = NULL;
+  MMFileDeltaHeader header;
+  MMFileDeltaValue *delta_value = NULL;
+  MMValue **delta_values = NULL;
+  gboolean ret = FALSE;
+  g_return_val_if_fail (file, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  /* Deltas are folded when they outgrow the base, keeping writes linear */
+  file->delta_axis = axis;
+  if ((g_hash_table_size (file->checkpoints) == 0)
+      || (file->delta_size > file->base_size))
+    return mm_file_write (file, error);
+
+  data = g_array_new (FALSE, FALSE, sizeof (GOutputVector));
+  delta_value = g_new0 (MMFileDeltaValue, file->value_array->len);
+  delta_values = g_new (MMValue *, file->value_array->len);
+  memcpy (header.magic, MM_FILE_DELTA_MAGIC, sizeof (header.magic));
+  header.nvalues = 0;
+  header.size = 0;
+  g_array_append_val (data, ((GOutputVector){ &header, sizeof (header) }));
+
+  for (guint k = 0; k < file->value_array->len; k++)
+    {
+      MMValue *v = file->value_array->pdata[k];
+      MMFileDeltaValue *dv = delta_value + header.nvalues;
+      const MMFileCheckpoint *checkpoint;
+      const gchar *name = v->input_name ? v->input_name : v->output_name;
+      size_t element_size = mm_value_info_get_element_size (v->info);
+      size_t a = axis < v->info->ndim ? axis : 0;
+      size_t outer;
+      size_t row_size;
+      int64_t rows;
+      const guint8 *tensor_data = NULL;
+      gboolean empty = mm_file_is_empty (v->info->dim, v->info->ndim);
+
+      /* Values without names never match */
+      if (name == NULL)
+        continue;
+      checkpoint = g_hash_table_lookup (file->checkpoints, v);
+
+      if (empty)
+        {
+          /* Emptied values are truncated, without data like the base */
+          if ((checkpoint == NULL) || (checkpoint->ndim != v->info->ndim)
+              || !memcmp (checkpoint->dim, v->info->dim,
+                          sizeof (int64_t) * v->info->ndim))
+            continue;
+          dv->start = 0;
+        }
+      else
+        {
+          if (mm_value_info_get_element_count (v->info) == 0)
+            continue;
+          if (mm_value_get_quantize_info (v, NULL, NULL, NULL)
+              || (element_size == 0))
+            {
+              g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_UNSUPPORTED,
+                           "Can not append quantized or sub-byte value %s.",
+                           name);
+              goto on_error;
+            }
+
+          /* Rows changed since the checkpoint are written again */
+          dv->start = mm_file_get_delta_start (checkpoint, v, a);
+          if ((dv->start > 0)
+              && ((v->info->ndim == 0)
+                  || ((dv->start == v->info->dim[a])
+                      && (checkpoint->dim[a] == v->info->dim[a]))))
+            continue;
+
+          tensor_data = mm_value_peek_data (v, error);
+          if (tensor_data == NULL)
+            goto on_error;
+        }
+
+      dv->name_len = strlen (name);
+      dv->output = v->input_name == NULL;
+      dv->dtype = v->info->dtype;
+      dv->ndim = v->info->ndim;
+      dv->axis = a;
+      g_array_append_val (data, ((GOutputVector){ dv, sizeof (*dv) }));
+      g_array_append_val (data,
+                          ((GOutputVector){ name, dv->name_len + 1 }));
+      g_array_append_val (data,
+                          ((GOutputVector){ v->info->dim,
+                                            sizeof (int64_t) * dv->ndim }));
+
+      if (empty)
+        dv->data_size = 0;
+      else if (dv->start == 0)
+        {
+          dv->data_size = mm_value_info_get_data_size (v->info);
+          g_array_append_val (data,
+                              ((GOutputVector){ tensor_data, dv->data_size }));
+        }
+      else
+        {
+          /* Appended rows are written straight from the tensor */
+          mm_file_get_rows (v->info->dim, v->info->ndim, a, element_size,
+                            &outer, &row_size);
+          rows = v->info->dim[a] - dv->start;
+          dv->data_size = outer * rows * row_size;
+          for (size_t o = 0; (o < outer) && rows; o++)
+            g_array_append_val (
+                data, ((GOutputVector){
+                          tensor_data
+                              + (o * v->info->dim[a] + dv->start) * row_size,
+                          rows * row_size }));
+        }
+
+      header.size += sizeof (*dv) + dv->name_len + 1
+                     + sizeof (int64_t) * dv->ndim + dv->data_size;
+      delta_values[header.nvalues++] = v;
+    }
+
+  if (header.nvalues == 0)
+    goto out;
+
+  stream = g_file_append_to (file->file, G_FILE_CREATE_PRIVATE, NULL, error);
+  if (stream == NULL)
+    goto on_error;
+  if (!g_output_stream_writev_all (G_OUTPUT_STREAM (stream),
+                                   (GOutputVector *)data->data, data->len,
+                                   NULL, NULL, error)
+      || !g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, error))
+    {
+      /* A partial record ends the log, so the next call rewrites the file */
+      g_hash_table_remove_all (file->checkpoints);
+      goto on_error;
+    }
+
+  for (size_t k = 0; k < header.nvalues; k++)
+    mm_file_set_checkpoint (file, delta_values[k]);
+  file->delta_size += header.size;
+out:
+  ret = TRUE;
+on_error:
+  g_clear_object (&stream);
+  g_free (delta_values);
+  g_free (delta_value);
+  g_array_unref (data);
+  return ret;
+}
+
+static size_t
+mm_file_get_header_value_size (MMFileSubversion subversion)
+{
+  switch (subversion)
+    {
+    case MM_FILE_SUBVERSION_ALPHA:
+      return sizeof (MMFileHeaderValueAlpha);
+    case MM_FILE_SUBVERSION_BETA:
+      return sizeof (MMFileHeaderValueBeta);
+    default:
+      return sizeof (MMFileHeaderValueGamma);
+    }
+}
+
+/*
+ * Converts variable length headers of subversion to gamma ones. Missing
+ * dtype is set to ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED, and values of
+ * older subversions are never quantized.
+ */
+static MMFileHeaderValueGamma *
+mm_file_convert_header_value (const guint8 *data, MMFileSubversion subversion,
+                              uint64_t nvalues)
+{
+  MMFileHeaderValueGamma *header_value;
+  size_t size = mm_file_get_header_value_size (subversion);
+
+  if (subversion == MM_FILE_SUBVERSION_GAMMA)
+    return g_memdup2 (data, size * nvalues);
+
+  header_value = g_new0 (MMFileHeaderValueGamma, nvalues);
+  for (uint64_t k = 0; k < nvalues; k++)
+    {
+      /* Alpha headers are the common prefix of later ones. */
+      const MMFileHeaderValueAlpha *hva
+          = (const MMFileHeaderValueAlpha *)(data + size * k);
+      MMFileHeaderValueGamma *hv = header_value + k;
+
+      hv->ndim = hva->ndim;
+      hv->input_name_len = hva->input_name_len;
+      hv->output_name_len = hva->output_name_len;
+      hv->data_size = hva->data_size;
+      hv->dim_offset = hva->dim_offset;
+      hv->input_name_offset = hva->input_name_offset;
+      hv->output_name_offset = hva->output_name_offset;
+      hv->data_offset = hva->data_offset;
+      hv->dtype = subversion == MM_FILE_SUBVERSION_BETA
+                      ? ((const MMFileHeaderValueBeta *)hva)->dtype
+                      : ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+      hv->dequantized_dtype = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+    }
+  return header_value;
+}
+
+/* Reads variable length headers, and converts them to gamma ones. */
+static MMFileHeaderValueGamma *
+mm_file_read_header_value (GFileInputStream *stream,
+                           MMFileSubversion subversion, uint64_t nvalues,
+                           GError **error)
+{
+  MMFileHeaderValueGamma *header_value;
+  guint8 *data;
+  size_t size = mm_file_get_header_value_size (subversion) * nvalues;
+
+  data = g_malloc (size);
+  if (!g_input_stream_read_all (G_INPUT_STREAM (stream), data, size, NULL,
+                                NULL, error))
+    {
+      g_free (data);
+      return NULL;
+    }
+
+  header_value = mm_file_convert_header_value (data, subversion, nvalues);
+  g_free (data);
+  return header_value;
+}
+
+/* base_end is set to the end of the base file, where delta records start */
 static gboolean
-mm_file_read_alpha (MMFile *file, GFileInputStream *stream, GError **error)
+mm_file_read_alpha (MMFile *file, GFileInputStream *stream,
+                    MMFileSubversion subversion, goffset *base_end,
+                    GError **error)
 {
   MMFileHeaderAlpha header;
-  MMFileHeaderValueAlpha *header_value = NULL;
+  MMFileHeaderValueGamma *header_value = NULL;
   MMFileHeaderValueDataAlpha *header_value_data = NULL;
   goffset base_offset;
 
+  header.nvalues = 0;
   if (!g_input_stream_read (G_INPUT_STREAM (stream), &header, sizeof (header),
                             NULL, error))
     goto on_error;
 
-  header_value = g_new (MMFileHeaderValueAlpha, header.nvalues);
-  if (!g_input_stream_read (G_INPUT_STREAM (stream), header_value,
-                            sizeof (MMFileHeaderValueAlpha) * header.nvalues,
-                            NULL, error))
+  header_value = mm_file_read_header_value (stream, subversion,
+                                            header.nvalues, error);
+  if ((header_value == NULL) && header.nvalues)
     goto on_error;
 
   header_value_data = g_new0 (MMFileHeaderValueDataAlpha, header.nvalues);
   base_offset = g_seekable_tell (G_SEEKABLE (stream));
+  *base_end = base_offset;
+  for (int64_t k = 0; k < header.nvalues; k++)
+    {
+      /* mm_file_write() pads data to int64_t */
+      *base_end = MAX (*base_end,
+                       base_offset
+                           + MM_FILE_ALIGN (header_value[k].data_offset
+                                                + header_value[k].data_size,
+                                            sizeof (int64_t)));
+      file->base_size += header_value[k].data_size;
+    }
 
   for (int64_t k = 0; k < header.nvalues; k++)
     {
-      MMFileHeaderValueAlpha *hv = header_value + k;
+      MMFileHeaderValueGamma *hv = header_value + k;
       MMFileHeaderValueDataAlpha *hvd = header_value_data + k;
 
       if (hv->input_name_len)
         {
-          hvd->input_name = g_new (gchar, hv->input_name_len);
+          hvd->input_name = g_new0 (gchar, hv->input_name_len + 1);
 
           if (!g_seekable_seek (G_SEEKABLE (stream),
                                 base_offset + hv->input_name_offset,
@@ -275,7 +1063,7 @@ mm_file_read_alpha (MMFile *file, GFileInputStream *stream, GError **error)
 
       if (hv->output_name_len)
         {
-          hvd->output_name = g_new (gchar, hv->output_name_len);
+          hvd->output_name = g_new0 (gchar, hv->output_name_len + 1);
           if (!g_seekable_seek (G_SEEKABLE (stream),
                                 base_offset + hv->output_name_offset,
                                 G_SEEK_SET, NULL, error))
@@ -291,22 +1079,50 @@ mm_file_read_alpha (MMFile *file, GFileInputStream *stream, GError **error)
     {
       bool match = FALSE;
       MMValue *v = file->value_array->pdata[k];
-      MMFileHeaderValueAlpha *tgt_hv;
+      MMFileHeaderValueGamma *tgt_hv;
       MMFileHeaderValueDataAlpha *tgt_hvd;
+      ONNXTensorElementDataType dtype;
+      uint64_t file_dtype;
+      gboolean quantized;
 
       for (int64_t i = 0; i < header.nvalues; i++)
         {
           MMFileHeaderValueDataAlpha *hvd = header_value_data + i;
 
-          match = !g_strcmp0 (v->input_name, hvd->input_name)
-                  || !g_strcmp0 (v->output_name, hvd->output_name);
+          /* Values without names never match each other */
+          match = (v->input_name
+                   && !g_strcmp0 (v->input_name, hvd->input_name))
+                  || (v->output_name
+                      && !g_strcmp0 (v->output_name, hvd->output_name));
+          if (!match)
+            continue;
           tgt_hv = header_value + i;
           tgt_hvd = hvd;
+          break;
         }
 
       if (!match)
         continue;
 
+      /* Quantized data is loaded to values of the type before quantization */
+      mm_value_get_quantize_info (v, &dtype, NULL, NULL);
+      quantized = tgt_hv->dequantized_dtype
+                  != ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+      file_dtype = quantized ? tgt_hv->dequantized_dtype : tgt_hv->dtype;
+      if ((file_dtype != ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED)
+          && (file_dtype != dtype))
+        {
+          g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_INVALID,
+                       "Data type mismatch.");
+          goto on_error;
+        }
+      if (tgt_hv->ndim != v->info->ndim)
+        {
+          g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_INVALID,
+                       "Rank mismatch.");
+          goto on_error;
+        }
+
       if (tgt_hvd->dim == NULL)
         {
           tgt_hvd->dim = g_new (uint64_t, tgt_hv->ndim);
@@ -334,12 +1150,76 @@ mm_file_read_alpha (MMFile *file, GFileInputStream *stream, GError **error)
             goto on_error;
         }
 
+      if (quantized && (tgt_hvd->scales == NULL))
+        {
+          tgt_hvd->scales = g_new (float, tgt_hv->nscales);
+          tgt_hvd->zero_points = g_new (guint8, tgt_hv->nscales);
+          if (!g_seekable_seek (G_SEEKABLE (stream),
+                                base_offset + tgt_hv->scales_offset,
+                                G_SEEK_SET, NULL, error))
+            goto on_error;
+
+          if (!g_input_stream_read_all (G_INPUT_STREAM (stream),
+                                        tgt_hvd->scales,
+                                        sizeof (float) * tgt_hv->nscales,
+                                        NULL, NULL, error))
+            goto on_error;
+
+          if (!g_input_stream_read_all (G_INPUT_STREAM (stream),
+                                        tgt_hvd->zero_points,
+                                        sizeof (guint8) * tgt_hv->nscales,
+                                        NULL, NULL, error))
+            goto on_error;
+        }
+
+      if (!quantized)
+        {
+          MMValueInfo *info = mm_value_info_copy (v->info);
+          size_t size;
+
+          memcpy (info->dim, tgt_hvd->dim, sizeof (int64_t) * tgt_hv->ndim);
+          size = mm_value_info_get_data_size (info);
+          mm_value_info_unref (info);
+          if (size != tgt_hv->data_size)
+            {
+              g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_INVALID,
+                           "Data size of %s does not match its shape.",
+                           v->info->name);
+              goto on_error;
+            }
+        }
+
       memcpy (v->info->dim, tgt_hvd->dim, sizeof (int64_t) * tgt_hv->ndim);
 
-      if (!mm_value_update (v, error))
+      if (quantized)
+        {
+          MMQuantizeInfo quantize_info;
+
+          quantize_info.dtype = tgt_hv->dtype;
+          quantize_info.granularity = tgt_hv->granularity;
+          quantize_info.axis = tgt_hv->axis;
+          quantize_info.block_size = tgt_hv->block_size;
+          if (mm_quantize_get_scale_count (&quantize_info, v->info->dim,
+                                           v->info->ndim)
+              != tgt_hv->nscales)
+            {
+              g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_INVALID,
+                           "Invalid quantization parameters.");
+              goto on_error;
+            }
+          if (!mm_value_set_quantized_data (v, &quantize_info, tgt_hvd->data,
+                                            tgt_hvd->scales,
+                                            tgt_hvd->zero_points, error))
+            goto on_error;
+          continue;
+        }
+
+      /* Existing tensors of the same shape are overwritten in place */
+      if (!mm_value_reserve (v, error))
         goto on_error;
-      if (!mm_value_set_data (v, tgt_hvd->data, error))
+      if (tgt_hv->data_size && !mm_value_set_data (v, tgt_hvd->data, error))
         goto on_error;
+      mm_file_set_checkpoint (file, v);
     }
 
   for (size_t k = 0; k < header.nvalues; k++)
@@ -349,29 +1229,359 @@ mm_file_read_alpha (MMFile *file, GFileInputStream *stream, GError **error)
       g_free (hvd->input_name);
       g_free (hvd->output_name);
       g_free (hvd->data);
+      g_free (hvd->scales);
+      g_free (hvd->zero_points);
     }
   g_free (header_value_data);
   g_free (header_value);
   return TRUE;
 on_error:
-  for (size_t k = 0; k < header.nvalues; k++)
+  for (size_t k = 0; header_value_data && (k < header.nvalues); k++)
     {
       MMFileHeaderValueDataAlpha *hvd = header_value_data + k;
       g_free (hvd->dim);
       g_free (hvd->input_name);
       g_free (hvd->output_name);
       g_free (hvd->data);
+      g_free (hvd->scales);
+      g_free (hvd->zero_points);
     }
   g_free (header_value_data);
   g_free (header_value);
   return FALSE;
 }
 
+/* Rows of a delta record which are still part of the latest state */
+typedef struct _MMFileDeltaPiece
+{
+  int64_t start;
+  int64_t rows;
+  /* Rows in the record */
+  int64_t stored_rows;
+  goffset offset;
+} MMFileDeltaPiece;
+
+/* Latest state of a value, assembled from the base and delta records */
+typedef struct _MMFileDeltaState
+{
+  MMValue *value;
+  /* TRUE if data of the base is discarded */
+  gboolean reset;
+  /* Rows of axis kept from the base */
+  int64_t keep;
+  size_t axis;
+  int64_t *dim;
+  /* MMFileDeltaPiece */
+  GArray *pieces;
+} MMFileDeltaState;
+
+static void
+mm_file_delta_state_free (MMFileDeltaState *state)
+{
+  g_free (state->dim);
+  g_array_unref (state->pieces);
+  g_free (state);
+}
+
+static MMValue *
+mm_file_find_value (MMFile *file, const gchar *name, gboolean output)
+{
+  for (guint k = 0; k < file->value_array->len; k++)
+    {
+      MMValue *v = file->value_array->pdata[k];
+
+      if (!g_strcmp0 (output ? v->output_name : v->input_name, name))
+        return v;
+    }
+  return NULL;
+}
+
+/* Adds a delta of value to states. Takes dim. */
+static gboolean
+mm_file_add_delta (MMFile *file, GHashTable *states, MMValue *value,
+                   const MMFileDeltaValue *dv, int64_t *dim, goffset offset,
+                   GError **error)
+{
+  MMFileDeltaState *state;
+  MMFileDeltaPiece piece;
+  size_t element_size = mm_value_info_get_element_size (value->info);
+  size_t outer;
+  size_t row_size;
+
+  if (mm_value_get_quantize_info (value, NULL, NULL, NULL)
+      || (element_size == 0) || (dv->dtype != value->info->dtype)
+      || (dv->ndim != value->info->ndim)
+      || ((dv->axis >= dv->ndim) && (dv->ndim || dv->start)) || (dv->start < 0)
+      || (dv->ndim && (dv->start > dim[dv->axis])))
+    goto on_invalid;
+
+  state = g_hash_table_lookup (states, value);
+  if (state == NULL)
+    {
+      const MMFileCheckpoint *checkpoint
+          = g_hash_table_lookup (file->checkpoints, value);
+
+      state = g_new0 (MMFileDeltaState, 1);
+      state->value = value;
+      /* Values missing in the base have nothing to keep */
+      state->reset = checkpoint == NULL;
+      state->axis = dv->axis;
+      state->keep = (checkpoint && value->info->ndim)
+                        ? value->info->dim[dv->axis]
+                        : 0;
+      state->dim = g_memdup2 (value->info->dim,
+                              sizeof (int64_t) * value->info->ndim);
+      state->pieces = g_array_new (FALSE, FALSE, sizeof (MMFileDeltaPiece));
+      g_hash_table_insert (states, value, state);
+    }
+
+  if (dv->start == 0)
+    {
+      state->reset = TRUE;
+      state->keep = 0;
+      state->axis = dv->axis;
+      g_array_set_size (state->pieces, 0);
+    }
+  else
+    {
+      /* Rows before start must exist, either in the base or in deltas */
+      if ((dv->axis != state->axis) || (dv->start > state->dim[dv->axis])
+          || (state->reset && (state->pieces->len == 0)))
+        goto on_invalid;
+      for (size_t k = 0; k < dv->ndim; k++)
+        if ((k != dv->axis) && (dim[k] != state->dim[k]))
+          goto on_invalid;
+
+      /* Rows from start are replaced */
+      state->keep = MIN (state->keep, dv->start);
+      for (guint k = state->pieces->len; k-- > 0;)
+        {
+          MMFileDeltaPiece *p
+              = &g_array_index (state->pieces, MMFileDeltaPiece, k);
+
+          if (p->start >= dv->start)
+            g_array_remove_index (state->pieces, k);
+          else
+            p->rows = MIN (p->rows, dv->start - p->start);
+        }
+    }
+
+  mm_file_get_rows (dim, dv->ndim, dv->axis, element_size, &outer,
+                    &row_size);
+  piece.start = dv->start;
+  piece.stored_rows = dv->ndim ? dim[dv->axis] - dv->start : 1;
+  piece.rows = piece.stored_rows;
+  piece.offset = offset;
+  if (outer * piece.stored_rows * row_size != dv->data_size)
+    goto on_invalid;
+  g_array_append_val (state->pieces, piece);
+  g_free (state->dim);
+  state->dim = dim;
+  return TRUE;
+on_invalid:
+  g_free (dim);
+  g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_INVALID,
+               "Invalid delta record of %s.", value->info->name);
+  return FALSE;
+}
+
+/* Allocates the latest shape once, and fills it from the base and deltas */
+static gboolean
+mm_file_apply_delta (MMFile *file, GFileInputStream *stream,
+                     MMFileDeltaState *state, GError **error)
+{
+  MMValue *v = state->value;
+  const OrtApi *api = mm_value_get_context (v)->api;
+  OrtValue *old = NULL;
+  int64_t *old_dim = NULL;
+  int64_t old_rows = 0;
+  int64_t rows;
+  guint8 *old_data = NULL;
+  guint8 *data;
+  size_t outer;
+  size_t row_size;
+  OrtStatus *status;
+
+  if (!state->reset && state->keep)
+    {
+      old = v->value;
+      v->value = NULL;
+      old_dim = g_memdup2 (v->info->dim, sizeof (int64_t) * v->info->ndim);
+      old_rows = old_dim[state->axis];
+      status = api->GetTensorMutableData (old, (void **)&old_data);
+      if (status)
+        {
+          mm_context_set_error (mm_value_get_context (v), error, status);
+          goto on_error;
+        }
+    }
+
+  memcpy (v->info->dim, state->dim, sizeof (int64_t) * v->info->ndim);
+  if (!mm_value_reserve (v, error))
+    goto on_error;
+  /* Truncated to no elements, so there is nothing to fill */
+  if (mm_file_is_empty (v->info->dim, v->info->ndim))
+    goto out;
+  data = mm_value_get_data (v, error);
+  if (data == NULL)
+    goto on_error;
+
+  mm_file_get_rows (v->info->dim, v->info->ndim, state->axis,
+                    mm_value_info_get_element_size (v->info), &outer,
+                    &row_size);
+  rows = v->info->ndim ? v->info->dim[state->axis] : 1;
+  for (size_t o = 0; old && (o < outer); o++)
+    memcpy (data + o * rows * row_size, old_data + o * old_rows * row_size,
+            state->keep * row_size);
+
+  for (guint k = 0; k < state->pieces->len; k++)
+    {
+      MMFileDeltaPiece *p
+          = &g_array_index (state->pieces, MMFileDeltaPiece, k);
+
+      for (size_t o = 0; p->rows && (o < outer); o++)
+        {
+          if (!g_seekable_seek (G_SEEKABLE (stream),
+                                p->offset + o * p->stored_rows * row_size,
+                                G_SEEK_SET, NULL, error))
+            goto on_error;
+          if (!g_input_stream_read_all (
+                  G_INPUT_STREAM (stream),
+                  data + (o * rows + p->start) * row_size,
+                  p->rows * row_size, NULL, NULL, error))
+            goto on_error;
+        }
+    }
+
+out:
+  g_clear_pointer (&old, api->ReleaseValue);
+  g_free (old_dim);
+  mm_file_set_checkpoint (file, v);
+  return TRUE;
+on_error:
+  /* Keeps the base if the new tensor is not created */
+  if (old && (v->value == NULL))
+    {
+      v->value = g_steal_pointer (&old);
+      memcpy (v->info->dim, old_dim, sizeof (int64_t) * v->info->ndim);
+    }
+  g_clear_pointer (&old, api->ReleaseValue);
+  g_free (old_dim);
+  return FALSE;
+}
+
+/*
+ * Reads delta records from offset to the end of the file. A truncated last
+ * record, for example by a crash while appending, is ignored.
+ */
+static gboolean
+mm_file_read_deltas (MMFile *file, GFileInputStream *stream, goffset offset,
+                     GError **error)
+{
+  GHashTable *states;
+  GHashTableIter iter;
+  MMFileDeltaState *state;
+  goffset length;
+
+  if (!g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_END, NULL, error))
+    return FALSE;
+  length = g_seekable_tell (G_SEEKABLE (stream));
+
+  states = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                  (GDestroyNotify)mm_file_delta_state_free);
+  while (offset + (goffset)sizeof (MMFileDeltaHeader) <= length)
+    {
+      MMFileDeltaHeader header;
+      goffset end;
+
+      if (!g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, NULL,
+                            error))
+        goto on_error;
+      if (!g_input_stream_read_all (G_INPUT_STREAM (stream), &header,
+                                    sizeof (header), NULL, NULL, error))
+        goto on_error;
+      if (memcmp (header.magic, MM_FILE_DELTA_MAGIC, sizeof (header.magic))
+          || (header.size > (guint64)(length - offset - sizeof (header))))
+        break;
+      offset += sizeof (header);
+      end = offset + header.size;
+
+      for (uint64_t k = 0; k < header.nvalues; k++)
+        {
+          MMFileDeltaValue dv;
+          gchar *name;
+          int64_t *dim;
+          MMValue *v;
+
+          if (!g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET,
+                                NULL, error))
+            goto on_error;
+          if ((end - offset < (goffset)sizeof (dv))
+              || !g_input_stream_read_all (G_INPUT_STREAM (stream), &dv,
+                                           sizeof (dv), NULL, NULL, error))
+            goto on_invalid;
+          offset += sizeof (dv);
+          if ((dv.name_len >= (guint64)(end - offset))
+              || (dv.ndim > (end - offset - dv.name_len - 1)
+                                / sizeof (int64_t)))
+            goto on_invalid;
+
+          name = g_malloc (dv.name_len + 1);
+          dim = g_new (int64_t, dv.ndim);
+          if (!g_input_stream_read_all (G_INPUT_STREAM (stream), name,
+                                        dv.name_len + 1, NULL, NULL, error)
+              || !g_input_stream_read_all (G_INPUT_STREAM (stream), dim,
+                                           sizeof (int64_t) * dv.ndim, NULL,
+                                           NULL, error))
+            {
+              g_free (name);
+              g_free (dim);
+              goto on_error;
+            }
+          name[dv.name_len] = '\0';
+          offset += dv.name_len + 1 + sizeof (int64_t) * dv.ndim;
+          if (dv.data_size > (guint64)(end - offset))
+            {
+              g_free (name);
+              g_free (dim);
+              goto on_invalid;
+            }
+
+          v = mm_file_find_value (file, name, dv.output);
+          g_free (name);
+          if (v == NULL)
+            g_free (dim);
+          else if (!mm_file_add_delta (file, states, v, &dv, dim, offset,
+                                       error))
+            goto on_error;
+          offset += dv.data_size;
+        }
+      offset = end;
+      file->delta_size += header.size;
+    }
+
+  g_hash_table_iter_init (&iter, states);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&state))
+    if (!mm_file_apply_delta (file, stream, state, error))
+      goto on_error;
+
+  g_hash_table_unref (states);
+  return TRUE;
+on_invalid:
+  g_clear_error (error);
+  g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_INVALID,
+               "Delta record is truncated or corrupted.");
+on_error:
+  g_hash_table_unref (states);
+  return FALSE;
+}
+
 gboolean
 mm_file_read (MMFile *file, GError **error)
 {
   GFileInputStream *stream;
   MMFileHeader header;
+  goffset base_end;
   g_return_val_if_fail (file, FALSE);
   g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
 
@@ -383,10 +1593,21 @@ mm_file_read (MMFile *file, GError **error)
                             NULL, error))
     goto on_error;
 
+  g_hash_table_remove_all (file->checkpoints);
+  file->base_size = 0;
+  file->delta_size = 0;
   if ((header.version == MM_FILE_VERSION_ALPHA)
-      && (header.subversion == MM_FILE_SUBVERSION_ALPHA))
+      && ((header.subversion == MM_FILE_SUBVERSION_ALPHA)
+          || (header.subversion == MM_FILE_SUBVERSION_BETA)
+          || (header.subversion == MM_FILE_SUBVERSION_GAMMA)))
     {
-      if (!mm_file_read_alpha (file, stream, error))
+      if (!mm_file_read_alpha (file, stream, header.subversion, &base_end,
+                               error))
+        goto on_error;
+      /* Only files written by mm_file_write() of gamma can have deltas */
+      if (header.subversion != MM_FILE_SUBVERSION_GAMMA)
+        g_hash_table_remove_all (file->checkpoints);
+      else if (!mm_file_read_deltas (file, stream, base_end, error))
         goto on_error;
     }
   else
@@ -402,3 +1623,138 @@ on_error:
   g_object_unref (stream);
   return FALSE;
 }
+
+gboolean
+mm_file_compact (MMFile *file, GError **error)
+{
+  g_return_val_if_fail (file, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  return mm_file_read (file, error) && mm_file_write (file, error);
+}
+
+gboolean
+mm_file_map (MMFile *file, MMContext *context, GStrv *names,
+             GPtrArray **values, GError **error)
+{
+  const OrtApi *api;
+  const gchar *contents;
+  gsize length;
+  const MMFileHeader *header;
+  const MMFileHeaderAlpha *header_alpha;
+  MMFileHeaderValueGamma *header_value = NULL;
+  size_t header_value_size;
+  size_t base_offset;
+  OrtMemoryInfo *memory_info = NULL;
+  GStrvBuilder *name_builder = NULL;
+  GPtrArray *value_array = NULL;
+  OrtStatus *status;
+  g_return_val_if_fail (file, FALSE);
+  g_return_val_if_fail (context, FALSE);
+  g_return_val_if_fail (names, FALSE);
+  g_return_val_if_fail (values, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  api = context->api;
+  if (file->mapped_file == NULL)
+    {
+      gchar *path = g_file_get_path (file->file);
+      file->mapped_file = g_mapped_file_new (path, FALSE, error);
+      g_free (path);
+      if (file->mapped_file == NULL)
+        return FALSE;
+    }
+
+  contents = g_mapped_file_get_contents (file->mapped_file);
+  length = g_mapped_file_get_length (file->mapped_file);
+  if (length < sizeof (MMFileHeader) + sizeof (MMFileHeaderAlpha))
+    goto on_invalid;
+
+  header = (const MMFileHeader *)contents;
+  if ((header->version != MM_FILE_VERSION_ALPHA)
+      || ((header->subversion != MM_FILE_SUBVERSION_BETA)
+          && (header->subversion != MM_FILE_SUBVERSION_GAMMA)))
+    {
+      g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_VERSION,
+                   "File version does not support mapping.");
+      return FALSE;
+    }
+
+  header_alpha = (const MMFileHeaderAlpha *)(contents + sizeof (*header));
+  header_value_size = mm_file_get_header_value_size (header->subversion);
+  base_offset = sizeof (*header) + sizeof (*header_alpha);
+  if (header_alpha->nvalues > (length - base_offset) / header_value_size)
+    goto on_invalid;
+  header_value = mm_file_convert_header_value (
+      (const guint8 *)(header_alpha + 1), header->subversion,
+      header_alpha->nvalues);
+  base_offset += header_value_size * header_alpha->nvalues;
+
+  status = api->CreateCpuMemoryInfo (OrtDeviceAllocator, OrtMemTypeDefault,
+                                     &memory_info);
+  if (status)
+    goto on_ort_error;
+
+  name_builder = g_strv_builder_new ();
+  value_array = g_ptr_array_new_with_free_func (
+      (GDestroyNotify)api->ReleaseValue);
+  for (uint64_t k = 0; k < header_alpha->nvalues; k++)
+    {
+      const MMFileHeaderValueGamma *hv = header_value + k;
+      const gchar *input_name;
+      OrtValue *value = NULL;
+
+      /* Offsets are checked by subtraction, so crafted ones can not wrap. */
+      if ((hv->data_offset > length - base_offset)
+          || (hv->data_size > length - base_offset - hv->data_offset)
+          || (hv->dim_offset > hv->data_offset)
+          || (hv->ndim
+              > (hv->data_offset - hv->dim_offset) / sizeof (int64_t))
+          || (hv->input_name_offset >= hv->data_offset)
+          || (hv->input_name_len
+              >= hv->data_offset - hv->input_name_offset)
+          || (hv->output_name_offset >= hv->data_offset)
+          || (hv->output_name_len
+              >= hv->data_offset - hv->output_name_offset))
+        goto on_invalid;
+      /* Quantized values can not be fed as they are. */
+      if ((hv->input_name_len == 0)
+          || (hv->dequantized_dtype
+              != ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED))
+        continue;
+
+      input_name = contents + base_offset + hv->input_name_offset;
+      if (input_name[hv->input_name_len] != '\0')
+        goto on_invalid;
+
+      /* The mapping is read-only, but ORT never writes initializers. */
+      status = api->CreateTensorWithDataAsOrtValue (
+          memory_info, (void *)(contents + base_offset + hv->data_offset),
+          hv->data_size,
+          (const int64_t *)(contents + base_offset + hv->dim_offset),
+          hv->ndim, hv->dtype, &value);
+      if (status)
+        goto on_ort_error;
+
+      g_strv_builder_add (name_builder, input_name);
+      g_ptr_array_add (value_array, value);
+    }
+
+  api->ReleaseMemoryInfo (memory_info);
+  g_free (header_value);
+  *names = g_strv_builder_unref_to_strv (name_builder);
+  *values = value_array;
+  return TRUE;
+on_invalid:
+  g_set_error (error, MM_FILE_ERROR, MM_FILE_ERROR_INVALID,
+               "File is truncated or corrupted.");
+  goto on_error;
+on_ort_error:
+  mm_context_set_error (context, error, status);
+on_error:
+  g_clear_pointer (&memory_info, api->ReleaseMemoryInfo);
+  g_free (header_value);
+  g_clear_pointer (&name_builder, g_strv_builder_unref);
+  g_clear_pointer (&value_array, g_ptr_array_unref);
+  return FALSE;
+}
@@ -0,0 +1,467 @@
+#include "mm-graph.h"
+
+G_DEFINE_QUARK (mm-graph-error, mm_graph_error);
+
+typedef struct _MMGraphNode MMGraphNode;
+typedef struct _MMGraphRun MMGraphRun;
+typedef struct _MMGraphTask MMGraphTask;
+
+struct _MMGraphNode
+{
+  MMModel *model;
+  const char **input_names;
+  const char **output_names;
+  /* Node index of each input, or -1 if it is fed from graph inputs */
+  gint *source_node;
+  /* Output index in source node of each input */
+  guint *source_output;
+  /* Number of connected inputs */
+  guint nsources;
+  /* Number of inputs connected to each output */
+  guint *consumers;
+  /* Destination node of each connection from this node (guint) */
+  GArray *targets;
+};
+
+struct _MMGraph
+{
+  GThreadPool *pool;
+  GPtrArray *nodes;
+  gatomicrefcount ref_count;
+};
+
+/* State of a mm_graph_run() call */
+struct _MMGraphRun
+{
+  MMGraph *graph;
+  GPtrArray *inputs;
+  /* Can be NULL */
+  MMRunContext *run_context;
+  /* OrtValue ** for each node */
+  OrtValue ***outputs;
+  /* Number of connected inputs not computed yet, for each node */
+  guint *pending;
+  /* Number of consumers not finished yet, for each node output */
+  guint **consumers;
+  /* Number of nodes not finished yet */
+  guint remaining;
+  GError *error;
+  GMutex mutex;
+  GCond cond;
+};
+
+struct _MMGraphTask
+{
+  MMGraphRun *run;
+  guint node;
+};
+
+static void
+mm_graph_node_free (MMGraphNode *node)
+{
+  g_array_unref (node->targets);
+  g_free (node->consumers);
+  g_free (node->source_output);
+  g_free (node->source_node);
+  g_free (node->output_names);
+  g_free (node->input_names);
+  mm_model_unref (node->model);
+  g_free (node);
+}
+
+static gboolean
+mm_graph_run_node (MMGraphRun *run, guint index, GError **error)
+{
+  MMGraphNode *node = run->graph->nodes->pdata[index];
+  MMModel *model = node->model;
+  MMContext *context = model->options->context;
+  guint ninputs = model->input_infos->len;
+  guint noutputs = model->output_infos->len;
+  const OrtValue **inputs;
+  OrtRunOptions *run_options;
+  OrtStatus *status;
+
+  inputs = g_newa (const OrtValue *, ninputs);
+  for (guint k = 0; k < ninputs; k++)
+    {
+      inputs[k] = NULL;
+      if (node->source_node[k] >= 0)
+        {
+          inputs[k] = run->outputs[node->source_node[k]]
+                                  [node->source_output[k]];
+          continue;
+        }
+
+      for (guint i = 0; i < run->inputs->len; i++)
+        {
+          MMValue *v = run->inputs->pdata[i];
+          if (g_strcmp0 (v->input_name, node->input_names[k]))
+            continue;
+          inputs[k] = v->value;
+          break;
+        }
+
+      if (inputs[k] == NULL)
+        {
+          g_set_error (error, MM_GRAPH_ERROR, MM_GRAPH_ERROR_INPUT,
+                       "Input %s of node %u is not given.",
+                       node->input_names[k], index);
+          return FALSE;
+        }
+    }
+
+  run_options = model->options->run_options;
+  if (run->run_context)
+    {
+      run_options = mm_run_context_begin (run->run_context, error);
+      if (run_options == NULL)
+        return FALSE;
+    }
+
+  status = context->api->Run (model->session, run_options, node->input_names,
+                              inputs, ninputs, node->output_names, noutputs,
+                              run->outputs[index]);
+  if (run->run_context)
+    return mm_run_context_end (run->run_context, status, error);
+  if (status)
+    {
+      mm_context_set_error (context, error, status);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static void
+mm_graph_task (gpointer data, gpointer user_data)
+{
+  MMGraphTask *task = data;
+  MMGraphRun *run = task->run;
+  MMGraph *graph = user_data;
+  MMGraphNode *node = graph->nodes->pdata[task->node];
+  const OrtApi *api = node->model->options->context->api;
+  GError *error = NULL;
+  gboolean skip;
+
+  g_mutex_lock (&run->mutex);
+  skip = run->error != NULL;
+  g_mutex_unlock (&run->mutex);
+
+  /* After an error, nodes are only walked through to finish the run. */
+  if (!skip)
+    mm_graph_run_node (run, task->node, &error);
+
+  g_mutex_lock (&run->mutex);
+  if (error && (run->error == NULL))
+    run->error = error;
+  else if (error)
+    g_error_free (error);
+
+  for (guint k = 0; k < node->targets->len; k++)
+    {
+      guint target = g_array_index (node->targets, guint, k);
+      MMGraphTask *next;
+
+      if (--run->pending[target])
+        continue;
+      next = g_new (MMGraphTask, 1);
+      next->run = run;
+      next->node = target;
+      g_thread_pool_push (graph->pool, next, NULL);
+    }
+
+  for (guint k = 0; k < node->model->input_infos->len; k++)
+    {
+      gint source = node->source_node[k];
+      guint output = node->source_output[k];
+
+      if (source < 0)
+        continue;
+      if (--run->consumers[source][output] == 0)
+        g_clear_pointer (&run->outputs[source][output], api->ReleaseValue);
+    }
+
+  if (--run->remaining == 0)
+    g_cond_broadcast (&run->cond);
+  g_mutex_unlock (&run->mutex);
+  g_free (task);
+}
+
+/* Returns TRUE if to is reachable from from. */
+static gboolean
+mm_graph_reachable (MMGraph *graph, guint from, guint to)
+{
+  /* Nodes are visited once, so diamonds do not repeat the search. */
+  gboolean *visited;
+  GArray *stack;
+  gboolean found = FALSE;
+
+  visited = g_new0 (gboolean, graph->nodes->len);
+  stack = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_array_append_val (stack, from);
+  visited[from] = TRUE;
+  while (!found && stack->len)
+    {
+      guint index = g_array_index (stack, guint, stack->len - 1);
+      MMGraphNode *node = graph->nodes->pdata[index];
+
+      g_array_set_size (stack, stack->len - 1);
+      found = index == to;
+      for (guint k = 0; !found && (k < node->targets->len); k++)
+        {
+          guint target = g_array_index (node->targets, guint, k);
+
+          if (visited[target])
+            continue;
+          visited[target] = TRUE;
+          g_array_append_val (stack, target);
+        }
+    }
+  g_array_unref (stack);
+  g_free (visited);
+  return found;
+}
+
+MMGraph *
+mm_graph_new (guint max_threads, GError **error)
+{
+  MMGraph *graph;
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  if (max_threads == 0)
+    max_threads = g_get_num_processors ();
+
+  graph = g_new0 (MMGraph, 1);
+  graph->pool
+      = g_thread_pool_new (mm_graph_task, graph, max_threads, FALSE, error);
+  if (graph->pool == NULL)
+    {
+      g_free (graph);
+      return NULL;
+    }
+
+  graph->nodes
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_graph_node_free);
+  g_atomic_ref_count_init (&graph->ref_count);
+  return graph;
+}
+
+void
+mm_graph_ref (MMGraph *graph)
+{
+  g_return_if_fail (graph);
+  g_atomic_ref_count_inc (&graph->ref_count);
+}
+
+void
+mm_graph_unref (MMGraph *graph)
+{
+  g_return_if_fail (graph);
+  if (!g_atomic_ref_count_dec (&graph->ref_count))
+    return;
+
+  g_thread_pool_free (graph->pool, FALSE, TRUE);
+  g_ptr_array_unref (graph->nodes);
+  g_free (graph);
+}
+
+guint
+mm_graph_add_node (MMGraph *graph, MMModel *model)
+{
+  MMGraphNode *node;
+  guint ninputs;
+  guint noutputs;
+  g_return_val_if_fail (graph, 0);
+  g_return_val_if_fail (model, 0);
+
+  ninputs = model->input_infos->len;
+  noutputs = model->output_infos->len;
+
+  mm_model_ref (model);
+  node = g_new0 (MMGraphNode, 1);
+  node->model = model;
+  node->input_names = g_new (const char *, ninputs);
+  node->output_names = g_new (const char *, noutputs);
+  node->source_node = g_new (gint, ninputs);
+  node->source_output = g_new0 (guint, ninputs);
+  node->consumers = g_new0 (guint, noutputs);
+  node->targets = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (guint k = 0; k < ninputs; k++)
+    {
+      MMValueInfo *info = model->input_infos->pdata[k];
+      node->input_names[k] = info->name;
+      node->source_node[k] = -1;
+    }
+  for (guint k = 0; k < noutputs; k++)
+    {
+      MMValueInfo *info = model->output_infos->pdata[k];
+      node->output_names[k] = info->name;
+    }
+
+  g_ptr_array_add (graph->nodes, node);
+  return graph->nodes->len - 1;
+}
+
+gboolean
+mm_graph_connect (MMGraph *graph, guint src, const char *output_name,
+                  guint dst, const char *input_name, GError **error)
+{
+  MMGraphNode *src_node;
+  MMGraphNode *dst_node;
+  guint output_index;
+  guint input_index;
+  g_return_val_if_fail (graph, FALSE);
+  g_return_val_if_fail (src < graph->nodes->len, FALSE);
+  g_return_val_if_fail (dst < graph->nodes->len, FALSE);
+  g_return_val_if_fail (output_name, FALSE);
+  g_return_val_if_fail (input_name, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  src_node = graph->nodes->pdata[src];
+  dst_node = graph->nodes->pdata[dst];
+
+  for (output_index = 0; output_index < src_node->model->output_infos->len;
+       output_index++)
+    if (!g_strcmp0 (src_node->output_names[output_index], output_name))
+      break;
+  if (output_index == src_node->model->output_infos->len)
+    {
+      g_set_error (error, MM_GRAPH_ERROR, MM_GRAPH_ERROR_NOT_FOUND,
+                   "Node %u has no output %s.", src, output_name);
+      return FALSE;
+    }
+
+  for (input_index = 0; input_index < dst_node->model->input_infos->len;
+       input_index++)
+    if (!g_strcmp0 (dst_node->input_names[input_index], input_name))
+      break;
+  if ((input_index == dst_node->model->input_infos->len)
+      || (dst_node->source_node[input_index] >= 0))
+    {
+      g_set_error (error, MM_GRAPH_ERROR, MM_GRAPH_ERROR_NOT_FOUND,
+                   "Node %u has no unconnected input %s.", dst, input_name);
+      return FALSE;
+    }
+
+  if (mm_graph_reachable (graph, dst, src))
+    {
+      g_set_error (error, MM_GRAPH_ERROR, MM_GRAPH_ERROR_CYCLE,
+                   "Connecting node %u to node %u makes a cycle.", src, dst);
+      return FALSE;
+    }
+
+  dst_node->source_node[input_index] = src;
+  dst_node->source_output[input_index] = output_index;
+  dst_node->nsources++;
+  src_node->consumers[output_index]++;
+  g_array_append_val (src_node->targets, dst);
+  return TRUE;
+}
+
+GPtrArray *
+mm_graph_run (MMGraph *graph, GPtrArray *inputs, GError **error)
+{
+  return mm_graph_run_with_context (graph, inputs, NULL, error);
+}
+
+GPtrArray *
+mm_graph_run_with_context (MMGraph *graph, GPtrArray *inputs,
+                           MMRunContext *run_context, GError **error)
+{
+  MMGraphRun run;
+  GPtrArray *outputs = NULL;
+  guint nnodes;
+  g_return_val_if_fail (graph, NULL);
+  g_return_val_if_fail (inputs, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  nnodes = graph->nodes->len;
+  run.graph = graph;
+  run.inputs = inputs;
+  run.run_context = run_context;
+  run.outputs = g_new (OrtValue **, nnodes);
+  run.pending = g_new (guint, nnodes);
+  run.consumers = g_new (guint *, nnodes);
+  run.remaining = nnodes;
+  run.error = NULL;
+  g_mutex_init (&run.mutex);
+  g_cond_init (&run.cond);
+
+  for (guint k = 0; k < nnodes; k++)
+    {
+      MMGraphNode *node = graph->nodes->pdata[k];
+      guint noutputs = node->model->output_infos->len;
+
+      run.outputs[k] = g_new0 (OrtValue *, noutputs);
+      run.pending[k] = node->nsources;
+      run.consumers[k]
+          = g_memdup2 (node->consumers, sizeof (guint) * noutputs);
+    }
+
+  g_mutex_lock (&run.mutex);
+  for (guint k = 0; k < nnodes; k++)
+    {
+      MMGraphTask *task;
+
+      if (run.pending[k])
+        continue;
+      task = g_new (MMGraphTask, 1);
+      task->run = &run;
+      task->node = k;
+      g_thread_pool_push (graph->pool, task, NULL);
+    }
+
+  while (run.remaining)
+    g_cond_wait (&run.cond, &run.mutex);
+  g_mutex_unlock (&run.mutex);
+
+  if (run.error == NULL)
+    outputs = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_value_unref);
+
+  /* Outputs without consumers are graph outputs. */
+  for (guint k = 0; k < nnodes; k++)
+    {
+      MMGraphNode *node = graph->nodes->pdata[k];
+      MMModel *model = node->model;
+      MMContext *context = model->options->context;
+
+      for (guint i = 0; i < model->output_infos->len; i++)
+        {
+          MMValueInfo *info = model->output_infos->pdata[i];
+          MMValue *v;
+
+          if (run.outputs[k][i] == NULL)
+            continue;
+          if ((outputs == NULL) || (run.error != NULL))
+            {
+              context->api->ReleaseValue (run.outputs[k][i]);
+              continue;
+            }
+
+          v = mm_value_new (context, info, model, NULL, info->name, NULL,
+                            &run.error);
+          if (v == NULL)
+            {
+              context->api->ReleaseValue (run.outputs[k][i]);
+              continue;
+            }
+          v->value = run.outputs[k][i];
+          g_ptr_array_add (outputs, v);
+          mm_value_update_info (v, &run.error);
+        }
+      g_free (run.consumers[k]);
+      g_free (run.outputs[k]);
+    }
+
+  g_free (run.consumers);
+  g_free (run.pending);
+  g_free (run.outputs);
+  g_cond_clear (&run.cond);
+  g_mutex_clear (&run.mutex);
+
+  if (run.error == NULL)
+    return outputs;
+  g_clear_pointer (&outputs, g_ptr_array_unref);
+  g_propagate_error (error, run.error);
+  return NULL;
+}
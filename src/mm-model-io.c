@@ -8,6 +8,13 @@ struct _MMModelIO
   OrtValue **values;
   size_t length;
   GPtrArray *value_array;
+  /* (char *, GArray of int64_t) */
+  GHashTable *buckets;
+  /*
+   * (char *, int64_t *) unpadded values of dimensions with buckets given to
+   * the last set_dimension, NULL if none
+   */
+  GHashTable *valid_dimension;
   gatomicrefcount ref_count;
 };
 
@@ -46,6 +53,9 @@ mm_model_io_new (GPtrArray *value_array, bool is_input)
   g_strv_builder_unref (name_builder);
   model_io->length = model_io->value_array->len;
   model_io->values = g_new0 (OrtValue *, model_io->value_array->len);
+  model_io->buckets = g_hash_table_new_full (
+      g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+  model_io->valid_dimension = NULL;
   g_atomic_ref_count_init (&model_io->ref_count);
   return model_io;
 }
@@ -64,6 +74,8 @@ mm_model_io_unref (MMModelIO *model_io)
   if (!g_atomic_ref_count_dec (&model_io->ref_count))
     return;
 
+  g_clear_pointer (&model_io->valid_dimension, g_hash_table_unref);
+  g_hash_table_unref (model_io->buckets);
   g_free (model_io->values);
   g_strfreev (model_io->names);
   g_ptr_array_unref (model_io->value_array);
@@ -74,22 +86,84 @@ gboolean
 mm_model_io_set_dimension (MMModelIO *model_io, GHashTable *hash_table,
                            GError **error)
 {
+  GHashTable *padded = NULL;
+  GHashTableIter iter;
+  const char *name;
+  int64_t *dim;
   g_return_val_if_fail (model_io, FALSE);
   g_return_val_if_fail (hash_table, FALSE);
 
+  g_clear_pointer (&model_io->valid_dimension, g_hash_table_unref);
+  if (g_hash_table_size (model_io->buckets))
+    {
+      padded = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+      model_io->valid_dimension
+          = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+      g_hash_table_iter_init (&iter, hash_table);
+      while (g_hash_table_iter_next (&iter, (gpointer *)&name,
+                                     (gpointer *)&dim))
+        {
+          GArray *buckets = g_hash_table_lookup (model_io->buckets, name);
+          int64_t padded_dim = *dim;
+
+          if (buckets)
+            g_hash_table_insert (model_io->valid_dimension, g_strdup (name),
+                                 g_memdup2 (dim, sizeof (int64_t)));
+          for (guint k = 0; buckets && (k < buckets->len); k++)
+            {
+              if (g_array_index (buckets, int64_t, k) < *dim)
+                continue;
+              padded_dim = g_array_index (buckets, int64_t, k);
+              break;
+            }
+
+          g_hash_table_insert (padded, (gpointer)name,
+                               g_memdup2 (&padded_dim, sizeof (int64_t)));
+        }
+      if (g_hash_table_size (model_io->valid_dimension) == 0)
+        g_clear_pointer (&model_io->valid_dimension, g_hash_table_unref);
+    }
+
   for (size_t k = 0; k < model_io->value_array->len; k++)
     {
       MMValue *v = model_io->value_array->pdata[k];
-      if (!mm_value_set_dimension (v, hash_table, error))
+      if (!mm_value_set_dimension (v, padded ? padded : hash_table, error))
         goto on_error;
+      if (model_io->valid_dimension)
+        mm_value_set_valid_dimension (v, model_io->valid_dimension);
     }
 
+  if (padded)
+    g_hash_table_unref (padded);
   mm_model_io_update (model_io);
   return TRUE;
 on_error:
+  if (padded)
+    g_hash_table_unref (padded);
   return FALSE;
 }
 
+void
+mm_model_io_set_buckets (MMModelIO *model_io, const char *dim_name,
+                         const int64_t *buckets, size_t length)
+{
+  GArray *array;
+  g_return_if_fail (model_io);
+  g_return_if_fail (dim_name);
+  g_return_if_fail ((buckets != NULL) || (length == 0));
+
+  if (length == 0)
+    {
+      g_hash_table_remove (model_io->buckets, dim_name);
+      return;
+    }
+
+  array = g_array_sized_new (FALSE, FALSE, sizeof (int64_t), length);
+  g_array_append_vals (array, buckets, length);
+  g_hash_table_insert (model_io->buckets, g_strdup (dim_name), array);
+}
+
 void
 mm_model_io_update (MMModelIO *model_io)
 {
@@ -102,19 +176,82 @@ mm_model_io_update (MMModelIO *model_io)
     }
 }
 
+gboolean
+mm_model_io_unshare (MMModelIO *model_io, GError **error)
+{
+  g_return_val_if_fail (model_io, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  for (size_t k = 0; k < model_io->value_array->len; k++)
+    {
+      MMValue *v = model_io->value_array->pdata[k];
+
+      if ((model_io->values[k] != v->value) || !mm_value_is_shared (v))
+        continue;
+      if (!mm_value_reserve (v, error))
+        return FALSE;
+      model_io->values[k] = v->value;
+    }
+  return TRUE;
+}
+
+GHashTable *
+mm_model_io_get_valid_dimension (MMModelIO *model_io)
+{
+  g_return_val_if_fail (model_io, NULL);
+  return model_io->valid_dimension;
+}
+
 gboolean
 mm_model_io_update_info (MMModelIO *model_io, GError **error)
 {
+  return mm_model_io_update_info_with_dimension (model_io, NULL, error);
+}
+
+gboolean
+mm_model_io_update_info_with_dimension (MMModelIO *model_io,
+                                        GHashTable *valid_dimension,
+                                        GError **error)
+{
+  GHashTable *merged = NULL;
+  GHashTable *valid;
   g_return_val_if_fail (model_io, FALSE);
   g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
 
+  /* Dimensions padded by either side are sliced back */
+  valid = valid_dimension ? valid_dimension : model_io->valid_dimension;
+  if (valid_dimension && model_io->valid_dimension)
+    {
+      GHashTableIter iter;
+      gpointer name;
+      gpointer dim;
+
+      merged = g_hash_table_new (g_str_hash, g_str_equal);
+      g_hash_table_iter_init (&iter, valid_dimension);
+      while (g_hash_table_iter_next (&iter, &name, &dim))
+        g_hash_table_insert (merged, name, dim);
+      g_hash_table_iter_init (&iter, model_io->valid_dimension);
+      while (g_hash_table_iter_next (&iter, &name, &dim))
+        g_hash_table_insert (merged, name, dim);
+      valid = merged;
+    }
+
   for (size_t k = 0; k < model_io->value_array->len; k++)
     {
       MMValue *v = model_io->value_array->pdata[k];
       v->value = model_io->values[k];
       if (!mm_value_update_info (v, error))
-        return FALSE;
+        goto on_error;
+      /* Slice outputs back to valid dimension */
+      if (valid)
+        mm_value_set_valid_dimension (v, valid);
     }
 
+  if (merged)
+    g_hash_table_unref (merged);
   return TRUE;
+on_error:
+  if (merged)
+    g_hash_table_unref (merged);
+  return FALSE;
 }
@@ -0,0 +1,301 @@
+#include "mm-model-loader.h"
+
+G_DEFINE_QUARK (mm-model-loader-error, mm_model_loader_error);
+
+typedef struct _MMModelLoaderEntry MMModelLoaderEntry;
+
+struct _MMModelLoaderEntry
+{
+  gchar *id;
+  gchar *file_path;
+  MMModelOptions *options;
+  MMModelLoadPhase phase;
+  /* Valid if phase is MM_MODEL_LOAD_PHASE_READY */
+  MMModel *model;
+  /* Valid if phase is MM_MODEL_LOAD_PHASE_FAILED */
+  GError *error;
+};
+
+struct _MMModelLoader
+{
+  GThreadPool *pool;
+  /* (char *, MMModelLoaderEntry *) */
+  GHashTable *entries;
+  MMModelLoaderPhaseFunc phase_func;
+  gpointer phase_func_data;
+  GMutex mutex;
+  GCond cond;
+  gatomicrefcount ref_count;
+};
+
+static void
+mm_model_loader_entry_free (MMModelLoaderEntry *entry)
+{
+  g_free (entry->id);
+  g_free (entry->file_path);
+  mm_model_options_unref (entry->options);
+  if (entry->model)
+    mm_model_unref (entry->model);
+  if (entry->error)
+    g_error_free (entry->error);
+  g_free (entry);
+}
+
+static void
+mm_model_loader_set_phase (MMModelLoader *loader, MMModelLoaderEntry *entry,
+                           MMModelLoadPhase phase)
+{
+  g_mutex_lock (&loader->mutex);
+  entry->phase = phase;
+  g_cond_broadcast (&loader->cond);
+  g_mutex_unlock (&loader->mutex);
+
+  if (loader->phase_func)
+    loader->phase_func (loader, entry->id, phase, loader->phase_func_data);
+}
+
+static void
+mm_model_loader_load (gpointer data, gpointer user_data)
+{
+  MMModelLoaderEntry *entry = data;
+  MMModelLoader *loader = user_data;
+  MMModel *model;
+  GError *error = NULL;
+
+  mm_model_loader_set_phase (loader, entry, MM_MODEL_LOAD_PHASE_LOADING);
+  model = mm_model_new (entry->options, entry->file_path, &error);
+
+  g_mutex_lock (&loader->mutex);
+  entry->model = model;
+  entry->error = error;
+  g_mutex_unlock (&loader->mutex);
+
+  mm_model_loader_set_phase (loader, entry,
+                             model ? MM_MODEL_LOAD_PHASE_READY
+                                   : MM_MODEL_LOAD_PHASE_FAILED);
+}
+
+MMModelLoader *
+mm_model_loader_new (guint max_threads, GError **error)
+{
+  MMModelLoader *loader;
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  if (max_threads == 0)
+    max_threads = g_get_num_processors ();
+
+  loader = g_new0 (MMModelLoader, 1);
+  loader->pool = g_thread_pool_new (mm_model_loader_load, loader, max_threads,
+                                    FALSE, error);
+  if (loader->pool == NULL)
+    {
+      g_free (loader);
+      return NULL;
+    }
+
+  loader->entries = g_hash_table_new_full (
+      g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify)mm_model_loader_entry_free);
+  g_mutex_init (&loader->mutex);
+  g_cond_init (&loader->cond);
+  g_atomic_ref_count_init (&loader->ref_count);
+  return loader;
+}
+
+void
+mm_model_loader_ref (MMModelLoader *loader)
+{
+  g_return_if_fail (loader);
+  g_atomic_ref_count_inc (&loader->ref_count);
+}
+
+void
+mm_model_loader_unref (MMModelLoader *loader)
+{
+  g_return_if_fail (loader);
+  if (!g_atomic_ref_count_dec (&loader->ref_count))
+    return;
+
+  g_thread_pool_free (loader->pool, TRUE, TRUE);
+  g_hash_table_unref (loader->entries);
+  g_cond_clear (&loader->cond);
+  g_mutex_clear (&loader->mutex);
+  g_free (loader);
+}
+
+void
+mm_model_loader_set_phase_func (MMModelLoader *loader,
+                                MMModelLoaderPhaseFunc func,
+                                gpointer user_data)
+{
+  g_return_if_fail (loader);
+
+  loader->phase_func = func;
+  loader->phase_func_data = user_data;
+}
+
+gboolean
+mm_model_loader_add (MMModelLoader *loader, const char *id,
+                     MMModelOptions *options, const char *file_path,
+                     GError **error)
+{
+  MMModelLoaderEntry *entry;
+  GError *local_error = NULL;
+  g_return_val_if_fail (loader, FALSE);
+  g_return_val_if_fail (id, FALSE);
+  g_return_val_if_fail (options, FALSE);
+  g_return_val_if_fail (file_path, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  g_mutex_lock (&loader->mutex);
+  entry = g_hash_table_lookup (loader->entries, id);
+  if (entry && (entry->phase != MM_MODEL_LOAD_PHASE_FAILED))
+    {
+      g_mutex_unlock (&loader->mutex);
+      g_set_error (error, MM_MODEL_LOADER_ERROR,
+                   MM_MODEL_LOADER_ERROR_EXISTS, "Model %s is already added.",
+                   id);
+      return FALSE;
+    }
+
+  mm_model_options_ref (options);
+  if (entry)
+    {
+      /* Failed entries are reused, since waiters may still hold them. */
+      g_free (entry->file_path);
+      mm_model_options_unref (entry->options);
+      g_clear_error (&entry->error);
+    }
+  else
+    {
+      entry = g_new0 (MMModelLoaderEntry, 1);
+      entry->id = g_strdup (id);
+      g_hash_table_insert (loader->entries, entry->id, entry);
+    }
+  entry->file_path = g_strdup (file_path);
+  entry->options = options;
+  entry->phase = MM_MODEL_LOAD_PHASE_QUEUED;
+  g_mutex_unlock (&loader->mutex);
+
+  if (loader->phase_func)
+    loader->phase_func (loader, entry->id, MM_MODEL_LOAD_PHASE_QUEUED,
+                        loader->phase_func_data);
+
+  if (!g_thread_pool_push (loader->pool, entry, &local_error))
+    {
+      /* Waiters are woken, and the id can be added again. */
+      g_mutex_lock (&loader->mutex);
+      entry->error = g_error_copy (local_error);
+      g_mutex_unlock (&loader->mutex);
+      mm_model_loader_set_phase (loader, entry, MM_MODEL_LOAD_PHASE_FAILED);
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+MMModelLoadPhase
+mm_model_loader_get_phase (MMModelLoader *loader, const char *id)
+{
+  MMModelLoaderEntry *entry;
+  MMModelLoadPhase phase;
+  g_return_val_if_fail (loader, MM_MODEL_LOAD_PHASE_FAILED);
+  g_return_val_if_fail (id, MM_MODEL_LOAD_PHASE_FAILED);
+
+  g_mutex_lock (&loader->mutex);
+  entry = g_hash_table_lookup (loader->entries, id);
+  phase = entry ? entry->phase : MM_MODEL_LOAD_PHASE_FAILED;
+  g_mutex_unlock (&loader->mutex);
+
+  g_return_val_if_fail (entry, MM_MODEL_LOAD_PHASE_FAILED);
+  return phase;
+}
+
+MMModel *
+mm_model_loader_get (MMModelLoader *loader, const char *id)
+{
+  MMModelLoaderEntry *entry;
+  MMModel *model = NULL;
+  g_return_val_if_fail (loader, NULL);
+  g_return_val_if_fail (id, NULL);
+
+  g_mutex_lock (&loader->mutex);
+  entry = g_hash_table_lookup (loader->entries, id);
+  if (entry && entry->model)
+    {
+      model = entry->model;
+      mm_model_ref (model);
+    }
+  g_mutex_unlock (&loader->mutex);
+  return model;
+}
+
+MMModel *
+mm_model_loader_wait (MMModelLoader *loader, const char *id, GError **error)
+{
+  MMModelLoaderEntry *entry;
+  MMModel *model = NULL;
+  g_return_val_if_fail (loader, NULL);
+  g_return_val_if_fail (id, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  g_mutex_lock (&loader->mutex);
+  entry = g_hash_table_lookup (loader->entries, id);
+  if (entry == NULL)
+    {
+      g_mutex_unlock (&loader->mutex);
+      g_set_error (error, MM_MODEL_LOADER_ERROR,
+                   MM_MODEL_LOADER_ERROR_NOT_FOUND, "Model %s is not added.",
+                   id);
+      return NULL;
+    }
+
+  while ((entry->phase != MM_MODEL_LOAD_PHASE_READY)
+         && (entry->phase != MM_MODEL_LOAD_PHASE_FAILED))
+    g_cond_wait (&loader->cond, &loader->mutex);
+
+  if (entry->model)
+    {
+      model = entry->model;
+      mm_model_ref (model);
+    }
+  else
+    g_propagate_error (error, g_error_copy (entry->error));
+  g_mutex_unlock (&loader->mutex);
+  return model;
+}
+
+gboolean
+mm_model_loader_wait_all (MMModelLoader *loader, GError **error)
+{
+  GHashTableIter iter;
+  GPtrArray *entries;
+  MMModelLoaderEntry *entry;
+  GError *first_error = NULL;
+  g_return_val_if_fail (loader, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  g_mutex_lock (&loader->mutex);
+  /* Entries are never removed, but the table can change while waiting. */
+  entries = g_ptr_array_sized_new (g_hash_table_size (loader->entries));
+  g_hash_table_iter_init (&iter, loader->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    g_ptr_array_add (entries, entry);
+
+  for (guint k = 0; k < entries->len; k++)
+    {
+      entry = entries->pdata[k];
+      while ((entry->phase != MM_MODEL_LOAD_PHASE_READY)
+             && (entry->phase != MM_MODEL_LOAD_PHASE_FAILED))
+        g_cond_wait (&loader->cond, &loader->mutex);
+      if ((first_error == NULL) && entry->error)
+        first_error = g_error_copy (entry->error);
+    }
+  g_mutex_unlock (&loader->mutex);
+  g_ptr_array_unref (entries);
+
+  if (first_error == NULL)
+    return TRUE;
+  g_propagate_error (error, first_error);
+  return FALSE;
+}
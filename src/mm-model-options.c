@@ -1,5 +1,9 @@
 
+#include "mm-file.h"
 #include "mm-model-options.h"
+#include "mm-numa.h"
+
+#define MM_SESSION_TUNING_GROUP "session"
 
 typedef struct _MMRealModelOptions MMRealModelOptions;
 
@@ -9,6 +13,11 @@ struct _MMRealModelOptions
   OrtSessionOptions *session_options;
   OrtRunOptions *run_options;
   GPtrArray *providers;
+  /* MMFile and OrtValue used by AddExternalInitializers */
+  GPtrArray *initializer_files;
+  GPtrArray *initializers;
+  /* Shapes for provider selection, or NULL */
+  GPtrArray *auto_shapes;
   gatomicrefcount ref_count;
 };
 
@@ -33,6 +42,13 @@ mm_model_options_new (MMContext *context, GError **error)
   if (status)
     goto on_ort_error;
 
+  if (mm_context_has_global_thread_pools (context))
+    {
+      status = context->api->DisablePerSessionThreads (session_options);
+      if (status)
+        goto on_ort_error;
+    }
+
   status = context->api->CreateRunOptions (&run_options);
   if (status)
     goto on_ort_error;
@@ -43,6 +59,11 @@ mm_model_options_new (MMContext *context, GError **error)
   model_options->session_options = session_options;
   model_options->run_options = run_options;
   model_options->providers = g_ptr_array_new_with_free_func((GDestroyNotify)mm_provider_unref);
+  model_options->initializer_files
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_file_unref);
+  model_options->initializers = g_ptr_array_new_with_free_func (
+      (GDestroyNotify)context->api->ReleaseValue);
+  model_options->auto_shapes = NULL;
   g_atomic_ref_count_init (&model_options->ref_count);
 
   return (MMModelOptions *)model_options;
@@ -56,6 +77,49 @@ on_ort_error:
   return NULL;
 }
 
+MMModelOptions *
+mm_model_options_copy (MMModelOptions *model_options, GError **error)
+{
+  MMRealModelOptions *rmodel_options = (MMRealModelOptions *)model_options;
+  MMRealModelOptions *copy;
+  MMContext *context;
+  OrtSessionOptions *session_options = NULL;
+  OrtRunOptions *run_options = NULL;
+  OrtStatus *status;
+  g_return_val_if_fail (rmodel_options, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  context = model_options->context;
+  status = context->api->CloneSessionOptions (
+      rmodel_options->session_options, &session_options);
+  if (status)
+    goto on_ort_error;
+
+  status = context->api->CreateRunOptions (&run_options);
+  if (status)
+    goto on_ort_error;
+
+  mm_context_ref (context);
+  copy = g_new (MMRealModelOptions, 1);
+  copy->context = context;
+  copy->session_options = session_options;
+  copy->run_options = run_options;
+  /* Providers and initializers are used by both session options. */
+  copy->providers = g_ptr_array_ref (rmodel_options->providers);
+  copy->initializer_files
+      = g_ptr_array_ref (rmodel_options->initializer_files);
+  copy->initializers = g_ptr_array_ref (rmodel_options->initializers);
+  /* Copies are candidates of provider selection. */
+  copy->auto_shapes = NULL;
+  g_atomic_ref_count_init (&copy->ref_count);
+  return (MMModelOptions *)copy;
+on_ort_error:
+  mm_context_set_error (context, error, status);
+  if (session_options)
+    context->api->ReleaseSessionOptions (session_options);
+  return NULL;
+}
+
 void
 mm_model_options_ref (MMModelOptions *model_options)
 {
@@ -76,10 +140,46 @@ mm_model_options_unref (MMModelOptions *model_options)
   rmodel_options->context->api->ReleaseRunOptions (model_options->run_options);
   rmodel_options->context->api->ReleaseSessionOptions (
       model_options->session_options);
+  /* Values point into the mapping, so release them first. */
+  g_ptr_array_unref (rmodel_options->initializers);
+  g_ptr_array_unref (rmodel_options->initializer_files);
+  if (rmodel_options->auto_shapes)
+    g_ptr_array_unref (rmodel_options->auto_shapes);
   mm_context_unref (model_options->context);
   g_free (model_options);
 }
 
+/* Appends provider by name, with options of char * to char *. */
+static OrtStatus *
+mm_model_options_append_generic_provider (MMModelOptions *model_options,
+                                          const char *name,
+                                          GHashTable *options)
+{
+  MMContext *context = model_options->context;
+  const char **keys;
+  const char **values;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  size_t n = 0;
+  OrtStatus *status;
+
+  keys = g_new (const char *, g_hash_table_size (options) + 1);
+  values = g_new (const char *, g_hash_table_size (options) + 1);
+  g_hash_table_iter_init (&iter, options);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      keys[n] = key;
+      values[n] = value;
+      n++;
+    }
+  status = context->api->SessionOptionsAppendExecutionProvider (
+      model_options->session_options, name, keys, values, n);
+  g_free (values);
+  g_free (keys);
+  return status;
+}
+
 gboolean
 mm_model_options_append_provider (MMModelOptions *model_options,
                                   MMProvider *provider, GError **error)
@@ -115,6 +215,14 @@ mm_model_options_append_provider (MMModelOptions *model_options,
       status = context->api->SessionOptionsAppendExecutionProvider_ROCM (
           rmodel_options->session_options, provider->rocm);
       break;
+    case MM_PROVIDER_XNNPACK:
+      status = mm_model_options_append_generic_provider (
+          model_options, "XNNPACK", provider->options);
+      break;
+    case MM_PROVIDER_OPEN_VINO:
+      status = mm_model_options_append_generic_provider (
+          model_options, "OpenVINO", provider->options);
+      break;
     default:
       g_warn_if_reached ();
       status = NULL;
@@ -131,3 +239,406 @@ on_error:
   mm_context_set_error (model_options->context, error, status);
   return FALSE;
 }
+
+void
+mm_model_options_set_auto_provider (MMModelOptions *model_options,
+                                    GPtrArray *shapes)
+{
+  MMRealModelOptions *rmodel_options = (MMRealModelOptions *)model_options;
+  g_return_if_fail (rmodel_options);
+
+  if (shapes)
+    g_ptr_array_ref (shapes);
+  if (rmodel_options->auto_shapes)
+    g_ptr_array_unref (rmodel_options->auto_shapes);
+  rmodel_options->auto_shapes = shapes;
+}
+
+GPtrArray *
+mm_model_options_get_auto_provider (MMModelOptions *model_options)
+{
+  MMRealModelOptions *rmodel_options = (MMRealModelOptions *)model_options;
+  g_return_val_if_fail (rmodel_options, NULL);
+  return rmodel_options->auto_shapes;
+}
+
+gboolean
+mm_model_options_add_external_initializers (MMModelOptions *model_options,
+                                            MMFile *file, GError **error)
+{
+  MMRealModelOptions *rmodel_options = (MMRealModelOptions *)model_options;
+  MMContext *context;
+  GStrv names = NULL;
+  GPtrArray *values = NULL;
+  OrtStatus *status;
+  g_return_val_if_fail (rmodel_options, FALSE);
+  g_return_val_if_fail (file, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  context = model_options->context;
+  if (!mm_file_map (file, context, &names, &values, error))
+    return FALSE;
+
+  status = context->api->AddSessionConfigEntry (
+      rmodel_options->session_options, "session.disable_prepacking", "1");
+  if (status)
+    goto on_ort_error;
+
+  status = context->api->AddExternalInitializers (
+      rmodel_options->session_options, (const char *const *)names,
+      (const OrtValue *const *)values->pdata, values->len);
+  if (status)
+    goto on_ort_error;
+
+  mm_file_ref (file);
+  g_ptr_array_add (rmodel_options->initializer_files, file);
+  /* values is freed, and its elements are owned by model_options */
+  g_ptr_array_extend_and_steal (rmodel_options->initializers, values);
+  g_strfreev (names);
+  return TRUE;
+on_ort_error:
+  mm_context_set_error (context, error, status);
+  g_ptr_array_unref (values);
+  g_strfreev (names);
+  return FALSE;
+}
+
+gboolean
+mm_model_options_set_numa_node (MMModelOptions *model_options, guint node,
+                                GError **error)
+{
+  MMContext *context;
+  GArray *cpus;
+  GString *group;
+  GString *affinities;
+  OrtStatus *status;
+  g_return_val_if_fail (model_options, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  context = model_options->context;
+  if (mm_context_has_global_thread_pools (context))
+    return TRUE;
+  if (node >= mm_numa_get_node_count ())
+    {
+      g_set_error (error, MM_NUMA_ERROR, MM_NUMA_ERROR_NODE,
+                   "Node %u does not exist.", node);
+      return FALSE;
+    }
+
+  cpus = mm_numa_get_node_cpus (node);
+  status = context->api->SetIntraOpNumThreads (model_options->session_options,
+                                               cpus->len);
+  if (status || (cpus->len < 2))
+    goto out;
+
+  /*
+   * Each thread but the calling one may run on any processor of the node.
+   * ORT numbers processors from 1.
+   */
+  group = g_string_new (NULL);
+  for (guint k = 0; k < cpus->len; k++)
+    {
+      guint cpu = g_array_index (cpus, guint, k);
+      guint last = cpu;
+
+      while ((k + 1 < cpus->len)
+             && (g_array_index (cpus, guint, k + 1) == last + 1))
+        last = g_array_index (cpus, guint, ++k);
+      if (group->len)
+        g_string_append_c (group, ',');
+      if (last == cpu)
+        g_string_append_printf (group, "%u", cpu + 1);
+      else
+        g_string_append_printf (group, "%u-%u", cpu + 1, last + 1);
+    }
+
+  affinities = g_string_new (NULL);
+  for (guint k = 1; k < cpus->len; k++)
+    {
+      if (affinities->len)
+        g_string_append_c (affinities, ';');
+      g_string_append (affinities, group->str);
+    }
+  status = context->api->AddSessionConfigEntry (
+      model_options->session_options, "session.intra_op_thread_affinities",
+      affinities->str);
+  g_string_free (affinities, TRUE);
+  g_string_free (group, TRUE);
+out:
+  g_array_unref (cpus);
+  if (status)
+    {
+      mm_context_set_error (context, error, status);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+gboolean
+mm_model_options_apply_tuning (MMModelOptions *model_options,
+                               const MMSessionTuning *tuning, GError **error)
+{
+  MMContext *context;
+  OrtSessionOptions *session_options;
+  const char *spinning;
+  OrtStatus *status;
+  g_return_val_if_fail (model_options, FALSE);
+  g_return_val_if_fail (tuning, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  context = model_options->context;
+  session_options = model_options->session_options;
+
+  status = context->api->SetSessionExecutionMode (session_options,
+                                                  tuning->execution_mode);
+  if (status)
+    goto on_ort_error;
+  status = context->api->SetSessionGraphOptimizationLevel (
+      session_options, tuning->optimization_level);
+  if (status)
+    goto on_ort_error;
+  if (tuning->memory_pattern)
+    status = context->api->EnableMemPattern (session_options);
+  else
+    status = context->api->DisableMemPattern (session_options);
+  if (status)
+    goto on_ort_error;
+  if (tuning->cpu_arena)
+    status = context->api->EnableCpuMemArena (session_options);
+  else
+    status = context->api->DisableCpuMemArena (session_options);
+  if (status)
+    goto on_ort_error;
+
+  /* Global thread pools are set up by the context. */
+  if (mm_context_has_global_thread_pools (context))
+    return TRUE;
+
+  status = context->api->SetIntraOpNumThreads (session_options,
+                                               tuning->intra_op_threads);
+  if (status)
+    goto on_ort_error;
+  status = context->api->SetInterOpNumThreads (session_options,
+                                               tuning->inter_op_threads);
+  if (status)
+    goto on_ort_error;
+  spinning = tuning->allow_spinning ? "1" : "0";
+  status = context->api->AddSessionConfigEntry (
+      session_options, "session.intra_op.allow_spinning", spinning);
+  if (status)
+    goto on_ort_error;
+  status = context->api->AddSessionConfigEntry (
+      session_options, "session.inter_op.allow_spinning", spinning);
+  if (status)
+    goto on_ort_error;
+  return TRUE;
+on_ort_error:
+  mm_context_set_error (context, error, status);
+  return FALSE;
+}
+
+gboolean
+mm_model_options_load_profile (MMModelOptions *model_options,
+                               const char *path, const char *group,
+                               GError **error)
+{
+  MMSessionTuning tuning;
+  GKeyFile *key_file;
+  gboolean ret = FALSE;
+  g_return_val_if_fail (model_options, FALSE);
+  g_return_val_if_fail (path, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  mm_session_tuning_init (&tuning);
+  key_file = g_key_file_new ();
+  if (g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, error)
+      && mm_session_tuning_load (&tuning, key_file, group, error))
+    ret = mm_model_options_apply_tuning (model_options, &tuning, error);
+  g_key_file_unref (key_file);
+  return ret;
+}
+
+static const char *const mm_session_tuning_execution_modes[] = {
+  [ORT_SEQUENTIAL] = "sequential",
+  [ORT_PARALLEL] = "parallel",
+};
+
+static const char *const mm_session_tuning_optimization_levels[] = {
+  [ORT_DISABLE_ALL] = "disable",
+  [ORT_ENABLE_BASIC] = "basic",
+  [ORT_ENABLE_EXTENDED] = "extended",
+  [ORT_ENABLE_ALL] = "all",
+};
+
+void
+mm_session_tuning_init (MMSessionTuning *tuning)
+{
+  g_return_if_fail (tuning);
+
+  tuning->intra_op_threads = 0;
+  tuning->inter_op_threads = 0;
+  tuning->execution_mode = ORT_SEQUENTIAL;
+  tuning->optimization_level = ORT_ENABLE_ALL;
+  tuning->memory_pattern = TRUE;
+  tuning->cpu_arena = TRUE;
+  tuning->allow_spinning = TRUE;
+}
+
+/* Returns index of the name in names, or -1. */
+static int
+mm_session_tuning_lookup (const char *const *names, size_t len,
+                          const char *name)
+{
+  for (size_t i = 0; i < len; i++)
+    if (names[i] && (g_strcmp0 (names[i], name) == 0))
+      return i;
+  return -1;
+}
+
+static gboolean
+mm_session_tuning_load_enum (GKeyFile *key_file, const char *group,
+                             const char *key, const char *const *names,
+                             size_t len, int *value, GError **error)
+{
+  char *name;
+  int i;
+
+  if (!g_key_file_has_key (key_file, group, key, NULL))
+    return TRUE;
+  name = g_key_file_get_string (key_file, group, key, error);
+  if (name == NULL)
+    return FALSE;
+  i = mm_session_tuning_lookup (names, len, name);
+  if (i < 0)
+    g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                 "Value %s of %s is not valid.", name, key);
+  else
+    *value = i;
+  g_free (name);
+  return i >= 0;
+}
+
+static gboolean
+mm_session_tuning_load_int (GKeyFile *key_file, const char *group,
+                            const char *key, int *value, GError **error)
+{
+  GError *local_error = NULL;
+  int v;
+
+  if (!g_key_file_has_key (key_file, group, key, NULL))
+    return TRUE;
+  v = g_key_file_get_integer (key_file, group, key, &local_error);
+  if ((local_error == NULL) && (v < 0))
+    g_set_error (&local_error, G_KEY_FILE_ERROR,
+                 G_KEY_FILE_ERROR_INVALID_VALUE,
+                 "Value %d of %s is not valid.", v, key);
+  if (local_error)
+    {
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+  *value = v;
+  return TRUE;
+}
+
+static gboolean
+mm_session_tuning_load_boolean (GKeyFile *key_file, const char *group,
+                                const char *key, gboolean *value,
+                                GError **error)
+{
+  GError *local_error = NULL;
+  gboolean v;
+
+  if (!g_key_file_has_key (key_file, group, key, NULL))
+    return TRUE;
+  v = g_key_file_get_boolean (key_file, group, key, &local_error);
+  if (local_error)
+    {
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+  *value = v;
+  return TRUE;
+}
+
+gboolean
+mm_session_tuning_load (MMSessionTuning *tuning, GKeyFile *key_file,
+                        const char *group, GError **error)
+{
+  MMSessionTuning loaded;
+  int execution_mode;
+  int optimization_level;
+  g_return_val_if_fail (tuning, FALSE);
+  g_return_val_if_fail (key_file, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (group == NULL)
+    group = MM_SESSION_TUNING_GROUP;
+  if (!g_key_file_has_group (key_file, group))
+    {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+                   "Group %s is not found.", group);
+      return FALSE;
+    }
+
+  /* tuning is left unchanged on error. */
+  loaded = *tuning;
+  execution_mode = loaded.execution_mode;
+  optimization_level = loaded.optimization_level;
+  if (!mm_session_tuning_load_int (key_file, group, "intra_op_threads",
+                                   &loaded.intra_op_threads, error)
+      || !mm_session_tuning_load_int (key_file, group, "inter_op_threads",
+                                      &loaded.inter_op_threads, error)
+      || !mm_session_tuning_load_enum (
+          key_file, group, "execution_mode",
+          mm_session_tuning_execution_modes,
+          G_N_ELEMENTS (mm_session_tuning_execution_modes), &execution_mode,
+          error)
+      || !mm_session_tuning_load_enum (
+          key_file, group, "optimization_level",
+          mm_session_tuning_optimization_levels,
+          G_N_ELEMENTS (mm_session_tuning_optimization_levels),
+          &optimization_level, error)
+      || !mm_session_tuning_load_boolean (key_file, group, "memory_pattern",
+                                          &loaded.memory_pattern, error)
+      || !mm_session_tuning_load_boolean (key_file, group, "cpu_arena",
+                                          &loaded.cpu_arena, error)
+      || !mm_session_tuning_load_boolean (key_file, group, "allow_spinning",
+                                          &loaded.allow_spinning, error))
+    return FALSE;
+
+  loaded.execution_mode = execution_mode;
+  loaded.optimization_level = optimization_level;
+  *tuning = loaded;
+  return TRUE;
+}
+
+void
+mm_session_tuning_save (const MMSessionTuning *tuning, GKeyFile *key_file,
+                        const char *group)
+{
+  g_return_if_fail (tuning);
+  g_return_if_fail (key_file);
+  g_return_if_fail (tuning->execution_mode
+                    < G_N_ELEMENTS (mm_session_tuning_execution_modes));
+  g_return_if_fail (tuning->optimization_level
+                    < G_N_ELEMENTS (mm_session_tuning_optimization_levels));
+
+  if (group == NULL)
+    group = MM_SESSION_TUNING_GROUP;
+  g_key_file_set_integer (key_file, group, "intra_op_threads",
+                          tuning->intra_op_threads);
+  g_key_file_set_integer (key_file, group, "inter_op_threads",
+                          tuning->inter_op_threads);
+  g_key_file_set_string (
+      key_file, group, "execution_mode",
+      mm_session_tuning_execution_modes[tuning->execution_mode]);
+  g_key_file_set_string (
+      key_file, group, "optimization_level",
+      mm_session_tuning_optimization_levels[tuning->optimization_level]);
+  g_key_file_set_boolean (key_file, group, "memory_pattern",
+                          tuning->memory_pattern);
+  g_key_file_set_boolean (key_file, group, "cpu_arena", tuning->cpu_arena);
+  g_key_file_set_boolean (key_file, group, "allow_spinning",
+                          tuning->allow_spinning);
+}
@@ -0,0 +1,424 @@
+#include <glib/gstdio.h>
+
+#include "mm-model-registry.h"
+
+G_DEFINE_QUARK (mm-model-registry-error, mm_model_registry_error);
+
+typedef struct _MMModelRegistryEntry MMModelRegistryEntry;
+
+struct _MMModelRegistryEntry
+{
+  gchar *id;
+  gchar *file_path;
+  MMModelOptions *options;
+  size_t size;
+  /* NULL if not loaded */
+  MMModel *model;
+  /* TRUE while model is being loaded */
+  gboolean loading;
+  /* Number of acquires not released yet */
+  guint pins;
+  /* Link in the LRU queue while model is loaded */
+  GList link;
+};
+
+struct _MMModelRegistry
+{
+  /* Prefetches models */
+  GThreadPool *pool;
+  /* (char *, MMModelRegistryEntry *) */
+  GHashTable *entries;
+  /* Loaded entries, the most recently used first */
+  GQueue lru;
+  size_t budget;
+  /* Including models being loaded */
+  size_t loaded_size;
+  GMutex mutex;
+  GCond cond;
+  /* Contexts of added options, and ids of their evict functions */
+  GPtrArray *contexts;
+  GArray *evict_ids;
+  GMutex contexts_mutex;
+  gatomicrefcount ref_count;
+};
+
+static void
+mm_model_registry_entry_free (MMModelRegistryEntry *entry)
+{
+  g_free (entry->id);
+  g_free (entry->file_path);
+  mm_model_options_unref (entry->options);
+  if (entry->model)
+    mm_model_unref (entry->model);
+  g_free (entry);
+}
+
+/*
+ * Unloads the least recently used unpinned models until size bytes are
+ * freed. Models are moved to unloaded, so they can be freed after mutex is
+ * released. Called with mutex held.
+ */
+static size_t
+mm_model_registry_evict (MMModelRegistry *registry, size_t size,
+                         GPtrArray *unloaded)
+{
+  GList *link = registry->lru.tail;
+  size_t freed = 0;
+
+  while (link && (freed < size))
+    {
+      MMModelRegistryEntry *entry = link->data;
+      GList *prev = link->prev;
+
+      if (entry->pins == 0)
+        {
+          g_queue_unlink (&registry->lru, link);
+          g_ptr_array_add (unloaded, g_steal_pointer (&entry->model));
+          registry->loaded_size -= entry->size;
+          freed += entry->size;
+        }
+      link = prev;
+    }
+  return freed;
+}
+
+/* Evicts models until size more bytes fit budget. */
+static gboolean
+mm_model_registry_make_room (MMModelRegistry *registry, size_t size,
+                             GPtrArray *unloaded)
+{
+  size_t budget = registry->budget;
+
+  if ((budget == 0) || (registry->loaded_size + size <= budget))
+    return TRUE;
+  mm_model_registry_evict (registry, registry->loaded_size + size - budget,
+                           unloaded);
+  return registry->loaded_size + size <= budget;
+}
+
+/*
+ * Loads model of entry. Called with mutex held, which is released while
+ * loading.
+ */
+static gboolean
+mm_model_registry_load (MMModelRegistry *registry,
+                        MMModelRegistryEntry *entry, GError **error)
+{
+  GPtrArray *unloaded;
+  MMModel *model;
+  gboolean fit;
+
+  unloaded = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_model_unref);
+  fit = mm_model_registry_make_room (registry, entry->size, unloaded);
+  if (!fit)
+    g_set_error (error, MM_MODEL_REGISTRY_ERROR,
+                 MM_MODEL_REGISTRY_ERROR_BUDGET,
+                 "Model %s (%" G_GSIZE_FORMAT " bytes) does not fit budget.",
+                 entry->id, entry->size);
+  else
+    {
+      /* Counted while loading, so concurrent loads do not exceed budget. */
+      registry->loaded_size += entry->size;
+      entry->loading = TRUE;
+    }
+
+  /* Free unloaded models before loading, to keep the peak low. */
+  g_mutex_unlock (&registry->mutex);
+  g_ptr_array_unref (unloaded);
+  model = fit ? mm_model_new (entry->options, entry->file_path, error) : NULL;
+  g_mutex_lock (&registry->mutex);
+  if (!fit)
+    return FALSE;
+
+  entry->loading = FALSE;
+  g_cond_broadcast (&registry->cond);
+  if (model == NULL)
+    {
+      registry->loaded_size -= entry->size;
+      return FALSE;
+    }
+  entry->model = model;
+  g_queue_push_head_link (&registry->lru, &entry->link);
+  return TRUE;
+}
+
+static void
+mm_model_registry_prefetch_entry (gpointer data, gpointer user_data)
+{
+  MMModelRegistryEntry *entry = data;
+  MMModelRegistry *registry = user_data;
+
+  g_mutex_lock (&registry->mutex);
+  if ((entry->model == NULL) && !entry->loading)
+    mm_model_registry_load (registry, entry, NULL);
+  g_mutex_unlock (&registry->mutex);
+}
+
+/* Called by contexts whose memory budget is exceeded. */
+static size_t
+mm_model_registry_evict_memory (size_t size, gpointer user_data)
+{
+  MMModelRegistry *registry = user_data;
+  GPtrArray *unloaded;
+  size_t freed;
+
+  unloaded = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_model_unref);
+  g_mutex_lock (&registry->mutex);
+  freed = mm_model_registry_evict (registry, size, unloaded);
+  g_mutex_unlock (&registry->mutex);
+  g_ptr_array_unref (unloaded);
+  return freed;
+}
+
+MMModelRegistry *
+mm_model_registry_new (size_t budget, GError **error)
+{
+  MMModelRegistry *registry;
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  registry = g_new0 (MMModelRegistry, 1);
+  registry->pool = g_thread_pool_new (mm_model_registry_prefetch_entry,
+                                      registry, 1, FALSE, error);
+  if (registry->pool == NULL)
+    {
+      g_free (registry);
+      return NULL;
+    }
+
+  registry->entries = g_hash_table_new_full (
+      g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify)mm_model_registry_entry_free);
+  g_queue_init (&registry->lru);
+  registry->budget = budget;
+  g_mutex_init (&registry->mutex);
+  g_cond_init (&registry->cond);
+  registry->contexts
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_context_unref);
+  registry->evict_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_mutex_init (&registry->contexts_mutex);
+  g_atomic_ref_count_init (&registry->ref_count);
+  return registry;
+}
+
+void
+mm_model_registry_ref (MMModelRegistry *registry)
+{
+  g_return_if_fail (registry);
+  g_atomic_ref_count_inc (&registry->ref_count);
+}
+
+void
+mm_model_registry_unref (MMModelRegistry *registry)
+{
+  g_return_if_fail (registry);
+  if (!g_atomic_ref_count_dec (&registry->ref_count))
+    return;
+
+  g_thread_pool_free (registry->pool, TRUE, TRUE);
+  /* Waits for evict functions being called. */
+  for (guint k = 0; k < registry->contexts->len; k++)
+    mm_context_remove_memory_evict_func (
+        registry->contexts->pdata[k],
+        g_array_index (registry->evict_ids, guint, k));
+  g_ptr_array_unref (registry->contexts);
+  g_array_unref (registry->evict_ids);
+  /* Links of the LRU queue are embedded in entries. */
+  g_hash_table_unref (registry->entries);
+  g_mutex_clear (&registry->contexts_mutex);
+  g_cond_clear (&registry->cond);
+  g_mutex_clear (&registry->mutex);
+  g_free (registry);
+}
+
+void
+mm_model_registry_set_budget (MMModelRegistry *registry, size_t budget)
+{
+  GPtrArray *unloaded;
+  g_return_if_fail (registry);
+
+  unloaded = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_model_unref);
+  g_mutex_lock (&registry->mutex);
+  registry->budget = budget;
+  mm_model_registry_make_room (registry, 0, unloaded);
+  g_mutex_unlock (&registry->mutex);
+  g_ptr_array_unref (unloaded);
+}
+
+/* Registers evict function to context once. */
+static void
+mm_model_registry_watch_context (MMModelRegistry *registry,
+                                 MMContext *context)
+{
+  guint id;
+
+  /*
+   * Not under mutex, because the context calls evict functions, which take
+   * mutex, with its own lock held.
+   */
+  g_mutex_lock (&registry->contexts_mutex);
+  if (!g_ptr_array_find (registry->contexts, context, NULL))
+    {
+      id = mm_context_add_memory_evict_func (
+          context, mm_model_registry_evict_memory, registry);
+      mm_context_ref (context);
+      g_ptr_array_add (registry->contexts, context);
+      g_array_append_val (registry->evict_ids, id);
+    }
+  g_mutex_unlock (&registry->contexts_mutex);
+}
+
+gboolean
+mm_model_registry_add (MMModelRegistry *registry, const char *id,
+                       MMModelOptions *options, const char *file_path,
+                       GError **error)
+{
+  MMModelRegistryEntry *entry;
+  GStatBuf st;
+  g_return_val_if_fail (registry, FALSE);
+  g_return_val_if_fail (id, FALSE);
+  g_return_val_if_fail (options, FALSE);
+  g_return_val_if_fail (file_path, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  g_mutex_lock (&registry->mutex);
+  if (g_hash_table_contains (registry->entries, id))
+    {
+      g_mutex_unlock (&registry->mutex);
+      g_set_error (error, MM_MODEL_REGISTRY_ERROR,
+                   MM_MODEL_REGISTRY_ERROR_EXISTS,
+                   "Model %s is already added.", id);
+      return FALSE;
+    }
+
+  mm_model_options_ref (options);
+  entry = g_new0 (MMModelRegistryEntry, 1);
+  entry->id = g_strdup (id);
+  entry->file_path = g_strdup (file_path);
+  entry->options = options;
+  if (g_stat (file_path, &st) == 0)
+    entry->size = st.st_size;
+  entry->link.data = entry;
+  g_hash_table_insert (registry->entries, entry->id, entry);
+  g_mutex_unlock (&registry->mutex);
+
+  mm_model_registry_watch_context (registry, options->context);
+  return TRUE;
+}
+
+static MMModelRegistryEntry *
+mm_model_registry_lookup (MMModelRegistry *registry, const char *id,
+                          GError **error)
+{
+  MMModelRegistryEntry *entry;
+
+  entry = g_hash_table_lookup (registry->entries, id);
+  if (entry == NULL)
+    g_set_error (error, MM_MODEL_REGISTRY_ERROR,
+                 MM_MODEL_REGISTRY_ERROR_NOT_FOUND, "Model %s is not added.",
+                 id);
+  return entry;
+}
+
+MMModel *
+mm_model_registry_acquire (MMModelRegistry *registry, const char *id,
+                           GError **error)
+{
+  MMModelRegistryEntry *entry;
+  MMModel *model = NULL;
+  g_return_val_if_fail (registry, NULL);
+  g_return_val_if_fail (id, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  g_mutex_lock (&registry->mutex);
+  entry = mm_model_registry_lookup (registry, id, error);
+  if (entry == NULL)
+    goto out;
+
+  entry->pins++;
+  while (entry->loading)
+    g_cond_wait (&registry->cond, &registry->mutex);
+  if ((entry->model == NULL)
+      && !mm_model_registry_load (registry, entry, error))
+    {
+      entry->pins--;
+      goto out;
+    }
+
+  g_queue_unlink (&registry->lru, &entry->link);
+  g_queue_push_head_link (&registry->lru, &entry->link);
+  model = entry->model;
+out:
+  g_mutex_unlock (&registry->mutex);
+  return model;
+}
+
+void
+mm_model_registry_release (MMModelRegistry *registry, const char *id)
+{
+  MMModelRegistryEntry *entry;
+  GPtrArray *unloaded;
+  g_return_if_fail (registry);
+  g_return_if_fail (id);
+
+  unloaded = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_model_unref);
+  g_mutex_lock (&registry->mutex);
+  entry = g_hash_table_lookup (registry->entries, id);
+  if (entry && entry->pins)
+    {
+      entry->pins--;
+      /* Budget can be lowered while the model is pinned. */
+      mm_model_registry_make_room (registry, 0, unloaded);
+    }
+  g_mutex_unlock (&registry->mutex);
+  g_ptr_array_unref (unloaded);
+  g_return_if_fail (entry);
+}
+
+gboolean
+mm_model_registry_prefetch (MMModelRegistry *registry, const char *id,
+                            GError **error)
+{
+  MMModelRegistryEntry *entry;
+  gboolean queue;
+  g_return_val_if_fail (registry, FALSE);
+  g_return_val_if_fail (id, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  g_mutex_lock (&registry->mutex);
+  entry = mm_model_registry_lookup (registry, id, error);
+  queue = entry && (entry->model == NULL) && !entry->loading;
+  g_mutex_unlock (&registry->mutex);
+
+  if (entry == NULL)
+    return FALSE;
+  if (!queue)
+    return TRUE;
+  return g_thread_pool_push (registry->pool, entry, error);
+}
+
+gboolean
+mm_model_registry_is_loaded (MMModelRegistry *registry, const char *id)
+{
+  MMModelRegistryEntry *entry;
+  gboolean loaded;
+  g_return_val_if_fail (registry, FALSE);
+  g_return_val_if_fail (id, FALSE);
+
+  g_mutex_lock (&registry->mutex);
+  entry = g_hash_table_lookup (registry->entries, id);
+  loaded = entry && entry->model;
+  g_mutex_unlock (&registry->mutex);
+  return loaded;
+}
+
+size_t
+mm_model_registry_get_loaded_size (MMModelRegistry *registry)
+{
+  size_t size;
+  g_return_val_if_fail (registry, 0);
+
+  g_mutex_lock (&registry->mutex);
+  size = registry->loaded_size;
+  g_mutex_unlock (&registry->mutex);
+  return size;
+}
@@ -1,9 +1,14 @@
+#include <glib/gstdio.h>
 
+#include "mm-convert.h"
+#include "mm-provider-select.h"
 #include "mm-value-info.h"
+#include "mm-value.h"
 
 #include "mm-model.h"
 
 typedef struct _MMRealModel MMRealModel;
+G_DEFINE_QUARK (mm-model-error, mm_model_error);
 
 struct _MMRealModel
 {
@@ -12,6 +17,8 @@ struct _MMRealModel
   OrtAllocator *allocator;
   GPtrArray *input_infos;
   GPtrArray *output_infos;
+  /* Bytes charged to the context for the session */
+  size_t memory_size;
   gatomicrefcount ref_count;
 };
 
@@ -25,6 +32,7 @@ mm_model_new (MMModelOptions *options, const char *file_path, GError **error)
   size_t noutputs = 0;
   OrtTypeInfo *__info = NULL;
   char *__name = NULL;
+  GStatBuf st;
   OrtStatus *status;
 
   g_return_val_if_fail (options, NULL);
@@ -32,8 +40,22 @@ mm_model_new (MMModelOptions *options, const char *file_path, GError **error)
   g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
   context = options->context;
 
+  if (mm_model_options_get_auto_provider (options))
+    return mm_provider_select_model (
+        options, file_path, mm_model_options_get_auto_provider (options),
+        error);
+
   model = g_new0 (MMRealModel, 1);
 
+  /* Weights dominate the session, so the file size is charged for it. */
+  if (g_stat (file_path, &st) == 0)
+    model->memory_size = st.st_size;
+  if (!mm_context_reserve_memory (context, model->memory_size, error))
+    {
+      g_free (model);
+      return NULL;
+    }
+
   status = context->api->CreateSession (context->env, file_path,
                                         options->session_options, &session);
   if (status)
@@ -126,10 +148,76 @@ on_error:
   g_ptr_array_free (model->input_infos, TRUE);
   if (session)
     context->api->ReleaseSession (session);
+  mm_context_release_memory (context, model->memory_size);
   g_free (model);
   return NULL;
 }
 
+typedef struct _MMModelNewData
+{
+  MMModelOptions *options;
+  gchar *file_path;
+} MMModelNewData;
+
+static void
+mm_model_new_data_free (MMModelNewData *data)
+{
+  mm_model_options_unref (data->options);
+  g_free (data->file_path);
+  g_free (data);
+}
+
+static void
+mm_model_new_thread (GTask *task, gpointer source_object, gpointer task_data,
+                     GCancellable *cancellable)
+{
+  MMModelNewData *data = task_data;
+  MMModel *model;
+  GError *error = NULL;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  model = mm_model_new (data->options, data->file_path, &error);
+  if (model == NULL)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+  g_task_return_pointer (task, model, (GDestroyNotify)mm_model_unref);
+}
+
+void
+mm_model_new_async (MMModelOptions *options, const char *file_path,
+                    GCancellable *cancellable, GAsyncReadyCallback callback,
+                    gpointer user_data)
+{
+  GTask *task;
+  MMModelNewData *data;
+  g_return_if_fail (options);
+  g_return_if_fail (file_path);
+
+  mm_model_options_ref (options);
+  data = g_new (MMModelNewData, 1);
+  data->options = options;
+  data->file_path = g_strdup (file_path);
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mm_model_new_async);
+  g_task_set_task_data (task, data, (GDestroyNotify)mm_model_new_data_free);
+  g_task_run_in_thread (task, mm_model_new_thread);
+  g_object_unref (task);
+}
+
+MMModel *
+mm_model_new_finish (GAsyncResult *result, GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 void
 mm_model_ref (MMModel *model)
 {
@@ -153,6 +241,7 @@ mm_model_unref (MMModel *model)
   g_ptr_array_unref (rmodel->input_infos);
   g_ptr_array_unref (rmodel->output_infos);
   context->api->ReleaseSession (rmodel->session);
+  mm_context_release_memory (context, rmodel->memory_size);
   mm_model_options_unref (rmodel->options);
   g_free (rmodel);
 }
@@ -160,23 +249,312 @@ mm_model_unref (MMModel *model)
 gboolean
 mm_model_run (MMModel *model, MMModelInput *input, MMModelOutput *output,
               GError **error)
+{
+  return mm_model_run_with_context (model, input, output, NULL, error);
+}
+
+gboolean
+mm_model_run_with_context (MMModel *model, MMModelInput *input,
+                           MMModelOutput *output, MMRunContext *run_context,
+                           GError **error)
 {
   MMContext *context;
+  OrtRunOptions *run_options;
   OrtStatus *status;
   g_return_val_if_fail (model, FALSE);
   g_return_val_if_fail (input, FALSE);
   g_return_val_if_fail (output, FALSE);
   g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
 
+  if (!mm_model_output_unshare (output, error))
+    return FALSE;
+
   context = model->options->context;
-  status = context->api->Run (model->session, model->options->run_options,
-                              input->names, input->values, input->length,
-                              output->names, output->length, output->values);
-  if (status)
+  run_options = model->options->run_options;
+  if (run_context)
+    {
+      run_options = mm_run_context_begin (run_context, error);
+      if (run_options == NULL)
+        return FALSE;
+    }
+
+  status = context->api->Run (model->session, run_options, input->names,
+                              input->values, input->length, output->names,
+                              output->length, output->values);
+  if (run_context)
+    {
+      if (!mm_run_context_end (run_context, status, error))
+        return FALSE;
+    }
+  else if (status)
     {
       mm_context_set_error (context, error, status);
       return FALSE;
     }
 
-  return mm_model_output_update_info (output, error);
+  /* Outputs are sliced back to dimensions padded by inputs, too */
+  return mm_model_output_update_info_with_dimension (
+      output, mm_model_input_get_valid_dimension (input), error);
+}
+
+size_t
+mm_model_get_projected_size (MMModel *model, GHashTable *shape)
+{
+  size_t size = 0;
+  g_return_val_if_fail (model, 0);
+
+  for (guint k = 0; k < model->output_infos->len; k++)
+    {
+      MMValueInfo *info = mm_value_info_copy (model->output_infos->pdata[k]);
+
+      if (shape)
+        mm_value_info_set_dimension (info, shape);
+      size += mm_value_info_get_data_size (info);
+      mm_value_info_unref (info);
+    }
+  return size;
+}
+
+typedef struct _MMModelWarmupData
+{
+  MMModel *model;
+  GHashTable *shape;
+  MMModelWarmupTiming *timing;
+  GError *error;
+} MMModelWarmupData;
+
+/*
+ * Creates zero-filled inputs for shape, and outputs to be allocated by ORT.
+ * If fill is TRUE, floating point inputs are filled with the same pseudo
+ * random values in [-1, 1) instead, so kernels do not take paths special to
+ * zero. values holds both, and should be freed with g_ptr_array_unref().
+ */
+static gboolean
+mm_model_new_io (MMModel *model, GHashTable *shape, gboolean fill,
+                 GPtrArray **values, MMModelInput **input,
+                 MMModelOutput **output, GError **error)
+{
+  MMContext *context;
+  GPtrArray *v_array;
+  GRand *rand = NULL;
+
+  context = model->options->context;
+  v_array = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_value_unref);
+
+  for (guint k = 0; k < model->input_infos->len; k++)
+    {
+      MMValueInfo *info = model->input_infos->pdata[k];
+      MMValue *v;
+
+      v = mm_value_new (context, info, model, info->name, NULL, NULL, error);
+      if (v == NULL)
+        goto on_error;
+      g_ptr_array_add (v_array, v);
+
+      mm_value_info_set_dimension (v->info, shape);
+      for (size_t i = 0; i < v->info->ndim; i++)
+        {
+          if (v->info->dim[i] > 0)
+            continue;
+          g_set_error (error, MM_MODEL_ERROR, MM_MODEL_ERROR_SHAPE,
+                       "Dimension %s of %s is not set.",
+                       v->info->dim_name[i], info->name);
+          goto on_error;
+        }
+
+      /* Tensors are created zero-filled. */
+      if (!mm_value_update (v, error))
+        goto on_error;
+      if (fill
+          && mm_convert_is_supported (v->info->dtype,
+                                      ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT))
+        {
+          size_t count = mm_value_info_get_element_count (v->info);
+          float *data = g_new (float, count);
+          gboolean ret;
+
+          if (rand == NULL)
+            rand = g_rand_new_with_seed (0);
+          for (size_t i = 0; i < count; i++)
+            data[i] = g_rand_double_range (rand, -1.0, 1.0);
+          ret = mm_value_set_data_from (
+              v, data, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, error);
+          g_free (data);
+          if (!ret)
+            goto on_error;
+        }
+    }
+
+  /* Output values are left NULL, so ORT allocates them. */
+  for (guint k = 0; k < model->output_infos->len; k++)
+    {
+      MMValueInfo *info = model->output_infos->pdata[k];
+      MMValue *v;
+
+      v = mm_value_new (context, info, model, NULL, info->name, NULL, error);
+      if (v == NULL)
+        goto on_error;
+      g_ptr_array_add (v_array, v);
+    }
+
+  *input = mm_model_input_new (v_array);
+  *output = mm_model_output_new (v_array);
+  mm_model_input_update (*input);
+  mm_model_output_update (*output);
+  *values = v_array;
+  g_clear_pointer (&rand, g_rand_free);
+  return TRUE;
+on_error:
+  g_ptr_array_unref (v_array);
+  g_clear_pointer (&rand, g_rand_free);
+  return FALSE;
+}
+
+static gboolean
+mm_model_warmup_shape (MMModel *model, GHashTable *shape,
+                       MMModelWarmupTiming *timing, GError **error)
+{
+  GPtrArray *values;
+  MMModelInput *input;
+  MMModelOutput *output;
+  gboolean ret = FALSE;
+  gint64 start;
+
+  if (!mm_model_new_io (model, shape, FALSE, &values, &input, &output,
+                        error))
+    return FALSE;
+
+  start = g_get_monotonic_time ();
+  if (!mm_model_run (model, input, output, error))
+    goto out;
+  timing->cold = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  if (!mm_model_run (model, input, output, error))
+    goto out;
+  timing->warm = g_get_monotonic_time () - start;
+  ret = TRUE;
+out:
+  mm_model_output_unref (output);
+  mm_model_input_unref (input);
+  g_ptr_array_unref (values);
+  return ret;
+}
+
+static gpointer
+mm_model_warmup_thread (gpointer user_data)
+{
+  MMModelWarmupData *data = user_data;
+  mm_model_warmup_shape (data->model, data->shape, data->timing,
+                         &data->error);
+  return NULL;
+}
+
+gboolean
+mm_model_warmup (MMModel *model, GPtrArray *shapes, gboolean parallel,
+                 GArray **timings, GError **error)
+{
+  GArray *timing_array;
+  gboolean ret = TRUE;
+  g_return_val_if_fail (model, FALSE);
+  g_return_val_if_fail (shapes, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  timing_array = g_array_sized_new (FALSE, TRUE, sizeof (MMModelWarmupTiming),
+                                    shapes->len);
+  g_array_set_size (timing_array, shapes->len);
+
+  if (parallel)
+    {
+      MMModelWarmupData *data = g_new0 (MMModelWarmupData, shapes->len);
+      GThread **threads = g_new (GThread *, shapes->len);
+
+      for (guint k = 0; k < shapes->len; k++)
+        {
+          data[k].model = model;
+          data[k].shape = shapes->pdata[k];
+          data[k].timing
+              = &g_array_index (timing_array, MMModelWarmupTiming, k);
+          threads[k] = g_thread_new ("mm-model-warmup",
+                                     mm_model_warmup_thread, data + k);
+        }
+
+      for (guint k = 0; k < shapes->len; k++)
+        {
+          g_thread_join (threads[k]);
+          if (data[k].error == NULL)
+            continue;
+          if (ret)
+            g_propagate_error (error, data[k].error);
+          else
+            g_error_free (data[k].error);
+          ret = FALSE;
+        }
+
+      g_free (threads);
+      g_free (data);
+    }
+  else
+    {
+      for (guint k = 0; ret && (k < shapes->len); k++)
+        ret = mm_model_warmup_shape (
+            model, shapes->pdata[k],
+            &g_array_index (timing_array, MMModelWarmupTiming, k), error);
+    }
+
+  if (ret && timings)
+    *timings = timing_array;
+  else
+    g_array_unref (timing_array);
+  return ret;
+}
+
+GArray *
+mm_model_benchmark (MMModel *model, GHashTable *shape, guint iterations,
+                    GPtrArray **outputs, GError **error)
+{
+  GPtrArray *values;
+  MMModelInput *input;
+  MMModelOutput *output;
+  GArray *durations;
+  g_return_val_if_fail (model, NULL);
+  g_return_val_if_fail (shape, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  if (!mm_model_new_io (model, shape, TRUE, &values, &input, &output,
+                        error))
+    return NULL;
+
+  durations = g_array_sized_new (FALSE, FALSE, sizeof (gint64), iterations);
+  /* The first run plans allocations and is not measured. */
+  for (guint k = 0; k <= iterations; k++)
+    {
+      gint64 start = g_get_monotonic_time ();
+      gint64 duration;
+
+      if (!mm_model_run (model, input, output, error))
+        {
+          g_clear_pointer (&durations, g_array_unref);
+          break;
+        }
+      duration = g_get_monotonic_time () - start;
+      if (k > 0)
+        g_array_append_val (durations, duration);
+    }
+
+  if (durations && outputs)
+    {
+      *outputs = g_ptr_array_new_with_free_func (
+          (GDestroyNotify)mm_value_unref);
+      for (guint k = model->input_infos->len; k < values->len; k++)
+        {
+          mm_value_ref (values->pdata[k]);
+          g_ptr_array_add (*outputs, values->pdata[k]);
+        }
+    }
+
+  mm_model_output_unref (output);
+  mm_model_input_unref (input);
+  g_ptr_array_unref (values);
+  return durations;
 }
@@ -0,0 +1,378 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#endif
+
+#include "mm-numa.h"
+
+G_DEFINE_QUARK (mm-numa-error, mm_numa_error);
+
+#define MM_NUMA_SYSFS_PATH "/sys/devices/system/node"
+
+typedef struct _MMNumaTopology MMNumaTopology;
+typedef struct _MMNumaLoadData MMNumaLoadData;
+
+struct _MMNumaTopology
+{
+  /* GArray of guint for each node */
+  GPtrArray *node_cpus;
+  /* Node of each processor, indexed by processor id */
+  GArray *cpu_node;
+};
+
+struct _MMModelReplicas
+{
+  /* MMModel for each node */
+  GPtrArray *models;
+  gatomicrefcount ref_count;
+};
+
+/* Data of a thread loading a replica */
+struct _MMNumaLoadData
+{
+  MMModelOptions *options;
+  const char *file_path;
+  guint node;
+  MMModel *model;
+  GError *error;
+};
+
+/* Parses cpulist of sysfs, such as "0-3,8-11". */
+static GArray *
+mm_numa_parse_cpulist (const char *cpulist)
+{
+  GArray *cpus = g_array_new (FALSE, FALSE, sizeof (guint));
+  GStrv ranges = g_strsplit (cpulist, ",", -1);
+
+  for (guint k = 0; ranges[k]; k++)
+    {
+      char *range = g_strstrip (ranges[k]);
+      guint64 first;
+      guint64 last;
+      char *end;
+
+      if (*range == '\0')
+        continue;
+      first = g_ascii_strtoull (range, &end, 10);
+      last = first;
+      if (*end == '-')
+        last = g_ascii_strtoull (end + 1, NULL, 10);
+      for (guint64 cpu = first; cpu <= last; cpu++)
+        {
+          guint c = cpu;
+          g_array_append_val (cpus, c);
+        }
+    }
+  g_strfreev (ranges);
+  return cpus;
+}
+
+static gint
+mm_numa_compare_id (gconstpointer a, gconstpointer b)
+{
+  guint ia = *(const guint *)a;
+  guint ib = *(const guint *)b;
+  return (ia > ib) - (ia < ib);
+}
+
+/* Adds nodes with processors from sysfs. */
+static void
+mm_numa_read_nodes (MMNumaTopology *topology)
+{
+  GArray *ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  const char *name;
+  GDir *dir;
+
+  dir = g_dir_open (MM_NUMA_SYSFS_PATH, 0, NULL);
+  if (dir == NULL)
+    goto out;
+  while ((name = g_dir_read_name (dir)))
+    {
+      char *end;
+      guint id;
+
+      if (!g_str_has_prefix (name, "node")
+          || !g_ascii_isdigit (name[strlen ("node")]))
+        continue;
+      id = g_ascii_strtoull (name + strlen ("node"), &end, 10);
+      if (*end == '\0')
+        g_array_append_val (ids, id);
+    }
+  g_dir_close (dir);
+  g_array_sort (ids, mm_numa_compare_id);
+
+  for (guint k = 0; k < ids->len; k++)
+    {
+      char *path;
+      char *cpulist = NULL;
+      GArray *cpus;
+
+      path = g_strdup_printf (MM_NUMA_SYSFS_PATH "/node%u/cpulist",
+                              g_array_index (ids, guint, k));
+      if (g_file_get_contents (path, &cpulist, NULL, NULL))
+        {
+          cpus = mm_numa_parse_cpulist (cpulist);
+          /* Nodes with memory only can not run threads. */
+          if (cpus->len)
+            g_ptr_array_add (topology->node_cpus, cpus);
+          else
+            g_array_unref (cpus);
+        }
+      g_free (cpulist);
+      g_free (path);
+    }
+out:
+  g_array_unref (ids);
+}
+
+static MMNumaTopology *
+mm_numa_read_topology (void)
+{
+  MMNumaTopology *topology = g_new0 (MMNumaTopology, 1);
+
+  topology->node_cpus
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)g_array_unref);
+  mm_numa_read_nodes (topology);
+  if (topology->node_cpus->len == 0)
+    {
+      GArray *cpus = g_array_new (FALSE, FALSE, sizeof (guint));
+      for (guint cpu = 0; cpu < g_get_num_processors (); cpu++)
+        g_array_append_val (cpus, cpu);
+      g_ptr_array_add (topology->node_cpus, cpus);
+    }
+
+  /* Unknown processors are on node 0. */
+  topology->cpu_node = g_array_new (FALSE, TRUE, sizeof (guint));
+  for (guint node = 0; node < topology->node_cpus->len; node++)
+    {
+      GArray *cpus = topology->node_cpus->pdata[node];
+      for (guint k = 0; k < cpus->len; k++)
+        {
+          guint cpu = g_array_index (cpus, guint, k);
+          if (cpu >= topology->cpu_node->len)
+            g_array_set_size (topology->cpu_node, cpu + 1);
+          g_array_index (topology->cpu_node, guint, cpu) = node;
+        }
+    }
+  return topology;
+}
+
+/* Topology is read once, and never freed. */
+static MMNumaTopology *
+mm_numa_get_topology (void)
+{
+  static gsize initialized = 0;
+  static MMNumaTopology *topology = NULL;
+
+  if (g_once_init_enter (&initialized))
+    {
+      topology = mm_numa_read_topology ();
+      g_once_init_leave (&initialized, 1);
+    }
+  return topology;
+}
+
+guint
+mm_numa_get_node_count (void)
+{
+  return mm_numa_get_topology ()->node_cpus->len;
+}
+
+GArray *
+mm_numa_get_node_cpus (guint node)
+{
+  MMNumaTopology *topology = mm_numa_get_topology ();
+  g_return_val_if_fail (node < topology->node_cpus->len, NULL);
+
+  return g_array_ref (topology->node_cpus->pdata[node]);
+}
+
+guint
+mm_numa_get_current_node (void)
+{
+#ifdef __linux__
+  MMNumaTopology *topology = mm_numa_get_topology ();
+  int cpu = sched_getcpu ();
+
+  if ((cpu >= 0) && (cpu < topology->cpu_node->len))
+    return g_array_index (topology->cpu_node, guint, cpu);
+#endif
+  return 0;
+}
+
+gboolean
+mm_numa_bind_thread (guint node, GError **error)
+{
+  MMNumaTopology *topology = mm_numa_get_topology ();
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (node >= topology->node_cpus->len)
+    {
+      g_set_error (error, MM_NUMA_ERROR, MM_NUMA_ERROR_NODE,
+                   "Node %u does not exist.", node);
+      return FALSE;
+    }
+
+#ifdef __linux__
+  {
+    GArray *cpus = topology->node_cpus->pdata[node];
+    cpu_set_t *set;
+    size_t set_size;
+    guint ncpus = 0;
+    int ret;
+
+    /* cpu_set_t is limited to CPU_SETSIZE processors */
+    for (guint k = 0; k < cpus->len; k++)
+      ncpus = MAX (ncpus, g_array_index (cpus, guint, k) + 1);
+    set = CPU_ALLOC (ncpus);
+    if (set == NULL)
+      {
+        g_set_error (error, MM_NUMA_ERROR, MM_NUMA_ERROR_AFFINITY,
+                     "Can not bind thread to node %u: %s", node,
+                     g_strerror (errno));
+        return FALSE;
+      }
+    set_size = CPU_ALLOC_SIZE (ncpus);
+    CPU_ZERO_S (set_size, set);
+    for (guint k = 0; k < cpus->len; k++)
+      CPU_SET_S (g_array_index (cpus, guint, k), set_size, set);
+    ret = sched_setaffinity (0, set_size, set) != 0 ? errno : 0;
+    CPU_FREE (set);
+    if (ret != 0)
+      {
+        g_set_error (error, MM_NUMA_ERROR, MM_NUMA_ERROR_AFFINITY,
+                     "Can not bind thread to node %u: %s", node,
+                     g_strerror (ret));
+        return FALSE;
+      }
+  }
+#endif
+  return TRUE;
+}
+
+static gpointer
+mm_numa_load_thread (gpointer user_data)
+{
+  MMNumaLoadData *data = user_data;
+
+  /* Pages are placed on the node of the thread which touches them first. */
+  if (mm_numa_bind_thread (data->node, &data->error))
+    data->model
+        = mm_model_new (data->options, data->file_path, &data->error);
+  return NULL;
+}
+
+MMModelReplicas *
+mm_model_replicas_new (MMModelOptions *options, const char *file_path,
+                       GError **error)
+{
+  MMModelReplicas *replicas = NULL;
+  MMNumaLoadData *data;
+  GThread **threads;
+  GError *local_error = NULL;
+  guint nnodes;
+  g_return_val_if_fail (options, NULL);
+  g_return_val_if_fail (file_path, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  nnodes = mm_numa_get_node_count ();
+  replicas = g_new0 (MMModelReplicas, 1);
+  replicas->models
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_model_unref);
+  g_atomic_ref_count_init (&replicas->ref_count);
+
+  /* Nothing to place on a single node. */
+  if (nnodes == 1)
+    {
+      MMModel *model = mm_model_new (options, file_path, error);
+      if (model == NULL)
+        {
+          mm_model_replicas_unref (replicas);
+          return NULL;
+        }
+      g_ptr_array_add (replicas->models, model);
+      return replicas;
+    }
+
+  data = g_new0 (MMNumaLoadData, nnodes);
+  threads = g_new0 (GThread *, nnodes);
+  for (guint k = 0; (k < nnodes) && (local_error == NULL); k++)
+    {
+      data[k].file_path = file_path;
+      data[k].node = k;
+      data[k].options = mm_model_options_copy (options, &local_error);
+      if ((data[k].options == NULL)
+          || !mm_model_options_set_numa_node (data[k].options, k,
+                                              &local_error))
+        break;
+      threads[k] = g_thread_try_new ("mm-numa-load", mm_numa_load_thread,
+                                     &data[k], &local_error);
+    }
+
+  for (guint k = 0; k < nnodes; k++)
+    {
+      if (threads[k])
+        g_thread_join (threads[k]);
+      if (data[k].options)
+        mm_model_options_unref (data[k].options);
+      if (data[k].model)
+        g_ptr_array_add (replicas->models, data[k].model);
+      if (data[k].error && (local_error == NULL))
+        local_error = g_steal_pointer (&data[k].error);
+      g_clear_error (&data[k].error);
+    }
+  g_free (threads);
+  g_free (data);
+
+  if (local_error == NULL)
+    return replicas;
+  g_propagate_error (error, local_error);
+  mm_model_replicas_unref (replicas);
+  return NULL;
+}
+
+void
+mm_model_replicas_ref (MMModelReplicas *replicas)
+{
+  g_return_if_fail (replicas);
+  g_atomic_ref_count_inc (&replicas->ref_count);
+}
+
+void
+mm_model_replicas_unref (MMModelReplicas *replicas)
+{
+  g_return_if_fail (replicas);
+  if (!g_atomic_ref_count_dec (&replicas->ref_count))
+    return;
+
+  g_ptr_array_unref (replicas->models);
+  g_free (replicas);
+}
+
+guint
+mm_model_replicas_get_count (MMModelReplicas *replicas)
+{
+  g_return_val_if_fail (replicas, 0);
+  return replicas->models->len;
+}
+
+MMModel *
+mm_model_replicas_get_node (MMModelReplicas *replicas, guint node)
+{
+  g_return_val_if_fail (replicas, NULL);
+  g_return_val_if_fail (node < replicas->models->len, NULL);
+  return replicas->models->pdata[node];
+}
+
+MMModel *
+mm_model_replicas_get (MMModelReplicas *replicas)
+{
+  guint node;
+  g_return_val_if_fail (replicas, NULL);
+
+  node = mm_numa_get_current_node ();
+  if (node >= replicas->models->len)
+    node = 0;
+  return replicas->models->pdata[node];
+}
@@ -0,0 +1,559 @@
+#include "mm-pipeline.h"
+
+G_DEFINE_QUARK (mm-pipeline-error, mm_pipeline_error);
+
+typedef struct _MMPipelineQueue MMPipelineQueue;
+typedef struct _MMPipelineStage MMPipelineStage;
+
+/* Bounded queue between stages */
+struct _MMPipelineQueue
+{
+  GQueue queue;
+  guint max_length;
+  gboolean closed;
+  GMutex mutex;
+  GCond cond;
+};
+
+struct _MMPipelineStage
+{
+  MMModel *model;
+  const char **input_names;
+  const char **output_names;
+  /* Stage index of each input, or -1 if it is fed from request inputs */
+  gint *source_stage;
+  /* Output index in source stage of each input */
+  guint *source_output;
+  /* Outputs are released after this stage runs */
+  guint last_consumer;
+  MMPipelineQueue *queue;
+  GThread *thread;
+  MMPipeline *pipeline;
+  guint index;
+};
+
+struct _MMPipeline
+{
+  GPtrArray *stages;
+  guint queue_length;
+  gboolean started;
+  gatomicrefcount ref_count;
+};
+
+struct _MMPipelineRequest
+{
+  GPtrArray *inputs;
+  /* Can be NULL */
+  MMRunContext *run_context;
+  /* OrtValue ** for each stage, released by stage threads */
+  OrtValue ***stage_outputs;
+  guint nstages;
+  /* Array of MMValue for outputs of the last stage */
+  GPtrArray *outputs;
+  GError *error;
+  gboolean done;
+  GMutex mutex;
+  GCond cond;
+  gatomicrefcount ref_count;
+};
+
+static MMPipelineQueue *
+mm_pipeline_queue_new (guint max_length)
+{
+  MMPipelineQueue *queue = g_new0 (MMPipelineQueue, 1);
+  g_queue_init (&queue->queue);
+  queue->max_length = MAX (max_length, 1);
+  g_mutex_init (&queue->mutex);
+  g_cond_init (&queue->cond);
+  return queue;
+}
+
+static void
+mm_pipeline_queue_free (MMPipelineQueue *queue)
+{
+  g_queue_clear (&queue->queue);
+  g_cond_clear (&queue->cond);
+  g_mutex_clear (&queue->mutex);
+  g_free (queue);
+}
+
+static gboolean
+mm_pipeline_queue_push (MMPipelineQueue *queue, gpointer data)
+{
+  g_mutex_lock (&queue->mutex);
+  while (!queue->closed && (queue->queue.length >= queue->max_length))
+    g_cond_wait (&queue->cond, &queue->mutex);
+  if (queue->closed)
+    {
+      g_mutex_unlock (&queue->mutex);
+      return FALSE;
+    }
+  g_queue_push_tail (&queue->queue, data);
+  g_cond_broadcast (&queue->cond);
+  g_mutex_unlock (&queue->mutex);
+  return TRUE;
+}
+
+/* Returns NULL if queue is closed and empty. */
+static gpointer
+mm_pipeline_queue_pop (MMPipelineQueue *queue)
+{
+  gpointer data;
+
+  g_mutex_lock (&queue->mutex);
+  while (!queue->closed && g_queue_is_empty (&queue->queue))
+    g_cond_wait (&queue->cond, &queue->mutex);
+  data = g_queue_pop_head (&queue->queue);
+  g_cond_broadcast (&queue->cond);
+  g_mutex_unlock (&queue->mutex);
+  return data;
+}
+
+static void
+mm_pipeline_queue_close (MMPipelineQueue *queue)
+{
+  g_mutex_lock (&queue->mutex);
+  queue->closed = TRUE;
+  g_cond_broadcast (&queue->cond);
+  g_mutex_unlock (&queue->mutex);
+}
+
+static void
+mm_pipeline_stage_free (MMPipelineStage *stage)
+{
+  if (stage->queue)
+    mm_pipeline_queue_free (stage->queue);
+  g_free (stage->source_output);
+  g_free (stage->source_stage);
+  g_free (stage->output_names);
+  g_free (stage->input_names);
+  mm_model_unref (stage->model);
+  g_free (stage);
+}
+
+static void
+mm_pipeline_request_release_outputs (MMPipelineRequest *request,
+                                     MMPipelineStage *stage)
+{
+  const OrtApi *api = stage->model->options->context->api;
+  OrtValue **outputs = request->stage_outputs[stage->index];
+
+  for (guint k = 0; k < stage->model->output_infos->len; k++)
+    g_clear_pointer (&outputs[k], api->ReleaseValue);
+}
+
+static void
+mm_pipeline_request_complete (MMPipelineRequest *request)
+{
+  g_mutex_lock (&request->mutex);
+  request->done = TRUE;
+  g_cond_broadcast (&request->cond);
+  g_mutex_unlock (&request->mutex);
+  mm_pipeline_request_unref (request);
+}
+
+static gboolean
+mm_pipeline_stage_run (MMPipelineStage *stage, MMPipelineRequest *request,
+                       GError **error)
+{
+  MMModel *model = stage->model;
+  MMContext *context = model->options->context;
+  guint ninputs = model->input_infos->len;
+  guint noutputs = model->output_infos->len;
+  const OrtValue **inputs;
+  OrtValue **outputs;
+  OrtRunOptions *run_options;
+  OrtStatus *status;
+
+  inputs = g_newa (const OrtValue *, ninputs);
+  for (guint k = 0; k < ninputs; k++)
+    {
+      inputs[k] = NULL;
+      if (stage->source_stage[k] >= 0)
+        {
+          inputs[k] = request->stage_outputs[stage->source_stage[k]]
+                                            [stage->source_output[k]];
+          continue;
+        }
+
+      for (guint i = 0; i < request->inputs->len; i++)
+        {
+          MMValue *v = request->inputs->pdata[i];
+          if (g_strcmp0 (v->input_name, stage->input_names[k]))
+            continue;
+          inputs[k] = v->value;
+          break;
+        }
+
+      if (inputs[k] == NULL)
+        {
+          g_set_error (error, MM_PIPELINE_ERROR, MM_PIPELINE_ERROR_INPUT,
+                       "Input %s of stage %u is not given.",
+                       stage->input_names[k], stage->index);
+          return FALSE;
+        }
+    }
+
+  run_options = model->options->run_options;
+  if (request->run_context)
+    {
+      run_options = mm_run_context_begin (request->run_context, error);
+      if (run_options == NULL)
+        return FALSE;
+    }
+
+  outputs = g_new0 (OrtValue *, noutputs);
+  request->stage_outputs[stage->index] = outputs;
+  status = context->api->Run (model->session, run_options,
+                              stage->input_names, inputs, ninputs,
+                              stage->output_names, noutputs, outputs);
+  if (request->run_context)
+    return mm_run_context_end (request->run_context, status, error);
+  if (status)
+    {
+      mm_context_set_error (context, error, status);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* Wraps outputs of the last stage with MMValue. */
+static gboolean
+mm_pipeline_stage_finish (MMPipelineStage *stage, MMPipelineRequest *request,
+                          GError **error)
+{
+  MMModel *model = stage->model;
+  OrtValue **outputs = request->stage_outputs[stage->index];
+
+  request->outputs = g_ptr_array_new_full (model->output_infos->len,
+                                           (GDestroyNotify)mm_value_unref);
+  for (guint k = 0; k < model->output_infos->len; k++)
+    {
+      MMValueInfo *info = model->output_infos->pdata[k];
+      MMValue *v;
+
+      v = mm_value_new (model->options->context, info, model, NULL,
+                        info->name, NULL, error);
+      if (v == NULL)
+        return FALSE;
+      g_ptr_array_add (request->outputs, v);
+
+      v->value = outputs[k];
+      outputs[k] = NULL;
+      if (!mm_value_update_info (v, error))
+        return FALSE;
+    }
+  return TRUE;
+}
+
+static gpointer
+mm_pipeline_stage_thread (gpointer user_data)
+{
+  MMPipelineStage *stage = user_data;
+  MMPipeline *pipeline = stage->pipeline;
+  gboolean is_last = stage->index == pipeline->stages->len - 1;
+  MMPipelineStage *next = NULL;
+  MMPipelineRequest *request;
+
+  if (!is_last)
+    next = pipeline->stages->pdata[stage->index + 1];
+
+  while ((request = mm_pipeline_queue_pop (stage->queue)))
+    {
+      if (request->error == NULL)
+        {
+          if (mm_pipeline_stage_run (stage, request, &request->error)
+              && is_last)
+            mm_pipeline_stage_finish (stage, request, &request->error);
+        }
+
+      /* Free intermediate values once their last consumer has run. */
+      for (guint k = 0; k <= stage->index; k++)
+        {
+          MMPipelineStage *s = pipeline->stages->pdata[k];
+          if ((request->stage_outputs[k] == NULL)
+              || ((s->last_consumer != stage->index) && !is_last))
+            continue;
+          mm_pipeline_request_release_outputs (request, s);
+        }
+
+      if (is_last)
+        mm_pipeline_request_complete (request);
+      else
+        /* next queue is closed only after this thread exits */
+        mm_pipeline_queue_push (next->queue, request);
+    }
+
+  if (next)
+    mm_pipeline_queue_close (next->queue);
+  return NULL;
+}
+
+MMPipeline *
+mm_pipeline_new (guint queue_length)
+{
+  MMPipeline *pipeline;
+
+  pipeline = g_new0 (MMPipeline, 1);
+  pipeline->stages = g_ptr_array_new_with_free_func (
+      (GDestroyNotify)mm_pipeline_stage_free);
+  pipeline->queue_length = queue_length;
+  g_atomic_ref_count_init (&pipeline->ref_count);
+  return pipeline;
+}
+
+void
+mm_pipeline_ref (MMPipeline *pipeline)
+{
+  g_return_if_fail (pipeline);
+  g_atomic_ref_count_inc (&pipeline->ref_count);
+}
+
+void
+mm_pipeline_unref (MMPipeline *pipeline)
+{
+  g_return_if_fail (pipeline);
+  if (!g_atomic_ref_count_dec (&pipeline->ref_count))
+    return;
+
+  if (pipeline->started)
+    {
+      MMPipelineStage *first = pipeline->stages->pdata[0];
+
+      /* Each stage closes the next queue when it is drained. */
+      mm_pipeline_queue_close (first->queue);
+      for (guint k = 0; k < pipeline->stages->len; k++)
+        {
+          MMPipelineStage *stage = pipeline->stages->pdata[k];
+          g_thread_join (stage->thread);
+        }
+    }
+
+  g_ptr_array_unref (pipeline->stages);
+  g_free (pipeline);
+}
+
+guint
+mm_pipeline_add_stage (MMPipeline *pipeline, MMModel *model)
+{
+  MMPipelineStage *stage;
+  guint ninputs;
+  guint noutputs;
+  g_return_val_if_fail (pipeline, 0);
+  g_return_val_if_fail (model, 0);
+  g_return_val_if_fail (!pipeline->started, 0);
+
+  ninputs = model->input_infos->len;
+  noutputs = model->output_infos->len;
+
+  mm_model_ref (model);
+  stage = g_new0 (MMPipelineStage, 1);
+  stage->model = model;
+  stage->input_names = g_new (const char *, ninputs);
+  stage->output_names = g_new (const char *, noutputs);
+  stage->source_stage = g_new (gint, ninputs);
+  stage->source_output = g_new0 (guint, ninputs);
+  stage->pipeline = pipeline;
+  stage->index = pipeline->stages->len;
+  stage->last_consumer = stage->index;
+
+  for (guint k = 0; k < ninputs; k++)
+    {
+      MMValueInfo *info = model->input_infos->pdata[k];
+      stage->input_names[k] = info->name;
+      stage->source_stage[k] = -1;
+    }
+  for (guint k = 0; k < noutputs; k++)
+    {
+      MMValueInfo *info = model->output_infos->pdata[k];
+      stage->output_names[k] = info->name;
+    }
+
+  g_ptr_array_add (pipeline->stages, stage);
+  return stage->index;
+}
+
+gboolean
+mm_pipeline_connect (MMPipeline *pipeline, guint src, const char *output_name,
+                     guint dst, const char *input_name, GError **error)
+{
+  MMPipelineStage *src_stage;
+  MMPipelineStage *dst_stage;
+  guint output_index;
+  guint input_index;
+  g_return_val_if_fail (pipeline, FALSE);
+  g_return_val_if_fail (output_name, FALSE);
+  g_return_val_if_fail (input_name, FALSE);
+  g_return_val_if_fail (src < dst, FALSE);
+  g_return_val_if_fail (dst < pipeline->stages->len, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (pipeline->started)
+    {
+      g_set_error (error, MM_PIPELINE_ERROR, MM_PIPELINE_ERROR_STATE,
+                   "Pipeline is already started.");
+      return FALSE;
+    }
+
+  src_stage = pipeline->stages->pdata[src];
+  dst_stage = pipeline->stages->pdata[dst];
+
+  for (output_index = 0; output_index < src_stage->model->output_infos->len;
+       output_index++)
+    if (!g_strcmp0 (src_stage->output_names[output_index], output_name))
+      break;
+  if (output_index == src_stage->model->output_infos->len)
+    {
+      g_set_error (error, MM_PIPELINE_ERROR, MM_PIPELINE_ERROR_NOT_FOUND,
+                   "Stage %u has no output %s.", src, output_name);
+      return FALSE;
+    }
+
+  for (input_index = 0; input_index < dst_stage->model->input_infos->len;
+       input_index++)
+    if (!g_strcmp0 (dst_stage->input_names[input_index], input_name))
+      break;
+  if (input_index == dst_stage->model->input_infos->len)
+    {
+      g_set_error (error, MM_PIPELINE_ERROR, MM_PIPELINE_ERROR_NOT_FOUND,
+                   "Stage %u has no input %s.", dst, input_name);
+      return FALSE;
+    }
+
+  dst_stage->source_stage[input_index] = src;
+  dst_stage->source_output[input_index] = output_index;
+  src_stage->last_consumer = MAX (src_stage->last_consumer, dst);
+  return TRUE;
+}
+
+gboolean
+mm_pipeline_start (MMPipeline *pipeline, GError **error)
+{
+  g_return_val_if_fail (pipeline, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (pipeline->started || (pipeline->stages->len == 0))
+    {
+      g_set_error (error, MM_PIPELINE_ERROR, MM_PIPELINE_ERROR_STATE,
+                   "Pipeline is already started or has no stage.");
+      return FALSE;
+    }
+
+  for (guint k = 0; k < pipeline->stages->len; k++)
+    {
+      MMPipelineStage *stage = pipeline->stages->pdata[k];
+      stage->queue = mm_pipeline_queue_new (pipeline->queue_length);
+    }
+
+  for (guint k = 0; k < pipeline->stages->len; k++)
+    {
+      MMPipelineStage *stage = pipeline->stages->pdata[k];
+      stage->thread = g_thread_new ("mm-pipeline-stage",
+                                    mm_pipeline_stage_thread, stage);
+    }
+
+  pipeline->started = TRUE;
+  return TRUE;
+}
+
+MMPipelineRequest *
+mm_pipeline_push (MMPipeline *pipeline, GPtrArray *inputs, GError **error)
+{
+  return mm_pipeline_push_with_context (pipeline, inputs, NULL, error);
+}
+
+MMPipelineRequest *
+mm_pipeline_push_with_context (MMPipeline *pipeline, GPtrArray *inputs,
+                               MMRunContext *run_context, GError **error)
+{
+  MMPipelineRequest *request;
+  MMPipelineStage *first;
+  g_return_val_if_fail (pipeline, NULL);
+  g_return_val_if_fail (inputs, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  if (!pipeline->started)
+    {
+      g_set_error (error, MM_PIPELINE_ERROR, MM_PIPELINE_ERROR_STATE,
+                   "Pipeline is not started.");
+      return NULL;
+    }
+
+  request = g_new0 (MMPipelineRequest, 1);
+  request->inputs = g_ptr_array_new_full (inputs->len,
+                                          (GDestroyNotify)mm_value_unref);
+  for (guint k = 0; k < inputs->len; k++)
+    {
+      mm_value_ref (inputs->pdata[k]);
+      g_ptr_array_add (request->inputs, inputs->pdata[k]);
+    }
+  if (run_context)
+    mm_run_context_ref (run_context);
+  request->run_context = run_context;
+  request->stage_outputs = g_new0 (OrtValue **, pipeline->stages->len);
+  request->nstages = pipeline->stages->len;
+  g_mutex_init (&request->mutex);
+  g_cond_init (&request->cond);
+  g_atomic_ref_count_init (&request->ref_count);
+
+  /* Reference for stage threads, released on completion. */
+  mm_pipeline_request_ref (request);
+  first = pipeline->stages->pdata[0];
+  if (!mm_pipeline_queue_push (first->queue, request))
+    {
+      g_set_error (error, MM_PIPELINE_ERROR, MM_PIPELINE_ERROR_STATE,
+                   "Pipeline is stopped.");
+      mm_pipeline_request_unref (request);
+      mm_pipeline_request_unref (request);
+      return NULL;
+    }
+  return request;
+}
+
+void
+mm_pipeline_request_ref (MMPipelineRequest *request)
+{
+  g_return_if_fail (request);
+  g_atomic_ref_count_inc (&request->ref_count);
+}
+
+void
+mm_pipeline_request_unref (MMPipelineRequest *request)
+{
+  g_return_if_fail (request);
+  if (!g_atomic_ref_count_dec (&request->ref_count))
+    return;
+
+  for (guint k = 0; k < request->nstages; k++)
+    g_free (request->stage_outputs[k]);
+  g_free (request->stage_outputs);
+  if (request->outputs)
+    g_ptr_array_unref (request->outputs);
+  if (request->error)
+    g_error_free (request->error);
+  g_ptr_array_unref (request->inputs);
+  if (request->run_context)
+    mm_run_context_unref (request->run_context);
+  g_cond_clear (&request->cond);
+  g_mutex_clear (&request->mutex);
+  g_free (request);
+}
+
+GPtrArray *
+mm_pipeline_request_wait (MMPipelineRequest *request, GError **error)
+{
+  g_return_val_if_fail (request, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  g_mutex_lock (&request->mutex);
+  while (!request->done)
+    g_cond_wait (&request->cond, &request->mutex);
+  g_mutex_unlock (&request->mutex);
+
+  if (request->error)
+    {
+      g_propagate_error (error, g_error_copy (request->error));
+      return NULL;
+    }
+  return g_ptr_array_ref (request->outputs);
+}
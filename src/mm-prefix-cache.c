@@ -0,0 +1,448 @@
+#include "mm-prefix-cache.h"
+
+G_DEFINE_QUARK (mm-prefix-cache-error, mm_prefix_cache_error);
+
+/* FNV-1a over tokens */
+#define MM_PREFIX_CACHE_HASH_INIT 0xcbf29ce484222325
+#define MM_PREFIX_CACHE_HASH_PRIME 0x100000001b3
+
+typedef struct _MMPrefixCacheEntry MMPrefixCacheEntry;
+
+struct _MMPrefixCacheEntry
+{
+  int64_t *tokens;
+  size_t ntokens;
+  guint64 hash;
+  /*
+   * Clones of values sharing their data. Referenced by lookups while they
+   * assign values, so evicting the entry never waits for them.
+   */
+  GPtrArray *values;
+  size_t size;
+  /* Link in the LRU queue */
+  GList link;
+};
+
+struct _MMPrefixCache
+{
+  MMContext *context;
+  guint evict_id;
+  /* Set of MMPrefixCacheEntry */
+  GHashTable *entries;
+  /* The most recently used first */
+  GQueue lru;
+  size_t budget;
+  size_t size;
+  GMutex mutex;
+  gatomicrefcount ref_count;
+};
+
+static void
+mm_prefix_cache_entry_free (MMPrefixCacheEntry *entry)
+{
+  g_free (entry->tokens);
+  g_ptr_array_unref (entry->values);
+  g_free (entry);
+}
+
+static guint64
+mm_prefix_cache_hash_step (guint64 hash, int64_t token)
+{
+  return (hash ^ (guint64)token) * MM_PREFIX_CACHE_HASH_PRIME;
+}
+
+static guint
+mm_prefix_cache_entry_hash (gconstpointer key)
+{
+  const MMPrefixCacheEntry *entry = key;
+  return (guint)(entry->hash ^ (entry->hash >> 32));
+}
+
+/* Tokens are compared, so colliding hashes never match. */
+static gboolean
+mm_prefix_cache_entry_equal (gconstpointer a, gconstpointer b)
+{
+  const MMPrefixCacheEntry *ea = a;
+  const MMPrefixCacheEntry *eb = b;
+
+  return (ea->hash == eb->hash) && (ea->ntokens == eb->ntokens)
+         && !memcmp (ea->tokens, eb->tokens, sizeof (int64_t) * ea->ntokens);
+}
+
+/*
+ * Returns size of data only entry holds, which is freed by evicting it.
+ * Data shared with values of conversations stays allocated.
+ */
+static size_t
+mm_prefix_cache_entry_get_owned_size (MMPrefixCacheEntry *entry)
+{
+  size_t size = 0;
+
+  for (guint k = 0; k < entry->values->len; k++)
+    {
+      MMValue *v = entry->values->pdata[k];
+
+      if (v->value && !mm_value_is_shared (v))
+        size += mm_value_info_get_data_size (v->info);
+    }
+  return size;
+}
+
+/*
+ * Evicts the least recently used entries until size bytes are freed. If
+ * owned is TRUE, only data entries hold alone is counted, and entries
+ * holding none are kept. Entries are moved to evicted, so they can be freed
+ * after mutex is released. Called with mutex held.
+ */
+static size_t
+mm_prefix_cache_evict (MMPrefixCache *cache, size_t size, gboolean owned,
+                       GPtrArray *evicted)
+{
+  GList *link = cache->lru.tail;
+  size_t freed = 0;
+
+  while (link && (freed < size))
+    {
+      MMPrefixCacheEntry *entry = link->data;
+      GList *prev = link->prev;
+      size_t entry_size
+          = owned ? mm_prefix_cache_entry_get_owned_size (entry) : entry->size;
+
+      if (entry_size > 0)
+        {
+          g_queue_unlink (&cache->lru, link);
+          g_hash_table_steal (cache->entries, entry);
+          g_ptr_array_add (evicted, entry);
+          cache->size -= entry->size;
+          freed += entry_size;
+        }
+      link = prev;
+    }
+  return freed;
+}
+
+/*
+ * Called by context whose memory budget is exceeded. Data of entries is
+ * charged by the allocator of values, and is released when they are freed.
+ */
+static size_t
+mm_prefix_cache_evict_memory (size_t size, gpointer user_data)
+{
+  MMPrefixCache *cache = user_data;
+  GPtrArray *evicted;
+  size_t freed;
+
+  evicted = g_ptr_array_new_with_free_func (
+      (GDestroyNotify)mm_prefix_cache_entry_free);
+  g_mutex_lock (&cache->mutex);
+  freed = mm_prefix_cache_evict (cache, size, TRUE, evicted);
+  g_mutex_unlock (&cache->mutex);
+  g_ptr_array_unref (evicted);
+  return freed;
+}
+
+MMPrefixCache *
+mm_prefix_cache_new (MMContext *context, size_t budget)
+{
+  MMPrefixCache *cache;
+  g_return_val_if_fail (context, NULL);
+
+  cache = g_new0 (MMPrefixCache, 1);
+  mm_context_ref (context);
+  cache->context = context;
+  cache->entries = g_hash_table_new_full (
+      mm_prefix_cache_entry_hash, mm_prefix_cache_entry_equal,
+      (GDestroyNotify)mm_prefix_cache_entry_free, NULL);
+  g_queue_init (&cache->lru);
+  cache->budget = budget;
+  g_mutex_init (&cache->mutex);
+  g_atomic_ref_count_init (&cache->ref_count);
+  cache->evict_id = mm_context_add_memory_evict_func (
+      context, mm_prefix_cache_evict_memory, cache);
+  return cache;
+}
+
+void
+mm_prefix_cache_ref (MMPrefixCache *cache)
+{
+  g_return_if_fail (cache);
+  g_atomic_ref_count_inc (&cache->ref_count);
+}
+
+void
+mm_prefix_cache_unref (MMPrefixCache *cache)
+{
+  g_return_if_fail (cache);
+  if (!g_atomic_ref_count_dec (&cache->ref_count))
+    return;
+
+  /* Waits for the evict function being called. */
+  mm_context_remove_memory_evict_func (cache->context, cache->evict_id);
+  /* Links of the LRU queue are embedded in entries. */
+  g_hash_table_unref (cache->entries);
+  g_mutex_clear (&cache->mutex);
+  mm_context_unref (cache->context);
+  g_free (cache);
+}
+
+void
+mm_prefix_cache_set_budget (MMPrefixCache *cache, size_t budget)
+{
+  GPtrArray *evicted;
+  g_return_if_fail (cache);
+
+  evicted = g_ptr_array_new_with_free_func (
+      (GDestroyNotify)mm_prefix_cache_entry_free);
+  g_mutex_lock (&cache->mutex);
+  cache->budget = budget;
+  if (budget && (cache->size > budget))
+    mm_prefix_cache_evict (cache, cache->size - budget, FALSE, evicted);
+  g_mutex_unlock (&cache->mutex);
+  g_ptr_array_unref (evicted);
+}
+
+/* Returns total data size of values, or 0 with error. */
+static size_t
+mm_prefix_cache_check_values (GPtrArray *values, GError **error)
+{
+  size_t size = 0;
+
+  for (guint k = 0; k < values->len; k++)
+    {
+      MMValue *v = values->pdata[k];
+
+      if (v->value == NULL)
+        {
+          g_set_error (error, MM_PREFIX_CACHE_ERROR,
+                       MM_PREFIX_CACHE_ERROR_EMPTY, "Value %s has no tensor.",
+                       v->info->name);
+          return 0;
+        }
+      if (mm_value_get_quantize_info (v, NULL, NULL, NULL))
+        {
+          g_set_error (error, MM_PREFIX_CACHE_ERROR,
+                       MM_PREFIX_CACHE_ERROR_QUANTIZED,
+                       "Value %s is quantized.", v->info->name);
+          return 0;
+        }
+      size += mm_value_info_get_data_size (v->info);
+    }
+  /* Entries of empty values still take a slot. */
+  return MAX (size, 1);
+}
+
+static MMPrefixCacheEntry *
+mm_prefix_cache_entry_new (const int64_t *tokens, size_t ntokens,
+                           guint64 hash, GPtrArray *values, size_t size,
+                           GError **error)
+{
+  MMPrefixCacheEntry *entry;
+
+  entry = g_new0 (MMPrefixCacheEntry, 1);
+  entry->tokens = g_memdup2 (tokens, sizeof (int64_t) * ntokens);
+  entry->ntokens = ntokens;
+  entry->hash = hash;
+  entry->values = g_ptr_array_new_full (values->len,
+                                        (GDestroyNotify)mm_value_unref);
+  entry->size = size;
+  entry->link.data = entry;
+
+  for (guint k = 0; k < values->len; k++)
+    {
+      MMValue *clone = mm_value_clone (values->pdata[k], error);
+
+      if (clone == NULL)
+        {
+          mm_prefix_cache_entry_free (entry);
+          return NULL;
+        }
+      g_ptr_array_add (entry->values, clone);
+    }
+  return entry;
+}
+
+gboolean
+mm_prefix_cache_insert (MMPrefixCache *cache, const int64_t *tokens,
+                        size_t ntokens, GPtrArray *values, GError **error)
+{
+  MMPrefixCacheEntry key;
+  MMPrefixCacheEntry *entry;
+  MMPrefixCacheEntry *found;
+  GPtrArray *evicted;
+  gboolean ret = TRUE;
+  size_t size;
+  g_return_val_if_fail (cache, FALSE);
+  g_return_val_if_fail (tokens, FALSE);
+  g_return_val_if_fail (ntokens > 0, FALSE);
+  g_return_val_if_fail (values, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  size = mm_prefix_cache_check_values (values, error);
+  if (size == 0)
+    return FALSE;
+
+  key.tokens = (int64_t *)tokens;
+  key.ntokens = ntokens;
+  key.hash = MM_PREFIX_CACHE_HASH_INIT;
+  for (size_t i = 0; i < ntokens; i++)
+    key.hash = mm_prefix_cache_hash_step (key.hash, tokens[i]);
+
+  g_mutex_lock (&cache->mutex);
+  found = g_hash_table_lookup (cache->entries, &key);
+  if (found)
+    {
+      g_queue_unlink (&cache->lru, &found->link);
+      g_queue_push_head_link (&cache->lru, &found->link);
+    }
+  else if (cache->budget && (size > cache->budget))
+    {
+      g_set_error (error, MM_PREFIX_CACHE_ERROR, MM_PREFIX_CACHE_ERROR_BUDGET,
+                   "Prefix of %zu tokens (%" G_GSIZE_FORMAT
+                   " bytes) does not fit budget.",
+                   ntokens, size);
+      ret = FALSE;
+    }
+  g_mutex_unlock (&cache->mutex);
+  if (found || !ret)
+    return ret;
+
+  entry = mm_prefix_cache_entry_new (tokens, ntokens, key.hash, values, size,
+                                     error);
+  if (entry == NULL)
+    return FALSE;
+
+  evicted = g_ptr_array_new_with_free_func (
+      (GDestroyNotify)mm_prefix_cache_entry_free);
+  g_mutex_lock (&cache->mutex);
+  if (g_hash_table_contains (cache->entries, entry))
+    /* Inserted by another thread meanwhile */
+    g_ptr_array_add (evicted, entry);
+  else
+    {
+      if (cache->budget && (cache->size + size > cache->budget))
+        mm_prefix_cache_evict (cache, cache->size + size - cache->budget,
+                               FALSE, evicted);
+      if (cache->budget && (cache->size + size > cache->budget))
+        {
+          g_set_error (error, MM_PREFIX_CACHE_ERROR,
+                       MM_PREFIX_CACHE_ERROR_BUDGET,
+                       "Prefix of %zu tokens (%" G_GSIZE_FORMAT
+                       " bytes) does not fit budget.",
+                       ntokens, size);
+          g_ptr_array_add (evicted, entry);
+          ret = FALSE;
+        }
+      else
+        {
+          g_hash_table_add (cache->entries, entry);
+          g_queue_push_head_link (&cache->lru, &entry->link);
+          cache->size += size;
+        }
+    }
+  g_mutex_unlock (&cache->mutex);
+  g_ptr_array_unref (evicted);
+  return ret;
+}
+
+/*
+ * Returns values of the longest entry whose tokens are a prefix, referenced,
+ * or NULL. matched is set to the number of its tokens.
+ */
+static GPtrArray *
+mm_prefix_cache_find (MMPrefixCache *cache, const int64_t *tokens,
+                      size_t ntokens, size_t *matched)
+{
+  MMPrefixCacheEntry key;
+  MMPrefixCacheEntry *found = NULL;
+  GPtrArray *values = NULL;
+  guint64 *hashes;
+  guint64 hash = MM_PREFIX_CACHE_HASH_INIT;
+
+  hashes = g_new (guint64, ntokens);
+  for (size_t i = 0; i < ntokens; i++)
+    hashes[i] = hash = mm_prefix_cache_hash_step (hash, tokens[i]);
+
+  key.tokens = (int64_t *)tokens;
+  g_mutex_lock (&cache->mutex);
+  for (size_t n = ntokens; (found == NULL) && (n > 0); n--)
+    {
+      key.ntokens = n;
+      key.hash = hashes[n - 1];
+      found = g_hash_table_lookup (cache->entries, &key);
+    }
+  if (found)
+    {
+      g_queue_unlink (&cache->lru, &found->link);
+      g_queue_push_head_link (&cache->lru, &found->link);
+      values = g_ptr_array_ref (found->values);
+      *matched = found->ntokens;
+    }
+  g_mutex_unlock (&cache->mutex);
+  g_free (hashes);
+  return values;
+}
+
+gboolean
+mm_prefix_cache_lookup (MMPrefixCache *cache, const int64_t *tokens,
+                        size_t ntokens, GPtrArray *values, size_t *matched,
+                        GError **error)
+{
+  GPtrArray *found;
+  size_t nfound = 0;
+  gboolean ret = FALSE;
+  g_return_val_if_fail (cache, FALSE);
+  g_return_val_if_fail (tokens || (ntokens == 0), FALSE);
+  g_return_val_if_fail (values, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (matched)
+    *matched = 0;
+  found = mm_prefix_cache_find (cache, tokens, ntokens, &nfound);
+  if (found == NULL)
+    return TRUE;
+
+  if (found->len != values->len)
+    {
+      g_set_error (error, MM_PREFIX_CACHE_ERROR,
+                   MM_PREFIX_CACHE_ERROR_MISMATCH,
+                   "Prefix has %u values, but %u values are given.",
+                   found->len, values->len);
+      goto out;
+    }
+  for (guint k = 0; k < values->len; k++)
+    if (!mm_value_assign (values->pdata[k], found->pdata[k], error))
+      goto out;
+
+  if (matched)
+    *matched = nfound;
+  ret = TRUE;
+out:
+  g_ptr_array_unref (found);
+  return ret;
+}
+
+void
+mm_prefix_cache_clear (MMPrefixCache *cache)
+{
+  GPtrArray *evicted;
+  g_return_if_fail (cache);
+
+  evicted = g_ptr_array_new_with_free_func (
+      (GDestroyNotify)mm_prefix_cache_entry_free);
+  g_mutex_lock (&cache->mutex);
+  mm_prefix_cache_evict (cache, G_MAXSIZE, FALSE, evicted);
+  g_mutex_unlock (&cache->mutex);
+  g_ptr_array_unref (evicted);
+}
+
+size_t
+mm_prefix_cache_get_size (MMPrefixCache *cache)
+{
+  size_t size;
+  g_return_val_if_fail (cache, 0);
+
+  g_mutex_lock (&cache->mutex);
+  size = cache->size;
+  g_mutex_unlock (&cache->mutex);
+  return size;
+}
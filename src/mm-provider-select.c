@@ -0,0 +1,394 @@
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <math.h>
+
+#include "mm-provider-select.h"
+#include "mm-provider.h"
+#include "mm-value.h"
+
+#define MM_PROVIDER_SELECT_ITERATIONS 3
+#define MM_PROVIDER_SELECT_CPU "CPUExecutionProvider"
+/* Reduced precision kernels of accelerators differ from CPU. */
+#define MM_PROVIDER_SELECT_RTOL 1e-2
+#define MM_PROVIDER_SELECT_ATOL 1e-3
+
+/* Serializes updates of the cache file. */
+static GMutex mm_provider_select_mutex;
+
+static char *
+mm_provider_select_get_cache_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "moduler-model",
+                           "providers.ini", NULL);
+}
+
+static char *
+mm_provider_select_hash_file (const char *file_path, GError **error)
+{
+  GMappedFile *mapped;
+  char *hash;
+
+  mapped = g_mapped_file_new (file_path, FALSE, error);
+  if (mapped == NULL)
+    return NULL;
+  hash = g_compute_checksum_for_data (
+      G_CHECKSUM_SHA256,
+      (const guchar *)g_mapped_file_get_contents (mapped),
+      g_mapped_file_get_length (mapped));
+  g_mapped_file_unref (mapped);
+  return hash;
+}
+
+/*
+ * Returns cached provider name of model hash, or NULL if it is not cached
+ * for available providers.
+ */
+static char *
+mm_provider_select_lookup (const char *hash, GStrv available)
+{
+  GKeyFile *key_file = g_key_file_new ();
+  char *path = mm_provider_select_get_cache_path ();
+  GStrv cached_available = NULL;
+  char *name = NULL;
+
+  g_mutex_lock (&mm_provider_select_mutex);
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL))
+    goto out;
+  cached_available = g_key_file_get_string_list (key_file, hash, "available",
+                                                 NULL, NULL);
+  if ((cached_available == NULL)
+      || !g_strv_equal ((const char *const *)cached_available,
+                        (const char *const *)available))
+    goto out;
+  name = g_key_file_get_string (key_file, hash, "provider", NULL);
+out:
+  g_mutex_unlock (&mm_provider_select_mutex);
+  g_strfreev (cached_available);
+  g_free (path);
+  g_key_file_unref (key_file);
+  return name;
+}
+
+/* Failing to write the cache only costs another selection. */
+static void
+mm_provider_select_store (const char *hash, GStrv available,
+                          const char *name)
+{
+  GKeyFile *key_file = g_key_file_new ();
+  char *path = mm_provider_select_get_cache_path ();
+  char *dir = g_path_get_dirname (path);
+  GError *error = NULL;
+
+  g_mutex_lock (&mm_provider_select_mutex);
+  g_key_file_load_from_file (key_file, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+  g_key_file_set_string (key_file, hash, "provider", name);
+  g_key_file_set_string_list (key_file, hash, "available",
+                              (const char *const *)available,
+                              g_strv_length (available));
+  if ((g_mkdir_with_parents (dir, 0755) != 0)
+      || !g_key_file_save_to_file (key_file, path, &error))
+    g_debug ("Can not save provider of %s: %s", hash,
+             error ? error->message : g_strerror (errno));
+  g_mutex_unlock (&mm_provider_select_mutex);
+  g_clear_error (&error);
+  g_free (dir);
+  g_free (path);
+  g_key_file_unref (key_file);
+}
+
+/* Returns copy of options with provider appended. */
+static MMModelOptions *
+mm_provider_select_new_options (MMModelOptions *options, MMProviderName name,
+                                GError **error)
+{
+  MMModelOptions *copy;
+  MMProvider *provider;
+  gboolean ret;
+
+  copy = mm_model_options_copy (options, error);
+  if ((copy == NULL) || (name == MM_PROVIDER_NULL))
+    return copy;
+  provider = mm_provider_new (options->context, name, error);
+  ret = provider && mm_model_options_append_provider (copy, provider, error);
+  if (provider)
+    mm_provider_unref (provider);
+  if (ret)
+    return copy;
+  mm_model_options_unref (copy);
+  return NULL;
+}
+
+static MMModel *
+mm_provider_select_load (MMModelOptions *options, MMProviderName name,
+                         const char *file_path, GError **error)
+{
+  MMModelOptions *copy;
+  MMModel *model;
+
+  copy = mm_provider_select_new_options (options, name, error);
+  if (copy == NULL)
+    return NULL;
+  model = mm_model_new (copy, file_path, error);
+  mm_model_options_unref (copy);
+  return model;
+}
+
+static gint
+mm_provider_select_compare_duration (gconstpointer a, gconstpointer b)
+{
+  gint64 da = *(const gint64 *)a;
+  gint64 db = *(const gint64 *)b;
+  return (da > db) - (da < db);
+}
+
+/*
+ * Runs model at every shape, and returns sum of median times. outputs is set
+ * to array of output arrays for each shape.
+ */
+static gint64
+mm_provider_select_measure (MMModel *model, GPtrArray *shapes,
+                            GPtrArray **outputs, GError **error)
+{
+  gint64 time = 0;
+
+  *outputs = g_ptr_array_new_with_free_func (
+      (GDestroyNotify)g_ptr_array_unref);
+  for (guint k = 0; k < shapes->len; k++)
+    {
+      GPtrArray *shape_outputs;
+      GArray *durations;
+
+      durations = mm_model_benchmark (model, shapes->pdata[k],
+                                      MM_PROVIDER_SELECT_ITERATIONS,
+                                      &shape_outputs, error);
+      if (durations == NULL)
+        {
+          g_clear_pointer (outputs, g_ptr_array_unref);
+          return -1;
+        }
+      g_array_sort (durations, mm_provider_select_compare_duration);
+      time += g_array_index (durations, gint64, durations->len / 2);
+      g_array_unref (durations);
+      g_ptr_array_add (*outputs, shape_outputs);
+    }
+  return time;
+}
+
+static gboolean
+mm_provider_select_is_close (double x, double ref)
+{
+  if (isnan (x) && isnan (ref))
+    return TRUE;
+  return fabs (x - ref)
+         <= MM_PROVIDER_SELECT_ATOL + MM_PROVIDER_SELECT_RTOL * fabs (ref);
+}
+
+/* Compares FLOAT, FLOAT16 and BFLOAT16 values as float. */
+static gboolean
+mm_provider_select_compare_float (MMValue *value, MMValue *reference,
+                                  size_t count)
+{
+  float *data;
+  float *ref_data;
+  gboolean ret = TRUE;
+
+  data = g_new (float, count);
+  ref_data = g_new (float, count);
+  if (!mm_value_copy_data_to (value, data,
+                              ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, NULL)
+      || !mm_value_copy_data_to (reference, ref_data,
+                                 ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, NULL))
+    ret = FALSE;
+  for (size_t i = 0; ret && (i < count); i++)
+    ret = mm_provider_select_is_close (data[i], ref_data[i]);
+  g_free (ref_data);
+  g_free (data);
+  return ret;
+}
+
+/* Returns TRUE if value is close to reference. */
+static gboolean
+mm_provider_select_compare_value (MMValue *value, MMValue *reference)
+{
+  ONNXTensorElementDataType dtype = reference->info->dtype;
+  size_t count;
+  const double *data;
+  const double *ref_data;
+
+  if ((value->info->dtype != dtype)
+      || (value->info->ndim != reference->info->ndim)
+      || memcmp (value->info->dim, reference->info->dim,
+                 sizeof (int64_t) * reference->info->ndim))
+    return FALSE;
+  count = mm_value_info_get_element_count (reference->info);
+  if (count == 0)
+    return TRUE;
+
+  switch (dtype)
+    {
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16:
+      return mm_provider_select_compare_float (value, reference, count);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE:
+      data = mm_value_peek_data (value, NULL);
+      ref_data = mm_value_peek_data (reference, NULL);
+      if ((data == NULL) || (ref_data == NULL))
+        return FALSE;
+      for (size_t i = 0; i < count; i++)
+        if (!mm_provider_select_is_close (data[i], ref_data[i]))
+          return FALSE;
+      return TRUE;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_BOOL:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT16:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT16:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT32:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT64:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:
+      {
+        /* Token ids and masks should match exactly. */
+        gconstpointer bytes = mm_value_peek_data (value, NULL);
+        gconstpointer ref_bytes = mm_value_peek_data (reference, NULL);
+
+        return bytes && ref_bytes
+               && !memcmp (bytes, ref_bytes,
+                           mm_value_info_get_data_size (reference->info));
+      }
+    default:
+      /* Outputs which can not be compared can not be trusted either. */
+      return FALSE;
+    }
+}
+
+static gboolean
+mm_provider_select_compare (GPtrArray *outputs, GPtrArray *reference)
+{
+  for (guint k = 0; k < reference->len; k++)
+    {
+      GPtrArray *values = outputs->pdata[k];
+      GPtrArray *ref_values = reference->pdata[k];
+
+      for (guint i = 0; i < ref_values->len; i++)
+        if (!mm_provider_select_compare_value (values->pdata[i],
+                                               ref_values->pdata[i]))
+          return FALSE;
+    }
+  return TRUE;
+}
+
+MMModel *
+mm_provider_select_model (MMModelOptions *options, const char *file_path,
+                          GPtrArray *shapes, GError **error)
+{
+  MMModel *best_model;
+  MMProviderName best_name = MM_PROVIDER_NULL;
+  GPtrArray *reference = NULL;
+  GPtrArray *fixed_shapes = NULL;
+  GStrv available;
+  char *hash;
+  char *cached;
+  gint64 best_time;
+  g_return_val_if_fail (options, NULL);
+  g_return_val_if_fail (file_path, NULL);
+  g_return_val_if_fail (shapes, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  hash = mm_provider_select_hash_file (file_path, error);
+  if (hash == NULL)
+    return NULL;
+  available = mm_context_get_available_execution_provider (options->context);
+
+  /* Select again if the cached provider can not load the model any more. */
+  cached = mm_provider_select_lookup (hash, available);
+  if (cached)
+    {
+      GError *local_error = NULL;
+
+      best_model = mm_provider_select_load (
+          options, mm_provider_name_from_str (cached), file_path,
+          &local_error);
+      if (best_model)
+        goto out;
+      g_debug ("Can not load %s with %s: %s", file_path, cached,
+               local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  /* Like MMTuner, models with fixed dimensions are run at an empty shape */
+  if (shapes->len == 0)
+    {
+      fixed_shapes = g_ptr_array_new_with_free_func (
+          (GDestroyNotify)g_hash_table_unref);
+      g_ptr_array_add (fixed_shapes,
+                       g_hash_table_new (g_str_hash, g_str_equal));
+      shapes = fixed_shapes;
+    }
+
+  /* CPU is the reference of correctness. */
+  best_model = mm_provider_select_load (options, MM_PROVIDER_NULL, file_path,
+                                        error);
+  if (best_model == NULL)
+    goto out;
+  best_time = mm_provider_select_measure (best_model, shapes, &reference,
+                                          error);
+  if (best_time < 0)
+    {
+      g_clear_pointer (&best_model, mm_model_unref);
+      goto out;
+    }
+
+  for (guint k = 0; available[k]; k++)
+    {
+      MMProviderName name = mm_provider_name_from_str (available[k]);
+      GPtrArray *outputs = NULL;
+      GError *local_error = NULL;
+      MMModel *model;
+      gint64 time = -1;
+
+      if (name == MM_PROVIDER_NULL)
+        continue;
+      model = mm_provider_select_load (options, name, file_path,
+                                       &local_error);
+      if (model)
+        time = mm_provider_select_measure (model, shapes, &outputs,
+                                           &local_error);
+      if (local_error)
+        {
+          g_debug ("%s is not selected for %s: %s", available[k], file_path,
+                   local_error->message);
+          g_clear_error (&local_error);
+        }
+      else if (!mm_provider_select_compare (outputs, reference))
+        g_debug ("%s is not selected for %s: Outputs differ from CPU.",
+                 available[k], file_path);
+      else if (time < best_time)
+        {
+          g_clear_pointer (&best_model, mm_model_unref);
+          best_model = g_steal_pointer (&model);
+          best_name = name;
+          best_time = time;
+        }
+      if (outputs)
+        g_ptr_array_unref (outputs);
+      if (model)
+        mm_model_unref (model);
+    }
+
+  if (best_name == MM_PROVIDER_NULL)
+    mm_provider_select_store (hash, available, MM_PROVIDER_SELECT_CPU);
+  else
+    mm_provider_select_store (hash, available,
+                              mm_provider_name_to_str (best_name));
+out:
+  if (reference)
+    g_ptr_array_unref (reference);
+  if (fixed_shapes)
+    g_ptr_array_unref (fixed_shapes);
+  g_free (cached);
+  g_strfreev (available);
+  g_free (hash);
+  return best_model;
+}
@@ -1,24 +1,60 @@
 
 #include "mm-provider.h"
 
+G_DEFINE_QUARK (mm-provider-error, mm_provider_error);
+
 // Should be compatible with OrtApi::GetAvaiableProviders(), but these strings
 // could be wrong...
+static const char *const mm_provider_names[] = {
+  [MM_PROVIDER_TENSOR_RT] = "TensorRTExecutionProvider",
+  [MM_PROVIDER_CUDA] = "CUDAExecutionProvider",
+  [MM_PROVIDER_CANN] = "CANNExecutionProvider",
+  [MM_PROVIDER_DNNL] = "DnnlExecutionProvider",
+  [MM_PROVIDER_ROCM] = "ROCMExecutionProvider",
+  [MM_PROVIDER_XNNPACK] = "XnnpackExecutionProvider",
+  [MM_PROVIDER_OPEN_VINO] = "OpenVINOExecutionProvider",
+};
+
 MMProviderName
 mm_provider_name_from_str (const char *name)
 {
   g_return_val_if_fail (name, MM_PROVIDER_NULL);
 
-  if (!strcmp (name, "TensorRTExecutionProvider"))
-    return MM_PROVIDER_TENSOR_RT;
-  if (!strcmp (name, "CUDAExecutionProvider"))
-    return MM_PROVIDER_CUDA;
-  if (!strcmp (name, "CANNExecutionProvider"))
-    return MM_PROVIDER_CANN;
-  if (!strcmp (name, "DnnlExecutionProvider"))
-    return MM_PROVIDER_DNNL;
-  if (!strcmp (name, "ROCMExecutionProvider"))
-    return MM_PROVIDER_ROCM;
-  g_return_val_if_reached (MM_PROVIDER_NULL);
+  for (guint k = 0; k < G_N_ELEMENTS (mm_provider_names); k++)
+    if (mm_provider_names[k] && !strcmp (name, mm_provider_names[k]))
+      return k;
+  /* CPU and providers we do not wrap */
+  return MM_PROVIDER_NULL;
+}
+
+const char *
+mm_provider_name_to_str (MMProviderName name)
+{
+  g_return_val_if_fail (name < G_N_ELEMENTS (mm_provider_names), NULL);
+  return mm_provider_names[name];
+}
+
+gboolean
+mm_provider_is_available (MMContext *context, MMProviderName name)
+{
+  GStrv providers;
+  gboolean available;
+  g_return_val_if_fail (context, FALSE);
+  g_return_val_if_fail (name != MM_PROVIDER_NULL, FALSE);
+  g_return_val_if_fail (name < G_N_ELEMENTS (mm_provider_names), FALSE);
+
+  providers = mm_context_get_available_execution_provider (context);
+  available = g_strv_contains ((const char *const *)providers,
+                               mm_provider_names[name]);
+  g_strfreev (providers);
+  return available;
+}
+
+/* Returns TRUE if provider is appended by name with key/value options. */
+static gboolean
+mm_provider_is_generic (MMProviderName name)
+{
+  return (name == MM_PROVIDER_XNNPACK) || (name == MM_PROVIDER_OPEN_VINO);
 }
 
 typedef struct _MMRealProvider MMRealProvider;
@@ -36,6 +72,7 @@ struct _MMRealProvider
     OrtROCMProviderOptions *rocm;
     OrtMIGraphXProviderOptions *mi_graph_x;
     OrtOpenVINOProviderOptions *open_vino;
+    GHashTable *options;
     void *ep_options;
   };
 
@@ -53,6 +90,13 @@ mm_provider_new (MMContext *context, MMProviderName name, GError **error)
   g_return_val_if_fail (name != MM_PROVIDER_NULL, NULL);
   g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
 
+  if (!mm_provider_is_available (context, name))
+    {
+      g_set_error (error, MM_PROVIDER_ERROR, MM_PROVIDER_ERROR_UNAVAILABLE,
+                   "%s is not available.", mm_provider_name_to_str (name));
+      return NULL;
+    }
+
   provider = g_new0 (MMRealProvider, 1);
   provider->name = name;
   switch (name)
@@ -78,6 +122,13 @@ mm_provider_new (MMContext *context, MMProviderName name, GError **error)
       status = context->api->CreateROCMProviderOptions (&provider->rocm);
       release_func = (GDestroyNotify)context->api->ReleaseROCMProviderOptions;
       break;
+    case MM_PROVIDER_XNNPACK:
+    case MM_PROVIDER_OPEN_VINO:
+      provider->options
+          = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      status = NULL;
+      release_func = (GDestroyNotify)g_hash_table_unref;
+      break;
     default:
       g_warn_if_reached ();
       status = NULL;
@@ -135,6 +186,10 @@ mm_provider_unref (MMProvider *provider)
     case MM_PROVIDER_ROCM:
       context->api->ReleaseROCMProviderOptions (rprovider->rocm);
       break;
+    case MM_PROVIDER_XNNPACK:
+    case MM_PROVIDER_OPEN_VINO:
+      g_hash_table_unref (rprovider->options);
+      break;
     default:
       g_warn_if_reached ();
       break;
@@ -143,3 +198,58 @@ mm_provider_unref (MMProvider *provider)
   mm_context_unref (context);
   g_free (rprovider);
 }
+
+void
+mm_provider_set_option (MMProvider *provider, const char *key,
+                        const char *value)
+{
+  g_return_if_fail (provider);
+  g_return_if_fail (mm_provider_is_generic (provider->name));
+  g_return_if_fail (key);
+  g_return_if_fail (value);
+  g_hash_table_insert (provider->options, g_strdup (key), g_strdup (value));
+}
+
+static void
+mm_provider_set_int_option (MMProvider *provider, const char *key, int value)
+{
+  char *str = g_strdup_printf ("%d", value);
+  mm_provider_set_option (provider, key, str);
+  g_free (str);
+}
+
+void
+mm_provider_set_xnnpack_threads (MMProvider *provider, int threads)
+{
+  g_return_if_fail (provider);
+  g_return_if_fail (provider->name == MM_PROVIDER_XNNPACK);
+  g_return_if_fail (threads >= 0);
+  mm_provider_set_int_option (provider, "intra_op_num_threads", threads);
+}
+
+void
+mm_provider_set_open_vino_device_type (MMProvider *provider,
+                                       const char *device_type)
+{
+  g_return_if_fail (provider);
+  g_return_if_fail (provider->name == MM_PROVIDER_OPEN_VINO);
+  mm_provider_set_option (provider, "device_type", device_type);
+}
+
+void
+mm_provider_set_open_vino_threads (MMProvider *provider, int threads)
+{
+  g_return_if_fail (provider);
+  g_return_if_fail (provider->name == MM_PROVIDER_OPEN_VINO);
+  g_return_if_fail (threads > 0);
+  mm_provider_set_int_option (provider, "num_of_threads", threads);
+}
+
+void
+mm_provider_set_open_vino_cache_dir (MMProvider *provider,
+                                     const char *cache_dir)
+{
+  g_return_if_fail (provider);
+  g_return_if_fail (provider->name == MM_PROVIDER_OPEN_VINO);
+  mm_provider_set_option (provider, "cache_dir", cache_dir);
+}
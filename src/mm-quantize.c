@@ -0,0 +1,447 @@
+#include <math.h>
+
+#include "mm-quantize.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MM_QUANTIZE_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct _MMQuantizeKernels MMQuantizeKernels;
+typedef struct _MMQuantizeLayout MMQuantizeLayout;
+
+struct _MMQuantizeKernels
+{
+  void (*minmax) (const float *src, size_t count, float *min, float *max);
+  void (*quantize) (guint8 *dst, const float *src, size_t count, float scale,
+                    gint zero_point, gint qmin, gint qmax);
+  void (*dequantize) (float *dst, const guint8 *src, size_t count,
+                      float scale, gint zero_point, gboolean is_signed);
+};
+
+/*
+ * Tensor is handled as runs of contiguous elements, and every element of a
+ * run shares the same group (scale and zero point).
+ */
+struct _MMQuantizeLayout
+{
+  MMQuantizeGranularity granularity;
+  size_t count;
+  size_t nruns;
+  size_t ngroups;
+  /* MM_QUANTIZE_PER_CHANNEL */
+  size_t channels;
+  size_t inner;
+  /* MM_QUANTIZE_BLOCK */
+  size_t last;
+  size_t block_size;
+  size_t nblocks;
+};
+
+static MMQuantizeKernels kernels;
+
+static void
+mm_quantize_minmax_c (const float *src, size_t count, float *min, float *max)
+{
+  float lo = *min;
+  float hi = *max;
+
+  for (size_t k = 0; k < count; k++)
+    {
+      lo = MIN (lo, src[k]);
+      hi = MAX (hi, src[k]);
+    }
+  *min = lo;
+  *max = hi;
+}
+
+static void
+mm_quantize_quantize_c (guint8 *dst, const float *src, size_t count,
+                        float scale, gint zero_point, gint qmin, gint qmax)
+{
+  for (size_t k = 0; k < count; k++)
+    {
+      gint q = (gint)nearbyintf (src[k] / scale) + zero_point;
+      dst[k] = (guint8)CLAMP (q, qmin, qmax);
+    }
+}
+
+static void
+mm_quantize_dequantize_c (float *dst, const guint8 *src, size_t count,
+                          float scale, gint zero_point, gboolean is_signed)
+{
+  for (size_t k = 0; k < count; k++)
+    {
+      gint q = is_signed ? (gint8)src[k] : src[k];
+      dst[k] = (float)(q - zero_point) * scale;
+    }
+}
+
+#ifdef MM_QUANTIZE_X86
+__attribute__ ((target ("avx2"))) static void
+mm_quantize_minmax_avx2 (const float *src, size_t count, float *min,
+                         float *max)
+{
+  __m256 lo = _mm256_set1_ps (*min);
+  __m256 hi = _mm256_set1_ps (*max);
+  float lanes_lo[8];
+  float lanes_hi[8];
+  size_t k = 0;
+
+  for (; k + 8 <= count; k += 8)
+    {
+      __m256 v = _mm256_loadu_ps (src + k);
+      lo = _mm256_min_ps (lo, v);
+      hi = _mm256_max_ps (hi, v);
+    }
+
+  _mm256_storeu_ps (lanes_lo, lo);
+  _mm256_storeu_ps (lanes_hi, hi);
+  mm_quantize_minmax_c (lanes_lo, 8, min, max);
+  mm_quantize_minmax_c (lanes_hi, 8, min, max);
+  mm_quantize_minmax_c (src + k, count - k, min, max);
+}
+
+__attribute__ ((target ("avx2"))) static void
+mm_quantize_quantize_avx2 (guint8 *dst, const float *src, size_t count,
+                           float scale, gint zero_point, gint qmin, gint qmax)
+{
+  const __m256 vscale = _mm256_set1_ps (scale);
+  const __m256i vzero_point = _mm256_set1_epi32 (zero_point);
+  const __m256i vqmin = _mm256_set1_epi32 (qmin);
+  const __m256i vqmax = _mm256_set1_epi32 (qmax);
+  const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+  gboolean is_signed = qmin < 0;
+  size_t k = 0;
+
+  for (; k + 32 <= count; k += 32)
+    {
+      __m256i q[4];
+      __m256i q16[2];
+      __m256i q8;
+
+      for (guint i = 0; i < 4; i++)
+        {
+          __m256 v = _mm256_div_ps (_mm256_loadu_ps (src + k + 8 * i), vscale);
+          v = _mm256_round_ps (v, _MM_FROUND_TO_NEAREST_INT
+                                      | _MM_FROUND_NO_EXC);
+          q[i] = _mm256_add_epi32 (_mm256_cvtps_epi32 (v), vzero_point);
+          q[i] = _mm256_min_epi32 (_mm256_max_epi32 (q[i], vqmin), vqmax);
+        }
+
+      /* Values are clamped already, so packing never saturates. */
+      q16[0] = _mm256_packs_epi32 (q[0], q[1]);
+      q16[1] = _mm256_packs_epi32 (q[2], q[3]);
+      q8 = is_signed ? _mm256_packs_epi16 (q16[0], q16[1])
+                     : _mm256_packus_epi16 (q16[0], q16[1]);
+      q8 = _mm256_permutevar8x32_epi32 (q8, order);
+      _mm256_storeu_si256 ((__m256i *)(dst + k), q8);
+    }
+  mm_quantize_quantize_c (dst + k, src + k, count - k, scale, zero_point,
+                          qmin, qmax);
+}
+
+__attribute__ ((target ("avx2"))) static void
+mm_quantize_dequantize_avx2 (float *dst, const guint8 *src, size_t count,
+                             float scale, gint zero_point, gboolean is_signed)
+{
+  const __m256 vscale = _mm256_set1_ps (scale);
+  const __m256i vzero_point = _mm256_set1_epi32 (zero_point);
+  size_t k = 0;
+
+  for (; k + 8 <= count; k += 8)
+    {
+      __m128i bytes = _mm_loadl_epi64 ((const __m128i *)(src + k));
+      __m256i q = is_signed ? _mm256_cvtepi8_epi32 (bytes)
+                            : _mm256_cvtepu8_epi32 (bytes);
+      q = _mm256_sub_epi32 (q, vzero_point);
+      _mm256_storeu_ps (dst + k,
+                        _mm256_mul_ps (_mm256_cvtepi32_ps (q), vscale));
+    }
+  mm_quantize_dequantize_c (dst + k, src + k, count - k, scale, zero_point,
+                            is_signed);
+}
+#endif
+
+static void
+mm_quantize_init (void)
+{
+  static gsize initialized = 0;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  kernels.minmax = mm_quantize_minmax_c;
+  kernels.quantize = mm_quantize_quantize_c;
+  kernels.dequantize = mm_quantize_dequantize_c;
+
+#ifdef MM_QUANTIZE_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      kernels.minmax = mm_quantize_minmax_avx2;
+      kernels.quantize = mm_quantize_quantize_avx2;
+      kernels.dequantize = mm_quantize_dequantize_avx2;
+    }
+#endif
+
+  g_once_init_leave (&initialized, 1);
+}
+
+static gboolean
+mm_quantize_get_range (ONNXTensorElementDataType dtype, gint *qmin,
+                       gint *qmax)
+{
+  switch (dtype)
+    {
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8:
+      *qmin = G_MININT8;
+      *qmax = G_MAXINT8;
+      return TRUE;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8:
+      *qmin = 0;
+      *qmax = G_MAXUINT8;
+      return TRUE;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT4:
+      *qmin = -8;
+      *qmax = 7;
+      return TRUE;
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT4:
+      *qmin = 0;
+      *qmax = 15;
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static gboolean
+mm_quantize_layout_init (MMQuantizeLayout *layout, const MMQuantizeInfo *info,
+                         const int64_t *dim, size_t ndim)
+{
+  size_t outer = 1;
+  int64_t axis;
+  gint qmin;
+  gint qmax;
+
+  if (!mm_quantize_get_range (info->dtype, &qmin, &qmax))
+    return FALSE;
+
+  layout->granularity = info->granularity;
+  layout->count = 1;
+  for (size_t k = 0; k < ndim; k++)
+    {
+      if (dim[k] <= 0)
+        return FALSE;
+      layout->count *= dim[k];
+    }
+
+  switch (info->granularity)
+    {
+    case MM_QUANTIZE_PER_TENSOR:
+      layout->nruns = 1;
+      layout->ngroups = 1;
+      return TRUE;
+    case MM_QUANTIZE_PER_CHANNEL:
+      axis = info->axis < 0 ? info->axis + (int64_t)ndim : info->axis;
+      if ((axis < 0) || (axis >= (int64_t)ndim))
+        return FALSE;
+      for (int64_t k = 0; k < axis; k++)
+        outer *= dim[k];
+      layout->channels = dim[axis];
+      layout->inner = layout->count / (outer * layout->channels);
+      layout->nruns = outer * layout->channels;
+      layout->ngroups = layout->channels;
+      return TRUE;
+    case MM_QUANTIZE_BLOCK:
+      if ((ndim == 0) || (info->block_size <= 0))
+        return FALSE;
+      layout->last = dim[ndim - 1];
+      layout->block_size = info->block_size;
+      layout->nblocks
+          = (layout->last + layout->block_size - 1) / layout->block_size;
+      layout->nruns = layout->count / layout->last * layout->nblocks;
+      layout->ngroups = layout->nruns;
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static void
+mm_quantize_layout_get_run (const MMQuantizeLayout *layout, size_t run,
+                            size_t *offset, size_t *length, size_t *group)
+{
+  size_t block;
+
+  switch (layout->granularity)
+    {
+    case MM_QUANTIZE_PER_CHANNEL:
+      *offset = run * layout->inner;
+      *length = layout->inner;
+      *group = run % layout->channels;
+      return;
+    case MM_QUANTIZE_BLOCK:
+      block = run % layout->nblocks;
+      *offset = run / layout->nblocks * layout->last
+                + block * layout->block_size;
+      *length = MIN (layout->block_size,
+                     layout->last - block * layout->block_size);
+      *group = run;
+      return;
+    default:
+      *offset = 0;
+      *length = layout->count;
+      *group = 0;
+      return;
+    }
+}
+
+size_t
+mm_quantize_get_scale_count (const MMQuantizeInfo *info, const int64_t *dim,
+                             size_t ndim)
+{
+  MMQuantizeLayout layout;
+  g_return_val_if_fail (info, 0);
+  g_return_val_if_fail (dim || (ndim == 0), 0);
+
+  if (!mm_quantize_layout_init (&layout, info, dim, ndim))
+    return 0;
+  return layout.ngroups;
+}
+
+gboolean
+mm_quantize (gpointer dst, const float *src, const int64_t *dim, size_t ndim,
+             const MMQuantizeInfo *info, float *scales, guint8 *zero_points)
+{
+  MMQuantizeLayout layout;
+  float *min;
+  float *max;
+  guint8 *q;
+  gboolean is_packed;
+  gint qmin;
+  gint qmax;
+  g_return_val_if_fail (dst, FALSE);
+  g_return_val_if_fail (src, FALSE);
+  g_return_val_if_fail (info, FALSE);
+  g_return_val_if_fail (scales, FALSE);
+  g_return_val_if_fail (zero_points, FALSE);
+
+  if (!mm_quantize_layout_init (&layout, info, dim, ndim)
+      || !mm_quantize_get_range (info->dtype, &qmin, &qmax))
+    return FALSE;
+  mm_quantize_init ();
+
+  min = g_new (float, layout.ngroups);
+  max = g_new (float, layout.ngroups);
+  for (size_t k = 0; k < layout.ngroups; k++)
+    {
+      /* Range always includes 0, so 0 is represented exactly. */
+      min[k] = 0.0f;
+      max[k] = 0.0f;
+    }
+
+  for (size_t r = 0; r < layout.nruns; r++)
+    {
+      size_t offset, length, group;
+
+      mm_quantize_layout_get_run (&layout, r, &offset, &length, &group);
+      kernels.minmax (src + offset, length, min + group, max + group);
+    }
+
+  for (size_t k = 0; k < layout.ngroups; k++)
+    {
+      if (qmin < 0)
+        {
+          scales[k] = MAX (-min[k], max[k]) / qmax;
+          zero_points[k] = 0;
+        }
+      else
+        {
+          scales[k] = (max[k] - min[k]) / qmax;
+          zero_points[k] = scales[k] > 0.0f
+                               ? CLAMP (nearbyintf (-min[k] / scales[k]),
+                                        0, qmax)
+                               : 0;
+        }
+      if (!(scales[k] > 0.0f) || !isfinite (scales[k]))
+        scales[k] = 1.0f;
+    }
+
+  /* 4-bit values are quantized to bytes first, and packed after. */
+  is_packed = (info->dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_INT4)
+              || (info->dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT4);
+  q = is_packed ? g_malloc (layout.count) : dst;
+  for (size_t r = 0; r < layout.nruns; r++)
+    {
+      size_t offset, length, group;
+
+      mm_quantize_layout_get_run (&layout, r, &offset, &length, &group);
+      kernels.quantize (q + offset, src + offset, length, scales[group],
+                        zero_points[group], qmin, qmax);
+    }
+
+  if (is_packed)
+    {
+      guint8 *packed = dst;
+
+      for (size_t k = 0; k < layout.count / 2; k++)
+        packed[k] = (q[2 * k] & 0xf) | (q[2 * k + 1] << 4);
+      if (layout.count % 2)
+        packed[layout.count / 2] = q[layout.count - 1] & 0xf;
+      g_free (q);
+    }
+
+  g_free (max);
+  g_free (min);
+  return TRUE;
+}
+
+gboolean
+mm_dequantize (float *dst, gconstpointer src, const int64_t *dim, size_t ndim,
+               const MMQuantizeInfo *info, const float *scales,
+               const guint8 *zero_points)
+{
+  MMQuantizeLayout layout;
+  const guint8 *q = src;
+  guint8 *unpacked = NULL;
+  gboolean is_signed;
+  gint qmin;
+  gint qmax;
+  g_return_val_if_fail (dst, FALSE);
+  g_return_val_if_fail (src, FALSE);
+  g_return_val_if_fail (info, FALSE);
+  g_return_val_if_fail (scales, FALSE);
+  g_return_val_if_fail (zero_points, FALSE);
+
+  if (!mm_quantize_layout_init (&layout, info, dim, ndim)
+      || !mm_quantize_get_range (info->dtype, &qmin, &qmax))
+    return FALSE;
+  mm_quantize_init ();
+  is_signed = qmin < 0;
+
+  if ((info->dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_INT4)
+      || (info->dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT4))
+    {
+      /* Sign-extended to bytes, so the 8-bit kernel can be used. */
+      unpacked = g_malloc (layout.count);
+      for (size_t k = 0; k < layout.count; k++)
+        {
+          guint8 nibble = (q[k / 2] >> (4 * (k % 2))) & 0xf;
+          unpacked[k] = (is_signed && (nibble & 0x8)) ? nibble | 0xf0 : nibble;
+        }
+      q = unpacked;
+    }
+
+  for (size_t r = 0; r < layout.nruns; r++)
+    {
+      size_t offset, length, group;
+
+      mm_quantize_layout_get_run (&layout, r, &offset, &length, &group);
+      kernels.dequantize (dst + offset, q + offset, length, scales[group],
+                          zero_points[group], is_signed);
+    }
+
+  g_free (unpacked);
+  return TRUE;
+}
@@ -0,0 +1,327 @@
+#include "mm-run-context.h"
+
+G_DEFINE_QUARK (mm-run-context-error, mm_run_context_error);
+
+struct _MMRunContext
+{
+  MMContext *context;
+  OrtRunOptions *run_options;
+  gint64 deadline;
+  GCancellable *cancellable;
+  gulong cancelled_id;
+  /* Number of runs between begin and end */
+  guint active;
+  /* TRUE while in the watchdog list, protected by mm_run_watchdog_mutex */
+  gboolean armed;
+  GMutex mutex;
+  gatomicrefcount ref_count;
+};
+
+/*
+ * A single thread terminates runs whose deadline has passed. Armed contexts
+ * are sorted by deadline, and each one holds a reference.
+ */
+static GMutex mm_run_watchdog_mutex;
+static GCond mm_run_watchdog_cond;
+static GList *mm_run_watchdog_list;
+static GThread *mm_run_watchdog_thread;
+
+static void
+mm_run_context_terminate (MMRunContext *run_context)
+{
+  const OrtApi *api = run_context->context->api;
+  OrtStatus *status;
+
+  status = api->RunOptionsSetTerminate (run_context->run_options);
+  if (status)
+    api->ReleaseStatus (status);
+}
+
+static void
+mm_run_context_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+  mm_run_context_terminate (user_data);
+}
+
+static gpointer
+mm_run_watchdog (gpointer data)
+{
+  g_mutex_lock (&mm_run_watchdog_mutex);
+  for (;;)
+    {
+      MMRunContext *run_context;
+
+      if (mm_run_watchdog_list == NULL)
+        {
+          g_cond_wait (&mm_run_watchdog_cond, &mm_run_watchdog_mutex);
+          continue;
+        }
+
+      run_context = mm_run_watchdog_list->data;
+      if (g_get_monotonic_time () < run_context->deadline)
+        {
+          g_cond_wait_until (&mm_run_watchdog_cond, &mm_run_watchdog_mutex,
+                             run_context->deadline);
+          continue;
+        }
+
+      mm_run_watchdog_list = g_list_delete_link (mm_run_watchdog_list,
+                                                 mm_run_watchdog_list);
+      run_context->armed = FALSE;
+      mm_run_context_terminate (run_context);
+      g_mutex_unlock (&mm_run_watchdog_mutex);
+      mm_run_context_unref (run_context);
+      g_mutex_lock (&mm_run_watchdog_mutex);
+    }
+  return NULL;
+}
+
+static gint
+mm_run_context_compare_deadline (gconstpointer a, gconstpointer b)
+{
+  const MMRunContext *ra = a;
+  const MMRunContext *rb = b;
+  return (ra->deadline > rb->deadline) - (ra->deadline < rb->deadline);
+}
+
+static void
+mm_run_context_arm (MMRunContext *run_context)
+{
+  g_mutex_lock (&mm_run_watchdog_mutex);
+  if (mm_run_watchdog_thread == NULL)
+    mm_run_watchdog_thread
+        = g_thread_new ("mm-run-watchdog", mm_run_watchdog, NULL);
+  mm_run_context_ref (run_context);
+  run_context->armed = TRUE;
+  mm_run_watchdog_list = g_list_insert_sorted (
+      mm_run_watchdog_list, run_context, mm_run_context_compare_deadline);
+  g_cond_signal (&mm_run_watchdog_cond);
+  g_mutex_unlock (&mm_run_watchdog_mutex);
+}
+
+static void
+mm_run_context_disarm (MMRunContext *run_context)
+{
+  gboolean armed;
+
+  g_mutex_lock (&mm_run_watchdog_mutex);
+  armed = run_context->armed;
+  if (armed)
+    {
+      mm_run_watchdog_list
+          = g_list_remove (mm_run_watchdog_list, run_context);
+      run_context->armed = FALSE;
+    }
+  g_mutex_unlock (&mm_run_watchdog_mutex);
+  if (armed)
+    mm_run_context_unref (run_context);
+}
+
+MMRunContext *
+mm_run_context_new (MMContext *context, GError **error)
+{
+  MMRunContext *run_context;
+  OrtRunOptions *run_options = NULL;
+  OrtStatus *status;
+
+  g_return_val_if_fail (context, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  status = context->api->CreateRunOptions (&run_options);
+  if (status)
+    {
+      mm_context_set_error (context, error, status);
+      return NULL;
+    }
+
+  mm_context_ref (context);
+  run_context = g_new0 (MMRunContext, 1);
+  run_context->context = context;
+  run_context->run_options = run_options;
+  g_mutex_init (&run_context->mutex);
+  g_atomic_ref_count_init (&run_context->ref_count);
+  return run_context;
+}
+
+void
+mm_run_context_ref (MMRunContext *run_context)
+{
+  g_return_if_fail (run_context);
+  g_atomic_ref_count_inc (&run_context->ref_count);
+}
+
+void
+mm_run_context_unref (MMRunContext *run_context)
+{
+  g_return_if_fail (run_context);
+  if (!g_atomic_ref_count_dec (&run_context->ref_count))
+    return;
+
+  g_clear_object (&run_context->cancellable);
+  run_context->context->api->ReleaseRunOptions (run_context->run_options);
+  mm_context_unref (run_context->context);
+  g_mutex_clear (&run_context->mutex);
+  g_free (run_context);
+}
+
+void
+mm_run_context_set_deadline (MMRunContext *run_context, gint64 deadline)
+{
+  g_return_if_fail (run_context);
+  run_context->deadline = deadline;
+}
+
+void
+mm_run_context_set_timeout (MMRunContext *run_context, gint64 timeout)
+{
+  g_return_if_fail (run_context);
+  run_context->deadline = g_get_monotonic_time () + timeout;
+}
+
+gint64
+mm_run_context_get_deadline (MMRunContext *run_context)
+{
+  g_return_val_if_fail (run_context, 0);
+  return run_context->deadline;
+}
+
+void
+mm_run_context_set_cancellable (MMRunContext *run_context,
+                                GCancellable *cancellable)
+{
+  g_return_if_fail (run_context);
+  if (cancellable)
+    g_object_ref (cancellable);
+  g_clear_object (&run_context->cancellable);
+  run_context->cancellable = cancellable;
+}
+
+gboolean
+mm_run_context_set_tag (MMRunContext *run_context, const char *tag,
+                        GError **error)
+{
+  MMContext *context;
+  OrtStatus *status;
+  g_return_val_if_fail (run_context, FALSE);
+  g_return_val_if_fail (tag, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  context = run_context->context;
+  status = context->api->RunOptionsSetRunTag (run_context->run_options, tag);
+  if (status)
+    {
+      mm_context_set_error (context, error, status);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+gboolean
+mm_run_context_add_config_entry (MMRunContext *run_context, const char *key,
+                                 const char *value, GError **error)
+{
+  MMContext *context;
+  OrtStatus *status;
+  g_return_val_if_fail (run_context, FALSE);
+  g_return_val_if_fail (key, FALSE);
+  g_return_val_if_fail (value, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  context = run_context->context;
+  status = context->api->AddRunConfigEntry (run_context->run_options, key,
+                                            value);
+  if (status)
+    {
+      mm_context_set_error (context, error, status);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static gboolean
+mm_run_context_check (MMRunContext *run_context, GError **error)
+{
+  if (run_context->cancellable
+      && g_cancellable_set_error_if_cancelled (run_context->cancellable,
+                                               error))
+    return FALSE;
+
+  if (run_context->deadline
+      && (g_get_monotonic_time () >= run_context->deadline))
+    {
+      g_set_error (error, MM_RUN_CONTEXT_ERROR,
+                   MM_RUN_CONTEXT_ERROR_DEADLINE, "Deadline has passed.");
+      return FALSE;
+    }
+  return TRUE;
+}
+
+OrtRunOptions *
+mm_run_context_begin (MMRunContext *run_context, GError **error)
+{
+  const OrtApi *api;
+  OrtStatus *status;
+  g_return_val_if_fail (run_context, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  api = run_context->context->api;
+  g_mutex_lock (&run_context->mutex);
+  if (!mm_run_context_check (run_context, error))
+    {
+      g_mutex_unlock (&run_context->mutex);
+      return NULL;
+    }
+
+  if (run_context->active++ == 0)
+    {
+      /* Clear terminate flag left by the previous deadline or cancel. */
+      status = api->RunOptionsUnsetTerminate (run_context->run_options);
+      if (status)
+        {
+          run_context->active--;
+          g_mutex_unlock (&run_context->mutex);
+          mm_context_set_error (run_context->context, error, status);
+          return NULL;
+        }
+      /* Handler is called here if cancellable is cancelled meanwhile. */
+      if (run_context->cancellable)
+        run_context->cancelled_id = g_cancellable_connect (
+            run_context->cancellable, G_CALLBACK (mm_run_context_cancelled),
+            run_context, NULL);
+      if (run_context->deadline)
+        mm_run_context_arm (run_context);
+    }
+  g_mutex_unlock (&run_context->mutex);
+  return run_context->run_options;
+}
+
+gboolean
+mm_run_context_end (MMRunContext *run_context, OrtStatus *status,
+                    GError **error)
+{
+  g_return_val_if_fail (run_context, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  g_mutex_lock (&run_context->mutex);
+  if (--run_context->active == 0)
+    {
+      if (run_context->cancelled_id)
+        g_cancellable_disconnect (run_context->cancellable,
+                                  run_context->cancelled_id);
+      run_context->cancelled_id = 0;
+      mm_run_context_disarm (run_context);
+    }
+  g_mutex_unlock (&run_context->mutex);
+
+  if (status == NULL)
+    return TRUE;
+
+  /* Report runs terminated by us with our own error. */
+  if (!mm_run_context_check (run_context, error))
+    {
+      run_context->context->api->ReleaseStatus (status);
+      return FALSE;
+    }
+  mm_context_set_error (run_context->context, error, status);
+  return FALSE;
+}
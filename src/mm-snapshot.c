@@ -0,0 +1,351 @@
+#include "mm-file.h"
+#include "mm-snapshot.h"
+
+G_DEFINE_QUARK (mm-snapshot-error, mm_snapshot_error);
+
+/* Name of the token history in files, next to the values */
+#define MM_SNAPSHOT_TOKENS_NAME "mm-snapshot-tokens"
+
+struct _MMSnapshot
+{
+  GPtrArray *value_array;
+  /*
+   * MMValue sharing data of each captured value, or holding data read by
+   * mm_snapshot_load()
+   */
+  GPtrArray *captured;
+  /* int64_t */
+  GArray *tokens;
+  gint64 restore_time;
+  gatomicrefcount ref_count;
+};
+
+MMSnapshot *
+mm_snapshot_new (void)
+{
+  MMSnapshot *snapshot;
+
+  snapshot = g_new (MMSnapshot, 1);
+  snapshot->value_array
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_value_unref);
+  snapshot->captured
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)mm_value_unref);
+  snapshot->tokens = g_array_new (FALSE, FALSE, sizeof (int64_t));
+  snapshot->restore_time = 0;
+  g_atomic_ref_count_init (&snapshot->ref_count);
+  return snapshot;
+}
+
+void
+mm_snapshot_ref (MMSnapshot *snapshot)
+{
+  g_return_if_fail (snapshot);
+  g_atomic_ref_count_inc (&snapshot->ref_count);
+}
+
+void
+mm_snapshot_unref (MMSnapshot *snapshot)
+{
+  g_return_if_fail (snapshot);
+  if (!g_atomic_ref_count_dec (&snapshot->ref_count))
+    return;
+
+  g_ptr_array_unref (snapshot->captured);
+  g_array_unref (snapshot->tokens);
+  g_ptr_array_unref (snapshot->value_array);
+  g_free (snapshot);
+}
+
+void
+mm_snapshot_add_value (MMSnapshot *snapshot, MMValue *value)
+{
+  g_return_if_fail (snapshot);
+  g_return_if_fail (value);
+
+  mm_value_ref (value);
+  g_ptr_array_add (snapshot->value_array, value);
+}
+
+void
+mm_snapshot_set_tokens (MMSnapshot *snapshot, const int64_t *tokens,
+                        size_t ntokens)
+{
+  g_return_if_fail (snapshot);
+  g_return_if_fail (tokens || (ntokens == 0));
+
+  g_array_set_size (snapshot->tokens, 0);
+  g_array_append_vals (snapshot->tokens, tokens, ntokens);
+}
+
+const int64_t *
+mm_snapshot_get_tokens (MMSnapshot *snapshot, size_t *ntokens)
+{
+  g_return_val_if_fail (snapshot, NULL);
+
+  if (ntokens)
+    *ntokens = snapshot->tokens->len;
+  return (const int64_t *)snapshot->tokens->data;
+}
+
+gboolean
+mm_snapshot_capture (MMSnapshot *snapshot, GError **error)
+{
+  g_return_val_if_fail (snapshot, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  for (guint k = 0; k < snapshot->value_array->len; k++)
+    {
+      MMValue *v = snapshot->value_array->pdata[k];
+
+      if (v->value == NULL)
+        {
+          g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_EMPTY,
+                       "Value %s has no tensor.", v->info->name);
+          return FALSE;
+        }
+      if (mm_value_get_quantize_info (v, NULL, NULL, NULL))
+        {
+          g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_QUANTIZED,
+                       "Value %s is quantized.", v->info->name);
+          return FALSE;
+        }
+    }
+
+  /* Values read by mm_snapshot_load() are replaced */
+  g_ptr_array_set_size (snapshot->captured, snapshot->value_array->len);
+  for (guint k = 0; k < snapshot->value_array->len; k++)
+    {
+      MMValue *v = snapshot->value_array->pdata[k];
+      MMValue *c = snapshot->captured->pdata[k];
+
+      /* Data is shared until either value is written */
+      if (c)
+        {
+          if (!mm_value_assign (c, v, error))
+            return FALSE;
+          continue;
+        }
+      snapshot->captured->pdata[k] = mm_value_clone (v, error);
+      if (snapshot->captured->pdata[k] == NULL)
+        {
+          g_ptr_array_set_size (snapshot->captured, k);
+          return FALSE;
+        }
+    }
+  return TRUE;
+}
+
+gboolean
+mm_snapshot_restore (MMSnapshot *snapshot, GError **error)
+{
+  gint64 start;
+  g_return_val_if_fail (snapshot, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  start = g_get_monotonic_time ();
+  if (snapshot->captured->len != snapshot->value_array->len)
+    {
+      g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_MISMATCH,
+                   "Snapshot has %u values, but %u values are added.",
+                   snapshot->captured->len, snapshot->value_array->len);
+      return FALSE;
+    }
+
+  /* Every value is checked first, so a mismatch changes no value */
+  for (guint k = 0; k < snapshot->value_array->len; k++)
+    {
+      MMValue *v = snapshot->value_array->pdata[k];
+      MMValue *c = snapshot->captured->pdata[k];
+      ONNXTensorElementDataType dtype;
+
+      mm_value_get_quantize_info (v, &dtype, NULL, NULL);
+      if ((c->info->dtype != dtype) || (c->info->ndim != v->info->ndim))
+        {
+          g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_MISMATCH,
+                       "Data type or rank of %s does not match.",
+                       v->info->name);
+          return FALSE;
+        }
+    }
+
+  for (guint k = 0; k < snapshot->value_array->len; k++)
+    {
+      if (!mm_value_assign (snapshot->value_array->pdata[k],
+                            snapshot->captured->pdata[k], error))
+        return FALSE;
+    }
+
+  snapshot->restore_time = g_get_monotonic_time () - start;
+  return TRUE;
+}
+
+void
+mm_snapshot_clear (MMSnapshot *snapshot)
+{
+  g_return_if_fail (snapshot);
+
+  g_ptr_array_set_size (snapshot->captured, 0);
+}
+
+/* Returns value holding tokens, which is named MM_SNAPSHOT_TOKENS_NAME */
+static MMValue *
+mm_snapshot_new_tokens_value (MMContext *context, const int64_t *tokens,
+                              size_t ntokens, GError **error)
+{
+  MMValueInfo *info;
+  MMValue *value;
+  const int64_t dim = ntokens;
+
+  info = mm_value_info_new_from_shape (ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64,
+                                       &dim, 1, MM_SNAPSHOT_TOKENS_NAME);
+  value = mm_value_new (context, info, NULL, MM_SNAPSHOT_TOKENS_NAME, NULL,
+                        NULL, error);
+  mm_value_info_unref (info);
+  if (value == NULL)
+    return NULL;
+  if (tokens == NULL)
+    return value;
+
+  if (!mm_value_update (value, error))
+    goto on_error;
+  if (ntokens && !mm_value_set_data (value, (gpointer)tokens, error))
+    goto on_error;
+  return value;
+on_error:
+  mm_value_unref (value);
+  return NULL;
+}
+
+gboolean
+mm_snapshot_save (MMSnapshot *snapshot, const gchar *path, GError **error)
+{
+  MMFile *file;
+  MMValue *tokens;
+  gboolean ret;
+  g_return_val_if_fail (snapshot, FALSE);
+  g_return_val_if_fail (path, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (snapshot->captured->len == 0)
+    {
+      g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_EMPTY,
+                   "Nothing is captured.");
+      return FALSE;
+    }
+  /* Values are matched by names when loaded, like other MMFile data */
+  for (guint k = 0; k < snapshot->captured->len; k++)
+    {
+      MMValue *c = snapshot->captured->pdata[k];
+
+      if ((c->input_name == NULL) && (c->output_name == NULL))
+        {
+          g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_MISMATCH,
+                       "Value %s has no input or output name.",
+                       c->info->name);
+          return FALSE;
+        }
+    }
+
+  tokens = mm_snapshot_new_tokens_value (
+      mm_value_get_context (snapshot->captured->pdata[0]),
+      (const int64_t *)snapshot->tokens->data, snapshot->tokens->len, error);
+  if (tokens == NULL)
+    return FALSE;
+
+  file = mm_file_new (path);
+  for (guint k = 0; k < snapshot->captured->len; k++)
+    mm_file_add_value (file, snapshot->captured->pdata[k]);
+  mm_file_add_value (file, tokens);
+  ret = mm_file_write (file, error);
+  mm_file_unref (file);
+  mm_value_unref (tokens);
+  return ret;
+}
+
+gboolean
+mm_snapshot_load (MMSnapshot *snapshot, const gchar *path, GError **error)
+{
+  MMFile *file = NULL;
+  GPtrArray *captured;
+  MMValue *tokens = NULL;
+  const int64_t *data;
+  size_t ntokens;
+  g_return_val_if_fail (snapshot, FALSE);
+  g_return_val_if_fail (path, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (snapshot->value_array->len == 0)
+    {
+      g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_EMPTY,
+                   "No value is added.");
+      return FALSE;
+    }
+
+  captured = g_ptr_array_new_full (snapshot->value_array->len,
+                                   (GDestroyNotify)mm_value_unref);
+  file = mm_file_new (path);
+  for (guint k = 0; k < snapshot->value_array->len; k++)
+    {
+      MMValue *v = snapshot->value_array->pdata[k];
+      MMValue *c;
+
+      /* Data is read into tensors allocated like those of the values */
+      c = mm_value_new (mm_value_get_context (v), v->info, NULL,
+                        v->input_name, v->output_name, NULL, error);
+      if (c == NULL)
+        goto on_error;
+      mm_value_get_quantize_info (v, &c->info->dtype, NULL, NULL);
+      c->allocator = v->allocator;
+      g_ptr_array_add (captured, c);
+      mm_file_add_value (file, c);
+    }
+  tokens = mm_snapshot_new_tokens_value (
+      mm_value_get_context (snapshot->value_array->pdata[0]), NULL, 0, error);
+  if (tokens == NULL)
+    goto on_error;
+  mm_file_add_value (file, tokens);
+
+  if (!mm_file_read (file, error))
+    goto on_error;
+  for (guint k = 0; k < captured->len; k++)
+    {
+      MMValue *c = captured->pdata[k];
+
+      if (c->value == NULL)
+        {
+          g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_MISMATCH,
+                       "Snapshot has no data for %s.", c->info->name);
+          goto on_error;
+        }
+    }
+  if (tokens->value == NULL)
+    {
+      g_set_error (error, MM_SNAPSHOT_ERROR, MM_SNAPSHOT_ERROR_INVALID,
+                   "Snapshot has no token history.");
+      goto on_error;
+    }
+  ntokens = tokens->info->dim[0];
+  data = ntokens ? mm_value_peek_data (tokens, error) : NULL;
+  if (ntokens && (data == NULL))
+    goto on_error;
+
+  g_array_set_size (snapshot->tokens, 0);
+  g_array_append_vals (snapshot->tokens, data, ntokens);
+  g_ptr_array_unref (snapshot->captured);
+  snapshot->captured = captured;
+  mm_value_unref (tokens);
+  mm_file_unref (file);
+  return TRUE;
+on_error:
+  g_clear_pointer (&tokens, mm_value_unref);
+  mm_file_unref (file);
+  g_ptr_array_unref (captured);
+  return FALSE;
+}
+
+gint64
+mm_snapshot_get_restore_time (MMSnapshot *snapshot)
+{
+  g_return_val_if_fail (snapshot, 0);
+  return snapshot->restore_time;
+}
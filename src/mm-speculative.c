@@ -0,0 +1,326 @@
+#include "mm-speculative.h"
+
+G_DEFINE_QUARK (mm-speculative-error, mm_speculative_error);
+
+#define MM_SPECULATIVE_DEFAULT_MAX_TOKENS 256
+#define MM_SPECULATIVE_DEFAULT_K 4
+#define MM_SPECULATIVE_DEFAULT_MAX_K 8
+
+typedef struct _MMSpeculativeState
+{
+  MMSpeculativeModel model;
+  MMValue *value;
+  size_t axis;
+} MMSpeculativeState;
+
+struct _MMSpeculative
+{
+  MMSpeculativeRunFunc draft_func;
+  gpointer draft_data;
+  MMSpeculativeRunFunc target_func;
+  gpointer target_data;
+  /* MMSpeculativeState */
+  GArray *states;
+  guint max_tokens;
+  int64_t eos_token_id;
+  guint k;
+  guint max_k;
+  /* Draft tokens proposed and accepted */
+  guint64 proposed;
+  guint64 accepted;
+  gatomicrefcount ref_count;
+};
+
+MMSpeculative *
+mm_speculative_new (MMSpeculativeRunFunc draft_func, gpointer draft_data,
+                    MMSpeculativeRunFunc target_func, gpointer target_data)
+{
+  MMSpeculative *spec;
+  g_return_val_if_fail (draft_func, NULL);
+  g_return_val_if_fail (target_func, NULL);
+
+  spec = g_new0 (MMSpeculative, 1);
+  spec->draft_func = draft_func;
+  spec->draft_data = draft_data;
+  spec->target_func = target_func;
+  spec->target_data = target_data;
+  spec->states = g_array_new (FALSE, FALSE, sizeof (MMSpeculativeState));
+  spec->max_tokens = MM_SPECULATIVE_DEFAULT_MAX_TOKENS;
+  spec->eos_token_id = -1;
+  spec->k = MM_SPECULATIVE_DEFAULT_K;
+  spec->max_k = MM_SPECULATIVE_DEFAULT_MAX_K;
+  g_atomic_ref_count_init (&spec->ref_count);
+  return spec;
+}
+
+void
+mm_speculative_ref (MMSpeculative *spec)
+{
+  g_return_if_fail (spec);
+  g_atomic_ref_count_inc (&spec->ref_count);
+}
+
+void
+mm_speculative_unref (MMSpeculative *spec)
+{
+  g_return_if_fail (spec);
+  if (!g_atomic_ref_count_dec (&spec->ref_count))
+    return;
+
+  for (guint k = 0; k < spec->states->len; k++)
+    mm_value_unref (g_array_index (spec->states, MMSpeculativeState, k).value);
+  g_array_unref (spec->states);
+  g_free (spec);
+}
+
+void
+mm_speculative_set_max_tokens (MMSpeculative *spec, guint max_tokens)
+{
+  g_return_if_fail (spec);
+  spec->max_tokens = max_tokens;
+}
+
+void
+mm_speculative_set_eos_token (MMSpeculative *spec, int64_t eos_token_id)
+{
+  g_return_if_fail (spec);
+  spec->eos_token_id = eos_token_id;
+}
+
+void
+mm_speculative_set_draft_length (MMSpeculative *spec, guint k, guint max_k)
+{
+  g_return_if_fail (spec);
+  g_return_if_fail ((k > 0) && (k <= max_k));
+  spec->k = k;
+  spec->max_k = max_k;
+}
+
+void
+mm_speculative_add_state (MMSpeculative *spec, MMSpeculativeModel model,
+                          MMValue *value, size_t axis)
+{
+  MMSpeculativeState state;
+
+  g_return_if_fail (spec);
+  g_return_if_fail (value);
+
+  mm_value_ref (value);
+  state.model = model;
+  state.value = value;
+  state.axis = axis;
+  g_array_append_val (spec->states, state);
+}
+
+void
+mm_speculative_remove_state (MMSpeculative *spec, MMValue *value)
+{
+  g_return_if_fail (spec);
+
+  for (guint k = 0; k < spec->states->len; k++)
+    if (g_array_index (spec->states, MMSpeculativeState, k).value == value)
+      {
+        g_array_remove_index (spec->states, k);
+        mm_value_unref (value);
+        return;
+      }
+}
+
+static int64_t
+mm_speculative_argmax (const float *logits, size_t vocab_size)
+{
+  int64_t best = 0;
+
+  for (size_t i = 1; i < vocab_size; i++)
+    if (logits[i] > logits[best])
+      best = i;
+  return best;
+}
+
+/* Runs model, and returns greedy choices after each token. */
+static gboolean
+mm_speculative_run (MMSpeculative *spec, MMSpeculativeModel model,
+                    const int64_t *tokens, size_t ntokens, int64_t *choices,
+                    GError **error)
+{
+  const float *logits;
+  size_t vocab_size = 0;
+
+  if (model == MM_SPECULATIVE_DRAFT)
+    logits = spec->draft_func (tokens, ntokens, &vocab_size, spec->draft_data,
+                               error);
+  else
+    logits = spec->target_func (tokens, ntokens, &vocab_size,
+                                spec->target_data, error);
+  if (logits == NULL)
+    return FALSE;
+  if (vocab_size == 0)
+    {
+      g_set_error (error, MM_SPECULATIVE_ERROR, MM_SPECULATIVE_ERROR_SHAPE,
+                   "Vocabulary size is 0.");
+      return FALSE;
+    }
+  for (size_t i = 0; choices && (i < ntokens); i++)
+    choices[i] = mm_speculative_argmax (logits + i * vocab_size, vocab_size);
+  return TRUE;
+}
+
+/* Cuts the last ntokens of past states of model. */
+static gboolean
+mm_speculative_rollback (MMSpeculative *spec, MMSpeculativeModel model,
+                         size_t ntokens, GError **error)
+{
+  if (ntokens == 0)
+    return TRUE;
+
+  for (guint k = 0; k < spec->states->len; k++)
+    {
+      MMSpeculativeState *state
+          = &g_array_index (spec->states, MMSpeculativeState, k);
+      MMValueInfo *info = state->value->info;
+
+      if (state->model != model)
+        continue;
+      if ((state->axis >= info->ndim) || (info->dim[state->axis] < ntokens))
+        {
+          g_set_error (error, MM_SPECULATIVE_ERROR,
+                       MM_SPECULATIVE_ERROR_SHAPE,
+                       "Can not cut %zu tokens from axis %zu of %s.",
+                       ntokens, state->axis, info->name);
+          return FALSE;
+        }
+      if (!mm_value_truncate (state->value, state->axis,
+                              info->dim[state->axis] - ntokens, error))
+        return FALSE;
+    }
+  return TRUE;
+}
+
+/* Appends token, and returns FALSE when generation is finished. */
+static gboolean
+mm_speculative_emit (MMSpeculative *spec, GArray *tokens, guint *ntokens,
+                     int64_t token)
+{
+  g_array_append_val (tokens, token);
+  (*ntokens)++;
+  return (token != spec->eos_token_id) && (*ntokens < spec->max_tokens);
+}
+
+gboolean
+mm_speculative_generate (MMSpeculative *spec, const int64_t *prompt,
+                         size_t nprompt, GArray *tokens, GError **error)
+{
+  int64_t *choices;
+  int64_t *window;
+  int64_t draft_pending[2];
+  size_t ndraft_pending = 1;
+  guint ntokens = 0;
+  gboolean ret = FALSE;
+  g_return_val_if_fail (spec, FALSE);
+  g_return_val_if_fail (prompt, FALSE);
+  g_return_val_if_fail (nprompt > 0, FALSE);
+  g_return_val_if_fail (tokens, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (spec->max_tokens == 0)
+    return TRUE;
+
+  choices = g_new (int64_t, MAX (nprompt, spec->max_k + 1));
+  window = g_new (int64_t, spec->max_k + 1);
+  if (!mm_speculative_run (spec, MM_SPECULATIVE_TARGET, prompt, nprompt,
+                           choices, error)
+      || !mm_speculative_run (spec, MM_SPECULATIVE_DRAFT, prompt, nprompt,
+                              NULL, error))
+    goto out;
+
+  /* window[0] is the last token, which is not in past states yet. */
+  window[0] = choices[nprompt - 1];
+  draft_pending[0] = window[0];
+  if (!mm_speculative_emit (spec, tokens, &ntokens, window[0]))
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  for (;;)
+    {
+      guint k = MIN (spec->k, spec->max_tokens - ntokens);
+      guint accepted = 0;
+
+      /* Draft proposes window[1..k]. */
+      if (!mm_speculative_run (spec, MM_SPECULATIVE_DRAFT, draft_pending,
+                               ndraft_pending, choices, error))
+        goto out;
+      window[1] = choices[ndraft_pending - 1];
+      for (guint i = 2; i <= k; i++)
+        {
+          if (!mm_speculative_run (spec, MM_SPECULATIVE_DRAFT, &window[i - 1],
+                                   1, choices, error))
+            goto out;
+          window[i] = choices[0];
+        }
+
+      /* choices[i] is the target's token after window[i]. */
+      if (!mm_speculative_run (spec, MM_SPECULATIVE_TARGET, window, k + 1,
+                               choices, error))
+        goto out;
+      while ((accepted < k) && (choices[accepted] == window[accepted + 1]))
+        accepted++;
+
+      /*
+       * Target states hold the whole window, and draft states hold it but
+       * the last proposal, which was never run.
+       */
+      if (!mm_speculative_rollback (spec, MM_SPECULATIVE_TARGET,
+                                    k - accepted, error)
+          || !mm_speculative_rollback (spec, MM_SPECULATIVE_DRAFT,
+                                       accepted == k ? 0 : k - 1 - accepted,
+                                       error))
+        goto out;
+
+      spec->proposed += k;
+      spec->accepted += accepted;
+      if (accepted == k)
+        spec->k = MIN (spec->k + 1, spec->max_k);
+      else if ((accepted * 2 < k) && (spec->k > 1))
+        spec->k--;
+
+      for (guint i = 1; i <= accepted; i++)
+        if (!mm_speculative_emit (spec, tokens, &ntokens, window[i]))
+          {
+            ret = TRUE;
+            goto out;
+          }
+      if (!mm_speculative_emit (spec, tokens, &ntokens, choices[accepted]))
+        {
+          ret = TRUE;
+          goto out;
+        }
+
+      ndraft_pending = 0;
+      if (accepted == k)
+        draft_pending[ndraft_pending++] = window[k];
+      draft_pending[ndraft_pending++] = choices[accepted];
+      window[0] = choices[accepted];
+    }
+out:
+  g_free (window);
+  g_free (choices);
+  return ret;
+}
+
+double
+mm_speculative_get_acceptance_rate (MMSpeculative *spec)
+{
+  g_return_val_if_fail (spec, 0);
+  if (spec->proposed == 0)
+    return 0;
+  return (double)spec->accepted / spec->proposed;
+}
+
+guint
+mm_speculative_get_draft_length (MMSpeculative *spec)
+{
+  g_return_val_if_fail (spec, 0);
+  return spec->k;
+}
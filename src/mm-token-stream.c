@@ -0,0 +1,594 @@
+#include <math.h>
+
+#include "mm-token-stream.h"
+
+G_DEFINE_QUARK (mm-token-stream-error, mm_token_stream_error);
+
+#define MM_TOKEN_STREAM_DEFAULT_MAX_TOKENS 256
+#define MM_TOKEN_STREAM_DEFAULT_QUEUE_SIZE 16
+
+typedef struct _MMTokenCandidate MMTokenCandidate;
+
+struct _MMTokenStream
+{
+  MMTokenStreamStepFunc step_func;
+  gpointer step_data;
+  guint max_tokens;
+  int64_t eos_token_id;
+  float temperature;
+  guint top_k;
+  float top_p;
+  GRand *rand;
+  /* Candidates of sampling, reused between steps */
+  MMTokenCandidate *candidates;
+  size_t ncandidates;
+
+  /* State of a run, protected by mutex */
+  GMutex mutex;
+  GCond cond;
+  /* Ring buffer of tokens from generation to the callback */
+  int64_t *queue;
+  guint queue_size;
+  guint queue_head;
+  guint queue_length;
+  gboolean running;
+  gboolean generating;
+  gboolean stopped;
+  MMTokenStreamTokenFunc token_func;
+  gpointer token_data;
+  /* Main context of mm_token_stream_run_async(), or NULL */
+  GMainContext *main_context;
+  /* Source delivering tokens, while it is attached to main_context */
+  GSource *dispatch_source;
+  gatomicrefcount ref_count;
+};
+
+struct _MMTokenCandidate
+{
+  float logit;
+  int64_t token;
+};
+
+MMTokenStream *
+mm_token_stream_new (MMTokenStreamStepFunc step_func, gpointer step_data)
+{
+  MMTokenStream *stream;
+  g_return_val_if_fail (step_func, NULL);
+
+  stream = g_new0 (MMTokenStream, 1);
+  stream->step_func = step_func;
+  stream->step_data = step_data;
+  stream->max_tokens = MM_TOKEN_STREAM_DEFAULT_MAX_TOKENS;
+  stream->eos_token_id = -1;
+  stream->top_p = 1;
+  stream->rand = g_rand_new ();
+  stream->queue_size = MM_TOKEN_STREAM_DEFAULT_QUEUE_SIZE;
+  g_mutex_init (&stream->mutex);
+  g_cond_init (&stream->cond);
+  g_atomic_ref_count_init (&stream->ref_count);
+  return stream;
+}
+
+void
+mm_token_stream_ref (MMTokenStream *stream)
+{
+  g_return_if_fail (stream);
+  g_atomic_ref_count_inc (&stream->ref_count);
+}
+
+void
+mm_token_stream_unref (MMTokenStream *stream)
+{
+  g_return_if_fail (stream);
+  if (!g_atomic_ref_count_dec (&stream->ref_count))
+    return;
+
+  g_free (stream->candidates);
+  g_free (stream->queue);
+  g_rand_free (stream->rand);
+  g_cond_clear (&stream->cond);
+  g_mutex_clear (&stream->mutex);
+  g_free (stream);
+}
+
+void
+mm_token_stream_set_max_tokens (MMTokenStream *stream, guint max_tokens)
+{
+  g_return_if_fail (stream);
+  stream->max_tokens = max_tokens;
+}
+
+void
+mm_token_stream_set_eos_token (MMTokenStream *stream, int64_t eos_token_id)
+{
+  g_return_if_fail (stream);
+  stream->eos_token_id = eos_token_id;
+}
+
+void
+mm_token_stream_set_sampling (MMTokenStream *stream, float temperature,
+                              guint top_k, float top_p)
+{
+  g_return_if_fail (stream);
+  g_return_if_fail (temperature >= 0);
+  g_return_if_fail ((top_p > 0) && (top_p <= 1));
+  stream->temperature = temperature;
+  stream->top_k = top_k;
+  stream->top_p = top_p;
+}
+
+void
+mm_token_stream_set_seed (MMTokenStream *stream, guint32 seed)
+{
+  g_return_if_fail (stream);
+  g_rand_set_seed (stream->rand, seed);
+}
+
+void
+mm_token_stream_set_queue_size (MMTokenStream *stream, guint size)
+{
+  g_return_if_fail (stream);
+  g_return_if_fail (size > 0);
+  g_return_if_fail (!stream->running);
+  stream->queue_size = size;
+}
+
+void
+mm_token_stream_stop (MMTokenStream *stream)
+{
+  g_return_if_fail (stream);
+  g_mutex_lock (&stream->mutex);
+  stream->stopped = TRUE;
+  /* Tokens not delivered yet are dropped. */
+  stream->queue_length = 0;
+  if (stream->dispatch_source)
+    {
+      g_source_destroy (stream->dispatch_source);
+      g_clear_pointer (&stream->dispatch_source, g_source_unref);
+    }
+  g_cond_broadcast (&stream->cond);
+  g_mutex_unlock (&stream->mutex);
+}
+
+static int64_t
+mm_token_stream_argmax (const float *logits, size_t vocab_size)
+{
+  int64_t best = 0;
+
+  for (size_t i = 1; i < vocab_size; i++)
+    if (logits[i] > logits[best])
+      best = i;
+  return best;
+}
+
+static gint
+mm_token_candidate_compare (gconstpointer a, gconstpointer b)
+{
+  const MMTokenCandidate *ca = a;
+  const MMTokenCandidate *cb = b;
+  return (ca->logit < cb->logit) - (ca->logit > cb->logit);
+}
+
+/* Restores min-heap of k candidates from i. */
+static void
+mm_token_candidate_sift (MMTokenCandidate *heap, size_t k, size_t i)
+{
+  for (;;)
+    {
+      size_t min = i;
+      size_t l = 2 * i + 1;
+      size_t r = l + 1;
+      MMTokenCandidate tmp;
+
+      if ((l < k) && (heap[l].logit < heap[min].logit))
+        min = l;
+      if ((r < k) && (heap[r].logit < heap[min].logit))
+        min = r;
+      if (min == i)
+        return;
+      tmp = heap[i];
+      heap[i] = heap[min];
+      heap[min] = tmp;
+      i = min;
+    }
+}
+
+/* Moves k largest candidates to the front, in no particular order. */
+static void
+mm_token_candidate_select (MMTokenCandidate *candidates, size_t n, size_t k)
+{
+  for (size_t i = k / 2; i-- > 0;)
+    mm_token_candidate_sift (candidates, k, i);
+  for (size_t i = k; i < n; i++)
+    {
+      if (candidates[i].logit <= candidates[0].logit)
+        continue;
+      candidates[0] = candidates[i];
+      mm_token_candidate_sift (candidates, k, 0);
+    }
+}
+
+/* Samples from candidates filtered by top-k and top-p. */
+static int64_t
+mm_token_stream_sample (MMTokenStream *stream, const float *logits,
+                        size_t vocab_size)
+{
+  MMTokenCandidate *candidates;
+  size_t n = vocab_size;
+  float max;
+  double sum = 0;
+  double cumulative = 0;
+  double r;
+
+  if ((stream->temperature == 0) || (stream->top_k == 1))
+    return mm_token_stream_argmax (logits, vocab_size);
+
+  if (stream->ncandidates < vocab_size)
+    {
+      stream->candidates
+          = g_renew (MMTokenCandidate, stream->candidates, vocab_size);
+      stream->ncandidates = vocab_size;
+    }
+  candidates = stream->candidates;
+  for (size_t i = 0; i < vocab_size; i++)
+    {
+      candidates[i].logit = logits[i] / stream->temperature;
+      candidates[i].token = i;
+    }
+
+  /* Only the kept candidates are sorted. */
+  if ((stream->top_k > 0) && (stream->top_k < n))
+    {
+      mm_token_candidate_select (candidates, n, stream->top_k);
+      n = stream->top_k;
+    }
+  qsort (candidates, n, sizeof (MMTokenCandidate),
+         mm_token_candidate_compare);
+
+  max = candidates[0].logit;
+  for (size_t i = 0; i < n; i++)
+    {
+      candidates[i].logit = exp (candidates[i].logit - max);
+      sum += candidates[i].logit;
+    }
+  if (stream->top_p < 1)
+    {
+      double kept = 0;
+      size_t i;
+
+      for (i = 0; (i < n) && (kept < stream->top_p * sum); i++)
+        kept += candidates[i].logit;
+      n = MAX (i, 1);
+      sum = kept > 0 ? kept : candidates[0].logit;
+    }
+
+  r = g_rand_double (stream->rand) * sum;
+  for (size_t i = 0; i < n; i++)
+    {
+      cumulative += candidates[i].logit;
+      if (r < cumulative)
+        return candidates[i].token;
+    }
+  return candidates[n - 1].token;
+}
+
+static gboolean mm_token_stream_dispatch (gpointer user_data);
+
+/*
+ * Queues token, waiting while the queue is full. Returns FALSE if token is
+ * dropped by stop or cancellation.
+ */
+static gboolean
+mm_token_stream_push (MMTokenStream *stream, int64_t token,
+                      GCancellable *cancellable)
+{
+  g_mutex_lock (&stream->mutex);
+  while ((stream->queue_length == stream->queue_size) && !stream->stopped
+         && !g_cancellable_is_cancelled (cancellable))
+    g_cond_wait (&stream->cond, &stream->mutex);
+  if (stream->stopped || (stream->queue_length == stream->queue_size))
+    {
+      g_mutex_unlock (&stream->mutex);
+      return FALSE;
+    }
+
+  stream->queue[(stream->queue_head + stream->queue_length)
+                % stream->queue_size]
+      = token;
+  stream->queue_length++;
+  if (stream->main_context && (stream->dispatch_source == NULL))
+    {
+      stream->dispatch_source = g_idle_source_new ();
+      mm_token_stream_ref (stream);
+      g_source_set_callback (stream->dispatch_source,
+                             mm_token_stream_dispatch, stream,
+                             (GDestroyNotify)mm_token_stream_unref);
+      g_source_attach (stream->dispatch_source, stream->main_context);
+    }
+  g_cond_broadcast (&stream->cond);
+  g_mutex_unlock (&stream->mutex);
+  return TRUE;
+}
+
+/* Delivers token, and stops generation if token_func returns FALSE. */
+static void
+mm_token_stream_deliver (MMTokenStream *stream, int64_t token)
+{
+  if (!stream->token_func (token, stream->token_data))
+    mm_token_stream_stop (stream);
+}
+
+/* Pops a token. Called with mutex locked. */
+static int64_t
+mm_token_stream_pop (MMTokenStream *stream)
+{
+  int64_t token = stream->queue[stream->queue_head];
+
+  stream->queue_head = (stream->queue_head + 1) % stream->queue_size;
+  stream->queue_length--;
+  g_cond_broadcast (&stream->cond);
+  return token;
+}
+
+/*
+ * Delivers queued tokens in main context. A source cleared by
+ * mm_token_stream_stop() delivers nothing, even if another run began.
+ */
+static gboolean
+mm_token_stream_dispatch (gpointer user_data)
+{
+  MMTokenStream *stream = user_data;
+  GSource *source = g_main_current_source ();
+
+  g_mutex_lock (&stream->mutex);
+  while (stream->queue_length && (stream->dispatch_source == source))
+    {
+      int64_t token = mm_token_stream_pop (stream);
+
+      g_mutex_unlock (&stream->mutex);
+      mm_token_stream_deliver (stream, token);
+      g_mutex_lock (&stream->mutex);
+    }
+  if (stream->dispatch_source == source)
+    g_clear_pointer (&stream->dispatch_source, g_source_unref);
+  g_cond_broadcast (&stream->cond);
+  g_mutex_unlock (&stream->mutex);
+  return G_SOURCE_REMOVE;
+}
+
+/* Wakes generation waiting for the queue to cancel it. */
+static void
+mm_token_stream_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+  MMTokenStream *stream = user_data;
+
+  g_mutex_lock (&stream->mutex);
+  g_cond_broadcast (&stream->cond);
+  g_mutex_unlock (&stream->mutex);
+}
+
+static gboolean
+mm_token_stream_is_stopped (MMTokenStream *stream)
+{
+  gboolean stopped;
+
+  g_mutex_lock (&stream->mutex);
+  stopped = stream->stopped;
+  g_mutex_unlock (&stream->mutex);
+  return stopped;
+}
+
+/*
+ * Generates tokens until max_tokens, eos_token_id or stop, and waits until
+ * they are delivered.
+ */
+static gboolean
+mm_token_stream_generate (MMTokenStream *stream, GCancellable *cancellable,
+                          GError **error)
+{
+  gboolean ret = TRUE;
+  int64_t token = -1;
+  gulong handler = 0;
+
+  if (cancellable)
+    handler = g_cancellable_connect (cancellable,
+                                     G_CALLBACK (mm_token_stream_cancelled),
+                                     stream, NULL);
+  for (guint n = 0; n < stream->max_tokens; n++)
+    {
+      const float *logits;
+      size_t vocab_size = 0;
+
+      if (mm_token_stream_is_stopped (stream))
+        break;
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        {
+          ret = FALSE;
+          break;
+        }
+      logits = stream->step_func (token, &vocab_size, stream->step_data,
+                                  error);
+      if (logits == NULL)
+        {
+          ret = FALSE;
+          break;
+        }
+      token = mm_token_stream_sample (stream, logits, vocab_size);
+      if (!mm_token_stream_push (stream, token, cancellable))
+        {
+          ret = !g_cancellable_set_error_if_cancelled (cancellable, error);
+          break;
+        }
+      if (token == stream->eos_token_id)
+        break;
+    }
+  if (handler)
+    g_cancellable_disconnect (cancellable, handler);
+
+  g_mutex_lock (&stream->mutex);
+  stream->generating = FALSE;
+  g_cond_broadcast (&stream->cond);
+  while ((stream->queue_length || stream->dispatch_source)
+         && !stream->stopped)
+    g_cond_wait (&stream->cond, &stream->mutex);
+  g_mutex_unlock (&stream->mutex);
+  return ret;
+}
+
+static gboolean
+mm_token_stream_begin (MMTokenStream *stream,
+                       MMTokenStreamTokenFunc token_func, gpointer user_data,
+                       GMainContext *main_context, GError **error)
+{
+  g_mutex_lock (&stream->mutex);
+  if (stream->running)
+    {
+      g_mutex_unlock (&stream->mutex);
+      g_set_error (error, MM_TOKEN_STREAM_ERROR, MM_TOKEN_STREAM_ERROR_BUSY,
+                   "Stream is already running.");
+      return FALSE;
+    }
+  stream->running = TRUE;
+  stream->generating = TRUE;
+  stream->stopped = FALSE;
+  stream->queue = g_renew (int64_t, stream->queue, stream->queue_size);
+  stream->queue_head = 0;
+  stream->queue_length = 0;
+  stream->token_func = token_func;
+  stream->token_data = user_data;
+  stream->main_context = main_context;
+  g_mutex_unlock (&stream->mutex);
+  return TRUE;
+}
+
+static void
+mm_token_stream_end (MMTokenStream *stream)
+{
+  g_mutex_lock (&stream->mutex);
+  stream->running = FALSE;
+  g_clear_pointer (&stream->main_context, g_main_context_unref);
+  g_mutex_unlock (&stream->mutex);
+}
+
+typedef struct _MMTokenStreamRunData
+{
+  MMTokenStream *stream;
+  GCancellable *cancellable;
+  GError *error;
+  gboolean ret;
+} MMTokenStreamRunData;
+
+static gpointer
+mm_token_stream_run_thread (gpointer user_data)
+{
+  MMTokenStreamRunData *data = user_data;
+
+  data->ret = mm_token_stream_generate (data->stream, data->cancellable,
+                                        &data->error);
+  return NULL;
+}
+
+gboolean
+mm_token_stream_run (MMTokenStream *stream, MMTokenStreamTokenFunc token_func,
+                     gpointer user_data, GCancellable *cancellable,
+                     GError **error)
+{
+  MMTokenStreamRunData data = { stream, cancellable, NULL, FALSE };
+  GThread *thread;
+  g_return_val_if_fail (stream, FALSE);
+  g_return_val_if_fail (token_func, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (!mm_token_stream_begin (stream, token_func, user_data, NULL, error))
+    return FALSE;
+  thread = g_thread_try_new ("mm-token-stream", mm_token_stream_run_thread,
+                             &data, error);
+  if (thread == NULL)
+    {
+      mm_token_stream_end (stream);
+      return FALSE;
+    }
+
+  /* The calling thread delivers tokens. */
+  g_mutex_lock (&stream->mutex);
+  for (;;)
+    {
+      int64_t token;
+
+      while (!stream->queue_length && stream->generating && !stream->stopped)
+        g_cond_wait (&stream->cond, &stream->mutex);
+      if (!stream->queue_length || stream->stopped)
+        break;
+      token = mm_token_stream_pop (stream);
+      g_mutex_unlock (&stream->mutex);
+      mm_token_stream_deliver (stream, token);
+      g_mutex_lock (&stream->mutex);
+    }
+  g_mutex_unlock (&stream->mutex);
+
+  g_thread_join (thread);
+  mm_token_stream_end (stream);
+  if (data.ret)
+    return TRUE;
+  g_propagate_error (error, data.error);
+  return FALSE;
+}
+
+static void
+mm_token_stream_task (GTask *task, gpointer source_object, gpointer task_data,
+                      GCancellable *cancellable)
+{
+  MMTokenStream *stream = task_data;
+  GError *error = NULL;
+  gboolean ret;
+
+  ret = mm_token_stream_generate (stream, cancellable, &error);
+  mm_token_stream_end (stream);
+  if (ret)
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+void
+mm_token_stream_run_async (MMTokenStream *stream,
+                           MMTokenStreamTokenFunc token_func,
+                           gpointer user_data, GCancellable *cancellable,
+                           GAsyncReadyCallback callback,
+                           gpointer callback_data)
+{
+  GMainContext *main_context;
+  GError *error = NULL;
+  GTask *task;
+  g_return_if_fail (stream);
+  g_return_if_fail (token_func);
+
+  task = g_task_new (NULL, cancellable, callback, callback_data);
+  g_task_set_source_tag (task, mm_token_stream_run_async);
+  main_context = g_main_context_ref_thread_default ();
+  if (!mm_token_stream_begin (stream, token_func, user_data, main_context,
+                              &error))
+    {
+      g_main_context_unref (main_context);
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  mm_token_stream_ref (stream);
+  g_task_set_task_data (task, stream,
+                        (GDestroyNotify)mm_token_stream_unref);
+  g_task_run_in_thread (task, mm_token_stream_task);
+  g_object_unref (task);
+}
+
+gboolean
+mm_token_stream_run_finish (MMTokenStream *stream, GAsyncResult *result,
+                            GError **error)
+{
+  g_return_val_if_fail (stream, FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
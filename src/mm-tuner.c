@@ -0,0 +1,333 @@
+#include "mm-tuner.h"
+
+#define MM_TUNER_DEFAULT_ITERATIONS 10
+#define MM_TUNER_DEFAULT_CONCURRENCY 2
+
+typedef struct _MMTunerThreadData MMTunerThreadData;
+
+struct _MMTuner
+{
+  MMModelOptions *options;
+  char *file_path;
+  /* GHashTable of shapes */
+  GPtrArray *shapes;
+  /* MMSessionTuning */
+  GArray *candidates;
+  /* MMTunerResult of the last run */
+  GArray *results;
+  guint iterations;
+  guint concurrency;
+  gatomicrefcount ref_count;
+};
+
+/* Data of a concurrent caller */
+struct _MMTunerThreadData
+{
+  MMTuner *tuner;
+  MMModel *model;
+  /* Sum of measured runs in microseconds */
+  gint64 time;
+  GError *error;
+};
+
+MMTuner *
+mm_tuner_new (MMModelOptions *options, const char *file_path)
+{
+  MMTuner *tuner;
+  g_return_val_if_fail (options, NULL);
+  g_return_val_if_fail (file_path, NULL);
+
+  mm_model_options_ref (options);
+  tuner = g_new0 (MMTuner, 1);
+  tuner->options = options;
+  tuner->file_path = g_strdup (file_path);
+  tuner->shapes
+      = g_ptr_array_new_with_free_func ((GDestroyNotify)g_hash_table_unref);
+  tuner->candidates = g_array_new (FALSE, FALSE, sizeof (MMSessionTuning));
+  tuner->results = g_array_new (FALSE, FALSE, sizeof (MMTunerResult));
+  tuner->iterations = MM_TUNER_DEFAULT_ITERATIONS;
+  tuner->concurrency = MM_TUNER_DEFAULT_CONCURRENCY;
+  g_atomic_ref_count_init (&tuner->ref_count);
+  return tuner;
+}
+
+void
+mm_tuner_ref (MMTuner *tuner)
+{
+  g_return_if_fail (tuner);
+  g_atomic_ref_count_inc (&tuner->ref_count);
+}
+
+void
+mm_tuner_unref (MMTuner *tuner)
+{
+  g_return_if_fail (tuner);
+  if (!g_atomic_ref_count_dec (&tuner->ref_count))
+    return;
+
+  g_array_unref (tuner->results);
+  g_array_unref (tuner->candidates);
+  g_ptr_array_unref (tuner->shapes);
+  g_free (tuner->file_path);
+  mm_model_options_unref (tuner->options);
+  g_free (tuner);
+}
+
+void
+mm_tuner_add_shape (MMTuner *tuner, GHashTable *shape)
+{
+  g_return_if_fail (tuner);
+  g_return_if_fail (shape);
+  g_ptr_array_add (tuner->shapes, g_hash_table_ref (shape));
+}
+
+void
+mm_tuner_add_candidate (MMTuner *tuner, const MMSessionTuning *tuning)
+{
+  g_return_if_fail (tuner);
+  g_return_if_fail (tuning);
+  g_array_append_val (tuner->candidates, *tuning);
+}
+
+void
+mm_tuner_add_default_candidates (MMTuner *tuner)
+{
+  MMSessionTuning tuning;
+  int nprocs;
+  int threads[3];
+  g_return_if_fail (tuner);
+
+  nprocs = g_get_num_processors ();
+  threads[0] = nprocs;
+  threads[1] = MAX (nprocs / 2, 1);
+  threads[2] = 1;
+  for (guint i = 0; i < G_N_ELEMENTS (threads); i++)
+    {
+      /* Skip counts which are the same on small hosts. */
+      if ((i > 0) && (threads[i] == threads[i - 1]))
+        continue;
+      for (guint spinning = 0; spinning < 2; spinning++)
+        {
+          mm_session_tuning_init (&tuning);
+          tuning.intra_op_threads = threads[i];
+          tuning.allow_spinning = spinning;
+          mm_tuner_add_candidate (tuner, &tuning);
+        }
+    }
+
+  /* Independent branches of the graph run concurrently. */
+  mm_session_tuning_init (&tuning);
+  tuning.intra_op_threads = threads[1];
+  tuning.inter_op_threads = 2;
+  tuning.execution_mode = ORT_PARALLEL;
+  mm_tuner_add_candidate (tuner, &tuning);
+
+  /* Memory pattern and arena may waste memory and time with many shapes. */
+  mm_session_tuning_init (&tuning);
+  tuning.intra_op_threads = nprocs;
+  tuning.memory_pattern = FALSE;
+  mm_tuner_add_candidate (tuner, &tuning);
+  tuning.cpu_arena = FALSE;
+  mm_tuner_add_candidate (tuner, &tuning);
+}
+
+void
+mm_tuner_set_iterations (MMTuner *tuner, guint iterations)
+{
+  g_return_if_fail (tuner);
+  g_return_if_fail (iterations > 0);
+  tuner->iterations = iterations;
+}
+
+void
+mm_tuner_set_concurrency (MMTuner *tuner, guint concurrency)
+{
+  g_return_if_fail (tuner);
+  g_return_if_fail (concurrency > 0);
+  tuner->concurrency = concurrency;
+}
+
+static gint
+mm_tuner_compare_duration (gconstpointer a, gconstpointer b)
+{
+  gint64 da = *(const gint64 *)a;
+  gint64 db = *(const gint64 *)b;
+  return (da > db) - (da < db);
+}
+
+/* Runs model at every shape, and returns sum of median times. */
+static double
+mm_tuner_measure_latency (MMTuner *tuner, MMModel *model, GError **error)
+{
+  double time = 0;
+
+  for (guint k = 0; k < tuner->shapes->len; k++)
+    {
+      GArray *durations;
+
+      durations = mm_model_benchmark (model, tuner->shapes->pdata[k],
+                                      tuner->iterations, NULL, error);
+      if (durations == NULL)
+        return 0;
+      g_array_sort (durations, mm_tuner_compare_duration);
+      time += g_array_index (durations, gint64, durations->len / 2);
+      g_array_unref (durations);
+    }
+  return time;
+}
+
+static gpointer
+mm_tuner_thread (gpointer user_data)
+{
+  MMTunerThreadData *data = user_data;
+  MMTuner *tuner = data->tuner;
+
+  for (guint k = 0; k < tuner->shapes->len; k++)
+    {
+      GArray *durations;
+
+      durations = mm_model_benchmark (data->model, tuner->shapes->pdata[k],
+                                      tuner->iterations, NULL,
+                                      &data->error);
+      if (durations == NULL)
+        break;
+      for (guint i = 0; i < durations->len; i++)
+        data->time += g_array_index (durations, gint64, i);
+      g_array_unref (durations);
+    }
+  return NULL;
+}
+
+/*
+ * Runs model from concurrent threads after warming it up, and returns time
+ * of measured runs divided by number of runs. Runs of each thread follow
+ * each other, so the longest sum of a thread is the elapsed time, without
+ * unmeasured runs and creation of inputs.
+ */
+static double
+mm_tuner_measure_throughput (MMTuner *tuner, MMModel *model, GError **error)
+{
+  MMTunerThreadData *data;
+  GThread **threads;
+  GError *local_error = NULL;
+  gint64 elapsed = 0;
+  double time;
+
+  /* Allocation planning is not overlapped with measured runs */
+  if (!mm_model_warmup (model, tuner->shapes, FALSE, NULL, error))
+    return 0;
+
+  data = g_new0 (MMTunerThreadData, tuner->concurrency);
+  threads = g_new0 (GThread *, tuner->concurrency);
+  for (guint k = 0; (k < tuner->concurrency) && (local_error == NULL); k++)
+    {
+      data[k].tuner = tuner;
+      data[k].model = model;
+      threads[k] = g_thread_try_new ("mm-tuner", mm_tuner_thread, &data[k],
+                                     &local_error);
+    }
+  for (guint k = 0; k < tuner->concurrency; k++)
+    {
+      if (threads[k])
+        g_thread_join (threads[k]);
+      if (data[k].error && (local_error == NULL))
+        local_error = g_steal_pointer (&data[k].error);
+      g_clear_error (&data[k].error);
+      elapsed = MAX (elapsed, data[k].time);
+    }
+  time = (double)elapsed
+         / ((double)tuner->concurrency * tuner->iterations
+            * tuner->shapes->len);
+  g_free (threads);
+  g_free (data);
+
+  if (local_error == NULL)
+    return time;
+  g_propagate_error (error, local_error);
+  return 0;
+}
+
+static double
+mm_tuner_measure (MMTuner *tuner, const MMSessionTuning *tuning,
+                  MMTunerObjective objective, GError **error)
+{
+  MMModelOptions *options;
+  MMModel *model;
+  double time;
+
+  options = mm_model_options_copy (tuner->options, error);
+  if (options == NULL)
+    return 0;
+  if (!mm_model_options_apply_tuning (options, tuning, error))
+    {
+      mm_model_options_unref (options);
+      return 0;
+    }
+  model = mm_model_new (options, tuner->file_path, error);
+  mm_model_options_unref (options);
+  if (model == NULL)
+    return 0;
+
+  if (objective == MM_TUNER_OBJECTIVE_THROUGHPUT)
+    time = mm_tuner_measure_throughput (tuner, model, error);
+  else
+    time = mm_tuner_measure_latency (tuner, model, error);
+  mm_model_unref (model);
+  return time;
+}
+
+gboolean
+mm_tuner_run (MMTuner *tuner, MMTunerObjective objective,
+              MMSessionTuning *best, GError **error)
+{
+  GError *first_error = NULL;
+  MMTunerResult *best_result = NULL;
+  g_return_val_if_fail (tuner, FALSE);
+  g_return_val_if_fail (best, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (tuner->candidates->len == 0)
+    mm_tuner_add_default_candidates (tuner);
+  /* Models with fixed dimensions are run once for each iteration. */
+  if (tuner->shapes->len == 0)
+    g_ptr_array_add (tuner->shapes,
+                     g_hash_table_new (g_str_hash, g_str_equal));
+
+  g_array_set_size (tuner->results, tuner->candidates->len);
+  for (guint k = 0; k < tuner->candidates->len; k++)
+    {
+      MMTunerResult *result;
+      GError *local_error = NULL;
+
+      result = &g_array_index (tuner->results, MMTunerResult, k);
+      result->tuning = g_array_index (tuner->candidates, MMSessionTuning, k);
+      result->time
+          = mm_tuner_measure (tuner, &result->tuning, objective, &local_error);
+      if (local_error)
+        {
+          result->time = 0;
+          if (first_error == NULL)
+            first_error = g_steal_pointer (&local_error);
+          g_clear_error (&local_error);
+          continue;
+        }
+      if ((best_result == NULL) || (result->time < best_result->time))
+        best_result = result;
+    }
+
+  if (best_result == NULL)
+    {
+      g_propagate_error (error, first_error);
+      return FALSE;
+    }
+  g_clear_error (&first_error);
+  *best = best_result->tuning;
+  return TRUE;
+}
+
+GArray *
+mm_tuner_get_results (MMTuner *tuner)
+{
+  g_return_val_if_fail (tuner, NULL);
+  return tuner->results;
+}
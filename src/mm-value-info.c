@@ -1,23 +1,89 @@
 #include "mm-value-info.h"
 
+/* Ranks up to this keep dim inline, so a copy is a single allocation. */
+#define MM_VALUE_INFO_INLINE_NDIM 8
+
 typedef struct _MMRealValueInfo MMRealValueInfo;
+typedef struct _MMValueInfoShape MMValueInfoShape;
+
+/* Static shape metadata shared by copies, never modified once created */
+struct _MMValueInfoShape
+{
+  gatomicrefcount ref_count;
+  /* Interned, terminated by NULL after ndim elements */
+  const char *dim_name[];
+};
 
 struct _MMRealValueInfo
 {
   ONNXTensorElementDataType dtype;
   size_t ndim;
   int64_t *dim;
-  char **dim_name;
-  char *name;
+  const char *const *dim_name;
+  const char *name;
+  MMValueInfoShape *shape;
+  /* dim points here if ndim <= MM_VALUE_INFO_INLINE_NDIM */
+  int64_t inline_dim[MM_VALUE_INFO_INLINE_NDIM];
   gatomicrefcount ref_count;
 };
 
+static MMValueInfoShape *
+mm_value_info_shape_new (const char **dim_name, size_t ndim)
+{
+  MMValueInfoShape *shape;
+
+  shape = g_malloc (sizeof (MMValueInfoShape)
+                    + sizeof (const char *) * (ndim + 1));
+  g_atomic_ref_count_init (&shape->ref_count);
+  for (size_t k = 0; k < ndim; k++)
+    shape->dim_name[k] = g_intern_string (dim_name[k]);
+  shape->dim_name[ndim] = NULL;
+  return shape;
+}
+
+static void
+mm_value_info_shape_unref (MMValueInfoShape *shape)
+{
+  if (g_atomic_ref_count_dec (&shape->ref_count))
+    g_free (shape);
+}
+
+/* Allocates value info of rank ndim, with dim not initialized. */
+static MMRealValueInfo *
+mm_value_info_alloc (size_t ndim)
+{
+  MMRealValueInfo *value_info;
+
+  value_info = g_new (MMRealValueInfo, 1);
+  value_info->ndim = ndim;
+  if (ndim <= MM_VALUE_INFO_INLINE_NDIM)
+    value_info->dim = value_info->inline_dim;
+  else
+    value_info->dim = g_new (int64_t, ndim);
+  value_info->dim_name = NULL;
+  value_info->name = NULL;
+  value_info->shape = NULL;
+  g_atomic_ref_count_init (&value_info->ref_count);
+  return value_info;
+}
+
+static void
+mm_value_info_free (MMRealValueInfo *value_info)
+{
+  if (value_info->dim != value_info->inline_dim)
+    g_free (value_info->dim);
+  g_clear_pointer (&value_info->shape, mm_value_info_shape_unref);
+  g_free (value_info);
+}
+
 MMValueInfo *
 mm_value_info_new (MMContext *context,
                    const OrtTensorTypeAndShapeInfo *tensor_info,
                    const char *name, GError **error)
 {
-  MMRealValueInfo *value_info;
+  MMRealValueInfo *value_info = NULL;
+  ONNXTensorElementDataType dtype;
+  size_t ndim;
   OrtStatus *status;
   const char **dim_name = NULL;
 
@@ -25,47 +91,62 @@ mm_value_info_new (MMContext *context,
   g_return_val_if_fail (tensor_info, NULL);
   g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
 
-  value_info = g_new0 (MMRealValueInfo, 1);
-
-  status
-      = context->api->GetTensorElementType (tensor_info, &value_info->dtype);
+  status = context->api->GetTensorElementType (tensor_info, &dtype);
   if (status)
     goto on_ort_error;
 
-  status = context->api->GetDimensionsCount (tensor_info, &value_info->ndim);
+  status = context->api->GetDimensionsCount (tensor_info, &ndim);
   if (status)
     goto on_ort_error;
 
-  value_info->dim = g_new (int64_t, value_info->ndim);
+  value_info = mm_value_info_alloc (ndim);
+  value_info->dtype = dtype;
   status = context->api->GetDimensions (tensor_info, value_info->dim,
                                         value_info->ndim);
   if (status)
     goto on_ort_error;
 
-  /* GLib's strv is NULL-terminated, so allocate ndim + 1 */
-  dim_name = g_new0 (const char *, value_info->ndim + 1);
+  dim_name = g_new0 (const char *, value_info->ndim);
   status = context->api->GetSymbolicDimensions (tensor_info, dim_name,
                                                 value_info->ndim);
   if (status)
     goto on_ort_error;
 
-  value_info->dim_name = g_strdupv ((gchar **)dim_name);
-  value_info->name = g_strdup (name);
-  g_atomic_ref_count_init (&value_info->ref_count);
+  value_info->shape = mm_value_info_shape_new (dim_name, value_info->ndim);
+  value_info->dim_name = value_info->shape->dim_name;
+  value_info->name = g_intern_string (name);
 
-  g_free(dim_name);
+  g_free (dim_name);
   return (MMValueInfo *)value_info;
 on_ort_error:
   mm_context_set_error (context, error, status);
   g_free (dim_name);
-
-  g_free (value_info->name);
-  g_strfreev (value_info->dim_name);
-  g_free (value_info->dim);
-  g_free (value_info);
+  if (value_info)
+    mm_value_info_free (value_info);
   return NULL;
 }
 
+MMValueInfo *
+mm_value_info_new_from_shape (ONNXTensorElementDataType dtype,
+                              const int64_t *dim, size_t ndim,
+                              const char *name)
+{
+  MMRealValueInfo *value_info;
+  const char **dim_name;
+  g_return_val_if_fail (dim || (ndim == 0), NULL);
+
+  value_info = mm_value_info_alloc (ndim);
+  value_info->dtype = dtype;
+  if (ndim)
+    memcpy (value_info->dim, dim, sizeof (int64_t) * ndim);
+  dim_name = g_new0 (const char *, ndim);
+  value_info->shape = mm_value_info_shape_new (dim_name, ndim);
+  value_info->dim_name = value_info->shape->dim_name;
+  value_info->name = g_intern_string (name);
+  g_free (dim_name);
+  return (MMValueInfo *)value_info;
+}
+
 MMValueInfo *
 mm_value_info_copy (MMValueInfo *value_info)
 {
@@ -73,14 +154,13 @@ mm_value_info_copy (MMValueInfo *value_info)
   MMRealValueInfo *copy;
   g_return_val_if_fail (value_info, NULL);
 
-  copy = g_new (MMRealValueInfo, 1);
+  copy = mm_value_info_alloc (rvalue_info->ndim);
   copy->dtype = rvalue_info->dtype;
-  copy->ndim = rvalue_info->ndim;
-  copy->dim
-      = g_memdup2 (rvalue_info->dim, sizeof (int64_t) * rvalue_info->ndim);
-  copy->dim_name = g_strdupv (rvalue_info->dim_name);
-  copy->name = g_strdup (rvalue_info->name);
-  g_atomic_ref_count_init (&copy->ref_count);
+  memcpy (copy->dim, rvalue_info->dim, sizeof (int64_t) * rvalue_info->ndim);
+  g_atomic_ref_count_inc (&rvalue_info->shape->ref_count);
+  copy->shape = rvalue_info->shape;
+  copy->dim_name = copy->shape->dim_name;
+  copy->name = rvalue_info->name;
   return (MMValueInfo *)copy;
 }
 
@@ -99,10 +179,7 @@ mm_value_info_unref (MMValueInfo *value_info)
   g_return_if_fail (rvalue_info);
   if (!g_atomic_ref_count_dec (&rvalue_info->ref_count))
     return;
-  g_free (rvalue_info->name);
-  g_strfreev (rvalue_info->dim_name);
-  g_free (rvalue_info->dim);
-  g_free (rvalue_info);
+  mm_value_info_free (rvalue_info);
 }
 
 gboolean
@@ -118,13 +195,17 @@ mm_value_info_match_shape (MMValueInfo *value_info, MMValueInfo *other)
   if (memcmp (rvalue_info->dim, rother->dim,
               rvalue_info->ndim * sizeof (int64_t)))
     return FALSE;
+  /* Copies of the same info share names. */
+  if (rvalue_info->shape == rother->shape)
+    return TRUE;
   for (size_t k = 0; k < rvalue_info->ndim; k++)
     {
       // TODO check dim_name always non-NULL or not.
       // If non-NULL, value_info->dim_name[k] should be
       // (strlen(value_info->dim_name[k]) != 0)
+      /* Names are interned, so they are equal only if pointers are. */
       if (rvalue_info->dim_name[k]
-          && g_strcmp0 (rvalue_info->dim_name[k], rother->dim_name[k]))
+          && (rvalue_info->dim_name[k] != rother->dim_name[k]))
         return FALSE;
       else if (rvalue_info->dim[k] != rother->dim[k])
         return FALSE;
@@ -142,7 +223,7 @@ mm_value_info_set_dimension (MMValueInfo *value_info, GHashTable *hash_table)
 
   for (size_t k = 0; k < rvalue_info->ndim; k++)
     {
-      char *dim_name = rvalue_info->dim_name[k];
+      const char *dim_name = rvalue_info->dim_name[k];
       int64_t *data;
 
       /* TODO check dim_name is always non-NULL or not. */
@@ -178,16 +259,9 @@ mm_value_info_get_element_count (MMValueInfo *value_info)
 }
 
 size_t
-mm_value_info_get_data_size (MMValueInfo *value_info)
+mm_value_info_get_dtype_size (ONNXTensorElementDataType dtype)
 {
-  MMRealValueInfo *rvalue_info = (MMRealValueInfo *)value_info;
-  int64_t element;
-  g_return_val_if_fail (rvalue_info, 0);
-
-  element = mm_value_info_get_element_count (value_info);
-  g_return_val_if_fail (element > 0, 0);
-
-  switch (rvalue_info->dtype)
+  switch (dtype)
     {
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8:
@@ -196,25 +270,53 @@ mm_value_info_get_data_size (MMValueInfo *value_info)
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT8E4M3FNUZ:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT8E5M2:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT8E5M2FNUZ:
-      return element;
+      return 1;
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT16:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT16:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16:
-      return 2 * element;
+      return 2;
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT32:
-      return 4 * element;
+      return 4;
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT64:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_COMPLEX64:
-      return 8 * element;
+      return 8;
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT4:
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT4:
-      return (element + 1) / 2;
+      return 0;
     default:
       g_return_val_if_reached (0);
     }
 }
+
+size_t
+mm_value_info_get_element_size (MMValueInfo *value_info)
+{
+  g_return_val_if_fail (value_info, 0);
+
+  return mm_value_info_get_dtype_size (value_info->dtype);
+}
+
+size_t
+mm_value_info_get_data_size (MMValueInfo *value_info)
+{
+  MMRealValueInfo *rvalue_info = (MMRealValueInfo *)value_info;
+  int64_t element;
+  g_return_val_if_fail (rvalue_info, 0);
+
+  element = mm_value_info_get_element_count (value_info);
+  g_return_val_if_fail (element > 0, 0);
+
+  switch (rvalue_info->dtype)
+    {
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT4:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT4:
+      return (element + 1) / 2;
+    default:
+      return element * mm_value_info_get_element_size (value_info);
+    }
+}
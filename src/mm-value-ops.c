@@ -0,0 +1,876 @@
+#include "mm-value-ops.h"
+
+/* Operations moving more bytes than this are split into threads. */
+#define MM_VALUE_OPS_PARALLEL_THRESHOLD (1 << 20)
+/* Tile size of transpose, in elements */
+#define MM_VALUE_OPS_TILE 32
+
+typedef void (*MMValueOpsFunc) (gpointer data, size_t begin, size_t end);
+
+typedef struct _MMValueOpsLatch MMValueOpsLatch;
+typedef struct _MMValueOpsJob MMValueOpsJob;
+typedef struct _MMValueOpsRows MMValueOpsRows;
+typedef struct _MMValueOpsStrided MMValueOpsStrided;
+typedef struct _MMValueOpsGather MMValueOpsGather;
+typedef struct _MMValueOpsTranspose MMValueOpsTranspose;
+
+struct _MMValueOpsLatch
+{
+  GMutex mutex;
+  GCond cond;
+  guint count;
+};
+
+struct _MMValueOpsJob
+{
+  MMValueOpsFunc func;
+  gpointer data;
+  size_t begin;
+  size_t end;
+  MMValueOpsLatch *latch;
+};
+
+/* Copies size bytes for each row */
+struct _MMValueOpsRows
+{
+  guint8 *dst;
+  const guint8 *src;
+  size_t dst_stride;
+  size_t src_stride;
+  size_t size;
+};
+
+/* Copies size bytes for each index of dim, with strides in bytes */
+struct _MMValueOpsStrided
+{
+  guint8 *dst;
+  const guint8 *src;
+  size_t ndim;
+  const int64_t *dim;
+  const size_t *dst_strides;
+  const size_t *src_strides;
+  size_t size;
+};
+
+struct _MMValueOpsGather
+{
+  guint8 *data;
+  const guint8 *src;
+  const int64_t *indices;
+  size_t nindices;
+  /* Dimension of axis in src */
+  size_t length;
+  /* Bytes of one row along axis */
+  size_t size;
+  /* Scratch slot of each row for in place gather, or -1 */
+  const gint64 *slots;
+  size_t nslots;
+};
+
+struct _MMValueOpsTranspose
+{
+  MMValueOpsStrided outer;
+  /* Output axes of the tile. src of axis b is contiguous. */
+  int64_t dim_a;
+  int64_t dim_b;
+  size_t dst_stride_b;
+  size_t src_stride_a;
+  size_t element_size;
+};
+
+static void
+mm_value_ops_job (gpointer data, gpointer user_data)
+{
+  MMValueOpsJob *job = data;
+
+  job->func (job->data, job->begin, job->end);
+
+  g_mutex_lock (&job->latch->mutex);
+  if (--job->latch->count == 0)
+    g_cond_signal (&job->latch->cond);
+  g_mutex_unlock (&job->latch->mutex);
+}
+
+static GThreadPool *
+mm_value_ops_get_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *p = g_thread_pool_new (
+          mm_value_ops_job, NULL, g_get_num_processors (), FALSE, NULL);
+      g_once_init_leave (&pool, (gsize)p);
+    }
+  return (GThreadPool *)pool;
+}
+
+/* Calls func for [0, n), split into threads if bytes is large enough. */
+static void
+mm_value_ops_run (MMValueOpsFunc func, gpointer data, size_t n, size_t bytes)
+{
+  MMValueOpsLatch latch;
+  MMValueOpsJob *jobs;
+  GThreadPool *pool;
+  guint nthreads;
+
+  nthreads = MIN (g_get_num_processors (), n);
+  nthreads = MIN (nthreads, bytes / (MM_VALUE_OPS_PARALLEL_THRESHOLD / 4));
+  if ((bytes < MM_VALUE_OPS_PARALLEL_THRESHOLD) || (nthreads < 2))
+    {
+      func (data, 0, n);
+      return;
+    }
+
+  pool = mm_value_ops_get_pool ();
+  g_mutex_init (&latch.mutex);
+  g_cond_init (&latch.cond);
+  latch.count = nthreads - 1;
+
+  jobs = g_new (MMValueOpsJob, nthreads);
+  for (guint t = 1; t < nthreads; t++)
+    {
+      MMValueOpsJob *job = jobs + t;
+
+      job->func = func;
+      job->data = data;
+      job->begin = n * t / nthreads;
+      job->end = n * (t + 1) / nthreads;
+      job->latch = &latch;
+      g_thread_pool_push (pool, job, NULL);
+    }
+  func (data, 0, n / nthreads);
+
+  g_mutex_lock (&latch.mutex);
+  while (latch.count)
+    g_cond_wait (&latch.cond, &latch.mutex);
+  g_mutex_unlock (&latch.mutex);
+
+  g_free (jobs);
+  g_cond_clear (&latch.cond);
+  g_mutex_clear (&latch.mutex);
+}
+
+static void
+mm_value_ops_copy_rows (gpointer data, size_t begin, size_t end)
+{
+  MMValueOpsRows *rows = data;
+
+  for (size_t r = begin; r < end; r++)
+    memcpy (rows->dst + r * rows->dst_stride, rows->src + r * rows->src_stride,
+            rows->size);
+}
+
+/* Returns byte offsets of flat index r of strided->dim. */
+static void
+mm_value_ops_get_offsets (const MMValueOpsStrided *strided, size_t r,
+                          size_t *dst_offset, size_t *src_offset)
+{
+  *dst_offset = 0;
+  *src_offset = 0;
+  for (size_t k = strided->ndim; k > 0; k--)
+    {
+      size_t i = r % strided->dim[k - 1];
+
+      r /= strided->dim[k - 1];
+      *dst_offset += i * strided->dst_strides[k - 1];
+      *src_offset += i * strided->src_strides[k - 1];
+    }
+}
+
+static void
+mm_value_ops_copy_strided (gpointer data, size_t begin, size_t end)
+{
+  MMValueOpsStrided *strided = data;
+
+  for (size_t r = begin; r < end; r++)
+    {
+      size_t dst_offset;
+      size_t src_offset;
+
+      mm_value_ops_get_offsets (strided, r, &dst_offset, &src_offset);
+      memcpy (strided->dst + dst_offset, strided->src + src_offset,
+              strided->size);
+    }
+}
+
+static void
+mm_value_ops_gather_rows (gpointer data, size_t begin, size_t end)
+{
+  MMValueOpsGather *gather = data;
+
+  for (size_t r = begin; r < end; r++)
+    {
+      size_t o = r / gather->nindices;
+      size_t i = r % gather->nindices;
+
+      memcpy (gather->data + r * gather->size,
+              gather->src
+                  + (o * gather->length + gather->indices[i]) * gather->size,
+              gather->size);
+    }
+}
+
+/*
+ * Reorders rows of each outer index in place. Rows which are read by other
+ * rows but overwritten are saved to scratch first, and rows which keep their
+ * index are not touched.
+ */
+static void
+mm_value_ops_gather_in_place (gpointer data, size_t begin, size_t end)
+{
+  MMValueOpsGather *gather = data;
+  guint8 *scratch = g_malloc (gather->nslots * gather->size);
+
+  for (size_t o = begin; o < end; o++)
+    {
+      guint8 *base = gather->data + o * gather->length * gather->size;
+
+      for (size_t i = 0; i < gather->length; i++)
+        if (gather->slots[i] >= 0)
+          memcpy (scratch + gather->slots[i] * gather->size,
+                  base + i * gather->size, gather->size);
+
+      for (size_t i = 0; i < gather->length; i++)
+        {
+          int64_t index = gather->indices[i];
+
+          if (index == (int64_t)i)
+            continue;
+          memcpy (base + i * gather->size,
+                  gather->slots[index] >= 0
+                      ? scratch + gather->slots[index] * gather->size
+                      : base + index * gather->size,
+                  gather->size);
+        }
+    }
+
+  g_free (scratch);
+}
+
+static inline void
+mm_value_ops_copy_element (guint8 *dst, const guint8 *src, size_t size)
+{
+  /* Constant sizes let memcpy be a single move. */
+  switch (size)
+    {
+    case 1:
+      *dst = *src;
+      break;
+    case 2:
+      memcpy (dst, src, 2);
+      break;
+    case 4:
+      memcpy (dst, src, 4);
+      break;
+    case 8:
+      memcpy (dst, src, 8);
+      break;
+    default:
+      memcpy (dst, src, size);
+      break;
+    }
+}
+
+static void
+mm_value_ops_transpose_tiles (gpointer data, size_t begin, size_t end)
+{
+  MMValueOpsTranspose *transpose = data;
+  size_t element_size = transpose->element_size;
+
+  for (size_t r = begin; r < end; r++)
+    {
+      size_t dst_offset;
+      size_t src_offset;
+      guint8 *dst;
+      const guint8 *src;
+
+      mm_value_ops_get_offsets (&transpose->outer, r, &dst_offset,
+                                &src_offset);
+      dst = transpose->outer.dst + dst_offset;
+      src = transpose->outer.src + src_offset;
+
+      for (int64_t bb = 0; bb < transpose->dim_b; bb += MM_VALUE_OPS_TILE)
+        for (int64_t aa = 0; aa < transpose->dim_a; aa += MM_VALUE_OPS_TILE)
+          {
+            int64_t b_end = MIN (bb + MM_VALUE_OPS_TILE, transpose->dim_b);
+            int64_t a_end = MIN (aa + MM_VALUE_OPS_TILE, transpose->dim_a);
+
+            for (int64_t b = bb; b < b_end; b++)
+              for (int64_t a = aa; a < a_end; a++)
+                mm_value_ops_copy_element (
+                    dst + b * transpose->dst_stride_b + a * element_size,
+                    src + b * element_size + a * transpose->src_stride_a,
+                    element_size);
+          }
+    }
+}
+
+/* Returns element size, or 0 with error if value can not be handled. */
+static size_t
+mm_value_ops_check (MMValue *dst, MMValue *src, GError **error)
+{
+  size_t element_size = mm_value_info_get_element_size (src->info);
+
+  if (element_size == 0)
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_DTYPE,
+                   "Data type %d of value %s is not supported.",
+                   src->info->dtype, src->info->name);
+      return 0;
+    }
+  if (dst->info->dtype != src->info->dtype)
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_DTYPE,
+                   "Data type of %s and %s differ.", dst->info->name,
+                   src->info->name);
+      return 0;
+    }
+  if (dst->info->ndim != src->info->ndim)
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_SHAPE,
+                   "Rank of %s and %s differ.", dst->info->name,
+                   src->info->name);
+      return 0;
+    }
+  return element_size;
+}
+
+/*
+ * Reallocates dst with shape dim if the shape differs or its data is
+ * shared. If alias is TRUE, dst is one of the sources, and it is always
+ * reallocated. Then the old tensor is returned in old, and should be
+ * released after copying.
+ */
+static gboolean
+mm_value_ops_prepare (MMValue *dst, const int64_t *dim, gboolean alias,
+                      OrtValue **old, GError **error)
+{
+  MMValueInfo *info = dst->info;
+  int64_t *old_dim;
+
+  *old = NULL;
+  if (!alias && dst->value && !mm_value_is_shared (dst)
+      && !memcmp (info->dim, dim, sizeof (int64_t) * info->ndim))
+    return TRUE;
+
+  old_dim = g_memdup2 (info->dim, sizeof (int64_t) * info->ndim);
+  if (alias)
+    {
+      *old = dst->value;
+      dst->value = NULL;
+    }
+
+  memcpy (info->dim, dim, sizeof (int64_t) * info->ndim);
+  if (mm_value_update (dst, error))
+    {
+      g_free (old_dim);
+      return TRUE;
+    }
+
+  memcpy (info->dim, old_dim, sizeof (int64_t) * info->ndim);
+  if (alias)
+    {
+      dst->value = *old;
+      *old = NULL;
+    }
+  g_free (old_dim);
+  return FALSE;
+}
+
+static void
+mm_value_ops_release (MMValue *dst, OrtValue *old)
+{
+  if (old)
+    mm_value_get_context (dst)->api->ReleaseValue (old);
+}
+
+/* Number of elements of dim[begin, end) */
+static size_t
+mm_value_ops_count (const int64_t *dim, size_t begin, size_t end)
+{
+  size_t count = 1;
+
+  for (size_t k = begin; k < end; k++)
+    count *= dim[k];
+  return count;
+}
+
+/* Sets strides in bytes of contiguous tensor of shape dim. */
+static void
+mm_value_ops_get_strides (const int64_t *dim, size_t ndim,
+                          size_t element_size, size_t *strides)
+{
+  size_t stride = element_size;
+
+  for (size_t k = ndim; k > 0; k--)
+    {
+      strides[k - 1] = stride;
+      stride *= dim[k - 1];
+    }
+}
+
+gboolean
+mm_value_slice (MMValue *dst, MMValue *src, size_t axis, int64_t start,
+                int64_t end, GError **error)
+{
+  MMValueInfo *info;
+  MMValueOpsRows rows;
+  OrtValue *old = NULL;
+  int64_t *dim = NULL;
+  size_t element_size;
+  size_t inner;
+  const guint8 *src_data;
+  guint8 *dst_data;
+  g_return_val_if_fail (dst, FALSE);
+  g_return_val_if_fail (src, FALSE);
+  g_return_val_if_fail (src->value, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  info = src->info;
+  element_size = mm_value_ops_check (dst, src, error);
+  if (element_size == 0)
+    return FALSE;
+  if ((axis >= info->ndim) || (start < 0) || (start > end)
+      || (end > info->dim[axis]))
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_SHAPE,
+                   "Invalid slice of %s.", info->name);
+      return FALSE;
+    }
+
+  src_data = mm_value_peek_data (src, error);
+  if (src_data == NULL)
+    return FALSE;
+
+  dim = g_memdup2 (info->dim, sizeof (int64_t) * info->ndim);
+  dim[axis] = end - start;
+  inner = mm_value_ops_count (info->dim, axis + 1, info->ndim) * element_size;
+  rows.src = src_data + start * inner;
+  rows.src_stride = info->dim[axis] * inner;
+  rows.dst_stride = dim[axis] * inner;
+  rows.size = rows.dst_stride;
+
+  if (!mm_value_ops_prepare (dst, dim, dst == src, &old, error))
+    goto on_error;
+  dst_data = mm_value_get_data (dst, error);
+  if (dst_data == NULL)
+    goto on_error;
+  rows.dst = dst_data;
+
+  mm_value_ops_run (mm_value_ops_copy_rows, &rows,
+                    mm_value_ops_count (info->dim, 0, axis),
+                    mm_value_info_get_data_size (dst->info));
+
+  mm_value_ops_release (dst, old);
+  g_free (dim);
+  return TRUE;
+on_error:
+  mm_value_ops_release (dst, old);
+  g_free (dim);
+  return FALSE;
+}
+
+gboolean
+mm_value_concat (MMValue *dst, MMValue **srcs, size_t nsrcs, size_t axis,
+                 GError **error)
+{
+  MMValueInfo *info;
+  OrtValue *old = NULL;
+  const guint8 **src_data = NULL;
+  int64_t *lengths = NULL;
+  guint8 *dst_data;
+  int64_t *dim = NULL;
+  gboolean alias = FALSE;
+  int64_t dirty_row;
+  size_t element_size = 0;
+  size_t outer;
+  size_t inner;
+  size_t offset = 0;
+  g_return_val_if_fail (dst, FALSE);
+  g_return_val_if_fail (srcs, FALSE);
+  g_return_val_if_fail (nsrcs > 0, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+  for (size_t k = 0; k < nsrcs; k++)
+    g_return_val_if_fail (srcs[k] && srcs[k]->value, FALSE);
+
+  info = srcs[0]->info;
+  if (axis >= info->ndim)
+    goto on_shape_error;
+
+  src_data = g_new (const guint8 *, nsrcs);
+  /* dst can be one of srcs, so its shape is saved before reallocation. */
+  lengths = g_new (int64_t, nsrcs);
+  dim = g_memdup2 (info->dim, sizeof (int64_t) * info->ndim);
+  dim[axis] = 0;
+  for (size_t k = 0; k < nsrcs; k++)
+    {
+      MMValueInfo *src_info = srcs[k]->info;
+
+      element_size = mm_value_ops_check (dst, srcs[k], error);
+      if (element_size == 0)
+        goto on_error;
+      for (size_t i = 0; i < info->ndim; i++)
+        if ((i != axis) && (src_info->dim[i] != info->dim[i]))
+          goto on_shape_error;
+
+      src_data[k] = mm_value_peek_data (srcs[k], error);
+      if (src_data[k] == NULL)
+        goto on_error;
+      lengths[k] = src_info->dim[axis];
+      dim[axis] += lengths[k];
+      alias = alias || (srcs[k] == dst);
+    }
+
+  outer = mm_value_ops_count (dim, 0, axis);
+  inner = mm_value_ops_count (dim, axis + 1, info->ndim) * element_size;
+  dirty_row = mm_value_get_dirty_row (dst, axis);
+  if (!mm_value_ops_prepare (dst, dim, alias, &old, error))
+    goto on_error;
+  dst_data = mm_value_get_data (dst, error);
+  if (dst_data == NULL)
+    goto on_error;
+
+  for (size_t k = 0; k < nsrcs; k++)
+    {
+      MMValueOpsRows rows;
+
+      rows.dst = dst_data + offset;
+      rows.src = src_data[k];
+      rows.dst_stride = dim[axis] * inner;
+      rows.src_stride = lengths[k] * inner;
+      rows.size = rows.src_stride;
+      offset += rows.size;
+      mm_value_ops_run (mm_value_ops_copy_rows, &rows, outer,
+                        outer * rows.size);
+    }
+  /* Appending to dst keeps its rows, so only the new ones are marked. */
+  if (srcs[0] == dst)
+    {
+      mm_value_mark_clean (dst, axis);
+      mm_value_mark_dirty (dst, axis, MIN (dirty_row, lengths[0]));
+    }
+
+  mm_value_ops_release (dst, old);
+  g_free (dim);
+  g_free (lengths);
+  g_free (src_data);
+  return TRUE;
+on_shape_error:
+  g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_SHAPE,
+               "Can not concatenate values along axis %zu.", axis);
+on_error:
+  mm_value_ops_release (dst, old);
+  g_free (dim);
+  g_free (lengths);
+  g_free (src_data);
+  return FALSE;
+}
+
+gboolean
+mm_value_gather (MMValue *dst, MMValue *src, size_t axis,
+                 const int64_t *indices, size_t nindices, GError **error)
+{
+  MMValueInfo *info;
+  MMValueOpsGather gather;
+  OrtValue *old = NULL;
+  gint64 *slots = NULL;
+  int64_t *dim = NULL;
+  size_t element_size;
+  size_t outer;
+  g_return_val_if_fail (dst, FALSE);
+  g_return_val_if_fail (src, FALSE);
+  g_return_val_if_fail (src->value, FALSE);
+  g_return_val_if_fail (indices || (nindices == 0), FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  info = src->info;
+  element_size = mm_value_ops_check (dst, src, error);
+  if (element_size == 0)
+    return FALSE;
+  for (size_t i = 0; (axis < info->ndim) && (i < nindices); i++)
+    if ((indices[i] < 0) || (indices[i] >= info->dim[axis]))
+      {
+        axis = info->ndim;
+        break;
+      }
+  if (axis >= info->ndim)
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_SHAPE,
+                   "Invalid indices for %s.", info->name);
+      return FALSE;
+    }
+
+  gather.src = mm_value_peek_data (src, error);
+  if (gather.src == NULL)
+    return FALSE;
+  gather.indices = indices;
+  gather.nindices = nindices;
+  gather.length = info->dim[axis];
+  gather.size
+      = mm_value_ops_count (info->dim, axis + 1, info->ndim) * element_size;
+  outer = mm_value_ops_count (info->dim, 0, axis);
+
+  if ((dst == src) && (nindices == (size_t)info->dim[axis]))
+    {
+      /* Shared data is copied before it is permuted in place. */
+      gather.data = mm_value_get_data (dst, error);
+      if (gather.data == NULL)
+        return FALSE;
+      gather.src = gather.data;
+      gather.nslots = 0;
+      slots = g_new (gint64, nindices);
+      for (size_t i = 0; i < nindices; i++)
+        slots[i] = -1;
+      /* Rows read by another row and overwritten themselves are saved. */
+      for (size_t i = 0; i < nindices; i++)
+        {
+          int64_t index = indices[i];
+
+          if ((index != (int64_t)i) && (indices[index] != index)
+              && (slots[index] < 0))
+            slots[index] = gather.nslots++;
+        }
+      gather.slots = slots;
+      mm_value_ops_run (mm_value_ops_gather_in_place, &gather, outer,
+                        mm_value_info_get_data_size (info));
+      g_free (slots);
+      return TRUE;
+    }
+
+  dim = g_memdup2 (info->dim, sizeof (int64_t) * info->ndim);
+  dim[axis] = nindices;
+  if (!mm_value_ops_prepare (dst, dim, dst == src, &old, error))
+    goto on_error;
+  gather.data = mm_value_get_data (dst, error);
+  if (gather.data == NULL)
+    goto on_error;
+
+  mm_value_ops_run (mm_value_ops_gather_rows, &gather, outer * nindices,
+                    mm_value_info_get_data_size (dst->info));
+
+  mm_value_ops_release (dst, old);
+  g_free (dim);
+  return TRUE;
+on_error:
+  mm_value_ops_release (dst, old);
+  g_free (dim);
+  return FALSE;
+}
+
+gboolean
+mm_value_pad (MMValue *dst, MMValue *src, const int64_t *pads_begin,
+              const int64_t *pads_end, GError **error)
+{
+  MMValueInfo *info;
+  MMValueOpsStrided strided;
+  OrtValue *old = NULL;
+  int64_t *dim = NULL;
+  int64_t *src_dim = NULL;
+  size_t *dst_strides = NULL;
+  size_t *src_strides = NULL;
+  size_t element_size;
+  size_t ndim;
+  guint8 *dst_data;
+  g_return_val_if_fail (dst, FALSE);
+  g_return_val_if_fail (src, FALSE);
+  g_return_val_if_fail (src->value, FALSE);
+  g_return_val_if_fail (pads_begin, FALSE);
+  g_return_val_if_fail (pads_end, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  info = src->info;
+  ndim = info->ndim;
+  element_size = mm_value_ops_check (dst, src, error);
+  if (element_size == 0)
+    return FALSE;
+  for (size_t k = 0; k < ndim; k++)
+    if ((pads_begin[k] < 0) || (pads_end[k] < 0))
+      {
+        g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_SHAPE,
+                     "Negative padding for %s.", info->name);
+        return FALSE;
+      }
+
+  strided.src = mm_value_peek_data (src, error);
+  if (strided.src == NULL)
+    return FALSE;
+
+  /* dst can be src, so its shape is saved before reallocation. */
+  src_dim = g_new (int64_t, ndim + 1);
+  memcpy (src_dim, info->dim, sizeof (int64_t) * ndim);
+  dim = g_new (int64_t, ndim + 1);
+  for (size_t k = 0; k < ndim; k++)
+    dim[k] = pads_begin[k] + src_dim[k] + pads_end[k];
+
+  /* Rows along the last axis are contiguous in both tensors. */
+  dst_strides = g_new (size_t, ndim + 1);
+  src_strides = g_new (size_t, ndim + 1);
+  mm_value_ops_get_strides (dim, ndim, element_size, dst_strides);
+  mm_value_ops_get_strides (src_dim, ndim, element_size, src_strides);
+  strided.ndim = ndim ? ndim - 1 : 0;
+  strided.dim = src_dim;
+  strided.dst_strides = dst_strides;
+  strided.src_strides = src_strides;
+  strided.size = (ndim ? src_dim[ndim - 1] : 1) * element_size;
+
+  if (!mm_value_ops_prepare (dst, dim, dst == src, &old, error))
+    goto on_error;
+  dst_data = mm_value_get_data (dst, error);
+  if (dst_data == NULL)
+    goto on_error;
+  memset (dst_data, 0, mm_value_info_get_data_size (dst->info));
+
+  strided.dst = dst_data;
+  for (size_t k = 0; k < ndim; k++)
+    strided.dst += pads_begin[k] * dst_strides[k];
+  mm_value_ops_run (mm_value_ops_copy_strided, &strided,
+                    mm_value_ops_count (src_dim, 0, strided.ndim),
+                    mm_value_ops_count (src_dim, 0, ndim) * element_size);
+
+  mm_value_ops_release (dst, old);
+  g_free (src_strides);
+  g_free (dst_strides);
+  g_free (src_dim);
+  g_free (dim);
+  return TRUE;
+on_error:
+  mm_value_ops_release (dst, old);
+  g_free (src_strides);
+  g_free (dst_strides);
+  g_free (src_dim);
+  g_free (dim);
+  return FALSE;
+}
+
+gboolean
+mm_value_transpose (MMValue *dst, MMValue *src, const size_t *perm,
+                    GError **error)
+{
+  MMValueInfo *info;
+  OrtValue *old = NULL;
+  const guint8 *src_data;
+  guint8 *dst_data;
+  int64_t *dim = NULL;
+  size_t *in_strides = NULL;
+  size_t *out_strides = NULL;
+  int64_t *outer_dim = NULL;
+  size_t *dst_strides = NULL;
+  size_t *src_strides = NULL;
+  guint64 seen = 0;
+  size_t element_size;
+  size_t ndim;
+  size_t last;
+  g_return_val_if_fail (dst, FALSE);
+  g_return_val_if_fail (src, FALSE);
+  g_return_val_if_fail (src->value, FALSE);
+  g_return_val_if_fail (perm || (src->info->ndim == 0), FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  info = src->info;
+  ndim = info->ndim;
+  element_size = mm_value_ops_check (dst, src, error);
+  if (element_size == 0)
+    return FALSE;
+  for (size_t k = 0; k < ndim; k++)
+    {
+      if ((perm[k] >= ndim) || (perm[k] >= 64) || (seen & (1ull << perm[k])))
+        {
+          g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_SHAPE,
+                       "Invalid permutation for %s.", info->name);
+          return FALSE;
+        }
+      seen |= 1ull << perm[k];
+    }
+
+  src_data = mm_value_peek_data (src, error);
+  if (src_data == NULL)
+    return FALSE;
+
+  dim = g_new (int64_t, ndim + 1);
+  in_strides = g_new (size_t, ndim + 1);
+  out_strides = g_new (size_t, ndim + 1);
+  for (size_t k = 0; k < ndim; k++)
+    dim[k] = info->dim[perm[k]];
+  mm_value_ops_get_strides (info->dim, ndim, element_size, in_strides);
+  mm_value_ops_get_strides (dim, ndim, element_size, out_strides);
+
+  if (!mm_value_ops_prepare (dst, dim, dst == src, &old, error))
+    goto on_error;
+  dst_data = mm_value_get_data (dst, error);
+  if (dst_data == NULL)
+    goto on_error;
+
+  last = ndim ? ndim - 1 : 0;
+  outer_dim = g_new (int64_t, ndim + 1);
+  dst_strides = g_new (size_t, ndim + 1);
+  src_strides = g_new (size_t, ndim + 1);
+
+  if ((ndim == 0) || (perm[last] == last))
+    {
+      MMValueOpsStrided strided;
+
+      /* The last axis stays, so rows are copied as they are. */
+      for (size_t k = 0; k < last; k++)
+        src_strides[k] = in_strides[perm[k]];
+      strided.dst = dst_data;
+      strided.src = src_data;
+      strided.ndim = last;
+      strided.dim = dim;
+      strided.dst_strides = out_strides;
+      strided.src_strides = src_strides;
+      strided.size = (ndim ? dim[last] : 1) * element_size;
+      mm_value_ops_run (mm_value_ops_copy_strided, &strided,
+                        mm_value_ops_count (dim, 0, last),
+                        mm_value_info_get_data_size (info));
+    }
+  else
+    {
+      MMValueOpsTranspose transpose;
+      size_t b = 0;
+      size_t n = 0;
+
+      /* Tiles over the last output axis and the one read contiguously. */
+      while (perm[b] != last)
+        b++;
+      for (size_t k = 0; k < last; k++)
+        {
+          if (k == b)
+            continue;
+          outer_dim[n] = dim[k];
+          dst_strides[n] = out_strides[k];
+          src_strides[n] = in_strides[perm[k]];
+          n++;
+        }
+
+      transpose.outer.dst = dst_data;
+      transpose.outer.src = src_data;
+      transpose.outer.ndim = n;
+      transpose.outer.dim = outer_dim;
+      transpose.outer.dst_strides = dst_strides;
+      transpose.outer.src_strides = src_strides;
+      transpose.dim_a = dim[last];
+      transpose.dim_b = dim[b];
+      transpose.dst_stride_b = out_strides[b];
+      transpose.src_stride_a = in_strides[perm[last]];
+      transpose.element_size = element_size;
+      mm_value_ops_run (mm_value_ops_transpose_tiles, &transpose,
+                        mm_value_ops_count (outer_dim, 0, n),
+                        mm_value_info_get_data_size (info));
+    }
+
+  mm_value_ops_release (dst, old);
+  g_free (src_strides);
+  g_free (dst_strides);
+  g_free (outer_dim);
+  g_free (out_strides);
+  g_free (in_strides);
+  g_free (dim);
+  return TRUE;
+on_error:
+  mm_value_ops_release (dst, old);
+  g_free (out_strides);
+  g_free (in_strides);
+  g_free (dim);
+  return FALSE;
+}
@@ -1,6 +1,12 @@
 
 #include "mm-value.h"
 
+#include "mm-buffer.h"
+#include "mm-convert.h"
+#include "mm-quantize.h"
+
+G_DEFINE_QUARK (mm-value-error, mm_value_error);
+
 typedef struct _MMRealValue MMRealValue;
 
 struct _MMRealValue
@@ -8,14 +14,40 @@ struct _MMRealValue
   MMValueInfo *info;
   MMAllocator *allocator;
   OrtValue *value;
-  gchar *input_name;
-  gchar *output_name;
+  const gchar *input_name;
+  const gchar *output_name;
 
   MMContext *context;
   MMValue *swap;
+  /*
+   * Data of view, which is value->value unless the tensor is replaced
+   * outside. NULL if value->value is not a view of a buffer.
+   */
+  MMBuffer *buffer;
+  OrtValue *view;
+  /* NULL if tensor is not padded */
+  int64_t *valid_dim;
+  /* NULL if value is not quantized. See mm_value_quantize(). */
+  MMQuantizeInfo *quantize_info;
+  ONNXTensorElementDataType dequantized_dtype;
+  float *scales;
+  guint8 *zero_points;
+  /*
+   * Rows of dirty_axis from dirty_row may have changed since
+   * mm_value_mark_clean(). G_MAXINT64 if nothing changed.
+   */
+  size_t dirty_axis;
+  int64_t dirty_row;
   gatomicrefcount ref_count;
 };
 
+/* Names are usually info->name, which is interned already. */
+static const gchar *
+mm_value_intern_name (MMValueInfo *info, const char *name)
+{
+  return (name == info->name) ? info->name : g_intern_string (name);
+}
+
 MMValue *
 mm_value_new (MMContext *context, MMValueInfo *info, MMModel *model,
               const char *input_name, const char *output_name, MMValue *swap,
@@ -39,9 +71,17 @@ mm_value_new (MMContext *context, MMValueInfo *info, MMModel *model,
   value->info = mm_value_info_copy (info);
   value->allocator = NULL;
   value->value = NULL;
-  value->input_name = g_strdup (input_name);
-  value->output_name = g_strdup (output_name);
+  value->input_name = mm_value_intern_name (value->info, input_name);
+  value->output_name = mm_value_intern_name (value->info, output_name);
   value->swap = swap;
+  value->buffer = NULL;
+  value->view = NULL;
+  value->valid_dim = NULL;
+  value->quantize_info = NULL;
+  value->scales = NULL;
+  value->zero_points = NULL;
+  value->dirty_axis = 0;
+  value->dirty_row = 0;
   g_atomic_ref_count_init (&value->ref_count);
 
   return (MMValue *)value;
@@ -65,33 +105,236 @@ mm_value_unref (MMValue *value)
 
   if (rvalue->swap)
     mm_value_unref (rvalue->swap);
-  if (rvalue->input_name)
-    g_free (rvalue->input_name);
-  if (rvalue->output_name)
-    g_free (rvalue->output_name);
   if (rvalue->value)
     rvalue->context->api->ReleaseValue (rvalue->value);
+  if (rvalue->buffer)
+    mm_buffer_unref (rvalue->buffer);
+  g_free (rvalue->valid_dim);
+  g_free (rvalue->quantize_info);
+  g_free (rvalue->scales);
+  g_free (rvalue->zero_points);
   mm_value_info_unref (rvalue->info);
   mm_context_unref (rvalue->context);
   g_free (rvalue);
 }
 
+/*
+ * Returns buffer of value->value, or NULL if the tensor is not a view of a
+ * buffer, for example if it is allocated by ORT.
+ */
+static MMBuffer *
+mm_value_get_buffer (MMRealValue *rvalue)
+{
+  /* The tensor is replaced outside. */
+  if (rvalue->buffer && (rvalue->value != rvalue->view))
+    {
+      g_clear_pointer (&rvalue->buffer, mm_buffer_unref);
+      rvalue->view = NULL;
+    }
+  return rvalue->buffer;
+}
+
+/*
+ * Releases value->value. buffer is kept if value->value is not its view, so
+ * a view put back by the caller is still tracked.
+ */
+static void
+mm_value_clear_tensor (MMRealValue *rvalue)
+{
+  if (rvalue->value && (rvalue->value == rvalue->view))
+    {
+      rvalue->view = NULL;
+      g_clear_pointer (&rvalue->buffer, mm_buffer_unref);
+    }
+  g_clear_pointer (&rvalue->value, rvalue->context->api->ReleaseValue);
+}
+
+/*
+ * Replaces value->value with tensor, which is a view of buffer if any.
+ * Every row is marked as changed.
+ */
+static void
+mm_value_set_tensor (MMRealValue *rvalue, OrtValue *tensor, MMBuffer *buffer)
+{
+  mm_value_clear_tensor (rvalue);
+  g_clear_pointer (&rvalue->buffer, mm_buffer_unref);
+  rvalue->value = tensor;
+  rvalue->buffer = buffer;
+  rvalue->view = buffer ? tensor : NULL;
+  rvalue->dirty_row = 0;
+}
+
+/*
+ * Creates tensor of dtype with shape dim of value's rank, without
+ * initializing data. buffer is set to the buffer of the tensor, or NULL if
+ * the type has no fixed element size and the tensor is allocated by ORT.
+ */
+static OrtValue *
+mm_value_create_tensor (MMRealValue *rvalue, const int64_t *dim,
+                        ONNXTensorElementDataType dtype, void **data,
+                        MMBuffer **buffer, GError **error)
+{
+  const OrtApi *api = rvalue->context->api;
+  OrtAllocator *allocator;
+  OrtValue *tensor = NULL;
+  size_t size;
+  OrtStatus *status;
+
+  allocator = rvalue->allocator ? rvalue->allocator->allocator
+                                : rvalue->context->allocator;
+  size = mm_value_info_get_dtype_size (dtype);
+  for (size_t k = 0; k < rvalue->info->ndim; k++)
+    size *= dim[k];
+
+  *buffer = NULL;
+  if (size)
+    {
+      *buffer = mm_buffer_new (rvalue->context, allocator, size, error);
+      if (*buffer == NULL)
+        return NULL;
+      tensor = mm_buffer_new_tensor (*buffer, dim, rvalue->info->ndim, dtype,
+                                     error);
+      if (tensor == NULL)
+        {
+          g_clear_pointer (buffer, mm_buffer_unref);
+          return NULL;
+        }
+      *data = mm_buffer_get_data (*buffer);
+      return tensor;
+    }
+
+  status = api->CreateTensorAsOrtValue (allocator, dim, rvalue->info->ndim,
+                                        dtype, &tensor);
+  if (status)
+    goto on_ort_error;
+
+  status = api->GetTensorMutableData (tensor, data);
+  if (status)
+    goto on_ort_error;
+
+  return tensor;
+on_ort_error:
+  mm_context_set_error (rvalue->context, error, status);
+  g_clear_pointer (&tensor, api->ReleaseValue);
+  return NULL;
+}
+
+/*
+ * Gives value its own tensor if its data is shared with other values. Data
+ * is copied if copy is TRUE.
+ */
+static gboolean
+mm_value_make_writable (MMRealValue *rvalue, gboolean copy, GError **error)
+{
+  MMBuffer *shared = mm_value_get_buffer (rvalue);
+  MMBuffer *buffer;
+  OrtValue *tensor;
+  void *data;
+
+  /* The value and its view hold a reference each. */
+  if ((shared == NULL) || !mm_buffer_is_shared (shared, 2))
+    return TRUE;
+
+  tensor = mm_value_create_tensor (rvalue, rvalue->info->dim,
+                                   rvalue->info->dtype, &data, &buffer,
+                                   error);
+  if (tensor == NULL)
+    return FALSE;
+  if (copy)
+    memcpy (data, mm_buffer_get_data (shared),
+            MIN (mm_buffer_get_size (shared),
+                 buffer ? mm_buffer_get_size (buffer) : 0));
+  mm_value_set_tensor (rvalue, tensor, buffer);
+  return TRUE;
+}
+
+/*
+ * Copies block of shape dim between tensors of shape src_dim and dst_dim,
+ * converting src_dtype to dst_dtype.
+ * dst and src point to the first element of the block.
+ */
+static void
+mm_value_copy_block (guint8 *dst, const int64_t *dst_dim,
+                     ONNXTensorElementDataType dst_dtype, const guint8 *src,
+                     const int64_t *src_dim,
+                     ONNXTensorElementDataType src_dtype, const int64_t *dim,
+                     size_t ndim)
+{
+  size_t dst_stride = mm_value_info_get_dtype_size (dst_dtype);
+  size_t src_stride = mm_value_info_get_dtype_size (src_dtype);
+  size_t count = 1;
+  gboolean contiguous = TRUE;
+
+  if (ndim == 0)
+    {
+      mm_convert (dst, dst_dtype, src, src_dtype, 1);
+      return;
+    }
+
+  for (size_t k = 1; k < ndim; k++)
+    {
+      dst_stride *= dst_dim[k];
+      src_stride *= src_dim[k];
+      count *= dim[k];
+      contiguous = contiguous && (dst_dim[k] == dim[k])
+                   && (src_dim[k] == dim[k]);
+    }
+
+  if (contiguous)
+    {
+      mm_convert (dst, dst_dtype, src, src_dtype, dim[0] * count);
+      return;
+    }
+
+  for (int64_t k = 0; k < dim[0]; k++)
+    mm_value_copy_block (dst + k * dst_stride, dst_dim + 1, dst_dtype,
+                         src + k * src_stride, src_dim + 1, src_dtype,
+                         dim + 1, ndim - 1);
+}
+
 gboolean
 mm_value_set_dimension (MMValue *value, GHashTable *hash_table, GError **error)
 {
+  MMRealValue *rvalue = (MMRealValue *)value;
   g_return_val_if_fail (value, FALSE);
   g_return_val_if_fail (hash_table, FALSE);
   g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
 
+  g_clear_pointer (&rvalue->valid_dim, g_free);
   if (!mm_value_info_set_dimension (value->info, hash_table))
     return TRUE;
   return mm_value_update (value, error);
 }
 
+static gboolean
+mm_value_check_dtype (MMValue *value, ONNXTensorElementDataType dst_dtype,
+                      ONNXTensorElementDataType src_dtype, GError **error)
+{
+  if (src_dtype == dst_dtype)
+    return TRUE;
+  if (mm_convert_is_supported (dst_dtype, src_dtype))
+    return TRUE;
+
+  g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_DTYPE,
+               "Can not convert data type %d to %d for value %s.", src_dtype,
+               dst_dtype, value->info->name);
+  return FALSE;
+}
+
 gboolean
 mm_value_set_data (MMValue *value, gpointer data, GError **error)
+{
+  g_return_val_if_fail (value, FALSE);
+
+  return mm_value_set_data_from (value, data, value->info->dtype, error);
+}
+
+gboolean
+mm_value_set_data_from (MMValue *value, gconstpointer data,
+                        ONNXTensorElementDataType dtype, GError **error)
 {
   MMRealValue *rvalue = (MMRealValue *)value;
+  MMValueInfo *info;
   const OrtApi *api;
   void *mutable_data;
   size_t data_size;
@@ -101,14 +344,38 @@ mm_value_set_data (MMValue *value, gpointer data, GError **error)
   g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
   g_return_val_if_fail (rvalue->value, FALSE);
 
+  info = rvalue->info;
+  if (!mm_value_check_dtype (value, info->dtype, dtype, error))
+    return FALSE;
+
+  /* Data is overwritten, so shared data is not copied. */
+  if (!mm_value_make_writable (rvalue, FALSE, error))
+    return FALSE;
+  rvalue->dirty_row = 0;
   api = rvalue->context->api;
   status = api->GetTensorMutableData (rvalue->value, &mutable_data);
   if (status)
     goto on_error;
 
-  data_size = mm_value_info_get_data_size (rvalue->info);
+  data_size = mm_value_info_get_data_size (info);
   g_return_val_if_fail (data_size, FALSE);
-  memcpy (mutable_data, data, data_size);
+  if ((rvalue->valid_dim == NULL) && (dtype == info->dtype))
+    {
+      memcpy (mutable_data, data, data_size);
+      return TRUE;
+    }
+  if (rvalue->valid_dim == NULL)
+    {
+      mm_convert (mutable_data, info->dtype, data, dtype,
+                  mm_value_info_get_element_count (info));
+      return TRUE;
+    }
+
+  /* Zero-filled padding masks the region for attention masks and so on. */
+  memset (mutable_data, 0, data_size);
+  mm_value_copy_block (mutable_data, info->dim, info->dtype, data,
+                       rvalue->valid_dim, dtype, rvalue->valid_dim,
+                       info->ndim);
 
   return TRUE;
 on_error:
@@ -116,8 +383,112 @@ on_error:
   return FALSE;
 }
 
+gboolean
+mm_value_copy_data (MMValue *value, gpointer data, GError **error)
+{
+  g_return_val_if_fail (value, FALSE);
+
+  return mm_value_copy_data_to (value, data, value->info->dtype, error);
+}
+
+gboolean
+mm_value_copy_data_to (MMValue *value, gpointer data,
+                       ONNXTensorElementDataType dtype, GError **error)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  MMValueInfo *info;
+  gconstpointer tensor_data;
+  size_t data_size;
+  g_return_val_if_fail (rvalue, FALSE);
+  g_return_val_if_fail (data, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  info = rvalue->info;
+  if (!mm_value_check_dtype (value, dtype, info->dtype, error))
+    return FALSE;
+
+  tensor_data = mm_value_peek_data (value, error);
+  if (tensor_data == NULL)
+    return FALSE;
+
+  data_size = mm_value_info_get_data_size (info);
+  g_return_val_if_fail (data_size, FALSE);
+  if ((rvalue->valid_dim == NULL) && (dtype == info->dtype))
+    {
+      memcpy (data, tensor_data, data_size);
+      return TRUE;
+    }
+  if (rvalue->valid_dim == NULL)
+    {
+      mm_convert (data, dtype, tensor_data, info->dtype,
+                  mm_value_info_get_element_count (info));
+      return TRUE;
+    }
+
+  mm_value_copy_block (data, rvalue->valid_dim, dtype, tensor_data,
+                       info->dim, info->dtype, rvalue->valid_dim,
+                       info->ndim);
+  return TRUE;
+}
+
+void
+mm_value_set_valid_dimension (MMValue *value, GHashTable *hash_table)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  MMValueInfo *info;
+  gboolean padded = FALSE;
+  g_return_if_fail (rvalue);
+
+  info = rvalue->info;
+  g_clear_pointer (&rvalue->valid_dim, g_free);
+  if (hash_table == NULL)
+    return;
+  /* Padding is not supported for types smaller than a byte. */
+  g_return_if_fail (mm_value_info_get_element_size (info) > 0);
+
+  rvalue->valid_dim = g_memdup2 (info->dim, sizeof (int64_t) * info->ndim);
+  for (size_t k = 0; k < info->ndim; k++)
+    {
+      int64_t *dim;
+
+      if (info->dim_name[k] == NULL)
+        continue;
+      dim = g_hash_table_lookup (hash_table, info->dim_name[k]);
+      if ((dim == NULL) || (*dim >= info->dim[k]))
+        continue;
+      rvalue->valid_dim[k] = *dim;
+      padded = TRUE;
+    }
+
+  if (!padded)
+    g_clear_pointer (&rvalue->valid_dim, g_free);
+}
+
+const int64_t *
+mm_value_get_valid_dimension (MMValue *value)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  g_return_val_if_fail (rvalue, NULL);
+
+  return rvalue->valid_dim ? rvalue->valid_dim : rvalue->info->dim;
+}
+
 gpointer
 mm_value_get_data (MMValue *value, GError **error)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  g_return_val_if_fail (rvalue, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  if (!mm_value_make_writable (rvalue, TRUE, error))
+    return NULL;
+  /* Rows written through the pointer are not known. */
+  rvalue->dirty_row = 0;
+  return (gpointer)mm_value_peek_data (value, error);
+}
+
+gconstpointer
+mm_value_peek_data (MMValue *value, GError **error)
 {
   MMRealValue *rvalue = (MMRealValue *)value;
   const OrtApi *api;
@@ -136,6 +507,15 @@ mm_value_get_data (MMValue *value, GError **error)
   return data;
 }
 
+MMContext *
+mm_value_get_context (MMValue *value)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  g_return_val_if_fail (rvalue, NULL);
+
+  return rvalue->context;
+}
+
 gboolean
 mm_value_update_info (MMValue *value, GError **error)
 {
@@ -165,6 +545,11 @@ mm_value_update_info (MMValue *value, GError **error)
   if (status)
     goto on_ort_error;
 
+  for (size_t k = 0; rvalue->valid_dim && (k < ndim); k++)
+    rvalue->valid_dim[k] = MIN (rvalue->valid_dim[k], value->info->dim[k]);
+  /* The tensor is written outside, for example by a run. */
+  rvalue->dirty_row = 0;
+
   api->ReleaseTensorTypeAndShapeInfo (tensor_info);
   return true;
 on_ort_error:
@@ -174,49 +559,631 @@ on_error:
   return false;
 }
 
+/* Forgets quantization, and restores data type before quantization. */
+static void
+mm_value_clear_quantize_info (MMRealValue *rvalue)
+{
+  if (rvalue->quantize_info == NULL)
+    return;
+
+  rvalue->info->dtype = rvalue->dequantized_dtype;
+  g_clear_pointer (&rvalue->quantize_info, g_free);
+  g_clear_pointer (&rvalue->scales, g_free);
+  g_clear_pointer (&rvalue->zero_points, g_free);
+}
+
 gboolean
 mm_value_update (MMValue *value, GError **error)
 {
   MMRealValue *rvalue = (MMRealValue *)value;
-  MMContext *context;
   MMValueInfo *info;
-  OrtAllocator *allocator;
+  MMBuffer *buffer;
+  OrtValue *tensor;
   void *data;
-  OrtStatus *status;
   g_return_val_if_fail (rvalue, FALSE);
   g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
 
-  context = rvalue->context;
   info = rvalue->info;
-  allocator = rvalue->allocator ? rvalue->allocator->allocator
-                                : rvalue->context->allocator;
-  g_clear_pointer (&rvalue->value, context->api->ReleaseValue);
+  /* Released first to keep the peak low */
+  mm_value_clear_tensor (rvalue);
+  mm_value_clear_quantize_info (rvalue);
+
+  tensor = mm_value_create_tensor (rvalue, info->dim, info->dtype, &data,
+                                   &buffer, error);
+  if (tensor == NULL)
+    return FALSE;
+  memset (data, 0, mm_value_info_get_data_size (info));
+  mm_value_set_tensor (rvalue, tensor, buffer);
+  return TRUE;
+}
 
-  status = context->api->CreateTensorAsOrtValue (
-      allocator, info->dim, info->ndim, info->dtype, &value->value);
+/* Returns TRUE if tensor has the shape and data type of info. */
+static gboolean
+mm_value_tensor_matches (MMRealValue *rvalue, GError **error)
+{
+  const OrtApi *api = rvalue->context->api;
+  OrtTensorTypeAndShapeInfo *tensor_info = NULL;
+  ONNXTensorElementDataType dtype;
+  int64_t *dim = NULL;
+  size_t ndim = 0;
+  gboolean match = FALSE;
+  OrtStatus *status;
+
+  status = api->GetTensorTypeAndShape (rvalue->value, &tensor_info);
   if (status)
     goto on_ort_error;
-
-  status = context->api->GetTensorMutableData (value->value, &data);
+  status = api->GetTensorElementType (tensor_info, &dtype);
+  if (status)
+    goto on_ort_error;
+  status = api->GetDimensionsCount (tensor_info, &ndim);
   if (status)
     goto on_ort_error;
-  memset (data, 0, mm_value_info_get_data_size (value->info));
+  if ((dtype != rvalue->info->dtype) || (ndim != rvalue->info->ndim))
+    goto out;
 
-  return TRUE;
+  dim = g_new (int64_t, ndim);
+  status = api->GetDimensions (tensor_info, dim, ndim);
+  if (status)
+    goto on_ort_error;
+  match = !memcmp (dim, rvalue->info->dim, sizeof (int64_t) * ndim);
+out:
+  g_free (dim);
+  api->ReleaseTensorTypeAndShapeInfo (tensor_info);
+  return match;
 on_ort_error:
-  mm_context_set_error (context, error, status);
+  mm_context_set_error (rvalue->context, error, status);
+  g_free (dim);
+  g_clear_pointer (&tensor_info, api->ReleaseTensorTypeAndShapeInfo);
   return FALSE;
 }
 
+gboolean
+mm_value_reserve (MMValue *value, GError **error)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  GError *local_error = NULL;
+  MMBuffer *buffer;
+  void *data;
+  OrtValue *tensor;
+  size_t size;
+  g_return_val_if_fail (rvalue, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if ((rvalue->quantize_info == NULL) && rvalue->value
+      && !mm_value_is_shared (value))
+    {
+      if (mm_value_tensor_matches (rvalue, &local_error))
+        return TRUE;
+      if (local_error)
+        {
+          g_propagate_error (error, local_error);
+          return FALSE;
+        }
+
+      /* Buffer kept by mm_value_truncate() is reused if it is large enough */
+      buffer = mm_value_get_buffer (rvalue);
+      size = mm_value_info_get_dtype_size (rvalue->info->dtype);
+      for (size_t k = 0; k < rvalue->info->ndim; k++)
+        size *= rvalue->info->dim[k];
+      if (buffer && (size > 0) && (size <= mm_buffer_get_size (buffer)))
+        {
+          tensor = mm_buffer_new_tensor (buffer, rvalue->info->dim,
+                                         rvalue->info->ndim,
+                                         rvalue->info->dtype, error);
+          if (tensor == NULL)
+            return FALSE;
+          mm_buffer_ref (buffer);
+          mm_value_set_tensor (rvalue, tensor, buffer);
+          return TRUE;
+        }
+    }
+
+  mm_value_clear_quantize_info (rvalue);
+  tensor = mm_value_create_tensor (rvalue, rvalue->info->dim,
+                                   rvalue->info->dtype, &data, &buffer,
+                                   error);
+  if (tensor == NULL)
+    return FALSE;
+  mm_value_set_tensor (rvalue, tensor, buffer);
+  return TRUE;
+}
+
+gboolean
+mm_value_truncate (MMValue *value, size_t axis, int64_t length,
+                   GError **error)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  MMValueInfo *info;
+  MMBuffer *buffer;
+  OrtValue *tensor;
+  int64_t *dim;
+  guint8 *src;
+  guint8 *dst;
+  size_t outer = 1;
+  size_t row_size;
+  size_t old_rows;
+  int64_t dirty_row;
+  g_return_val_if_fail (rvalue, FALSE);
+  g_return_val_if_fail (axis < rvalue->info->ndim, FALSE);
+  g_return_val_if_fail ((length >= 0) && (length <= rvalue->info->dim[axis]),
+                        FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  info = rvalue->info;
+  if (length == info->dim[axis])
+    return TRUE;
+  if (rvalue->value == NULL)
+    {
+      info->dim[axis] = length;
+      mm_value_mark_dirty (value, axis, length);
+      return TRUE;
+    }
+  row_size = mm_value_info_get_element_size (info);
+  if (rvalue->quantize_info || (row_size == 0))
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_DTYPE,
+                   "Can not truncate quantized or sub-byte value %s.",
+                   info->name);
+      return FALSE;
+    }
+  for (size_t k = 0; k < info->ndim; k++)
+    {
+      if (k < axis)
+        outer *= info->dim[k];
+      else if (k > axis)
+        row_size *= info->dim[k];
+    }
+  old_rows = info->dim[axis];
+  /* Kept rows do not change, though they move to a new tensor. */
+  dirty_row = rvalue->dirty_row;
+
+  if (!mm_value_make_writable (rvalue, TRUE, error))
+    return FALSE;
+  src = (guint8 *)mm_value_peek_data (value, error);
+  if (src == NULL)
+    return FALSE;
+
+  dim = g_memdup2 (info->dim, sizeof (int64_t) * info->ndim);
+  dim[axis] = length;
+  buffer = mm_value_get_buffer (rvalue);
+  if (buffer && length)
+    {
+      /* Rows are moved within the buffer, keeping it as capacity */
+      dst = src;
+      tensor = mm_buffer_new_tensor (buffer, dim, info->ndim, info->dtype,
+                                     error);
+      if (tensor)
+        mm_buffer_ref (buffer);
+    }
+  else
+    tensor = mm_value_create_tensor (rvalue, dim, info->dtype,
+                                     (void **)&dst, &buffer, error);
+  if (tensor == NULL)
+    {
+      g_free (dim);
+      return FALSE;
+    }
+
+  /* Blocks only move forward, so memmove() is safe in place. */
+  for (size_t o = 0; o < outer; o++)
+    memmove (dst + o * length * row_size, src + o * old_rows * row_size,
+             length * row_size);
+  mm_value_set_tensor (rvalue, tensor, buffer);
+  info->dim[axis] = length;
+  if (rvalue->valid_dim)
+    rvalue->valid_dim[axis] = MIN (rvalue->valid_dim[axis], length);
+  rvalue->dirty_row = dirty_row;
+  mm_value_mark_dirty (value, axis, length);
+  g_free (dim);
+  return TRUE;
+}
+
+int64_t
+mm_value_get_dirty_row (MMValue *value, size_t axis)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  g_return_val_if_fail (rvalue, 0);
+
+  if ((rvalue->dirty_row != G_MAXINT64) && (axis != rvalue->dirty_axis))
+    return 0;
+  return rvalue->dirty_row;
+}
+
+void
+mm_value_mark_dirty (MMValue *value, size_t axis, int64_t row)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  g_return_if_fail (rvalue);
+  g_return_if_fail (row >= 0);
+
+  if (row == G_MAXINT64)
+    return;
+  if (rvalue->dirty_row == G_MAXINT64)
+    rvalue->dirty_axis = axis;
+  /* Rows of another axis cover every row of this one */
+  else if (axis != rvalue->dirty_axis)
+    row = 0;
+  rvalue->dirty_row = MIN (rvalue->dirty_row, row);
+}
+
+void
+mm_value_mark_clean (MMValue *value, size_t axis)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  g_return_if_fail (rvalue);
+
+  rvalue->dirty_axis = axis;
+  rvalue->dirty_row = G_MAXINT64;
+}
+
 void
 mm_value_swap (MMValue *value)
 {
   MMRealValue *rvalue = (MMRealValue *)value;
+  MMBuffer *buffer;
   g_return_if_fail (rvalue);
 
   if (rvalue->swap == NULL)
     return;
-  rvalue->context->api->ReleaseValue (rvalue->swap->value);
-  rvalue->swap->value = rvalue->value;
+  /* The buffer goes with its view. */
+  buffer = mm_value_get_buffer (rvalue);
+  rvalue->buffer = NULL;
+  rvalue->view = NULL;
+  mm_value_set_tensor ((MMRealValue *)rvalue->swap, rvalue->value, buffer);
   rvalue->value = NULL;
+  rvalue->dirty_row = 0;
+}
+
+static gboolean
+mm_value_is_float (ONNXTensorElementDataType dtype)
+{
+  return (dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT)
+         || (dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16)
+         || (dtype == ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16);
+}
+
+static gboolean
+mm_value_check_quantize_info (MMRealValue *rvalue,
+                              const MMQuantizeInfo *quantize_info,
+                              size_t *nscales, GError **error)
+{
+  MMValueInfo *info = rvalue->info;
+
+  *nscales = mm_quantize_get_scale_count (quantize_info, info->dim,
+                                          info->ndim);
+  if (*nscales)
+    return TRUE;
+
+  g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_QUANTIZE,
+               "Invalid quantization for value %s.", info->name);
+  return FALSE;
+}
+
+gboolean
+mm_value_quantize (MMValue *value, const MMQuantizeInfo *quantize_info,
+                   GError **error)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  MMValueInfo *info;
+  MMBuffer *buffer;
+  OrtValue *tensor = NULL;
+  void *tensor_data;
+  gconstpointer data;
+  float *float_data = NULL;
+  float *scales = NULL;
+  guint8 *zero_points = NULL;
+  size_t nscales;
+  g_return_val_if_fail (rvalue, FALSE);
+  g_return_val_if_fail (quantize_info, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+  g_return_val_if_fail (rvalue->value, FALSE);
+
+  info = rvalue->info;
+  if (rvalue->quantize_info)
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_QUANTIZE,
+                   "Value %s is already quantized.", info->name);
+      return FALSE;
+    }
+  if (!mm_value_is_float (info->dtype))
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_DTYPE,
+                   "Can not quantize data type %d of value %s.", info->dtype,
+                   info->name);
+      return FALSE;
+    }
+  if (!mm_value_check_quantize_info (rvalue, quantize_info, &nscales, error))
+    return FALSE;
+
+  data = mm_value_peek_data (value, error);
+  if (data == NULL)
+    return FALSE;
+
+  if (info->dtype != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT)
+    {
+      size_t count = mm_value_info_get_element_count (info);
+
+      float_data = g_new (float, count);
+      mm_convert (float_data, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, data,
+                  info->dtype, count);
+      data = float_data;
+    }
+
+  tensor = mm_value_create_tensor (rvalue, info->dim, quantize_info->dtype,
+                                   &tensor_data, &buffer, error);
+  if (tensor == NULL)
+    goto on_error;
+
+  scales = g_new (float, nscales);
+  zero_points = g_new (guint8, nscales);
+  if (!mm_quantize (tensor_data, data, info->dim, info->ndim, quantize_info,
+                    scales, zero_points))
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_QUANTIZE,
+                   "Can not quantize %s.", info->name);
+      rvalue->context->api->ReleaseValue (tensor);
+      g_clear_pointer (&buffer, mm_buffer_unref);
+      g_free (zero_points);
+      g_free (scales);
+      goto on_error;
+    }
+
+  mm_value_set_tensor (rvalue, tensor, buffer);
+  rvalue->quantize_info = g_memdup2 (quantize_info, sizeof (MMQuantizeInfo));
+  rvalue->dequantized_dtype = info->dtype;
+  rvalue->scales = scales;
+  rvalue->zero_points = zero_points;
+  info->dtype = quantize_info->dtype;
+
+  g_free (float_data);
+  return TRUE;
+on_error:
+  g_free (float_data);
+  return FALSE;
+}
+
+gboolean
+mm_value_dequantize (MMValue *value, GError **error)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  MMValueInfo *info;
+  MMBuffer *buffer;
+  OrtValue *tensor;
+  void *tensor_data;
+  gconstpointer data;
+  float *float_data = NULL;
+  size_t count;
+  g_return_val_if_fail (rvalue, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (rvalue->quantize_info == NULL)
+    return TRUE;
+
+  info = rvalue->info;
+  data = mm_value_peek_data (value, error);
+  if (data == NULL)
+    return FALSE;
+
+  tensor = mm_value_create_tensor (rvalue, info->dim,
+                                   rvalue->dequantized_dtype, &tensor_data,
+                                   &buffer, error);
+  if (tensor == NULL)
+    return FALSE;
+
+  count = mm_value_info_get_element_count (info);
+  if (rvalue->dequantized_dtype != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT)
+    float_data = g_new (float, count);
+  if (!mm_dequantize (float_data ? float_data : tensor_data, data,
+                      info->dim, info->ndim, rvalue->quantize_info,
+                      rvalue->scales, rvalue->zero_points))
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_QUANTIZE,
+                   "Can not dequantize %s.", info->name);
+      rvalue->context->api->ReleaseValue (tensor);
+      g_clear_pointer (&buffer, mm_buffer_unref);
+      g_free (float_data);
+      return FALSE;
+    }
+  if (float_data)
+    mm_convert (tensor_data, rvalue->dequantized_dtype, float_data,
+                ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, count);
+
+  mm_value_set_tensor (rvalue, tensor, buffer);
+  mm_value_clear_quantize_info (rvalue);
+
+  g_free (float_data);
+  return TRUE;
+}
+
+const MMQuantizeInfo *
+mm_value_get_quantize_info (MMValue *value,
+                            ONNXTensorElementDataType *dtype,
+                            const float **scales, const guint8 **zero_points)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  g_return_val_if_fail (rvalue, NULL);
+
+  if (dtype)
+    *dtype = rvalue->quantize_info ? rvalue->dequantized_dtype
+                                   : rvalue->info->dtype;
+  if (scales)
+    *scales = rvalue->scales;
+  if (zero_points)
+    *zero_points = rvalue->zero_points;
+  return rvalue->quantize_info;
+}
+
+gboolean
+mm_value_set_quantized_data (MMValue *value,
+                             const MMQuantizeInfo *quantize_info,
+                             gconstpointer data, const float *scales,
+                             const guint8 *zero_points, GError **error)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  ONNXTensorElementDataType dequantized_dtype;
+  MMValueInfo *info;
+  MMBuffer *buffer;
+  OrtValue *tensor;
+  void *tensor_data;
+  size_t nscales;
+  g_return_val_if_fail (rvalue, FALSE);
+  g_return_val_if_fail (quantize_info, FALSE);
+  g_return_val_if_fail (data, FALSE);
+  g_return_val_if_fail (scales, FALSE);
+  g_return_val_if_fail (zero_points, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  info = rvalue->info;
+  mm_value_get_quantize_info (value, &dequantized_dtype, NULL, NULL);
+  if (!mm_value_is_float (dequantized_dtype))
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_DTYPE,
+                   "Can not quantize data type %d of value %s.",
+                   dequantized_dtype, info->name);
+      return FALSE;
+    }
+  if (!mm_value_check_quantize_info (rvalue, quantize_info, &nscales, error))
+    return FALSE;
+
+  tensor = mm_value_create_tensor (rvalue, info->dim, quantize_info->dtype,
+                                   &tensor_data, &buffer, error);
+  if (tensor == NULL)
+    return FALSE;
+
+  mm_value_set_tensor (rvalue, tensor, buffer);
+  mm_value_clear_quantize_info (rvalue);
+  g_clear_pointer (&rvalue->valid_dim, g_free);
+
+  rvalue->quantize_info = g_memdup2 (quantize_info, sizeof (MMQuantizeInfo));
+  rvalue->dequantized_dtype = dequantized_dtype;
+  rvalue->scales = g_memdup2 (scales, sizeof (float) * nscales);
+  rvalue->zero_points = g_memdup2 (zero_points, sizeof (guint8) * nscales);
+  info->dtype = quantize_info->dtype;
+  memcpy (tensor_data, data, mm_value_info_get_data_size (info));
+  return TRUE;
+}
+
+gboolean
+mm_value_is_shared (MMValue *value)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  MMBuffer *buffer;
+  g_return_val_if_fail (rvalue, FALSE);
+
+  buffer = mm_value_get_buffer (rvalue);
+  return buffer && mm_buffer_is_shared (buffer, 2);
+}
+
+/* Creates tensor for dst holding data of src. */
+static OrtValue *
+mm_value_share_tensor (MMRealValue *rdst, MMRealValue *rsrc,
+                       MMBuffer **buffer, GError **error)
+{
+  MMValueInfo *info = rsrc->info;
+  OrtValue *tensor;
+  gconstpointer src_data;
+  void *data;
+
+  *buffer = mm_value_get_buffer (rsrc);
+  if (*buffer)
+    {
+      tensor = mm_buffer_new_tensor (*buffer, info->dim, info->ndim,
+                                     info->dtype, error);
+      if (tensor)
+        mm_buffer_ref (*buffer);
+      return tensor;
+    }
+
+  /* Tensors allocated by ORT can not be shared, so they are copied once. */
+  src_data = mm_value_peek_data ((MMValue *)rsrc, error);
+  if (src_data == NULL)
+    return NULL;
+  tensor = mm_value_create_tensor (rdst, info->dim, info->dtype, &data,
+                                   buffer, error);
+  if (tensor && mm_value_info_get_element_count (info))
+    memcpy (data, src_data, mm_value_info_get_data_size (info));
+  return tensor;
+}
+
+gboolean
+mm_value_assign (MMValue *dst, MMValue *src, GError **error)
+{
+  MMRealValue *rdst = (MMRealValue *)dst;
+  MMRealValue *rsrc = (MMRealValue *)src;
+  ONNXTensorElementDataType dst_dtype;
+  ONNXTensorElementDataType src_dtype;
+  MMBuffer *buffer = NULL;
+  OrtValue *tensor = NULL;
+  size_t nscales = 0;
+  g_return_val_if_fail (rdst, FALSE);
+  g_return_val_if_fail (rsrc, FALSE);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), FALSE);
+
+  if (dst == src)
+    return TRUE;
+  mm_value_get_quantize_info (dst, &dst_dtype, NULL, NULL);
+  mm_value_get_quantize_info (src, &src_dtype, NULL, NULL);
+  if (dst_dtype != src_dtype)
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_DTYPE,
+                   "Data types of %s and %s differ.", dst->info->name,
+                   src->info->name);
+      return FALSE;
+    }
+  if (dst->info->ndim != src->info->ndim)
+    {
+      g_set_error (error, MM_VALUE_ERROR, MM_VALUE_ERROR_SHAPE,
+                   "Rank of %s and %s differ.", dst->info->name,
+                   src->info->name);
+      return FALSE;
+    }
+
+  if (rsrc->value)
+    {
+      tensor = mm_value_share_tensor (rdst, rsrc, &buffer, error);
+      if (tensor == NULL)
+        return FALSE;
+    }
+  if (rsrc->quantize_info)
+    nscales = mm_quantize_get_scale_count (rsrc->quantize_info,
+                                           src->info->dim, src->info->ndim);
+
+  mm_value_clear_quantize_info (rdst);
+  mm_value_set_tensor (rdst, tensor, buffer);
+  memcpy (dst->info->dim, src->info->dim, sizeof (int64_t) * src->info->ndim);
+  dst->info->dtype = src->info->dtype;
+  g_clear_pointer (&rdst->valid_dim, g_free);
+  if (rsrc->valid_dim)
+    rdst->valid_dim = g_memdup2 (rsrc->valid_dim,
+                                 sizeof (int64_t) * src->info->ndim);
+  if (rsrc->quantize_info)
+    {
+      rdst->quantize_info
+          = g_memdup2 (rsrc->quantize_info, sizeof (MMQuantizeInfo));
+      rdst->dequantized_dtype = rsrc->dequantized_dtype;
+      rdst->scales = g_memdup2 (rsrc->scales, sizeof (float) * nscales);
+      rdst->zero_points
+          = g_memdup2 (rsrc->zero_points, sizeof (guint8) * nscales);
+    }
+  return TRUE;
+}
+
+MMValue *
+mm_value_clone (MMValue *value, GError **error)
+{
+  MMRealValue *rvalue = (MMRealValue *)value;
+  MMValue *clone;
+  g_return_val_if_fail (rvalue, NULL);
+  g_return_val_if_fail ((error == NULL) || (*error == NULL), NULL);
+
+  clone = mm_value_new (rvalue->context, rvalue->info, NULL,
+                        rvalue->input_name, rvalue->output_name, NULL, error);
+  if (clone == NULL)
+    return NULL;
+  /* mm_value_assign() compares data types before quantization. */
+  mm_value_get_quantize_info (value, &clone->info->dtype, NULL, NULL);
+  clone->allocator = value->allocator;
+  if (!mm_value_assign (clone, value, error))
+    g_clear_pointer (&clone, mm_value_unref);
+  return clone;
 }
@@ -0,0 +1,156 @@
+/*
+ * mm-tune: Chooses session options for a model on this host, and saves them
+ * as a profile for mm_model_options_load_profile().
+ *
+ *   mm-tune [--objective=latency|throughput] [--shape=name=value,...]...
+ *           [--group=NAME] MODEL PROFILE
+ */
+#include <stdlib.h>
+
+#include "moduler-model.h"
+
+static char *objective_name = NULL;
+static char **shape_strings = NULL;
+static char *group = NULL;
+static int iterations = 0;
+static int concurrency = 0;
+
+static GOptionEntry entries[] = {
+  { "objective", 'o', 0, G_OPTION_ARG_STRING, &objective_name,
+    "latency (default) or throughput", "OBJECTIVE" },
+  { "shape", 's', 0, G_OPTION_ARG_STRING_ARRAY, &shape_strings,
+    "Symbolic dimensions, such as batch=1,sequence=128", "SHAPE" },
+  { "group", 'g', 0, G_OPTION_ARG_STRING, &group,
+    "Group of the profile (default: session)", "NAME" },
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+    "Measured runs for each shape", "N" },
+  { "concurrency", 'c', 0, G_OPTION_ARG_INT, &concurrency,
+    "Concurrent callers for throughput", "N" },
+  { NULL },
+};
+
+static GHashTable *
+parse_shape (const char *string, GError **error)
+{
+  GHashTable *shape;
+  GStrv dims;
+
+  shape = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  dims = g_strsplit (string, ",", -1);
+  for (guint k = 0; dims[k]; k++)
+    {
+      char *eq = strchr (dims[k], '=');
+      int64_t value;
+      char *end;
+
+      if (eq)
+        value = g_ascii_strtoll (eq + 1, &end, 10);
+      if ((eq == NULL) || (eq == dims[k]) || (*end != '\0') || (value <= 0))
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Dimension %s is not valid.", dims[k]);
+          g_clear_pointer (&shape, g_hash_table_unref);
+          break;
+        }
+      g_hash_table_insert (shape, g_strndup (dims[k], eq - dims[k]),
+                           g_memdup2 (&value, sizeof (value)));
+    }
+  g_strfreev (dims);
+  return shape;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *option_context;
+  MMContext *context = NULL;
+  MMModelOptions *options = NULL;
+  MMTuner *tuner = NULL;
+  MMTunerObjective objective = MM_TUNER_OBJECTIVE_LATENCY;
+  MMSessionTuning best;
+  GKeyFile *key_file = NULL;
+  GArray *results;
+  GError *error = NULL;
+  int ret = EXIT_FAILURE;
+
+  option_context = g_option_context_new ("MODEL PROFILE");
+  g_option_context_add_main_entries (option_context, entries, NULL);
+  if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    goto out;
+  if (argc != 3)
+    {
+      g_set_error (&error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+                   "MODEL and PROFILE are required.");
+      goto out;
+    }
+  if (objective_name && (g_strcmp0 (objective_name, "throughput") == 0))
+    objective = MM_TUNER_OBJECTIVE_THROUGHPUT;
+  else if (objective_name && (g_strcmp0 (objective_name, "latency") != 0))
+    {
+      g_set_error (&error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Objective %s is not valid.", objective_name);
+      goto out;
+    }
+
+  context = mm_context_new (&error);
+  if (context == NULL)
+    goto out;
+  options = mm_model_options_new (context, &error);
+  if (options == NULL)
+    goto out;
+  tuner = mm_tuner_new (options, argv[1]);
+  if (iterations > 0)
+    mm_tuner_set_iterations (tuner, iterations);
+  if (concurrency > 0)
+    mm_tuner_set_concurrency (tuner, concurrency);
+  for (guint k = 0; shape_strings && shape_strings[k]; k++)
+    {
+      GHashTable *shape = parse_shape (shape_strings[k], &error);
+      if (shape == NULL)
+        goto out;
+      mm_tuner_add_shape (tuner, shape);
+      g_hash_table_unref (shape);
+    }
+
+  if (!mm_tuner_run (tuner, objective, &best, &error))
+    goto out;
+  results = mm_tuner_get_results (tuner);
+  for (guint k = 0; k < results->len; k++)
+    {
+      MMTunerResult *result = &g_array_index (results, MMTunerResult, k);
+      g_print ("intra=%d inter=%d mode=%s pattern=%d arena=%d spin=%d: ",
+               result->tuning.intra_op_threads,
+               result->tuning.inter_op_threads,
+               result->tuning.execution_mode == ORT_PARALLEL ? "parallel"
+                                                             : "sequential",
+               result->tuning.memory_pattern, result->tuning.cpu_arena,
+               result->tuning.allow_spinning);
+      if (result->time > 0)
+        g_print ("%.1f us/run\n", result->time);
+      else
+        g_print ("failed\n");
+    }
+
+  /* Other groups of an existing profile are kept. */
+  key_file = g_key_file_new ();
+  g_key_file_load_from_file (key_file, argv[2], G_KEY_FILE_KEEP_COMMENTS,
+                             NULL);
+  mm_session_tuning_save (&best, key_file, group);
+  if (!g_key_file_save_to_file (key_file, argv[2], &error))
+    goto out;
+  ret = EXIT_SUCCESS;
+out:
+  if (error)
+    g_printerr ("%s\n", error->message);
+  g_clear_error (&error);
+  if (key_file)
+    g_key_file_unref (key_file);
+  if (tuner)
+    mm_tuner_unref (tuner);
+  if (options)
+    mm_model_options_unref (options);
+  if (context)
+    mm_context_unref (context);
+  g_option_context_free (option_context);
+  return ret;
+}